@@ -0,0 +1,178 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Host test of modbus_plan_reads. Plans the reads of the RS485 meters and
+// compares them with the hand-maintained tables they replaced.
+// Built and run by modbus_read_planner_test.py, which extracts the register
+// lists and read limits from the meter definitions into modbus_read_planner_test_registers.h.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "modules/meters/modbus_read_planner.h"
+
+#include "modbus_read_planner_test_registers.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+// Size of the register buffer in meter_rs485_bricklet.cpp, indexed by register address.
+#define REGISTER_BUFFER_SIZE 400
+
+// The tables that were used before the reads were planned.
+static const ModbusReadBlock sdm630_slow_table[] = {{1, 88}, {101, 8}, {201, 70}, {335, 48}};
+static const ModbusReadBlock sdm630_fast_table[] = {{7, 6}, {53, 2}};
+static const ModbusReadBlock sdm72dm_fast_table[] = {{53, 2}, {73, 4}, {343, 2}, {385, 8}};
+static const ModbusReadBlock sdm72dmv2_slow_table[] = {{1, 76}, {201, 26}, {343, 4}, {385, 8}};
+static const ModbusReadBlock sdm72dmv2_fast_table[] = {{7, 6}, {53, 2}};
+
+struct TestCycle {
+    const char *name;
+    const uint16_t *registers;
+    size_t register_count;
+    const ModbusReadBlock *table;
+    size_t table_len;
+};
+
+static const TestCycle cycles[] = {
+    {"SDM630 slow",    sdm630_registers_to_read,          ARRAY_SIZE(sdm630_registers_to_read),          sdm630_slow_table,    ARRAY_SIZE(sdm630_slow_table)},
+    {"SDM630 fast",    sdm630_registers_fast_to_read,     ARRAY_SIZE(sdm630_registers_fast_to_read),     sdm630_fast_table,    ARRAY_SIZE(sdm630_fast_table)},
+    {"SDM72DM slow",   nullptr,                           0,                                             nullptr,              0},
+    {"SDM72DM fast",   sdm72dm_registers_fast_to_read,    ARRAY_SIZE(sdm72dm_registers_fast_to_read),    sdm72dm_fast_table,   ARRAY_SIZE(sdm72dm_fast_table)},
+    {"SDM72DMv2 slow", sdm72dmv2_registers_to_read,       ARRAY_SIZE(sdm72dmv2_registers_to_read),       sdm72dmv2_slow_table, ARRAY_SIZE(sdm72dmv2_slow_table)},
+    {"SDM72DMv2 fast", sdm72dmv2_registers_fast_to_read,  ARRAY_SIZE(sdm72dmv2_registers_fast_to_read),  sdm72dmv2_fast_table, ARRAY_SIZE(sdm72dmv2_fast_table)},
+};
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            printf("  FAIL: " __VA_ARGS__); \
+            printf("\n"); \
+            ++failures; \
+        } \
+    } while (0)
+
+static bool covered(const std::vector<ModbusReadBlock> &blocks, uint32_t reg)
+{
+    for (const ModbusReadBlock &block : blocks) {
+        if (reg >= block.start && reg < static_cast<uint32_t>(block.start) + block.len) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void print_blocks(const char *label, const ModbusReadBlock *blocks, size_t count)
+{
+    printf("  %-6s %zu:", label, count);
+
+    for (size_t i = 0; i < count; ++i) {
+        printf(" {%u, %u}", blocks[i].start, blocks[i].len);
+    }
+
+    printf("\n");
+}
+
+static void test_meter_cycles()
+{
+    for (const TestCycle &cycle : cycles) {
+        std::vector<ModbusReadBlock> blocks;
+        modbus_plan_reads(cycle.registers, cycle.register_count, 2, RS485_MAX_READ_REGISTERS, RS485_MAX_READ_GAP, &blocks);
+
+        printf("%s\n", cycle.name);
+        print_blocks("table", cycle.table, cycle.table_len);
+        print_blocks("plan", blocks.data(), blocks.size());
+
+        CHECK(blocks.size() <= cycle.table_len, "plan needs %zu transactions, the table needed %zu", blocks.size(), cycle.table_len);
+
+        for (const ModbusReadBlock &block : blocks) {
+            CHECK(block.len > 0 && block.len <= RS485_MAX_READ_REGISTERS, "block {%u, %u} has an invalid length", block.start, block.len);
+            CHECK(block.start + block.len <= REGISTER_BUFFER_SIZE, "block {%u, %u} exceeds the register buffer", block.start, block.len);
+        }
+
+        for (size_t i = 0; i < cycle.register_count; ++i) {
+            CHECK(covered(blocks, cycle.registers[i]) && covered(blocks, cycle.registers[i] + 1u), "register %u is not read", cycle.registers[i]);
+        }
+    }
+}
+
+static void expect_plan(const char *name, const ModbusReadBlock *spans, size_t span_count, uint16_t max_words, uint16_t max_gap, const ModbusReadBlock *expected, size_t expected_count)
+{
+    std::vector<ModbusReadBlock> blocks;
+    modbus_plan_reads(spans, span_count, max_words, max_gap, &blocks);
+
+    bool equal = blocks.size() == expected_count;
+
+    for (size_t i = 0; equal && i < expected_count; ++i) {
+        equal = blocks[i].start == expected[i].start && blocks[i].len == expected[i].len;
+    }
+
+    printf("%s\n", name);
+
+    if (!equal) {
+        print_blocks("want", expected, expected_count);
+        print_blocks("got", blocks.data(), blocks.size());
+    }
+
+    CHECK(equal, "unexpected plan");
+}
+
+static void test_edge_cases()
+{
+    static const ModbusReadBlock empty[] = {{0, 0}};
+    expect_plan("empty span", empty, 1, 125, 16, nullptr, 0);
+
+    static const ModbusReadBlock unsorted[] = {{20, 2}, {10, 2}, {11, 4}};
+    static const ModbusReadBlock unsorted_plan[] = {{10, 12}};
+    expect_plan("unsorted and overlapping spans", unsorted, ARRAY_SIZE(unsorted), 125, 16, unsorted_plan, ARRAY_SIZE(unsorted_plan));
+
+    static const ModbusReadBlock gap[] = {{0, 2}, {19, 2}};
+    static const ModbusReadBlock gap_plan[] = {{0, 2}, {19, 2}};
+    expect_plan("gap too large", gap, ARRAY_SIZE(gap), 125, 16, gap_plan, ARRAY_SIZE(gap_plan));
+
+    static const ModbusReadBlock long_span[] = {{100, 300}};
+    static const ModbusReadBlock long_span_plan[] = {{100, 125}, {225, 125}, {350, 50}};
+    expect_plan("split long span", long_span, ARRAY_SIZE(long_span), 125, 16, long_span_plan, ARRAY_SIZE(long_span_plan));
+
+    static const ModbusReadBlock touching[] = {{0, 100}, {90, 40}};
+    static const ModbusReadBlock touching_plan[] = {{0, 100}, {100, 30}};
+    expect_plan("overlap exceeding max_words", touching, ARRAY_SIZE(touching), 125, 16, touching_plan, ARRAY_SIZE(touching_plan));
+
+    static const ModbusReadBlock last_register[] = {{65534, 2}};
+    static const ModbusReadBlock last_register_plan[] = {{65534, 2}};
+    expect_plan("span ending at the last register", last_register, ARRAY_SIZE(last_register), 125, 16, last_register_plan, ARRAY_SIZE(last_register_plan));
+}
+
+int main()
+{
+    test_meter_cycles();
+    test_edge_cases();
+
+    if (failures > 0) {
+        printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+
+# Builds and runs the host test of the Modbus read planner.
+# The register lists and read limits of the RS485 meters are extracted from
+# their definitions, which can't be built for the host.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+test_dir = os.path.dirname(os.path.realpath(__file__))
+software_dir = os.path.realpath(os.path.join(test_dir, '..'))
+src_dir = os.path.join(software_dir, 'src')
+build_dir = os.path.join(software_dir, 'build', 'modbus_read_planner_test')
+rs485_dir = os.path.join(src_dir, 'modules', 'meters_rs485_bricklet')
+
+sources = [
+    os.path.join(test_dir, 'modbus_read_planner_test.cpp'),
+    os.path.join(src_dir, 'modules', 'meters', 'modbus_read_planner.cpp'),
+]
+
+meter_defs = ['sdm630_defs.cpp', 'sdm72dm_defs.cpp', 'sdm72dmv2_defs.cpp']
+limits = ['RS485_MAX_READ_REGISTERS', 'RS485_MAX_READ_GAP']
+
+
+def generate_header():
+    lines = ['// Generated by modbus_read_planner_test.py, don\'t edit.', '', '#pragma once', '', '#include <stdint.h>', '']
+
+    with open(os.path.join(rs485_dir, 'meter_defs.h'), 'r', encoding='utf-8') as f:
+        meter_defs_h = f.read()
+
+    for limit in limits:
+        m = re.search(r'^#define {} (\d+)'.format(limit), meter_defs_h, re.MULTILINE)
+
+        if m is None:
+            raise Exception('{} not found in meter_defs.h'.format(limit))
+
+        lines.append('#define {} {}'.format(limit, m.group(1)))
+
+    lines.append('')
+
+    for name in meter_defs:
+        with open(os.path.join(rs485_dir, name), 'r', encoding='utf-8') as f:
+            source = f.read()
+
+        arrays = re.findall(r'static const uint16_t (\w+)\[\] = \{(.*?)\};', source, re.DOTALL)
+
+        if len(arrays) == 0:
+            raise Exception('No register lists found in {}'.format(name))
+
+        for array_name, body in arrays:
+            body = re.sub(r'//.*', '', body)
+            registers = [r.strip() for r in body.split(',') if len(r.strip()) > 0]
+            lines.append('static const uint16_t {}[] = {{{}}};'.format(array_name, ', '.join(registers)))
+
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build and run the Modbus read planner test.')
+    parser.add_argument('--compiler', default=os.environ.get('CXX', 'c++'))
+
+    args = parser.parse_args()
+
+    os.makedirs(build_dir, exist_ok=True)
+
+    with open(os.path.join(build_dir, 'modbus_read_planner_test_registers.h'), 'w', encoding='utf-8') as f:
+        f.write(generate_header())
+
+    binary = os.path.join(build_dir, 'modbus_read_planner_test')
+
+    subprocess.check_call([args.compiler, '-std=gnu++17', '-O2', '-Wall', '-Wextra', '-I', src_dir, '-I', build_dir, '-o', binary] + sources)
+
+    return subprocess.call([binary])
+
+
+if __name__ == '__main__':
+    sys.exit(main())
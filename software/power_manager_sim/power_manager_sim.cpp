@@ -0,0 +1,658 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Mattias Schäffersmann <mattias@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+// Closed-loop simulation of the power manager's control core on the host.
+// A recorded grid power trace is replayed as base load, the simulated chargers'
+// power is added on top and the sum is fed back to the control core as grid meter.
+// Built and run by power_manager_sim.py, which also converts the supported trace formats.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "modules/power_manager/power_manager_control.h"
+
+#define CHARGER_UPDATE_INTERVAL_MS  1000
+#define CHARGER_MAX                 32
+
+struct TraceRow {
+    uint64_t time_ms;
+    int32_t  base_power_w;
+};
+
+struct SimSettings {
+    PowerManagerControl::Settings pm;
+    uint32_t cloud_filter_mode       = CLOUD_FILTER_MEDIUM;
+    bool     meter_triggered_control = false;
+    uint32_t meter_interval_ms       = 1000;
+    uint32_t cm_interval_ms          = 5000;
+    uint32_t charger_count           = 1;
+    uint32_t ev_max_current_ma       = 16000;
+    uint32_t ev_phases               = 3;
+    uint32_t ev_response_ms          = 5000;
+    uint32_t contactor_ms            = 1000;
+    bool     verbose                 = false;
+};
+
+struct SimCharger {
+    uint32_t allocated_ma     = 0; // Current allocated by the charge manager.
+    uint32_t allowed_ma       = 0; // Current the charger reported back as allowed.
+    uint32_t drawn_ma         = 0;
+    uint32_t pending_ma       = 0; // The EV follows an allocation change after ev_response_ms.
+    uint64_t pending_at       = 0;
+    uint32_t last_update      = 0;
+    bool     cp_disconnected  = false;
+};
+
+struct SimResult {
+    double   grid_import_wh        = 0;
+    double   grid_export_wh        = 0;
+    double   ev_energy_wh          = 0;
+    double   ev_energy_grid_wh     = 0; // EV energy that was not covered by excess power
+    double   tracking_error_sq_ws  = 0;
+    uint32_t switch_on_count       = 0;
+    uint32_t switch_off_count      = 0;
+    uint32_t phase_switch_count    = 0;
+    uint32_t step_count            = 0;
+    uint32_t meter_sample_count    = 0;
+    uint64_t latency_total_ms      = 0;
+    uint32_t latency_max_ms        = 0;
+    uint32_t latency_count         = 0;
+};
+
+class SimContactor final : public PhaseSwitcherBackend
+{
+public:
+    SimContactor(const uint64_t *now, bool capable, bool is_3phase, uint32_t switch_duration_ms) :
+        now(now), capable(capable), is_3phase(is_3phase), switch_duration_ms(switch_duration_ms) {}
+
+    bool phase_switching_capable() override {return capable;}
+    bool can_switch_phases_now(bool /*wants_3phase*/) override {return !busy();}
+    bool requires_cp_disconnect() override {return true;}
+    bool get_is_3phase() override {return is_3phase;}
+
+    SwitchingState get_phase_switching_state() override
+    {
+        return busy() ? SwitchingState::Busy : SwitchingState::Ready;
+    }
+
+    bool switch_phases_3phase(bool wants_3phase) override
+    {
+        if (busy())
+            return false;
+
+        is_3phase = wants_3phase;
+        busy_until = *now + switch_duration_ms;
+        ++switch_count;
+        return true;
+    }
+
+    uint32_t switch_count = 0;
+
+private:
+    bool busy() const {return *now < busy_until;}
+
+    const uint64_t *now;
+    bool capable;
+    bool is_3phase;
+    uint32_t switch_duration_ms;
+    uint64_t busy_until = 0;
+};
+
+class Simulation final : public PowerManagerControlHost
+{
+public:
+    Simulation(const SimSettings &settings, const std::vector<TraceRow> &trace) :
+        settings(settings),
+        trace(trace),
+        contactor(&now, settings.pm.phase_switching_mode != PHASE_SWITCHING_ALWAYS_1PHASE && settings.pm.phase_switching_mode != PHASE_SWITCHING_ALWAYS_3PHASE,
+                  settings.pm.phase_switching_mode == PHASE_SWITCHING_ALWAYS_3PHASE, settings.contactor_ms),
+        chargers(settings.charger_count) {}
+
+    SimResult run();
+
+    // PowerManagerControlHost
+    void vlogfln(const char *fmt, va_list args) override;
+    void set_available_current(uint32_t current_ma) override;
+    void set_available_phases(uint32_t phases) override;
+    bool has_chargers() override {return !chargers.empty();}
+    bool seen_all_chargers() override {return chargers_seen;}
+    bool is_charging_stopped(uint32_t last_update_cutoff) override;
+    void set_all_control_pilot_disconnect(bool disconnect) override {cp_disconnect = disconnect;}
+    bool are_all_control_pilot_disconnected(uint32_t last_update_cutoff) override;
+    bool is_control_pilot_disconnect_supported(uint32_t last_update_cutoff) override;
+    uint32_t get_external_phases_wanted() override {return 0;}
+    void set_external_control_state(uint32_t /*external_control_state*/) override {}
+    void update_grid_balance(int32_t /*p_error_w*/) override {}
+    void power_available_changed(bool /*power_available*/) override {}
+
+private:
+    static bool after(uint32_t a, uint32_t b) {return (a - b) < (UINT32_MAX / 2);}
+    uint32_t millis() const {return static_cast<uint32_t>(now);}
+
+    void update_chargers();
+    void distribute_current();
+    void step();
+    void integrate(uint64_t duration_ms, int32_t base_power_w);
+    int32_t get_ev_power_w();
+
+    const SimSettings &settings;
+    const std::vector<TraceRow> &trace;
+
+    uint64_t now = 0;
+    SimContactor contactor;
+    std::vector<SimCharger> chargers;
+    PowerManagerControl control = PowerManagerControl(this);
+    SimResult result;
+
+    uint32_t available_current_ma = 0;
+    bool     cp_disconnect        = false;
+    bool     chargers_seen        = false;
+
+    bool     sample_pending       = false;
+    uint64_t sample_at            = 0;
+    double   charging_time_s      = 0;
+};
+
+void Simulation::vlogfln(const char *fmt, va_list args)
+{
+    if (!settings.verbose)
+        return;
+
+    printf("%10.3f  ", static_cast<double>(now) / 1000.0);
+    vprintf(fmt, args);
+    putchar('\n');
+}
+
+void Simulation::set_available_current(uint32_t current_ma)
+{
+    if (current_ma > 0 && available_current_ma == 0)
+        ++result.switch_on_count;
+    else if (current_ma == 0 && available_current_ma > 0)
+        ++result.switch_off_count;
+
+    available_current_ma = current_ma;
+}
+
+// The simulated chargers always follow the contactor.
+void Simulation::set_available_phases(uint32_t /*phases*/)
+{
+}
+
+bool Simulation::is_charging_stopped(uint32_t last_update_cutoff)
+{
+    for (const SimCharger &charger : chargers) {
+        if (!after(charger.last_update, last_update_cutoff) || charger.allowed_ma > 0)
+            return false;
+    }
+
+    return true;
+}
+
+bool Simulation::are_all_control_pilot_disconnected(uint32_t last_update_cutoff)
+{
+    for (const SimCharger &charger : chargers) {
+        if (!after(charger.last_update, last_update_cutoff) || !charger.cp_disconnected)
+            return false;
+    }
+
+    return true;
+}
+
+bool Simulation::is_control_pilot_disconnect_supported(uint32_t last_update_cutoff)
+{
+    for (const SimCharger &charger : chargers) {
+        if (!after(charger.last_update, last_update_cutoff))
+            return false;
+    }
+
+    return true;
+}
+
+// Chargers report their state once per second. The EV follows a new allocation after ev_response_ms.
+void Simulation::update_chargers()
+{
+    chargers_seen = true;
+
+    for (SimCharger &charger : chargers) {
+        charger.last_update = millis();
+        charger.cp_disconnected = cp_disconnect;
+
+        if (charger.allowed_ma != charger.allocated_ma) {
+            charger.allowed_ma = charger.allocated_ma;
+            charger.pending_ma = std::min(charger.allocated_ma, settings.ev_max_current_ma);
+            charger.pending_at = now + settings.ev_response_ms;
+        }
+
+        if (charger.cp_disconnected) {
+            charger.drawn_ma = 0;
+        } else if (now >= charger.pending_at) {
+            charger.drawn_ma = charger.pending_ma;
+        }
+    }
+}
+
+// Simplified charge manager: Split the available current evenly and
+// drop chargers that wouldn't get their minimum current.
+void Simulation::distribute_current()
+{
+    const bool     is_3phase    = contactor.get_is_3phase();
+    const uint32_t min_current  = is_3phase ? settings.pm.min_current_3p_ma : settings.pm.min_current_1p_ma;
+    const uint32_t charger_count = static_cast<uint32_t>(chargers.size());
+
+    uint32_t active_count = charger_count;
+    if (min_current > 0)
+        active_count = std::min(active_count, available_current_ma / min_current);
+
+    uint32_t allocated_total = 0;
+    for (uint32_t i = 0; i < charger_count; ++i) {
+        SimCharger &charger = chargers[i];
+
+        if (i < active_count && !cp_disconnect) {
+            charger.allocated_ma = std::min(available_current_ma / active_count, settings.ev_max_current_ma);
+        } else {
+            charger.allocated_ma = 0;
+        }
+
+        allocated_total += charger.allocated_ma;
+    }
+
+    control.charge_manager_allocated_current_ma = allocated_total;
+}
+
+int32_t Simulation::get_ev_power_w()
+{
+    const uint32_t phases = contactor.get_is_3phase() ? settings.ev_phases : 1;
+
+    uint32_t current_ma = 0;
+    for (const SimCharger &charger : chargers) {
+        current_ma += charger.drawn_ma;
+    }
+
+    return static_cast<int32_t>(230 * phases * current_ma / 1000);
+}
+
+void Simulation::step()
+{
+    if (sample_pending) {
+        const uint32_t latency_ms = static_cast<uint32_t>(now - sample_at);
+
+        result.latency_total_ms += latency_ms;
+        result.latency_max_ms = std::max(result.latency_max_ms, latency_ms);
+        ++result.latency_count;
+        sample_pending = false;
+    }
+
+    control.step(millis());
+    ++result.step_count;
+}
+
+void Simulation::integrate(uint64_t duration_ms, int32_t base_power_w)
+{
+    const double  hours      = static_cast<double>(duration_ms) / 3600000.0;
+    const int32_t ev_w       = get_ev_power_w();
+    const int32_t grid_w     = base_power_w + ev_w;
+    const int32_t grid_in_w  = std::max(grid_w, 0);
+
+    result.grid_import_wh    += grid_in_w * hours;
+    result.grid_export_wh    += std::max(-grid_w, 0) * hours;
+    result.ev_energy_wh      += ev_w * hours;
+    result.ev_energy_grid_wh += std::min(ev_w, grid_in_w) * hours;
+
+    if (ev_w > 0) {
+        const double error_w = grid_w - settings.pm.target_power_from_grid_w;
+
+        result.tracking_error_sq_ws += error_w * error_w * hours * 3600.0;
+        charging_time_s += hours * 3600.0;
+    }
+}
+
+SimResult Simulation::run()
+{
+    if (trace.empty())
+        return result;
+
+    // Same order as PowerManager::setup()
+    const int32_t mavg_values_count = PowerManagerControl::get_mavg_values_count(settings.cloud_filter_mode);
+    std::vector<int32_t> mavg_values_w(static_cast<size_t>(mavg_values_count));
+
+    control.setup(settings.pm, &contactor, mavg_values_w.data(), mavg_values_count);
+    control.update_phases();
+    control.reset_limit_max_current();
+    control.meter_triggered_control = settings.meter_triggered_control && settings.pm.excess_charging_enable;
+    set_available_phases(control.is_3phase ? 3 : 1);
+
+    const uint64_t end = trace.back().time_ms;
+    const uint64_t uptime_past_hysteresis_at = control.switching_hysteresis_ms;
+
+    size_t   trace_pos          = 0;
+    int32_t  base_power_w       = trace[0].base_power_w;
+    int32_t  meter_power_w      = 0;
+    bool     have_sample        = false;
+    uint64_t last_meter_step_at = 0;
+    uint64_t next_meter         = settings.meter_interval_ms + PM_TASK_DELAY_MS / 2; // not in sync with the PM task
+    uint64_t next_pm            = PM_TASK_DELAY_MS;
+    uint64_t next_cm            = settings.cm_interval_ms;
+    uint64_t next_charger       = CHARGER_UPDATE_INTERVAL_MS;
+
+    for (;;) {
+        uint64_t next = std::min({next_meter, next_pm, next_cm, next_charger});
+        if (trace_pos + 1 < trace.size())
+            next = std::min(next, trace[trace_pos + 1].time_ms);
+
+        if (next > end)
+            break;
+
+        integrate(next - now, base_power_w);
+        now = next;
+
+        while (trace_pos + 1 < trace.size() && trace[trace_pos + 1].time_ms <= now) {
+            ++trace_pos;
+            base_power_w = trace[trace_pos].base_power_w;
+        }
+
+        if (!control.uptime_past_hysteresis && now >= uptime_past_hysteresis_at)
+            control.uptime_past_hysteresis = true;
+
+        if (now == next_charger) {
+            update_chargers();
+            next_charger += CHARGER_UPDATE_INTERVAL_MS;
+        }
+
+        if (now == next_meter) {
+            meter_power_w = base_power_w + get_ev_power_w();
+            have_sample = true;
+            sample_pending = true;
+            sample_at = now;
+            ++result.meter_sample_count;
+
+            // See PowerManager::meter_triggered_step()
+            if (control.meter_triggered_control) {
+                control.update_power_filters(meter_power_w, true, control.power_at_meter_filtered_w == INT32_MAX, static_cast<int64_t>(now * 1000));
+                step();
+                last_meter_step_at = now;
+            }
+
+            next_meter += settings.meter_interval_ms;
+        }
+
+        if (now == next_pm) {
+            // See PowerManager::update_data() and the periodic task in PowerManager::setup()
+            control.update_phases();
+
+            if (have_sample)
+                control.update_power_filters(meter_power_w, !control.meter_triggered_control, true, static_cast<int64_t>(now * 1000));
+
+            if (!control.meter_triggered_control || now >= last_meter_step_at + PM_TASK_DELAY_MS)
+                step();
+
+            next_pm += PM_TASK_DELAY_MS;
+        }
+
+        if (now == next_cm) {
+            distribute_current();
+            next_cm += settings.cm_interval_ms;
+        }
+    }
+
+    result.phase_switch_count = contactor.switch_count;
+
+    if (charging_time_s > 0)
+        result.tracking_error_sq_ws /= charging_time_s;
+
+    return result;
+}
+
+static bool load_trace(const char *path, std::vector<TraceRow> *trace)
+{
+    FILE *f = fopen(path, "r");
+    if (f == nullptr) {
+        fprintf(stderr, "Can't open trace %s\n", path);
+        return false;
+    }
+
+    char line[1024];
+    int time_col = -1, grid_col = -1, pv_col = -1, load_col = -1;
+
+    if (fgets(line, sizeof(line), f) != nullptr) {
+        int col = 0;
+        for (char *tok = strtok(line, ",\r\n"); tok != nullptr; tok = strtok(nullptr, ",\r\n"), ++col) {
+            if (strcmp(tok, "time") == 0) time_col = col;
+            else if (strcmp(tok, "grid") == 0) grid_col = col;
+            else if (strcmp(tok, "pv") == 0) pv_col = col;
+            else if (strcmp(tok, "load") == 0) load_col = col;
+        }
+    }
+
+    if (time_col < 0 || (grid_col < 0 && (pv_col < 0 || load_col < 0))) {
+        fprintf(stderr, "Trace needs a header with the columns time and either grid or pv and load\n");
+        fclose(f);
+        return false;
+    }
+
+    double first_time_s = NAN;
+
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        double values[16];
+        int col = 0;
+
+        // strtok() would merge empty fields.
+        for (char *p = line; col < 16; ++col) {
+            values[col] = strtod(p, nullptr);
+            p = strchr(p, ',');
+            if (p == nullptr) {
+                ++col;
+                break;
+            }
+            ++p;
+        }
+
+        if (time_col >= col || grid_col >= col || pv_col >= col || load_col >= col)
+            continue;
+
+        double time_s = values[time_col];
+        if (isnan(first_time_s))
+            first_time_s = time_s;
+
+        double base_power_w = grid_col >= 0 ? values[grid_col] : values[load_col] - values[pv_col];
+
+        TraceRow row;
+        row.time_ms = static_cast<uint64_t>(llround((time_s - first_time_s) * 1000));
+        row.base_power_w = static_cast<int32_t>(lround(base_power_w));
+
+        if (!trace->empty() && row.time_ms < trace->back().time_ms) {
+            fprintf(stderr, "Trace is not sorted by time\n");
+            fclose(f);
+            return false;
+        }
+
+        trace->push_back(row);
+    }
+
+    fclose(f);
+
+    if (trace->size() < 2) {
+        fprintf(stderr, "Trace needs at least two rows\n");
+        return false;
+    }
+
+    return true;
+}
+
+static int lookup(const char *value, const char *const *names, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(value, names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: power_manager_sim --trace FILE [options]\n"
+        "  --mode fast|off|pv|min_pv                             charge mode (pv)\n"
+        "  --phase-switching automatic|1phase|3phase|pv1p_fast3p (automatic)\n"
+        "  --cloud-filter off|light|medium|strong                (medium)\n"
+        "  --hysteresis MINUTES                                  (5)\n"
+        "  --target-power W                                      power drawn from the grid (0)\n"
+        "  --guaranteed-power W                                  (1380)\n"
+        "  --max-current MA                                      charge manager's maximum available current (32000)\n"
+        "  --min-current-1p MA                                   (6000)\n"
+        "  --min-current-3p MA                                   (6000)\n"
+        "  --meter-interval MS                                   grid meter sample interval (1000)\n"
+        "  --meter-triggered                                     run a control step for every meter sample\n"
+        "  --cm-interval MS                                      charge manager distribution interval (5000)\n"
+        "  --chargers N                                          (1)\n"
+        "  --ev-max-current MA                                   (16000)\n"
+        "  --ev-phases N                                         (3)\n"
+        "  --ev-response MS                                      delay until an EV follows a new current (5000)\n"
+        "  --contactor MS                                        phase switching duration (1000)\n"
+        "  --verbose                                             print the control core's log\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const mode_names[] = {"fast", "off", "pv", "min_pv"};
+    static const char *const phase_switching_names[] = {"automatic", "1phase", "3phase", "", "pv1p_fast3p"};
+    static const char *const cloud_filter_names[] = {"off", "light", "medium", "strong"};
+
+    SimSettings settings;
+    settings.pm.default_mode             = MODE_PV;
+    settings.pm.excess_charging_enable   = true;
+    settings.pm.target_power_from_grid_w = 0;
+    settings.pm.guaranteed_power_w       = 1380;
+    settings.pm.phase_switching_mode     = PHASE_SWITCHING_AUTOMATIC;
+    settings.pm.switching_hysteresis_ms  = HYSTERESIS_MIN_TIME_MINUTES * 60 * 1000;
+    settings.pm.max_current_unlimited_ma = 32000;
+    settings.pm.min_current_1p_ma        = 6000;
+    settings.pm.min_current_3p_ma        = 6000;
+
+    const char *trace_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        int index = 0;
+
+        if (strcmp(arg, "--meter-triggered") == 0) {
+            settings.meter_triggered_control = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--verbose") == 0) {
+            settings.verbose = true;
+            continue;
+        }
+
+        if (value == nullptr) {
+            usage();
+            return 1;
+        }
+
+        ++i;
+
+        if (strcmp(arg, "--trace") == 0) {
+            trace_path = value;
+        } else if (strcmp(arg, "--mode") == 0 && (index = lookup(value, mode_names, 4)) >= 0) {
+            settings.pm.default_mode = static_cast<uint32_t>(index);
+        } else if (strcmp(arg, "--phase-switching") == 0 && (index = lookup(value, phase_switching_names, 5)) >= 0 && index != PHASE_SWITCHING_EXTERNAL_CONTROL) {
+            settings.pm.phase_switching_mode = static_cast<uint32_t>(index);
+        } else if (strcmp(arg, "--cloud-filter") == 0 && (index = lookup(value, cloud_filter_names, 4)) >= 0) {
+            settings.cloud_filter_mode = static_cast<uint32_t>(index);
+        } else if (strcmp(arg, "--hysteresis") == 0) {
+            settings.pm.switching_hysteresis_ms = static_cast<uint32_t>(strtoul(value, nullptr, 10)) * 60 * 1000;
+        } else if (strcmp(arg, "--target-power") == 0) {
+            settings.pm.target_power_from_grid_w = static_cast<int32_t>(strtol(value, nullptr, 10));
+        } else if (strcmp(arg, "--guaranteed-power") == 0) {
+            settings.pm.guaranteed_power_w = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--max-current") == 0) {
+            settings.pm.max_current_unlimited_ma = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--min-current-1p") == 0) {
+            settings.pm.min_current_1p_ma = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--min-current-3p") == 0) {
+            settings.pm.min_current_3p_ma = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--meter-interval") == 0) {
+            settings.meter_interval_ms = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--cm-interval") == 0) {
+            settings.cm_interval_ms = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--chargers") == 0) {
+            settings.charger_count = std::min(std::max(1ul, strtoul(value, nullptr, 10)), static_cast<unsigned long>(CHARGER_MAX));
+        } else if (strcmp(arg, "--ev-max-current") == 0) {
+            settings.ev_max_current_ma = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--ev-phases") == 0) {
+            settings.ev_phases = std::min(std::max(1ul, strtoul(value, nullptr, 10)), 3ul);
+        } else if (strcmp(arg, "--ev-response") == 0) {
+            settings.ev_response_ms = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--contactor") == 0) {
+            settings.contactor_ms = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        } else {
+            fprintf(stderr, "Invalid option %s %s\n", arg, value);
+            usage();
+            return 1;
+        }
+    }
+
+    if (trace_path == nullptr) {
+        usage();
+        return 1;
+    }
+
+    std::vector<TraceRow> trace;
+    if (!load_trace(trace_path, &trace))
+        return 1;
+
+    timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    Simulation sim(settings, trace);
+    SimResult result = sim.run();
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    const double sim_s  = static_cast<double>(trace.back().time_ms) / 1000.0;
+    const double wall_s = static_cast<double>(wall_end.tv_sec - wall_start.tv_sec) + static_cast<double>(wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    printf("simulated time:         %.1f s\n", sim_s);
+    printf("grid import:            %.1f Wh\n", result.grid_import_wh);
+    printf("grid export:            %.1f Wh\n", result.grid_export_wh);
+    printf("EV energy:              %.1f Wh\n", result.ev_energy_wh);
+    printf("EV energy from grid:    %.1f Wh\n", result.ev_energy_grid_wh);
+    printf("tracking error (RMS):   %.0f W while charging\n", sqrt(result.tracking_error_sq_ws));
+    printf("switch-on count:        %u\n", result.switch_on_count);
+    printf("switch-off count:       %u\n", result.switch_off_count);
+    printf("phase switch count:     %u\n", result.phase_switch_count);
+    printf("control steps:          %u\n", result.step_count);
+    printf("meter samples:          %u\n", result.meter_sample_count);
+    printf("meter-to-step latency:  avg %.1f ms, max %u ms\n",
+           result.latency_count > 0 ? static_cast<double>(result.latency_total_ms) / result.latency_count : 0.0,
+           result.latency_max_ms);
+    printf("wall time:              %.3f s (%.0fx real time)\n", wall_s, wall_s > 0 ? sim_s / wall_s : 0.0);
+
+    return 0;
+}
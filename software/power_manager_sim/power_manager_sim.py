@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+
+# Builds the power manager simulator for the host and replays a grid power trace against it.
+#
+# Supported trace formats:
+#   csv             header with the columns time (in seconds) and either grid or pv and load (in watt)
+#   meters-history  response of /meters/history, one sample every 4 minutes
+#   meters-live     response of /meters/live
+#   em-5min         response(s) of energy_manager/history_energy_manager_5min, one file per day
+#
+# The recorded grid power is used as base load. Power drawn by chargers
+# during the recording is not removed, so record traces without charging EVs.
+# All options not listed here are passed to the simulator, see --sim-help.
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+sim_dir = os.path.dirname(os.path.realpath(__file__))
+software_dir = os.path.realpath(os.path.join(sim_dir, '..'))
+src_dir = os.path.join(software_dir, 'src')
+build_dir = os.path.join(software_dir, 'build')
+
+sources = [
+    os.path.join(sim_dir, 'power_manager_sim.cpp'),
+    os.path.join(src_dir, 'modules', 'power_manager', 'power_manager_control.cpp'),
+]
+
+headers = [
+    os.path.join(src_dir, 'modules', 'power_manager', 'power_manager_control.h'),
+    os.path.join(src_dir, 'modules', 'power_manager', 'phase_switcher_back-end.h'),
+]
+
+METERS_HISTORY_INTERVAL_S = 4 * 60
+EM_5MIN_INTERVAL_S = 5 * 60
+EM_5MIN_SLOTS = 24 * 60 // 5
+EM_5MIN_VALUES_PER_SLOT = 8
+
+
+def build(compiler):
+    binary = os.path.join(build_dir, 'power_manager_sim')
+
+    if os.path.exists(binary):
+        binary_mtime = os.path.getmtime(binary)
+
+        if all(os.path.getmtime(path) < binary_mtime for path in sources + headers):
+            return binary
+
+    os.makedirs(build_dir, exist_ok=True)
+
+    print('Building {}'.format(binary), file=sys.stderr)
+    subprocess.check_call([compiler, '-std=gnu++17', '-O2', '-I', src_dir, '-o', binary] + sources)
+
+    return binary
+
+
+def samples_to_rows(samples, interval_s, start_s):
+    rows = []
+
+    for i, sample in enumerate(samples):
+        if sample is not None:
+            rows.append((start_s + i * interval_s, sample))
+
+    return rows
+
+
+def load_rows(paths, trace_format, meter_slot):
+    rows = []
+
+    for path in paths:
+        with open(path, 'r', encoding='utf-8') as f:
+            payload = json.load(f)
+
+        start_s = rows[-1][0] + 1 if len(rows) > 0 else 0
+
+        if trace_format == 'meters-history':
+            rows += samples_to_rows(payload['samples'][meter_slot] or [], METERS_HISTORY_INTERVAL_S, start_s)
+        elif trace_format == 'meters-live':
+            rows += samples_to_rows(payload['samples'][meter_slot] or [], 1 / payload['samples_per_second'], start_s)
+        elif trace_format == 'em-5min':
+            start_s = (rows[-1][0] // (24 * 60 * 60) + 1) * 24 * 60 * 60 if len(rows) > 0 else 0
+            samples = [payload[slot * EM_5MIN_VALUES_PER_SLOT + 1 + meter_slot] for slot in range(len(payload) // EM_5MIN_VALUES_PER_SLOT)]
+            rows += samples_to_rows(samples, EM_5MIN_INTERVAL_S, start_s)
+
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay a grid power trace against the power manager.')
+    parser.add_argument('trace', nargs='+')
+    parser.add_argument('--format', choices=['csv', 'meters-history', 'meters-live', 'em-5min'], default='csv')
+    parser.add_argument('--meter-slot', type=int, default=0, help='meter slot of the grid meter in JSON traces')
+    parser.add_argument('--compiler', default=os.environ.get('CXX', 'c++'))
+    parser.add_argument('--sim-help', action='store_true', help='show the simulator options')
+
+    args, sim_args = parser.parse_known_args()
+
+    binary = build(args.compiler)
+
+    if args.sim_help:
+        return subprocess.call([binary])
+
+    if args.format == 'csv':
+        if len(args.trace) != 1:
+            parser.error('only one CSV trace is supported')
+
+        return subprocess.call([binary, '--trace', args.trace[0]] + sim_args)
+
+    rows = load_rows(args.trace, args.format, args.meter_slot)
+
+    if len(rows) < 2:
+        print('Trace contains less than two samples', file=sys.stderr)
+        return 1
+
+    with tempfile.NamedTemporaryFile('w', suffix='.csv', prefix='power_manager_sim-') as f:
+        f.write('time,grid\n')
+
+        for time_s, power_w in rows:
+            f.write('{},{}\n'.format(time_s, power_w))
+
+        f.flush()
+
+        return subprocess.call([binary, '--trace', f.name] + sim_args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
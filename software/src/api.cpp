@@ -26,6 +26,7 @@
 #include "build.h"
 #include "config_migrations.h"
 #include "event_log.h"
+#include "string_builder.h"
 #include "task_scheduler.h"
 
 extern TF_HAL hal;
@@ -199,22 +200,22 @@ void API::addCommand(const String &path, ConfigRoot *config, std::initializer_li
     this->addCommand(strdup(path.c_str()), config, keys_to_censor_in_debug_report, std::forward<std::function<void(String &)>>(callback), is_action);
 }
 
-void API::addState(const char * const path, ConfigRoot *config, std::initializer_list<String> keys_to_censor, bool low_latency)
+size_t API::addState(const char * const path, ConfigRoot *config, std::initializer_list<String> keys_to_censor, bool low_latency)
 {
     size_t path_len = strlen(path);
 
     if (path_len > std::numeric_limits<decltype(StateRegistration::path_len)>::max()) {
         logger.printfln("API state %s: path too long!", path);
-        return;
+        return SIZE_MAX;
     }
 
     if (keys_to_censor.size() > std::numeric_limits<decltype(StateRegistration::keys_to_censor_len)>::max()) {
         logger.printfln("API state %s: keys_to_censor too long!", path);
-        return;
+        return SIZE_MAX;
     }
 
     if (already_registered(path, path_len, "state"))
-        return;
+        return SIZE_MAX;
 
     auto ktc = new String[keys_to_censor.size()];
     std::copy(keys_to_censor.begin(), keys_to_censor.end(), ktc);
@@ -233,11 +234,13 @@ void API::addState(const char * const path, ConfigRoot *config, std::initializer
     for (auto *backend : this->backends) {
         backend->addState(stateIdx, states[stateIdx]);
     }
+
+    return stateIdx;
 }
 
-void API::addState(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor, bool low_latency)
+size_t API::addState(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor, bool low_latency)
 {
-    this->addState(strdup(path.c_str()), config, keys_to_censor, low_latency);
+    return this->addState(strdup(path.c_str()), config, keys_to_censor, low_latency);
 }
 
 bool API::addPersistentConfig(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor)
@@ -516,6 +519,48 @@ size_t API::registerBackend(IAPIBackend *backend)
     return backendIdx;
 }
 
+bool API::appendStateDump(StringBuilder *sb, size_t *state_idx, const std::function<bool(const StateRegistration &)> &filter)
+{
+    static const char *prefix = "{\"topic\":\"";
+    static const char *infix = "\",\"payload\":";
+    static const char *suffix = "}\n";
+    static const size_t prefix_len = strlen(prefix);
+    static const size_t infix_len = strlen(infix);
+    static const size_t suffix_len = strlen(suffix);
+
+    for (; *state_idx < states.size(); ++*state_idx) {
+        auto &reg = states[*state_idx];
+
+        if (filter && !filter(reg))
+            continue;
+
+        auto config_len = reg.config->string_length();
+        size_t req = prefix_len + reg.path_len + infix_len + config_len + suffix_len + 1; // +1 for the second \n
+
+        if (sb->getRemainingLength() < req) {
+            if (sb->getLength() > 0)
+                return false;
+
+            // The state does not fit into the empty buffer, for example
+            // the charge manager state with many chargers. Grow the buffer.
+            if (!sb->setCapacity(req)) {
+                logger.printfln("API %s exceeds max dump buffer capacity! Required %u, buffer capacity %u", reg.path, req, sb->getCapacity());
+                return false;
+            }
+        }
+
+        sb->puts(prefix, static_cast<ssize_t>(prefix_len));
+        sb->puts(reg.path, reg.path_len);
+        sb->puts(infix, static_cast<ssize_t>(infix_len));
+
+        reg.config->to_string_except(reg.keys_to_censor, reg.keys_to_censor_len, sb);
+
+        sb->puts(suffix, static_cast<ssize_t>(suffix_len));
+    }
+
+    return true;
+}
+
 String API::callCommand(CommandRegistration &reg, char *payload, size_t len)
 {
     if (running_in_main_task()) {
@@ -547,6 +592,30 @@ String API::callCommand(CommandRegistration &reg, char *payload, size_t len)
     return result;
 }
 
+String API::callCommand(CommandRegistration &reg, JsonVariant payload)
+{
+    if (running_in_main_task()) {
+        return "Use ConfUpdate overload of callCommand in main thread!";
+    }
+
+    String result = "";
+
+    auto await_result = task_scheduler.await(
+        [&result, reg, payload]() mutable {
+            result = reg.config->update_from_json(payload, true, ConfigSource::API);
+            if (!result.isEmpty())
+                return;
+
+            reg.callback(result);
+        });
+
+    if (await_result == TaskScheduler::AwaitResult::Timeout) {
+        return "Failed to execute command: Timeout reached.";
+    }
+
+    return result;
+}
+
 void API::callCommandNonBlocking(CommandRegistration &reg, char *payload, size_t len, std::function<void(String)> done_cb)
 {
     if (running_in_main_task()) {
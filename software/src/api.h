@@ -99,6 +99,10 @@ public:
     // Call this method only if you are a IAPIBackend and run in another FreeRTOS task!
     String callCommand(CommandRegistration &reg, char *payload, size_t len);
 
+    // Call this method only if you are a IAPIBackend and run in another FreeRTOS task!
+    // The payload was already deserialized, for example while it was received.
+    String callCommand(CommandRegistration &reg, JsonVariant payload);
+
     // Call this method only if you are a IAPIBackend and run in another FreeRTOS task!
     void callCommandNonBlocking(CommandRegistration &reg, char *payload, size_t len, std::function<void(String)> done_cb);
 
@@ -116,8 +120,9 @@ public:
     void addCommand(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor_in_debug_report, std::function<void()> &&callback, bool is_action);
     void addCommand(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor_in_debug_report, std::function<void(String &)> &&callback, bool is_action);
 
-    void addState(const char * const path, ConfigRoot *config, std::initializer_list<String> keys_to_censor = {}, bool low_latency = false);
-    void addState(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor = {}, bool low_latency = false);
+    // Returns the index of the new state or SIZE_MAX if it could not be added.
+    size_t addState(const char * const path, ConfigRoot *config, std::initializer_list<String> keys_to_censor = {}, bool low_latency = false);
+    size_t addState(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor = {}, bool low_latency = false);
     bool addPersistentConfig(const String &path, ConfigRoot *config, std::initializer_list<String> keys_to_censor = {});
     //void addTemporaryConfig(const String &path, Config *config, std::initializer_list<String> keys_to_censor, std::function<void(void)> &&callback);
     void addRawCommand(const char * const path, std::function<String(char *, size_t)> &&callback, bool is_action);
@@ -150,6 +155,14 @@ public:
 
     size_t registerBackend(IAPIBackend *backend);
 
+    // Appends the states in the framing of the web socket's initial dump
+    // ({"topic":"...","payload":...} per line) to sb, starting at *state_idx.
+    // States for which filter returns false are skipped. Returns true if all
+    // states were appended. Otherwise sb is full: Send its content, clear it
+    // and call again. sb is grown if a single state does not fit into it.
+    // Must be called from the main thread.
+    bool appendStateDump(StringBuilder *sb, size_t *state_idx, const std::function<bool(const StateRegistration &)> &filter = nullptr);
+
     std::vector<StateRegistration> states;
     std::vector<CommandRegistration> commands;
     std::vector<RawCommandRegistration> raw_commands;
@@ -409,6 +409,20 @@ int tf_hal_get_device_info(TF_HAL *hal, uint16_t index, char ret_uid_str[7], cha
     return TF_E_OK;
 }
 
+int tf_hal_get_latency_histogram(TF_HAL *hal, uint16_t index, uint32_t ret_histogram[TF_TFP_LATENCY_BUCKET_COUNT]) {
+    TF_HALCommon *hal_common = tf_hal_get_common(hal);
+
+    if (index >= hal_common->tfps_used) {
+        return TF_E_DEVICE_NOT_FOUND;
+    }
+
+    index = hal_common->tfps_order[index];
+
+    memcpy(ret_histogram, hal_common->tfps[index].latency_histogram, sizeof(hal_common->tfps[index].latency_histogram));
+
+    return TF_E_OK;
+}
+
 #if TF_NET_ENABLE != 0
 static uint8_t enumerate_request[8] = {
     0, 0, 0, 0, // uid 1
@@ -610,6 +624,22 @@ int tf_hal_callback_tick(TF_HAL *hal, uint32_t timeout_us) {
     uint16_t first_index = hal_common->callback_tick_index;
     TF_TFP *tfp = NULL;
 
+    // Devices with an asynchronous request in flight are ticked on every call,
+    // so that their responses don't wait for the round robin below.
+    for (uint16_t i = 0; i < hal_common->tfps_used; ++i) {
+        tfp = &hal_common->tfps[i];
+
+        if (!tf_tfp_async_pending(tfp)) {
+            continue;
+        }
+
+        int result = tf_tfp_callback_tick(tfp, tf_hal_current_time_us(hal));
+
+        if (result != TF_E_OK) {
+            return result;
+        }
+    }
+
     do {
         ++hal_common->callback_tick_index;
 
@@ -64,6 +64,7 @@ typedef struct TF_HAL TF_HAL;
 void tf_hal_set_timeout(TF_HAL *hal, uint32_t timeout_us) TF_ATTRIBUTE_NONNULL_ALL;
 uint32_t tf_hal_get_timeout(TF_HAL *hal) TF_ATTRIBUTE_NONNULL_ALL;
 int tf_hal_get_device_info(TF_HAL *hal, uint16_t index, char ret_uid_str[7], char *ret_port_name, uint16_t *ret_device_id) TF_ATTRIBUTE_NONNULL(1);
+int tf_hal_get_latency_histogram(TF_HAL *hal, uint16_t index, uint32_t ret_histogram[TF_TFP_LATENCY_BUCKET_COUNT]) TF_ATTRIBUTE_NONNULL_ALL;
 int tf_hal_callback_tick(TF_HAL *hal, uint32_t timeout_us) TF_ATTRIBUTE_NONNULL_ALL;
 int tf_hal_tick(TF_HAL *hal, uint32_t timeout_us) TF_ATTRIBUTE_NONNULL_ALL;
 
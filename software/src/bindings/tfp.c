@@ -225,6 +225,12 @@ void tf_tfp_create(TF_TFP *tfp, uint32_t uid_num, uint16_t device_id, TF_SPITFP
 }
 
 void tf_tfp_prepare_send(TF_TFP *tfp, uint8_t fid, uint8_t payload_size, bool response_expected) {
+    if (tfp->async_handler != NULL) {
+        // This overwrites the send buffer and the expected response of the asynchronous request.
+        // The handler is called with TF_E_LOCKED on the next tick.
+        tfp->async_aborted = true;
+    }
+
     // TODO: theoretically, all bytes should be rewritten when sending a new packet, so this is not necessary.
     uint8_t *buf = tf_spitfp_get_send_payload_buffer(tfp->spitfp);
     memset(buf, 0, TF_TFP_MAX_MESSAGE_LENGTH);
@@ -254,6 +260,10 @@ void tf_tfp_inject_packet(TF_TFP *tfp, TF_TFPHeader *header, uint8_t *packet) {
     memset(buf, 0, TF_TFP_MAX_MESSAGE_LENGTH);
     memcpy(buf, packet, header->length);
 
+    if (tfp->async_handler != NULL) {
+        tfp->async_aborted = true;
+    }
+
     tfp->waiting_for_fid = 0;
     tfp->waiting_for_seq_num = 0;
 }
@@ -263,7 +273,8 @@ static int tf_tfp_send_getter(TF_TFP *tfp, uint32_t deadline_us, uint8_t *error_
 
     int result = TF_TICK_AGAIN;
     bool packet_received = false;
-    uint32_t last_send = tf_hal_current_time_us(tfp->spitfp->hal);
+    uint32_t first_send = tf_hal_current_time_us(tfp->spitfp->hal);
+    uint32_t last_send = first_send;
 
     while (!tf_hal_deadline_elapsed(tfp->spitfp->hal, deadline_us) && !packet_received) {
         if (result & TF_TICK_TIMEOUT && tf_hal_deadline_elapsed(tfp->spitfp->hal, last_send + 5000)) {
@@ -282,6 +293,8 @@ static int tf_tfp_send_getter(TF_TFP *tfp, uint32_t deadline_us, uint8_t *error_
                 tfp->waiting_for_fid = 0;
                 tfp->waiting_for_seq_num = 0;
                 packet_received = true;
+
+                tf_tfp_record_latency(tfp, tf_hal_current_time_us(tfp->spitfp->hal) - first_send);
             }
         }
 
@@ -374,9 +387,69 @@ int tf_tfp_get_error(uint8_t error_code) {
     }
 }
 
+void tf_tfp_record_latency(TF_TFP *tfp, uint32_t latency_us) {
+    uint8_t bucket = 0;
+    uint32_t limit_us = TF_TFP_LATENCY_BUCKET_BASE_US;
+
+    while (bucket < TF_TFP_LATENCY_BUCKET_COUNT - 1 && latency_us >= limit_us) {
+        ++bucket;
+        limit_us *= 2;
+    }
+
+    ++tfp->latency_histogram[bucket];
+}
+
+int tf_tfp_send_async(TF_TFP *tfp, uint8_t fid, const uint8_t *payload, uint8_t payload_size, uint32_t timeout_us, TF_TFP_AsyncHandler handler, void *user_data) {
+    if (payload_size > TF_TFP_MAX_MESSAGE_LENGTH - TF_TFP_MIN_MESSAGE_LENGTH) {
+        return TF_E_INVALID_PARAMETER;
+    }
+
+    // Don't overwrite a pending asynchronous request or a packet the network layer is still sending.
+    if (tfp->async_handler != NULL || tfp->spitfp->send_buf[0] != 0) {
+        return TF_E_LOCKED;
+    }
+
+    tf_tfp_prepare_send(tfp, fid, payload_size, true);
+
+    if (payload_size > 0) {
+        memcpy(tf_tfp_get_send_payload_buffer(tfp), payload, payload_size);
+    }
+
+    // The packet is transferred by tf_tfp_callback_tick.
+    tf_spitfp_build_packet(tfp->spitfp, TF_NEW_PACKET);
+
+    tfp->async_handler = handler;
+    tfp->async_user_data = user_data;
+    tfp->async_start_us = tf_hal_current_time_us(tfp->spitfp->hal);
+    tfp->async_deadline_us = tfp->async_start_us + timeout_us;
+    tfp->async_aborted = false;
+
+    return TF_E_OK;
+}
+
+bool tf_tfp_async_pending(TF_TFP *tfp) {
+    return tfp->async_handler != NULL;
+}
+
+static void tf_tfp_complete_async(TF_TFP *tfp, int result, TF_PacketBuffer *payload, uint8_t length) {
+    TF_TFP_AsyncHandler handler = tfp->async_handler;
+    void *user_data = tfp->async_user_data;
+
+    // Clear the request before calling the handler, so that it can send the next one.
+    tfp->async_handler = NULL;
+    tfp->async_user_data = NULL;
+    tfp->async_aborted = false;
+
+    handler(user_data, result, payload, length);
+}
+
 int tf_tfp_callback_tick(TF_TFP *tfp, uint32_t deadline_us) {
     int result = TF_TICK_AGAIN;
 
+    if (tfp->async_handler != NULL && tfp->async_aborted) {
+        tf_tfp_complete_async(tfp, TF_E_LOCKED, NULL, 0);
+    }
+
     if (tfp->spitfp->send_buf[0] != 0) {
         tf_spitfp_build_packet(tfp->spitfp, TF_RETRANSMISSION);
     }
@@ -392,14 +465,35 @@ int tf_tfp_callback_tick(TF_TFP *tfp, uint32_t deadline_us) {
             return result;
         }
 
+        // A response can acknowledge the request in the same tick. Handle this
+        // first: The async handler may already have put the next request into the send buffer.
+        if (result & TF_TICK_PACKET_SENT) {
+            tfp->spitfp->send_buf[0] = 0;
+        }
+
         if (result & TF_TICK_PACKET_RECEIVED) {
-            // handle possible callback packet
+            // handle possible callback packet or response to the asynchronous request
             uint8_t error_code, length;
-            tf_tfp_filter_received_packet(tfp, true, &error_code, &length);
-        }
+            bool async_pending = tfp->async_handler != NULL;
 
-        if (result & TF_TICK_PACKET_SENT) {
-            tfp->spitfp->send_buf[0] = 0;
+            if (tf_tfp_filter_received_packet(tfp, !async_pending, &error_code, &length)) {
+                TF_PacketBuffer *recv_buf = tf_tfp_get_receive_buffer(tfp);
+                uint8_t used_before = tf_packet_buffer_get_used(recv_buf);
+
+                tfp->waiting_for_fid = 0;
+                tfp->waiting_for_seq_num = 0;
+
+                tf_tfp_record_latency(tfp, tf_hal_current_time_us(tfp->spitfp->hal) - tfp->async_start_us);
+                tf_tfp_complete_async(tfp, tf_tfp_get_error(error_code), recv_buf, length);
+
+                uint8_t consumed = used_before - tf_packet_buffer_get_used(recv_buf);
+
+                if (consumed < length) {
+                    tf_packet_buffer_remove(recv_buf, length - consumed);
+                }
+
+                tf_tfp_packet_processed(tfp);
+            }
         }
 
         // Allow the state machine to run a bit over the deadline:
@@ -409,5 +503,14 @@ int tf_tfp_callback_tick(TF_TFP *tfp, uint32_t deadline_us) {
         // (Except an ACK that has not be acked again).
     } while (!tf_hal_deadline_elapsed(tfp->spitfp->hal, deadline_us) || (result & TF_TICK_AGAIN));
 
+    if (tfp->async_handler != NULL && tf_hal_deadline_elapsed(tfp->spitfp->hal, tfp->async_deadline_us)) {
+        // Same as tf_tfp_finish_send: Don't send the request again and don't wait for the response anymore.
+        tfp->spitfp->send_buf[0] = 0;
+        tfp->waiting_for_fid = 0;
+        tfp->waiting_for_seq_num = 0;
+
+        tf_tfp_complete_async(tfp, TF_E_TIMEOUT, NULL, 0);
+    }
+
     return TF_E_OK;
 }
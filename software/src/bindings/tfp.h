@@ -25,6 +25,19 @@ extern "C" {
 
 typedef bool (*TF_TFP_CallbackHandler)(void *device, uint8_t fid, TF_PacketBuffer *payload);
 
+// Called from tf_hal_tick/tf_hal_callback_tick when the response to an
+// asynchronous request was received (result is TF_E_OK or the error reported
+// by the device), the request timed out (result is TF_E_TIMEOUT, payload is NULL)
+// or it was aborted by a blocking call to the same device (result is TF_E_LOCKED, payload is NULL).
+// The handler may read up to length bytes from payload, unread bytes are removed afterwards.
+typedef void (*TF_TFP_AsyncHandler)(void *user_data, int result, TF_PacketBuffer *payload, uint8_t length);
+
+// Round trip latency histogram of getters and asynchronous requests.
+// Bucket i counts round trips shorter than 250 µs * 2^i,
+// the last bucket counts all slower round trips.
+#define TF_TFP_LATENCY_BUCKET_COUNT 12
+#define TF_TFP_LATENCY_BUCKET_BASE_US 250
+
 typedef struct TF_TFP {
     TF_SPITFP *spitfp;
     void *device;
@@ -46,6 +59,14 @@ typedef struct TF_TFP {
     uint8_t spitfp_timeout_counter;
     int8_t spitfp_last_seq_num;
 #endif
+
+    uint32_t latency_histogram[TF_TFP_LATENCY_BUCKET_COUNT];
+
+    TF_TFP_AsyncHandler async_handler; // NULL if no asynchronous request is in flight
+    void *async_user_data;
+    uint32_t async_start_us;
+    uint32_t async_deadline_us;
+    bool async_aborted;
 } TF_TFP;
 
 void tf_tfp_create(TF_TFP *tfp, uint32_t uid_num, uint16_t device_id, TF_SPITFP *spitfp) TF_ATTRIBUTE_NONNULL_ALL;
@@ -64,6 +85,15 @@ int tf_tfp_callback_tick(TF_TFP *tfp, uint32_t deadline_us) TF_ATTRIBUTE_NONNULL
 
 void tf_tfp_inject_packet(TF_TFP *tfp, TF_TFPHeader *header, uint8_t *packet) TF_ATTRIBUTE_NONNULL_ALL;
 
+// Sends a request without waiting for the response. At most one asynchronous
+// request per device can be in flight, but requests to different devices are
+// processed concurrently by tf_hal_tick. A blocking getter or setter call to
+// the same device aborts the asynchronous request.
+int tf_tfp_send_async(TF_TFP *tfp, uint8_t fid, const uint8_t *payload, uint8_t payload_size, uint32_t timeout_us, TF_TFP_AsyncHandler handler, void *user_data) TF_ATTRIBUTE_NONNULL(1, 6) TF_ATTRIBUTE_WARN_UNUSED_RESULT;
+bool tf_tfp_async_pending(TF_TFP *tfp) TF_ATTRIBUTE_NONNULL_ALL;
+
+void tf_tfp_record_latency(TF_TFP *tfp, uint32_t latency_us) TF_ATTRIBUTE_NONNULL_ALL;
+
 #ifdef __cplusplus
 }
 #endif
@@ -751,6 +751,8 @@ public:
     String update_from_json(JsonVariant root, bool force_same_keys, ConfigSource source);
     String get_updated_copy(JsonVariant root, bool force_same_keys, Config *out_config, ConfigSource source);
 
+    static String deserialization_error_to_string(DeserializationError error);
+
     String update(const Config::ConfUpdate *val);
 
     String validate(ConfigSource source);
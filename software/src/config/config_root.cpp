@@ -37,9 +37,17 @@ String ConfigRoot::get_updated_copy(char *c, size_t payload_len, Config *out_con
     DynamicJsonDocument doc(this->json_size(true));
     DeserializationError error = deserializeJson(doc, c, payload_len);
 
+    if (error)
+        return deserialization_error_to_string(error);
+
+    return this->get_updated_copy(doc.as<JsonVariant>(), true, out_config, source);
+}
+
+String ConfigRoot::deserialization_error_to_string(DeserializationError error)
+{
     switch (error.code()) {
         case DeserializationError::Ok:
-            return this->get_updated_copy(doc.as<JsonVariant>(), true, out_config, source);
+            return "";
         case DeserializationError::NoMemory:
             return String("Failed to deserialize: JSON payload was longer than expected and possibly contained unknown keys.");
         case DeserializationError::EmptyInput:
@@ -0,0 +1,348 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "heap_profiler.h"
+
+#ifdef DEBUG_HEAP_PROFILER
+
+#include <string.h>
+
+#include "esp_debug_helpers.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "soc/soc_memory_types.h"
+
+#include "gcc_warnings.h"
+
+// Entries in the table of live allocations. The table is in PSRAM if available.
+#define HEAP_PROFILER_TABLE_SIZE_PSRAM 8192
+#define HEAP_PROFILER_TABLE_SIZE_DRAM 2048
+
+// Every n-th allocation is sampled for the allocation site histogram. Must be a power of two.
+#define HEAP_PROFILER_SAMPLE_INTERVAL 32
+
+// Frames of the backtrace: record_site(), the __wrap_ function, malloc's caller and its caller.
+#define HEAP_PROFILER_SITE_SKIP_FRAMES 2
+
+struct Allocation {
+    uintptr_t ptr;
+    uint32_t size : 24;
+    uint32_t owner : 8;
+};
+
+static Allocation *table = nullptr;
+static size_t table_mask = 0;
+static size_t table_used = 0;
+
+static HeapProfilerOwnerStats owner_stats[HEAP_PROFILER_MAX_OWNERS];
+static const char *owner_names[HEAP_PROFILER_MAX_OWNERS];
+static HeapProfilerSite sites[HEAP_PROFILER_MAX_SITES];
+static size_t sites_used = 0;
+static uint32_t untracked_allocs = 0;
+static uint32_t sample_counter = 0;
+
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Zero-initialized, so every task starts as HEAP_PROFILER_OWNER_OTHER_TASKS.
+static thread_local uint8_t current_owner;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+}
+
+static inline size_t slot_of(uintptr_t ptr)
+{
+    return ((ptr >> 3) * 2654435761u) & table_mask;
+}
+
+// Call with mux held.
+static void remove_allocation(uintptr_t ptr)
+{
+    size_t i = slot_of(ptr);
+
+    while (table[i].ptr != ptr) {
+        if (table[i].ptr == 0) {
+            // Allocated before the profiler was initialized or not tracked.
+            return;
+        }
+
+        i = (i + 1) & table_mask;
+    }
+
+    HeapProfilerOwnerStats &stats = owner_stats[table[i].owner];
+    stats.live_bytes -= table[i].size;
+    stats.live_blocks -= 1;
+    --table_used;
+
+    // Backward shift deletion keeps the probe sequences intact without tombstones.
+    size_t j = i;
+
+    for (;;) {
+        j = (j + 1) & table_mask;
+
+        if (table[j].ptr == 0) {
+            break;
+        }
+
+        size_t k = slot_of(table[j].ptr);
+
+        // Entry j stays if its home slot k lies cyclically in (i, j].
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+
+        table[i] = table[j];
+        i = j;
+    }
+
+    table[i].ptr = 0;
+}
+
+// Call with mux held.
+static void add_allocation(uintptr_t ptr, size_t size, uint8_t owner)
+{
+    // Keep probe sequences short.
+    if (table_used >= (table_mask + 1) / 8 * 7) {
+        ++untracked_allocs;
+        return;
+    }
+
+    size_t i = slot_of(ptr);
+
+    while (table[i].ptr != 0) {
+        if (table[i].ptr == ptr) {
+            // Freed with heap_caps_free(), which bypasses the profiler.
+            remove_allocation(ptr);
+            add_allocation(ptr, size, owner);
+            return;
+        }
+
+        i = (i + 1) & table_mask;
+    }
+
+    uint32_t tracked_size = size > 0xFFFFFF ? 0xFFFFFF : static_cast<uint32_t>(size);
+
+    table[i].ptr = ptr;
+    table[i].size = tracked_size & 0xFFFFFF;
+    table[i].owner = owner;
+    ++table_used;
+
+    HeapProfilerOwnerStats &stats = owner_stats[owner];
+    stats.live_bytes += tracked_size;
+    stats.live_blocks += 1;
+    stats.allocs += 1;
+
+    if (stats.live_bytes > stats.peak_bytes) {
+        stats.peak_bytes = stats.live_bytes;
+    }
+}
+
+[[gnu::noinline]]
+static void record_site(size_t size)
+{
+    uint32_t pc[2] = {0, 0};
+
+    esp_backtrace_frame_t frame = {};
+    esp_backtrace_get_start(&frame.pc, &frame.sp, &frame.next_pc);
+
+    for (size_t i = 0; i < HEAP_PROFILER_SITE_SKIP_FRAMES + 2; ++i) {
+        if (i >= HEAP_PROFILER_SITE_SKIP_FRAMES) {
+            pc[i - HEAP_PROFILER_SITE_SKIP_FRAMES] = esp_cpu_process_stack_pc(frame.pc);
+        }
+
+        if (frame.next_pc == 0 || !esp_stack_ptr_is_sane(frame.sp) || !esp_backtrace_get_next_frame(&frame)) {
+            break;
+        }
+    }
+
+    portENTER_CRITICAL_SAFE(&mux);
+
+    HeapProfilerSite *min_site = nullptr;
+    size_t i = 0;
+
+    for (; i < sites_used; ++i) {
+        HeapProfilerSite &site = sites[i];
+
+        if (site.pc[0] == pc[0] && site.pc[1] == pc[1]) {
+            break;
+        }
+
+        if (min_site == nullptr || site.count < min_site->count) {
+            min_site = &site;
+        }
+    }
+
+    if (i < sites_used) {
+        sites[i].count += 1;
+        sites[i].bytes += static_cast<uint32_t>(size);
+    } else if (sites_used < HEAP_PROFILER_MAX_SITES) {
+        sites[sites_used++] = {{pc[0], pc[1]}, 1, static_cast<uint32_t>(size)};
+    } else {
+        // Space-saving: The new site inherits the count of the least frequent one, so that frequent sites are never dropped.
+        *min_site = {{pc[0], pc[1]}, min_site->count + 1, static_cast<uint32_t>(size)};
+    }
+
+    portEXIT_CRITICAL_SAFE(&mux);
+}
+
+static inline void track(void *old_ptr, void *new_ptr, size_t size)
+{
+    if (table == nullptr) {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&mux);
+
+    if (old_ptr != nullptr) {
+        remove_allocation(reinterpret_cast<uintptr_t>(old_ptr));
+    }
+
+    if (new_ptr != nullptr) {
+        add_allocation(reinterpret_cast<uintptr_t>(new_ptr), size, current_owner);
+    }
+
+    portEXIT_CRITICAL_SAFE(&mux);
+
+    // A data race on the counter only shifts the samples.
+    if (new_ptr != nullptr && (++sample_counter & (HEAP_PROFILER_SAMPLE_INTERVAL - 1)) == 0) {
+        record_site(size);
+    }
+}
+
+extern "C" {
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    track(nullptr, ptr, size);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    void *ptr = __real_calloc(count, size);
+    track(nullptr, ptr, count * size);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    void *new_ptr = __real_realloc(ptr, size);
+
+    // The old block is still valid if realloc failed.
+    if (new_ptr != nullptr || size == 0) {
+        track(ptr, new_ptr, size);
+    }
+
+    return new_ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    track(ptr, nullptr, 0);
+    __real_free(ptr);
+}
+}
+
+void heap_profiler_init()
+{
+    size_t entries = HEAP_PROFILER_TABLE_SIZE_PSRAM;
+    Allocation *new_table = static_cast<Allocation *>(heap_caps_calloc(entries, sizeof(Allocation), MALLOC_CAP_SPIRAM));
+
+    if (new_table == nullptr) {
+        entries = HEAP_PROFILER_TABLE_SIZE_DRAM;
+        new_table = static_cast<Allocation *>(heap_caps_calloc(entries, sizeof(Allocation), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
+    }
+
+    if (new_table == nullptr) {
+        return;
+    }
+
+    heap_profiler_set_owner_name(HEAP_PROFILER_OWNER_OTHER_TASKS, "other tasks");
+    heap_profiler_set_owner_name(HEAP_PROFILER_OWNER_BOOT, "boot");
+    heap_profiler_set_owner_name(HEAP_PROFILER_OWNER_CORE, "core");
+
+    portENTER_CRITICAL_SAFE(&mux);
+    table_mask = entries - 1;
+    table = new_table;
+    portEXIT_CRITICAL_SAFE(&mux);
+
+    heap_profiler_set_owner(HEAP_PROFILER_OWNER_BOOT);
+}
+
+void heap_profiler_set_owner_name(uint8_t owner, const char *name)
+{
+    if (owner < HEAP_PROFILER_MAX_OWNERS) {
+        owner_names[owner] = name;
+    }
+}
+
+const char *heap_profiler_get_owner_name(uint8_t owner)
+{
+    return owner < HEAP_PROFILER_MAX_OWNERS ? owner_names[owner] : nullptr;
+}
+
+uint8_t heap_profiler_set_owner(uint8_t owner)
+{
+    uint8_t previous = current_owner;
+    // Builds with more modules than owners attribute the remaining modules to the core.
+    current_owner = owner < HEAP_PROFILER_MAX_OWNERS ? owner : HEAP_PROFILER_OWNER_CORE;
+    return previous;
+}
+
+uint8_t heap_profiler_get_owner()
+{
+    return current_owner;
+}
+
+void heap_profiler_get_owner_stats(uint8_t owner, HeapProfilerOwnerStats *stats)
+{
+    if (owner >= HEAP_PROFILER_MAX_OWNERS) {
+        *stats = {};
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&mux);
+    *stats = owner_stats[owner];
+    portEXIT_CRITICAL_SAFE(&mux);
+}
+
+size_t heap_profiler_get_sites(HeapProfilerSite *sites_out, size_t max_sites)
+{
+    portENTER_CRITICAL_SAFE(&mux);
+    size_t count = sites_used < max_sites ? sites_used : max_sites;
+    memcpy(sites_out, sites, count * sizeof(HeapProfilerSite));
+    portEXIT_CRITICAL_SAFE(&mux);
+
+    return count;
+}
+
+uint32_t heap_profiler_get_untracked_allocs()
+{
+    return untracked_allocs;
+}
+
+#endif
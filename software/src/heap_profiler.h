@@ -0,0 +1,75 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Attributes heap allocations to the module or boot stage that runs on the
+// allocating task: The main loop sets the owner of the loop task while a
+// module's functions run, tasks scheduled with the TaskScheduler run as the
+// owner that scheduled them. Allocations on other tasks belong to "other tasks".
+//
+// Only available in builds with
+//     -DDEBUG_HEAP_PROFILER
+//     -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc -Wl,--wrap=free
+// in the build_flags. Allocations with heap_caps_malloc() are not tracked.
+
+#define HEAP_PROFILER_OWNER_OTHER_TASKS 0
+#define HEAP_PROFILER_OWNER_BOOT 1
+#define HEAP_PROFILER_OWNER_CORE 2
+#define HEAP_PROFILER_OWNER_FIRST_MODULE 3
+#define HEAP_PROFILER_MAX_OWNERS 128
+
+#define HEAP_PROFILER_MAX_SITES 32
+
+struct HeapProfilerOwnerStats {
+    uint32_t live_bytes;
+    uint32_t peak_bytes;
+    uint32_t live_blocks;
+    uint32_t allocs;
+};
+
+// A sampled allocation site: The return addresses into malloc's caller and its caller.
+struct HeapProfilerSite {
+    uint32_t pc[2];
+    uint32_t count;
+    uint32_t bytes;
+};
+
+#ifdef DEBUG_HEAP_PROFILER
+void heap_profiler_init();
+
+void heap_profiler_set_owner_name(uint8_t owner, const char *name);
+const char *heap_profiler_get_owner_name(uint8_t owner);
+
+// Sets the owner of the calling task. Returns the previous owner.
+uint8_t heap_profiler_set_owner(uint8_t owner);
+uint8_t heap_profiler_get_owner();
+
+void heap_profiler_get_owner_stats(uint8_t owner, HeapProfilerOwnerStats *stats);
+// Returns the number of sites written.
+size_t heap_profiler_get_sites(HeapProfilerSite *sites, size_t max_sites);
+// Allocations that did not fit into the table of live allocations.
+uint32_t heap_profiler_get_untracked_allocs();
+#else
+static inline uint8_t heap_profiler_set_owner(uint8_t owner) { (void)owner; return 0; }
+static inline uint8_t heap_profiler_get_owner() { return 0; }
+#endif
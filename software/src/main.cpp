@@ -32,6 +32,7 @@
 #include "build.h"
 #include "module.h"
 #include "modules_main.h"
+#include "heap_profiler.h"
 #include "tools.h"
 
 #include "gcc_warnings.h"
@@ -42,6 +43,17 @@ static IModule **loop_chain = nullptr;
 static size_t loop_chain_size = 0;
 static size_t loop_chain_head = 0;
 
+#ifdef DEBUG_HEAP_PROFILER
+static uint8_t *loop_chain_owners = nullptr;
+#endif
+
+// The heap profiler attributes allocations to the module whose functions run on the loop task.
+static uint8_t module_heap_owner(size_t module_index)
+{
+    size_t owner = HEAP_PROFILER_OWNER_FIRST_MODULE + module_index;
+    return owner < HEAP_PROFILER_MAX_OWNERS ? static_cast<uint8_t>(owner) : HEAP_PROFILER_OWNER_CORE;
+}
+
 static bool is_module_loop_overridden(const IModule *imodule) {
 #if defined(__GNUC__)
     #pragma GCC diagnostic push
@@ -91,7 +103,8 @@ static WebServerRequestReturnProtect send_index_html(WebServerRequest &request)
     request.addResponseHeader("ETag", build_timestamp_hex_str());
     request.addResponseHeader("X-Clacks-Overhead", "GNU Terry Pratchett");
 
-    if (request.header("If-None-Match") == build_timestamp_hex_str()) {
+    const char *if_none_match = request.headerCStr("If-None-Match");
+    if (if_none_match != nullptr && strcmp(if_none_match, build_timestamp_hex_str()) == 0) {
         return request.send(304);
     }
 
@@ -150,6 +163,10 @@ static void register_default_urls(void) {
 void setup(void) {
     set_main_task_handle();
 
+#ifdef DEBUG_HEAP_PROFILER
+    heap_profiler_init();
+#endif
+
     boot_stage = BootStage::PRE_INIT;
     Serial.begin(BUILD_MONITOR_SPEED);
 
@@ -164,11 +181,19 @@ void setup(void) {
     std::vector<IModule *> imodules;
     modules_get_imodules(&imodules);
 
+#ifdef DEBUG_HEAP_PROFILER
+    for (size_t i = 0; i < imodules.size() && module_heap_owner(i) != HEAP_PROFILER_OWNER_CORE; ++i) {
+        heap_profiler_set_owner_name(module_heap_owner(i), modules_get_imodule_name(i));
+    }
+#endif
+
     config_pre_init();
 
-    for (IModule *imodule : imodules) {
-        imodule->pre_init();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        heap_profiler_set_owner(module_heap_owner(i));
+        imodules[i]->pre_init();
     }
+    heap_profiler_set_owner(HEAP_PROFILER_OWNER_BOOT);
 
     if (!mount_or_format_spiffs()) {
         logger.printfln("Failed to mount SPIFFS.");
@@ -180,9 +205,11 @@ void setup(void) {
     api.pre_setup();
     logger.pre_setup();
 
-    for (IModule *imodule : imodules) {
-        imodule->pre_setup();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        heap_profiler_set_owner(module_heap_owner(i));
+        imodules[i]->pre_setup();
     }
+    heap_profiler_set_owner(HEAP_PROFILER_OWNER_BOOT);
 
     boot_stage = BootStage::SETUP;
 
@@ -190,9 +217,11 @@ void setup(void) {
     task_scheduler.setup();
     api.setup();
 
-    for (IModule *imodule : imodules) {
-        imodule->setup();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        heap_profiler_set_owner(module_heap_owner(i));
+        imodules[i]->setup();
     }
+    heap_profiler_set_owner(HEAP_PROFILER_OWNER_BOOT);
 
     modules = modules_get_init_config();
 
@@ -208,15 +237,19 @@ void setup(void) {
     logger.register_urls();
     task_scheduler.register_urls();
 
-    for (IModule *imodule : imodules) {
-        imodule->register_urls();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        heap_profiler_set_owner(module_heap_owner(i));
+        imodules[i]->register_urls();
     }
+    heap_profiler_set_owner(HEAP_PROFILER_OWNER_BOOT);
 
     boot_stage = BootStage::REGISTER_EVENTS;
 
-    for (IModule *imodule : imodules) {
-        imodule->register_events();
+    for (size_t i = 0; i < imodules.size(); ++i) {
+        heap_profiler_set_owner(module_heap_owner(i));
+        imodules[i]->register_events();
     }
+    heap_profiler_set_owner(HEAP_PROFILER_OWNER_BOOT);
 
     // Ignore non-overridden empty loop functions.
     for (IModule *imodule : imodules) {
@@ -228,16 +261,23 @@ void setup(void) {
     // Add all overridden loop functions to a circular list for round-robin execution.
     if (loop_chain_size > 0) {
         loop_chain = static_cast<IModule **>(malloc(sizeof(IModule*) * loop_chain_size));
+#ifdef DEBUG_HEAP_PROFILER
+        loop_chain_owners = static_cast<uint8_t *>(malloc(loop_chain_size));
+#endif
         size_t loop_chain_used = 0;
-        for (IModule *imodule : imodules) {
-            if (is_module_loop_overridden(imodule)) {
-                loop_chain[loop_chain_used] = imodule;
+        for (size_t i = 0; i < imodules.size(); ++i) {
+            if (is_module_loop_overridden(imodules[i])) {
+                loop_chain[loop_chain_used] = imodules[i];
+#ifdef DEBUG_HEAP_PROFILER
+                loop_chain_owners[loop_chain_used] = module_heap_owner(i);
+#endif
                 ++loop_chain_used;
             }
         }
     }
 
     boot_stage = BootStage::LOOP;
+    heap_profiler_set_owner(HEAP_PROFILER_OWNER_CORE);
 }
 
 void loop(void) {
@@ -246,7 +286,13 @@ void loop(void) {
 
     // Round-robin for modules' loop functions, to prioritize HAL ticks and scheduler.
     if (loop_chain != nullptr) {
+#ifdef DEBUG_HEAP_PROFILER
+        heap_profiler_set_owner(loop_chain_owners[loop_chain_head]);
+        loop_chain[loop_chain_head]->loop();
+        heap_profiler_set_owner(HEAP_PROFILER_OWNER_CORE);
+#else
         loop_chain[loop_chain_head]->loop();
+#endif
         loop_chain_head = loop_chain_head + 1;
         if (loop_chain_head >= loop_chain_size) {
             loop_chain_head = 0;
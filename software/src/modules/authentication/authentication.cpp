@@ -57,17 +57,16 @@ void Authentication::setup()
         String digest_hash = config.get("digest_hash")->asString();
 
         server.onAuthenticate_HTTPThread([user, digest_hash](WebServerRequest req) -> bool {
-            String auth = req.header("Authorization");
-            if (auth.isEmpty()) {
+            const char *auth = req.headerCStr("Authorization");
+            if (auth == nullptr) {
                 return false;
             }
 
-            if (!auth.startsWith("Digest ")) {
+            if (strncmp(auth, "Digest ", 7) != 0) {
                 return false;
             }
 
-            auth = auth.substring(7);
-            AuthFields fields = parseDigestAuth(auth.c_str());
+            AuthFields fields = parseDigestAuth(auth + 7);
 
             if (fields.username != user)
                 return false;
@@ -27,9 +27,14 @@ from dataclasses import dataclass, field
         uint8_t padding;
     } __attribute__((packed));
 
+    struct cm_command_v2 {
+        uint32_t allocated_current;
+    } __attribute__((packed));
+
     struct cm_command_packet {
         cm_packet_header header;
         cm_command_v1 v1;
+        cm_command_v2 v2;
     } __attribute__((packed));
 
     struct cm_state_v1 {
@@ -66,32 +71,128 @@ from dataclasses import dataclass, field
         uint32_t time_since_state_change;
     } __attribute__((packed));
 
+    struct cm_state_v3 {
+        uint32_t allowed_charging_current;
+        uint32_t supported_current;
+    } __attribute__((packed));
+
     struct cm_state_packet {
         cm_packet_header header;
         cm_state_v1 v1;
         cm_state_v2 v2;
+        cm_state_v3 v3;
     } __attribute__((packed));
 """
 
+CHARGE_MANAGER_PORT = 34127
+CHARGE_MANAGEMENT_PORT = 34128
+PACKET_MAGIC = 34127
+
 header_format = "<HHHBx"
-command_format = header_format + "HBx"
-COMMAND_VERSION = 1
-state_format = header_format + "IIIIHHBBBBffffffffffff" + "I"
-STATE_VERSION = 2
+command_v1_format = header_format + "HBx"
+command_format = command_v1_format + "I"
+COMMAND_VERSION = 2
+COMMAND_VERSION_MIN = 1
+state_v1_format = header_format + "IIIIHHBBBBffffffffffff"
+state_v2_format = state_v1_format + "I"
+state_format = state_v2_format + "II"
+STATE_VERSION = 3
+STATE_VERSION_MIN = 1
 
 command_len = struct.calcsize(command_format)
+# Indexed by command version
+command_len_versions = [0, struct.calcsize(command_v1_format), command_len]
 state_len = struct.calcsize(state_format)
+# Indexed by state version
+state_len_versions = [0, struct.calcsize(state_v1_format), struct.calcsize(state_v2_format), state_len]
+
+# Same as in charge_manager.cpp
+MINIMUM_CURRENT = 6000
+CHARGER_TIMEOUT = 30
+UPLINK_TIMEOUT = 30
+
+def parse_host(host, default_port):
+    # IPv6 addresses are not supported, so any colon starts a port.
+    addr, _, port = host.partition(':')
+    return (addr, int(port) if port else default_port)
+
+def check_packet_length(data, version, length, len_versions):
+    # Known versions must match their length exactly. Versions from the future must at least contain our newest version.
+    if version < len(len_versions):
+        return length == len_versions[version] and len(data) == length
+
+    return length >= len_versions[-1] and len(data) >= len_versions[-1]
+
+def parse_command(data):
+    """Returns (seq_num, version, allocated_current, cp_disconnect) or None if the command is invalid."""
+    if len(data) < command_len_versions[COMMAND_VERSION_MIN]:
+        return None
+
+    magic, length, seq_num, version = struct.unpack_from(header_format, data)
+
+    if magic != PACKET_MAGIC or version < COMMAND_VERSION_MIN or not check_packet_length(data, version, length, command_len_versions):
+        return None
+
+    if version >= 2:
+        _, _, _, _, _allocated_current_v1, command_flags, allocated_current = struct.unpack_from(command_format, data)
+    else:
+        _, _, _, _, allocated_current, command_flags = struct.unpack_from(command_v1_format, data)
+
+    return seq_num, version, allocated_current, ((command_flags & 0x40) >> 6) == 1
+
+def pack_command(seq_num, allocated_current, cp_disconnect):
+    return struct.pack(command_format,
+                       PACKET_MAGIC,
+                       command_len,
+                       seq_num,
+                       COMMAND_VERSION,
+                       min(allocated_current, 65535),
+                       0x40 if cp_disconnect else 0,
+                       allocated_current)
+
+@dataclass
+class ChildState:
+    """State of a charger or sub-manager as seen by its manager."""
+    charger_state: int
+    charging_time: int
+    allowed_charging_current: int
+    supported_current: int
+    managed: bool
+    last_update: float = field(default_factory=lambda: time.time())
+
+def parse_state(data):
+    """Returns a ChildState or None if the state packet is invalid."""
+    if len(data) < state_len_versions[STATE_VERSION_MIN]:
+        return None
+
+    magic, length, seq_num, version = struct.unpack_from(header_format, data)
+
+    if magic != PACKET_MAGIC or version < STATE_VERSION_MIN or not check_packet_length(data, version, length, state_len_versions):
+        return None
+
+    v1 = struct.unpack_from(state_v1_format, data)
+    charging_time, allowed_charging_current, supported_current = v1[7:10]
+    charger_state, state_flags = v1[11], v1[13]
+
+    # Only v3 carries currents that don't fit into 16 bits, for example those of a sub-manager.
+    if version >= 3:
+        allowed_charging_current, supported_current = struct.unpack_from(state_format, data)[-2:]
+
+    return ChildState(charger_state, charging_time, allowed_charging_current, supported_current, (state_flags & 0x80) != 0)
 
 @dataclass
 class Charger:
     uid: int
     listen_addr: str
     auto_mode: bool
+    port: int = CHARGE_MANAGEMENT_PORT
+    # In auto mode: The vehicle starts charging as soon as it is allowed to.
+    vehicle_auto_charge: bool = False
 
     # API
     uptime_blocked: bool = False
     seq_num_blocked: bool = False
-    expected_command_version = COMMAND_VERSION
+    min_command_version = COMMAND_VERSION_MIN
     state_version = STATE_VERSION
 
     managed: bool = True
@@ -134,12 +235,12 @@ class Charger:
     _sock: socket.socket = field(default_factory=lambda: socket.socket(socket.AF_INET, socket.SOCK_DGRAM))
 
     def __post_init__(self):
-        self._sock.bind((self.listen_addr, 34128))
+        self._sock.bind((self.listen_addr, self.port))
         self._sock.setblocking(False)
 
     def reset(self):
         self._sock.close()
-        self.__init__(self.uid, self.listen_addr, self.auto_mode)
+        self.__init__(self.uid, self.listen_addr, self.auto_mode, self.port, self.vehicle_auto_charge)
 
     def tick(self):
         if self.auto_mode:
@@ -154,6 +255,8 @@ class Charger:
                 self.charging_time_start = 0
             elif self.req_allocated_current > 0 and self.charger_state == 1:
                 self.charger_state = 2
+            elif self.req_allocated_current > 0 and self.charger_state == 2 and self.vehicle_auto_charge:
+                self.charger_state = 3
 
             # Apply charger state
             self.iec61851_state = {0: 0, 1: 1, 2: 1, 3: 2, 4: 4}[self.charger_state]
@@ -188,7 +291,7 @@ class Charger:
         flags |= 0x40 if self.cp_disconnect else 0
 
         b = struct.pack(state_format,
-                        34127, # magic
+                        PACKET_MAGIC,
                         state_len,
                         self.next_seq_num,
                         self.state_version,
@@ -196,8 +299,8 @@ class Charger:
                         self.uid,
                         self.uptime,
                         self.charging_time,
-                        self.allowed_charging_current,
-                        self.supported_current,
+                        min(self.allowed_charging_current, 65535),
+                        min(self.supported_current, 65535),
                         self.iec61851_state,
                         self.charger_state,
                         self.error_state,
@@ -208,7 +311,9 @@ class Charger:
                         sum(u * i for u, i in zip(self.line_voltages, self.line_currents)), # power total
                         self.energy_rel,  # energy_rel
                         self.energy_abs,  # energy_abs
-                        int(1000 * (time.time() - self.time_since_state_change))
+                        int(1000 * (time.time() - self.time_since_state_change)),
+                        self.allowed_charging_current,
+                        self.supported_current
         )
 
         if not self.seq_num_blocked:
@@ -219,23 +324,301 @@ class Charger:
 
     def recv(self):
         try:
-            data, self.manager_addr = self._sock.recvfrom(command_len)
+            data, self.manager_addr = self._sock.recvfrom(1024)
         except BlockingIOError:
             return
-        if len(data) != command_len:
+
+        command = parse_command(data)
+
+        if command is None:
             return
 
-        magic, length, seq_num, version, allocated_current, command_flags = struct.unpack(command_format, data)
+        seq_num, version, allocated_current, cp_disconnect = command
 
-        if version != self.expected_command_version:
+        if version < self.min_command_version:
             return
 
         self.req_seq_num = seq_num
         self.req_version = version
         self.req_allocated_current = allocated_current
-        self.req_should_disconnect_cp = ((command_flags & 0x40) >> 6) == 1
+        self.req_should_disconnect_cp = cp_disconnect
+
+class Manager:
+    """Distributes the available current between chargers or sub-managers.
+
+    This is a simplified version of the distribution in charge_manager.cpp:
+    Every child that wants to charge gets at least MINIMUM_CURRENT, if that
+    is not possible for all of them, the ones that are already charging are
+    preferred. The rest of the current is shared fairly, but never more than
+    the supported current of a child.
+    """
+    def __init__(self, listen_addr, children, available_current):
+        self.name = "manager {}".format(listen_addr)
+        self.available_current = available_current
+        # Hosts can have a port suffix, as in the charge manager's charger list.
+        self.children = [parse_host(c, CHARGE_MANAGEMENT_PORT) for c in children]
+        self.child_states = [None] * len(self.children)
+        self.allocated_currents = [0] * len(self.children)
+        self.next_seq_num = 0
+
+        self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._sock.bind((listen_addr, CHARGE_MANAGER_PORT))
+        self._sock.setblocking(False)
+
+    def get_available_current(self):
+        return self.available_current
+
+    def recv(self):
+        while True:
+            try:
+                data, addr = self._sock.recvfrom(1024)
+            except BlockingIOError:
+                return
+
+            if addr not in self.children:
+                print("{}: Received packet from unknown {}:{}".format(self.name, *addr))
+                continue
+
+            state = parse_state(data)
+
+            if state is not None:
+                self.child_states[self.children.index(addr)] = state
+
+    def wants_current(self, state):
+        if state is None or not state.managed or time.time() - state.last_update > CHARGER_TIMEOUT:
+            return False
+
+        return state.supported_current > 0 and state.charger_state in (1, 2, 3)
+
+    def distribute(self):
+        available_current = self.get_available_current()
+        wanting = [i for i, state in enumerate(self.child_states) if self.wants_current(state)]
+        # Stable sort: Charging children first, otherwise in configuration order.
+        wanting.sort(key=lambda i: self.child_states[i].charger_state != 3)
+        wanting = wanting[:available_current // MINIMUM_CURRENT]
+
+        self.allocated_currents = [0] * len(self.children)
+
+        # Children with a lower supported current leave the rest to the others.
+        wanting.sort(key=lambda i: self.child_states[i].supported_current)
+
+        for k, i in enumerate(wanting):
+            share = available_current // (len(wanting) - k)
+            self.allocated_currents[i] = min(share, self.child_states[i].supported_current)
+            available_current -= self.allocated_currents[i]
+
+    def send(self):
+        for addr, allocated_current in zip(self.children, self.allocated_currents):
+            self._sock.sendto(pack_command(self.next_seq_num, allocated_current, False), addr)
+            self.next_seq_num = (self.next_seq_num + 1) % 65536
+
+    def tick(self):
+        self.distribute()
+        self.send()
+
+    def print_status(self):
+        children = []
+
+        for (addr, port), state, allocated_current in zip(self.children, self.child_states, self.allocated_currents):
+            supported_current = "-" if state is None else state.supported_current
+            children.append("{}:{} supported {} allocated {}".format(addr, port, supported_current, allocated_current))
+
+        print("{}: available {} mA; {}".format(self.name, self.get_available_current(), "; ".join(children)))
+
+class SubManager(Manager):
+    """Manager that is itself managed by a parent manager.
+
+    Receives its budget as command on the uplink port and reports all of its
+    children as one charger in a v3 state, as ChargeManager::start_uplink and
+    send_uplink_state do.
+    """
+    def __init__(self, listen_addr, children, max_available_current, uplink_port):
+        super().__init__(listen_addr, children, 0)
+        self.name = "sub-manager {}".format(listen_addr)
+        self.max_available_current = max_available_current
+        self.uid = struct.unpack('>I', ipaddress.ip_address(listen_addr).packed)[0]
+        self._start = time.time()
+
+        self.budget_received = False
+        self.last_budget = 0
+        self.parent_addr = None
+        self.next_uplink_seq_num = 0
+
+        self._uplink_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._uplink_sock.bind((listen_addr, uplink_port))
+        self._uplink_sock.setblocking(False)
+
+    def get_available_current(self):
+        # Nothing is allocated before the first budget was received.
+        if not self.budget_received:
+            return 0
+
+        return min(self.available_current, self.max_available_current)
+
+    def recv(self):
+        super().recv()
+
+        while True:
+            try:
+                data, addr = self._uplink_sock.recvfrom(1024)
+            except BlockingIOError:
+                break
+
+            command = parse_command(data)
+
+            if command is None:
+                continue
+
+            if not self.budget_received:
+                print("{}: Received budget of {} mA from parent manager.".format(self.name, command[2]))
+
+            self.parent_addr = addr
+            self.available_current = command[2]
+            self.budget_received = True
+            self.last_budget = time.time()
+
+        if self.budget_received and time.time() - self.last_budget > UPLINK_TIMEOUT:
+            print("{}: Received no budget from parent manager for {} s. Setting available current to 0 mA.".format(self.name, UPLINK_TIMEOUT))
+            self.budget_received = False
+
+    def send_uplink_state(self):
+        if self.parent_addr is None:
+            return
+
+        any_connected = False
+        any_charging = False
+        any_high_prio = False
+        any_low_prio = False
+        requested_current = 0
+        allowed_current = 0
+
+        for state in self.child_states:
+            if state is None:
+                continue
+
+            any_connected |= state.charger_state != 0
+            any_charging |= state.charger_state == 3
+            allowed_current += state.allowed_charging_current
+
+            if not self.wants_current(state):
+                continue
+
+            if state.charger_state == 3 or state.charging_time == 0:
+                any_high_prio = True
+            else:
+                any_low_prio = True
+
+            requested_current += state.supported_current
+
+        charging_time = 0
+
+        if any_charging:
+            iec61851_state, charger_state = 2, 3
+        elif any_high_prio or any_low_prio:
+            iec61851_state, charger_state = 1, 2 if self.get_available_current() > 0 else 1
+            # The parent manager handles chargers that already charged as low priority.
+            charging_time = 0 if any_high_prio else 1
+        elif any_connected:
+            iec61851_state, charger_state = 1, 1
+        else:
+            iec61851_state, charger_state = 0, 0
+
+        b = struct.pack(state_format,
+                        PACKET_MAGIC,
+                        state_len,
+                        self.next_uplink_seq_num,
+                        STATE_VERSION,
+                        0, # features
+                        self.uid,
+                        int((time.time() - self._start) * 1000) % (1 << 32),
+                        charging_time,
+                        min(allowed_current, 65535),
+                        min(requested_current, 65535),
+                        iec61851_state,
+                        charger_state,
+                        0, # error_state
+                        0x80, # managed
+                        *[float('nan')] * 12, # meter values
+                        0, # time_since_state_change: The aggregate has no line currents the parent could clamp to.
+                        allowed_current,
+                        requested_current)
+
+        self.next_uplink_seq_num = (self.next_uplink_seq_num + 1) % 65536
+        self._uplink_sock.sendto(b, self.parent_addr)
+
+    def tick(self):
+        super().tick()
+        self.send_uplink_state()
+
+def run_headless(args):
+    import argparse
+
+    parser = argparse.ArgumentParser(prog="box_emu.py", description="Emulates chargers, managers and sub-managers without a UI. "
+                                     "Run each one in its own process and give each a separate loopback address, "
+                                     "for example 127.0.0.1 for the parent manager, 127.0.0.10 for a sub-manager and 127.0.0.11 for its charger.")
+    modes = parser.add_subparsers(dest="mode", required=True)
+
+    charger_parser = modes.add_parser("charger", help="Chargers with a connected vehicle")
+    charger_parser.add_argument("listen_addr", nargs="+", help="Address with optional port, one per charger")
+    charger_parser.add_argument("--supported-current", type=int, default=16000, help="in mA")
+
+    manager_parser = modes.add_parser("manager", help="Manager with a fixed available current")
+    manager_parser.add_argument("listen_addr")
+    manager_parser.add_argument("children", nargs="+", help="Chargers or sub-managers, host with optional port")
+    manager_parser.add_argument("--available-current", type=int, required=True, help="in mA")
+
+    sub_manager_parser = modes.add_parser("sub-manager", help="Manager that receives its budget from a parent manager")
+    sub_manager_parser.add_argument("listen_addr")
+    sub_manager_parser.add_argument("children", nargs="+", help="Chargers or sub-managers, host with optional port")
+    sub_manager_parser.add_argument("--uplink-port", type=int, default=CHARGE_MANAGEMENT_PORT + 1)
+    sub_manager_parser.add_argument("--max-available-current", type=int, default=(1 << 32) - 1, help="in mA; clamps the budget")
+
+    args = parser.parse_args(args)
+
+    if args.mode == "charger":
+        chargers = []
+
+        for host in args.listen_addr:
+            addr, port = parse_host(host, CHARGE_MANAGEMENT_PORT)
+            charger = Charger(uid=struct.unpack('>I', ipaddress.ip_address(addr).packed)[0], listen_addr=addr, auto_mode=True, port=port, vehicle_auto_charge=True)
+            charger.supported_current = args.supported_current
+            charger.charger_state = 1 # Vehicle connected
+            chargers.append(charger)
+
+        nodes = []
+    elif args.mode == "manager":
+        chargers = []
+        nodes = [Manager(args.listen_addr, args.children, args.available_current)]
+    else:
+        chargers = []
+        nodes = [SubManager(args.listen_addr, args.children, args.max_available_current, args.uplink_port)]
+
+    next_tick = time.time()
+
+    while True:
+        for charger in chargers:
+            charger.recv()
+
+        for node in nodes:
+            node.recv()
+
+        if time.time() >= next_tick:
+            next_tick += 1
+
+            for charger in chargers:
+                charger.tick()
+                charger.send()
+                print("charger {}:{}: allocated {} mA, charger state {}".format(charger.listen_addr, charger.port, charger.req_allocated_current, charger.charger_state))
+
+            for node in nodes:
+                node.tick()
+                node.print_status()
+
+        time.sleep(0.05)
 
-if __name__ == "__main__":
+if __name__ == "__main__" and len(sys.argv) > 1 and sys.argv[1] in ("charger", "manager", "sub-manager", "-h", "--help"):
+    run_headless(sys.argv[1:])
+elif __name__ == "__main__":
     from PyQt5.QtWidgets import *
     from PyQt5.QtCore import QTimer, Qt
 
@@ -52,12 +52,15 @@ static uint32_t max_avail_current = 0;
 
 #define WATCHDOG_TIMEOUT_MS 30000
 
+#define UPLINK_TIMEOUT_MS 30000
+
 // If this is an energy manager, we have exactly one charger and the margin is still the default,
 // double it to react faster if more current is available.
 #define REQUESTED_CURRENT_MARGIN_DEFAULT 3000
 
 extern bool firmware_update_allowed;
 extern ChargeManager charge_manager;
+extern uint32_t local_uid_num;
 
 #if MODULE_ENERGY_MANAGER_AVAILABLE()
 static void apply_energy_manager_config(Config &conf)
@@ -103,6 +106,11 @@ void ChargeManager::pre_setup()
         // every vehicle can always request more current.
         // See https://github.com/Tinkerforge/warp-charger/blob/master/tools/current_ramp/allowed_vs_effective_3.gp
         {"requested_current_margin", Config::Uint16(REQUESTED_CURRENT_MARGIN_DEFAULT)},
+        // A sub-manager is managed by a parent manager: It reports the
+        // aggregated demand of its chargers and distributes the received
+        // current between them.
+        {"enable_uplink", Config::Bool(false)},
+        {"uplink_port", Config::Uint16(CHARGE_MANAGEMENT_PORT + 1)},
         {"chargers", Config::Array({},
             new Config{Config::Object({
                 {"host", Config::Str("", 0, 64)},
@@ -142,6 +150,16 @@ void ChargeManager::pre_setup()
             conf.get("minimum_current")->updateUint(min_3p);
         }
 
+        uint32_t uplink_port = conf.get("uplink_port")->asUint();
+
+        if (uplink_port == CHARGE_MANAGER_PORT)
+            return "uplink_port can not be " + String(CHARGE_MANAGER_PORT) + ": This port is used to receive states from chargers";
+
+#if MODULE_EVSE_COMMON_AVAILABLE()
+        if (uplink_port == CHARGE_MANAGEMENT_PORT)
+            return "uplink_port can not be " + String(CHARGE_MANAGEMENT_PORT) + ": This port is used by the charger itself";
+#endif
+
         auto chargers = conf.get("chargers");
 
         for (size_t i = 0; i < chargers->count(); i++)
@@ -159,8 +177,8 @@ void ChargeManager::pre_setup()
             new Config{Config::Object({
                 {"state", Config::Uint8(0)}, // 0 - no vehicle, 1 - user blocked, 2 - manager blocked, 3 - car blocked, 4 - charging, 5 - error, 6 - charged
                 {"error", Config::Uint8(0)}, // 0 - okay, 1 - unreachable, 2 - FW mismatch, 3 - not managed
-                {"allocated_current", Config::Uint16(0)}, // last current limit send to the charger
-                {"supported_current", Config::Uint16(0)}, // maximum current supported by the charger
+                {"allocated_current", Config::Uint32(0)}, // last current limit send to the charger
+                {"supported_current", Config::Uint32(0)}, // maximum current supported by the charger
                 {"last_update", Config::Uint32(0)},
                 {"name", Config::Str("", 0, 32)},
                 {"uid", Config::Uint32(0)}
@@ -220,7 +238,7 @@ void ChargeManager::pre_setup()
 #endif
 }
 
-static uint8_t get_charge_state(uint8_t charger_state, uint16_t supported_current, uint32_t charging_time, uint16_t target_allocated_current)
+static uint8_t get_charge_state(uint8_t charger_state, uint32_t supported_current, uint32_t charging_time, uint32_t target_allocated_current)
 {
     if (charger_state == 0) // not connected
         return 0;
@@ -243,11 +261,11 @@ static uint8_t get_charge_state(uint8_t charger_state, uint16_t supported_curren
     return 5;
 }
 
-void ChargeManager::start_manager_task()
+bool ChargeManager::start_manager_task()
 {
     auto charger_count = config.get("chargers")->count();
 
-    cm_networking.register_manager(this->hosts.get(), config.get("chargers")->count(), [this](uint8_t client_id, cm_state_v1 *v1, cm_state_v2 *v2) mutable {
+    bool registered = cm_networking.register_manager(this->hosts.get(), config.get("chargers")->count(), [this](uint8_t client_id, cm_state_v1 *v1, cm_state_v2 *v2, cm_state_v3 *v3) mutable {
             // TODO: bounds check
             ChargerState &target = this->charger_state[client_id];
 
@@ -270,6 +288,10 @@ void ChargeManager::start_manager_task()
             target.uid = v1->esp32_uid;
             target.uptime = v1->evse_uptime;
 
+            // Sub-managers report currents that don't fit into the v1 fields.
+            uint32_t supported_current = v3 != nullptr ? v3->supported_current : v1->supported_current;
+            uint32_t allowed_current = v3 != nullptr ? v3->allowed_charging_current : v1->allowed_charging_current;
+
 #if MODULE_ENERGY_MANAGER_AVAILABLE() && !MODULE_EVSE_COMMON_AVAILABLE()
             // Immediately block firmware updates if this charger reports a connected vehicle.
             if (v1->charger_state != 0)
@@ -281,23 +303,23 @@ void ChargeManager::start_manager_task()
             //     AND we are still in charger state 1 (i.e. blocked by a slot, so the charge management slot)
             //         or 2 (i.e. already have current allocated)
             // OR the charger is already charging
-            bool wants_to_charge = (v1->charging_time == 0 && v1->supported_current != 0 && (v1->charger_state == 1 || v1->charger_state == 2)) || v1->charger_state == 3;
+            bool wants_to_charge = (v1->charging_time == 0 && supported_current != 0 && (v1->charger_state == 1 || v1->charger_state == 2)) || v1->charger_state == 3;
             target.wants_to_charge = wants_to_charge;
 
             // A charger wants to charge and has low priority if it has already charged this vehicle
             // AND only the charge manager slot (charger_state == 1, supported_current != 0) or no slot (charger_state == 2) blocks.
-            bool low_prio = v1->charging_time != 0 && v1->supported_current != 0 && (v1->charger_state == 1 || v1->charger_state == 2);
+            bool low_prio = v1->charging_time != 0 && supported_current != 0 && (v1->charger_state == 1 || v1->charger_state == 2);
             target.wants_to_charge_low_priority = low_prio;
 
             target.is_charging = v1->charger_state == 3;
-            target.allowed_current = v1->allowed_charging_current;
-            target.supported_current = v1->supported_current;
+            target.allowed_current = allowed_current;
+            target.supported_current = supported_current;
             target.cp_disconnect_supported = CM_FEATURE_FLAGS_CP_DISCONNECT_IS_SET(v1->feature_flags);
             target.cp_disconnect_state = CM_STATE_FLAGS_CP_DISCONNECTED_IS_SET(v1->state_flags);
             target.last_update = millis();
             target.charger_state = v1->charger_state;
 
-            uint16_t requested_current = v1->supported_current;
+            uint32_t requested_current = supported_current;
 
             if (v2 != nullptr && v1->charger_state == 3 && v2->time_since_state_change >= this->requested_current_threshold * 1000) {
                 int32_t max_phase_current = -1;
@@ -318,7 +340,7 @@ void ChargeManager::start_manager_task()
                 max_phase_current += this->requested_current_margin;
 
                 max_phase_current = max(6000, min(32000, max_phase_current));
-                requested_current = min(requested_current, (uint16_t)max_phase_current);
+                requested_current = min(requested_current, (uint32_t)max_phase_current);
             }
             target.requested_current = requested_current;
 
@@ -343,7 +365,7 @@ void ChargeManager::start_manager_task()
             current_error = target.error;
             if (current_error == 0 || current_error >= CHARGE_MANAGER_CLIENT_ERROR_START)
                 target.state = get_charge_state(v1->charger_state,
-                                                                  v1->supported_current,
+                                                                  supported_current,
                                                                   v1->charging_time,
                                                                   target.allocated_current);
 
@@ -361,6 +383,9 @@ void ChargeManager::start_manager_task()
         target.error = error;
     });
 
+    if (!registered)
+        return false;
+
     uint32_t cm_send_delay = 1000 / charger_count;
 
     task_scheduler.scheduleWithFixedDelay([this, charger_count]() mutable {
@@ -374,6 +399,8 @@ void ChargeManager::start_manager_task()
             ++i;
 
     }, 0, cm_send_delay);
+
+    return true;
 }
 
 int idx_array[MAX_CONTROLLED_CHARGERS] = {0};
@@ -431,7 +458,19 @@ void ChargeManager::setup()
     this->charger_count = config.get("chargers")->count();
     this->charger_state = (ChargerState*) heap_caps_calloc_prefer(this->charger_count, sizeof(ChargerState), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
 
-    start_manager_task();
+    if (this->charger_state == nullptr || !start_manager_task()) {
+        logger.printfln("Failed to start charge management for %zu chargers. Disabling charge manager.", this->charger_count);
+        free(this->charger_state);
+        this->charger_state = nullptr;
+        // The accessors used by other modules iterate over charger_state.
+        this->charger_count = 0;
+        state.get("state")->updateUint(0);
+        initialized = true;
+        return;
+    }
+
+    if (config.get("enable_uplink")->asBool())
+        start_uplink();
 
     task_scheduler.scheduleWithFixedDelay([this](){this->distribute_current();}, 5000, 5000);
 
@@ -445,6 +484,119 @@ void ChargeManager::setup()
     initialized = true;
 }
 
+void ChargeManager::start_uplink()
+{
+    // The parent manager controls the available current. Don't allocate
+    // anything before the first budget was received.
+    available_current.get("current")->updateUint(0);
+
+    cm_networking.register_uplink(config.get("uplink_port")->asUint(), [this](uint32_t budget, bool cp_disconnect_requested) {
+#if MODULE_POWER_MANAGER_AVAILABLE()
+        if (power_manager.get_enabled()) {
+            static bool warned = false;
+            if (!warned) {
+                logger.printfln("Ignoring budget from parent manager: The Power Manager controls the available current.");
+                warned = true;
+            }
+            return;
+        }
+#endif
+
+        if (!this->uplink_budget_received) {
+            logger.printfln("Received budget of %u mA from parent manager.", budget);
+            this->uplink_budget_received = true;
+        }
+
+        this->available_current.get("current")->updateUint(std::min(budget, max_avail_current));
+        this->control_pilot_disconnect.get("disconnect")->updateBool(cp_disconnect_requested);
+        this->last_available_current_update = millis();
+        this->last_uplink_update = millis();
+        this->watchdog_triggered = false;
+    });
+
+    task_scheduler.scheduleWithFixedDelay([this](){
+        if (this->uplink_budget_received && deadline_elapsed(this->last_uplink_update + UPLINK_TIMEOUT_MS)) {
+            logger.printfln("Received no budget from parent manager for %d ms. Setting available current to 0 mA.", UPLINK_TIMEOUT_MS);
+            this->uplink_budget_received = false;
+            this->available_current.get("current")->updateUint(0);
+        }
+
+        this->send_uplink_state();
+    }, 1000, 1000);
+}
+
+// Reports all chargers as one charger to the parent manager.
+void ChargeManager::send_uplink_state()
+{
+    bool any_connected = false;
+    bool any_charging = false;
+    bool any_high_prio = false;
+    bool any_low_prio = false;
+    bool all_cp_disconnect_supported = charger_count > 0;
+    bool all_cp_disconnected = charger_count > 0;
+    uint32_t requested_current = 0;
+    uint32_t allowed_current = 0;
+
+    for (size_t i = 0; i < charger_count; ++i) {
+        const auto &charger = this->charger_state[i];
+
+        any_connected |= charger.charger_state != 0;
+        any_charging |= charger.is_charging;
+        all_cp_disconnect_supported &= charger.cp_disconnect_supported;
+        all_cp_disconnected &= charger.cp_disconnect_state;
+        allowed_current += charger.allowed_current;
+
+        if (charger.is_charging || charger.wants_to_charge) {
+            any_high_prio = true;
+            requested_current += charger.requested_current;
+        } else if (charger.wants_to_charge_low_priority) {
+            any_low_prio = true;
+            requested_current += charger.requested_current;
+        }
+    }
+
+    cm_state_v1 v1;
+    memset(&v1, 0, sizeof(v1));
+
+    v1.feature_flags = all_cp_disconnect_supported ? CM_FEATURE_FLAGS_CP_DISCONNECT_MASK : 0;
+    v1.esp32_uid = local_uid_num;
+    v1.evse_uptime = millis();
+
+    if (any_charging) {
+        v1.iec61851_state = 2;
+        v1.charger_state = 3;
+    } else if (any_high_prio || any_low_prio) {
+        v1.iec61851_state = 1;
+        v1.charger_state = available_current.get("current")->asUint() > 0 ? 2 : 1;
+        // The parent manager handles chargers that already charged as low priority.
+        v1.charging_time = any_high_prio ? 0 : 1;
+    } else if (any_connected) {
+        // Connected, but no charger wants current: Blocked without supported current.
+        v1.iec61851_state = 1;
+        v1.charger_state = 1;
+    }
+
+    // Report no demand at all while the chargers are unreachable, as with a blocked charger.
+    if (state.get("state")->asUint() != 1)
+        requested_current = 0;
+
+    v1.allowed_charging_current = static_cast<uint16_t>(std::min<uint32_t>(allowed_current, 65535));
+    v1.supported_current = static_cast<uint16_t>(std::min<uint32_t>(requested_current, 65535));
+    v1.state_flags = CM_STATE_FLAGS_MANAGED_MASK | (all_cp_disconnected ? CM_STATE_FLAGS_CP_DISCONNECTED_MASK : 0);
+
+    // The parent manager limits the requested current of a charger that is
+    // charging for long enough to its line currents. Those are not
+    // reported for the aggregate, so claim that it has just started.
+    cm_state_v2 v2;
+    v2.time_since_state_change = 0;
+
+    cm_state_v3 v3;
+    v3.allowed_charging_current = allowed_current;
+    v3.supported_current = requested_current;
+
+    cm_networking.send_uplink_update(&v1, &v2, &v3);
+}
+
 void ChargeManager::check_watchdog()
 {
     if (this->watchdog_triggered || !deadline_elapsed(last_available_current_update + WATCHDOG_TIMEOUT_MS))
@@ -701,7 +853,7 @@ void ChargeManager::distribute_current()
         // that received the minimum.
         int chargers_allocated_current_to = 0;
 
-        uint16_t current_to_set = minimum_current;
+        uint32_t current_to_set = minimum_current;
         for (int i = 0; i < charger_count; ++i) {
             auto &charger = this->charger_state[idx_array[i]];
 
@@ -709,7 +861,7 @@ void ChargeManager::distribute_current()
                 continue;
             }
 
-            uint16_t supported_current = charger.supported_current;
+            uint32_t supported_current = charger.supported_current;
             if (supported_current < current_to_set) {
                 LOCAL_LOG("stage 0: Can't unblock %s (%s): It only supports %u mA, but %u mA is the configured minimum current. Handling as low priority charger.",
                           this->get_charger_name(idx_array[i]),
@@ -747,9 +899,11 @@ void ChargeManager::distribute_current()
                     continue;
 
                 auto &charger = this->charger_state[idx_array[i]];
-                uint16_t current_per_charger = MIN(32000, available / (chargers_allocated_current_to - chargers_reallocated));
+                // Sub-managers report the sum of their chargers' currents as supported current.
+                uint32_t max_current_per_charger = std::max<uint32_t>(32000, charger.supported_current);
+                uint32_t current_per_charger = MIN(max_current_per_charger, available / (chargers_allocated_current_to - chargers_reallocated));
 
-                uint16_t requested_current = charger.requested_current;
+                uint32_t requested_current = charger.requested_current;
 
                 // If exactly one charger is charging, double the current margin for faster power manager control.
                 if (chargers_allocated_current_to == 1) {
@@ -760,7 +914,7 @@ void ChargeManager::distribute_current()
                 if (requested_current < current_array[idx_array[i]])
                     continue;
 
-                uint16_t current_to_add = MIN(requested_current - current_array[idx_array[i]], current_per_charger);
+                uint32_t current_to_add = MIN(requested_current - current_array[idx_array[i]], current_per_charger);
 
                 ++chargers_reallocated;
 
@@ -781,11 +935,11 @@ void ChargeManager::distribute_current()
         if (available > 0) {
             LOCAL_LOG("stage 0: %u mA still available. Attempting to wake up chargers that already charged their vehicle once.", available);
 
-            uint16_t current_to_set = minimum_current;
+            uint32_t current_to_set = minimum_current;
             for (int i = 0; i < charger_count; ++i) {
                 auto &charger = this->charger_state[idx_array[i]];
 
-                uint16_t supported_current = charger.supported_current;
+                uint32_t supported_current = charger.supported_current;
 
                 bool high_prio = charger.is_charging || charger.wants_to_charge;
                 bool low_prio = charger.wants_to_charge_low_priority;
@@ -834,7 +988,7 @@ void ChargeManager::distribute_current()
         for (int i = 0; i < charger_count; ++i) {
             auto &charger = this->charger_state[i];
 
-            uint16_t current_to_set = current_array[i];
+            uint32_t current_to_set = current_array[i];
 
             bool will_throttle = current_to_set < charger.allocated_current || current_to_set < charger.allowed_current;
 
@@ -872,7 +1026,7 @@ void ChargeManager::distribute_current()
             for (int i = 0; i < charger_count; ++i) {
                 auto &charger = this->charger_state[i];
 
-                uint16_t current_to_set = current_array[i];
+                uint32_t current_to_set = current_array[i];
 
                 // > instead of >= to only catch chargers that were not already modified in stage 1.
                 bool will_not_throttle = current_to_set > charger.allocated_current || current_to_set > charger.allowed_current;
@@ -33,7 +33,7 @@ public:
     void register_urls() override;
 
     void distribute_current();
-    void start_manager_task();
+    bool start_manager_task();
     void check_watchdog();
     bool get_charger_count();
     bool seen_all_chargers();
@@ -72,16 +72,16 @@ public:
         float energy_abs;
 
         // last current limit send to the charger
-        uint16_t allocated_current;
+        uint32_t allocated_current;
 
         // maximum current supported by the charger
-        uint16_t supported_current;
+        uint32_t supported_current;
 
         // last current limit reported by the charger
-        uint16_t allowed_current;
+        uint32_t allowed_current;
 
         // requested current calculated with the line currents reported by the charger
-        uint16_t requested_current;
+        uint32_t requested_current;
 
         // 0 - no vehicle, 1 - user blocked, 2 - manager blocked, 3 - car blocked, 4 - charging, 5 - error, 6 - charged
         uint8_t state;
@@ -108,6 +108,9 @@ public:
     size_t charger_count = 0;
 
 private:
+    void start_uplink();
+    void send_uplink_state();
+
     bool all_chargers_seen = false;
     bool printed_all_chargers_seen = false;
     std::function<void(uint32_t)> allocated_current_callback;
@@ -120,4 +123,7 @@ private:
     uint32_t minimum_current_1p;
     uint16_t requested_current_threshold;
     uint16_t requested_current_margin;
+
+    uint32_t last_uplink_update = 0;
+    bool uplink_budget_received = false;
 };
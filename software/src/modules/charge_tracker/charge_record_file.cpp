@@ -0,0 +1,298 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "charge_record_file.h"
+
+#include <string.h>
+
+#include "esp_rom_crc.h"
+
+#include "gcc_warnings.h"
+
+enum class FileFormat {
+    V1,
+    V2,
+    // Header of the second format, but broken. No entry in the file can be trusted.
+    Invalid,
+};
+
+static uint16_t entry_crc(const void *entry, size_t len)
+{
+    // The CRC is always the last member.
+    return esp_rom_crc16_le(0, static_cast<const uint8_t *>(entry), static_cast<uint32_t>(len - sizeof(uint16_t)));
+}
+
+// Empty files are treated as files of the second format that still lack their header.
+static FileFormat detect_format(File &f, ChargeRecordFileHeader *header)
+{
+    size_t size = f.size();
+
+    header->first_sequence = 0;
+
+    if (size == 0) {
+        return FileFormat::V2;
+    }
+
+    if (size < sizeof(ChargeRecordFileHeader)) {
+        return FileFormat::V1;
+    }
+
+    f.seek(0);
+
+    if (f.read(reinterpret_cast<uint8_t *>(header), sizeof(ChargeRecordFileHeader)) != sizeof(ChargeRecordFileHeader)) {
+        return FileFormat::Invalid;
+    }
+
+    if (header->magic != CHARGE_RECORD_FILE_MAGIC) {
+        return FileFormat::V1;
+    }
+
+    if (header->version != CHARGE_RECORD_FILE_VERSION
+     || header->charge_size != CHARGE_RECORD_V2_SIZE
+     || header->crc != entry_crc(header, sizeof(ChargeRecordFileHeader))) {
+        return FileFormat::Invalid;
+    }
+
+    return FileFormat::V2;
+}
+
+static bool decode_start(const ChargeStartEntry &entry, uint32_t sequence, ChargeStart *cs)
+{
+    if (entry.crc != entry_crc(&entry, sizeof(entry)) || entry.sequence != (sequence & 0xFF)) {
+        return false;
+    }
+
+    cs->timestamp_minutes = entry.timestamp_minutes;
+    cs->meter_start = entry.meter_start;
+    cs->user_id = entry.user_id;
+
+    return true;
+}
+
+static bool decode_end(const ChargeEndEntry &entry, uint32_t sequence, ChargeEnd *ce)
+{
+    if (entry.crc != entry_crc(&entry, sizeof(entry)) || entry.sequence != (sequence & 0xFF)) {
+        return false;
+    }
+
+    ce->charge_duration = entry.charge_duration;
+    ce->meter_end = entry.meter_end;
+
+    return true;
+}
+
+static void scan_v1(File &f, ChargeRecordFileInfo *info, Charge *charges, size_t max_charges)
+{
+    size_t size = f.size();
+    size_t tail = size % CHARGE_RECORD_SIZE;
+
+    info->v2 = false;
+    info->charges = size / CHARGE_RECORD_SIZE;
+    info->valid_size = info->charges * CHARGE_RECORD_SIZE;
+
+    if (tail >= sizeof(ChargeStart)) {
+        f.seek(info->valid_size);
+
+        if (f.read(reinterpret_cast<uint8_t *>(&info->open_start), sizeof(ChargeStart)) == sizeof(ChargeStart)) {
+            info->open_charge = true;
+            info->valid_size += sizeof(ChargeStart);
+        }
+    }
+
+    if (charges == nullptr) {
+        return;
+    }
+
+    size_t to_read = info->charges < max_charges ? info->charges : max_charges;
+
+    f.seek(0);
+    f.read(reinterpret_cast<uint8_t *>(charges), to_read * CHARGE_RECORD_SIZE);
+}
+
+static void scan_v2(File &f, const ChargeRecordFileHeader &header, ChargeRecordFileInfo *info, Charge *charges, size_t max_charges)
+{
+    info->v2 = true;
+    info->first_sequence = header.first_sequence;
+
+    if (f.size() == 0) {
+        return;
+    }
+
+    size_t pos = sizeof(ChargeRecordFileHeader);
+    uint32_t sequence = header.first_sequence;
+
+    info->valid_size = pos;
+
+    f.seek(pos);
+
+    for (;;) {
+        ChargeStartEntry start_entry;
+        ChargeEndEntry end_entry;
+        Charge charge;
+
+        if (f.read(reinterpret_cast<uint8_t *>(&start_entry), sizeof(start_entry)) != sizeof(start_entry)
+         || !decode_start(start_entry, sequence, &charge.cs)) {
+            break;
+        }
+
+        if (f.read(reinterpret_cast<uint8_t *>(&end_entry), sizeof(end_entry)) != sizeof(end_entry)
+         || !decode_end(end_entry, sequence, &charge.ce)) {
+            info->open_charge = true;
+            info->open_start = charge.cs;
+            info->valid_size = pos + sizeof(ChargeStartEntry);
+            break;
+        }
+
+        if (charges != nullptr && info->charges < max_charges) {
+            charges[info->charges] = charge;
+        }
+
+        ++info->charges;
+        ++sequence;
+        pos += CHARGE_RECORD_V2_SIZE;
+        info->valid_size = pos;
+    }
+}
+
+void charge_record_file_scan(File &f, ChargeRecordFileInfo *info, Charge *charges, size_t max_charges)
+{
+    ChargeRecordFileHeader header;
+
+    info->v2 = true;
+    info->first_sequence = 0;
+    info->charges = 0;
+    info->open_charge = false;
+    info->open_start = ChargeStart{};
+    info->valid_size = 0;
+    info->file_size = f.size();
+
+    switch (detect_format(f, &header)) {
+        case FileFormat::V1:
+            scan_v1(f, info, charges, max_charges);
+            break;
+
+        case FileFormat::V2:
+            scan_v2(f, header, info, charges, max_charges);
+            break;
+
+        case FileFormat::Invalid:
+        default:
+            break;
+    }
+}
+
+size_t charge_record_file_count(File &f)
+{
+    ChargeRecordFileInfo info;
+
+    charge_record_file_scan(f, &info, nullptr, 0);
+
+    return info.charges;
+}
+
+bool charge_record_file_read_charge(File &f, size_t index, Charge *charge)
+{
+    ChargeRecordFileHeader header;
+
+    switch (detect_format(f, &header)) {
+        case FileFormat::V1:
+            if ((index + 1) * CHARGE_RECORD_SIZE > f.size()) {
+                return false;
+            }
+
+            f.seek(index * CHARGE_RECORD_SIZE);
+            return f.read(reinterpret_cast<uint8_t *>(charge), CHARGE_RECORD_SIZE) == CHARGE_RECORD_SIZE;
+
+        case FileFormat::V2: {
+                ChargeStartEntry start_entry;
+                ChargeEndEntry end_entry;
+                uint32_t sequence = header.first_sequence + static_cast<uint32_t>(index);
+
+                f.seek(sizeof(ChargeRecordFileHeader) + index * CHARGE_RECORD_V2_SIZE);
+
+                return f.read(reinterpret_cast<uint8_t *>(&start_entry), sizeof(start_entry)) == sizeof(start_entry)
+                    && f.read(reinterpret_cast<uint8_t *>(&end_entry), sizeof(end_entry)) == sizeof(end_entry)
+                    && decode_start(start_entry, sequence, &charge->cs)
+                    && decode_end(end_entry, sequence, &charge->ce);
+            }
+
+        case FileFormat::Invalid:
+        default:
+            break;
+    }
+
+    return false;
+}
+
+bool charge_record_file_read_start(File &f, size_t index, ChargeStart *cs)
+{
+    ChargeRecordFileHeader header;
+
+    switch (detect_format(f, &header)) {
+        case FileFormat::V1:
+            if (index * CHARGE_RECORD_SIZE + sizeof(ChargeStart) > f.size()) {
+                return false;
+            }
+
+            f.seek(index * CHARGE_RECORD_SIZE);
+            return f.read(reinterpret_cast<uint8_t *>(cs), sizeof(ChargeStart)) == sizeof(ChargeStart);
+
+        case FileFormat::V2: {
+                ChargeStartEntry start_entry;
+
+                f.seek(sizeof(ChargeRecordFileHeader) + index * CHARGE_RECORD_V2_SIZE);
+
+                return f.read(reinterpret_cast<uint8_t *>(&start_entry), sizeof(start_entry)) == sizeof(start_entry)
+                    && decode_start(start_entry, header.first_sequence + static_cast<uint32_t>(index), cs);
+            }
+
+        case FileFormat::Invalid:
+        default:
+            break;
+    }
+
+    return false;
+}
+
+void charge_record_encode_header(uint32_t first_sequence, ChargeRecordFileHeader *header)
+{
+    header->magic = CHARGE_RECORD_FILE_MAGIC;
+    header->version = CHARGE_RECORD_FILE_VERSION;
+    header->charge_size = CHARGE_RECORD_V2_SIZE;
+    header->first_sequence = first_sequence;
+    header->reserved = 0;
+    header->crc = entry_crc(header, sizeof(ChargeRecordFileHeader));
+}
+
+void charge_record_encode_start(const ChargeStart &cs, uint32_t sequence, ChargeStartEntry *entry)
+{
+    entry->timestamp_minutes = cs.timestamp_minutes;
+    entry->meter_start = cs.meter_start;
+    entry->user_id = cs.user_id;
+    entry->sequence = static_cast<uint8_t>(sequence);
+    entry->crc = entry_crc(entry, sizeof(ChargeStartEntry));
+}
+
+void charge_record_encode_end(const ChargeEnd &ce, uint32_t sequence, ChargeEndEntry *entry)
+{
+    entry->charge_duration = ce.charge_duration;
+    entry->sequence = static_cast<uint8_t>(sequence);
+    entry->meter_end = ce.meter_end;
+    entry->crc = entry_crc(entry, sizeof(ChargeEndEntry));
+}
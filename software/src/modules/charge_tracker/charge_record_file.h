@@ -0,0 +1,126 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <FS.h>
+
+// Layout of the first file format: A ChargeStart followed by a ChargeEnd for
+// each charge, without a file header. Still used by /charge_tracker/charge_log.
+struct [[gnu::packed]] ChargeStart {
+    uint32_t timestamp_minutes = 0;
+    float meter_start = 0.0f;
+    uint8_t user_id = 0;
+};
+
+static_assert(sizeof(ChargeStart) == 9, "Unexpected size of ChargeStart");
+
+struct [[gnu::packed]] ChargeEnd {
+    uint32_t charge_duration : 24;
+    float meter_end = 0.0f;
+};
+
+static_assert(sizeof(ChargeEnd) == 7, "Unexpected size of ChargeEnd");
+
+struct [[gnu::packed]] Charge {
+    ChargeStart cs;
+    ChargeEnd ce;
+};
+
+#define CHARGE_RECORD_SIZE (sizeof(ChargeStart) + sizeof(ChargeEnd))
+
+static_assert(CHARGE_RECORD_SIZE == 16, "Unexpected size of ChargeStart + ChargeEnd");
+
+#define CHARGE_RECORD_MAX_FILE_SIZE 4096
+
+#define CHARGE_RECORD_FILE_MAGIC 0x32525443 // "CTR2"
+#define CHARGE_RECORD_FILE_VERSION 2
+
+// Second file format: One header, followed by a ChargeStartEntry and a
+// ChargeEndEntry for each charge. Entries are only ever appended. Each entry
+// carries the low byte of the sequence number of its charge and a CRC, so the
+// valid part of a file is found by a forward scan and never has to be rewritten.
+struct [[gnu::packed]] ChargeRecordFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t charge_size;
+    uint32_t first_sequence;
+    uint16_t reserved;
+    uint16_t crc;
+};
+
+static_assert(sizeof(ChargeRecordFileHeader) == 16, "Unexpected size of ChargeRecordFileHeader");
+
+struct [[gnu::packed]] ChargeStartEntry {
+    uint32_t timestamp_minutes;
+    float meter_start;
+    uint8_t user_id;
+    uint8_t sequence;
+    uint16_t crc;
+};
+
+static_assert(sizeof(ChargeStartEntry) == 12, "Unexpected size of ChargeStartEntry");
+
+struct [[gnu::packed]] ChargeEndEntry {
+    uint32_t charge_duration : 24;
+    uint32_t sequence : 8;
+    float meter_end;
+    uint16_t crc;
+};
+
+static_assert(sizeof(ChargeEndEntry) == 10, "Unexpected size of ChargeEndEntry");
+
+#define CHARGE_RECORD_V2_SIZE (sizeof(ChargeStartEntry) + sizeof(ChargeEndEntry))
+
+// 185 charges per file in the second format, 256 in the first one.
+#define CHARGE_RECORD_V2_CHARGES_PER_FILE ((CHARGE_RECORD_MAX_FILE_SIZE - sizeof(ChargeRecordFileHeader)) / CHARGE_RECORD_V2_SIZE)
+#define CHARGE_RECORD_MAX_CHARGES_PER_FILE (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE)
+
+struct ChargeRecordFileInfo {
+    bool v2;
+    uint32_t first_sequence;
+    // Complete charges at the start of the file.
+    size_t charges;
+    // The start of a charge without an end follows the complete charges.
+    bool open_charge;
+    ChargeStart open_start;
+    // Bytes up to the end of the last valid entry. New entries are written
+    // here, overwriting a damaged tail.
+    size_t valid_size;
+    size_t file_size;
+};
+
+// Scans the file from its start and stops at the first invalid entry.
+// If charges is not nullptr, up to max_charges complete charges are
+// converted to the first format and stored there.
+void charge_record_file_scan(File &f, ChargeRecordFileInfo *info, Charge *charges, size_t max_charges);
+
+// Counts the valid complete charges at the start of the file.
+size_t charge_record_file_count(File &f);
+
+// Reads a single charge. Returns false if the charge is incomplete or invalid.
+bool charge_record_file_read_charge(File &f, size_t index, Charge *charge);
+bool charge_record_file_read_start(File &f, size_t index, ChargeStart *cs);
+
+void charge_record_encode_header(uint32_t first_sequence, ChargeRecordFileHeader *header);
+void charge_record_encode_start(const ChargeStart &cs, uint32_t sequence, ChargeStartEntry *entry);
+void charge_record_encode_end(const ChargeEnd &ce, uint32_t sequence, ChargeEndEntry *entry);
@@ -19,45 +19,23 @@
 
 #include "charge_tracker.h"
 
+#include <errno.h>
 #include <memory>
 
 #include "api.h"
 #include "task_scheduler.h"
 #include "tools.h"
+#include "string_builder.h"
 #include "module_dependencies.h"
 
 #include "pdf_charge_log.h"
 
-struct [[gnu::packed]] ChargeStart {
-    uint32_t timestamp_minutes = 0;
-    float meter_start = 0.0f;
-    uint8_t user_id = 0;
-};
-
-static_assert(sizeof(ChargeStart) == 9, "Unexpected size of ChargeStart");
-
-struct [[gnu::packed]] ChargeEnd {
-    uint32_t charge_duration : 24;
-    float meter_end = 0.0f;
-};
-
-struct [[gnu::packed]] Charge {
-    ChargeStart cs;
-    ChargeEnd ce;
-};
-
 static bool repair_logic(Charge *);
 
-static_assert(sizeof(ChargeEnd) == 7, "Unexpected size of ChargeEnd");
-
-#define CHARGE_RECORD_SIZE (sizeof(ChargeStart) + sizeof(ChargeEnd))
-
-static_assert(CHARGE_RECORD_SIZE == 16, "Unexpected size of ChargeStart + ChargeEnd");
-
-// 30 files with 256 records each: 7680 records @ ~ max. 10 records per day = ~ 2 years and one month of records.
+// 42 files with 185 records each: 7770 records @ ~ max. 10 records per day = ~ 2 years of records.
+// Files of the first format hold 256 records each.
 // Also update frontend when changing this!
-#define CHARGE_RECORD_FILE_COUNT 30
-#define CHARGE_RECORD_MAX_FILE_SIZE 4096
+#define CHARGE_RECORD_FILE_COUNT 42
 
 #define CHARGE_RECORD_LAST_CHARGES_SIZE 30
 
@@ -108,45 +86,76 @@ String ChargeTracker::chargeRecordFilename(uint32_t i)
     return String(CHARGE_RECORD_FOLDER) + "/charge-record-" + i + ".bin";
 }
 
-bool ChargeTracker::repair_last(float meter_start)
+// Writes after the last valid entry. A damaged tail is overwritten:
+// Readers stop at the first invalid entry, so bytes that remain behind
+// the new entries are never read.
+bool ChargeTracker::appendToLastFile(const void *buf, size_t len)
 {
-    Charge charges[3];
-    charges[0].ce.meter_end = NAN;
-    charges[2].cs.meter_start = meter_start;
+    File file;
 
-    if (!LittleFS.exists(chargeRecordFilename(last_charge_record)))
-        return true;
+    if (last_file.file_size == 0) {
+        file = LittleFS.open(chargeRecordFilename(this->last_charge_record), "w", true);
+    } else {
+        file = LittleFS.open(chargeRecordFilename(this->last_charge_record), "r+");
+        file.seek(last_file.valid_size);
+    }
+
+    size_t written = file.write(static_cast<const uint8_t *>(buf), len);
 
-    File r_file = LittleFS.open(chargeRecordFilename(last_charge_record), "r+");
-    if (r_file.size() % CHARGE_RECORD_SIZE != 0) {
-        logger.printfln("Can't track start of charge: Last charge end was not tracked or file is damaged! Offset is %u bytes. Expected 0", r_file.size() % CHARGE_RECORD_SIZE);
-        // TODO: for robustness we would have to write the last end here? Yes, but only if % == 9. Also write duration 0, so we know this is a "faked" end. Still write the correct meter state.
+    last_file.file_size = file.size();
+
+    if (written != len) {
+        logger.printfln("Failed to write charge record file %s: %u of %u bytes written", file.name(), written, len);
         return false;
     }
 
-    if (r_file.size() > sizeof(Charge)) {
-        r_file.seek(r_file.size() - sizeof(Charge) * 2);
-        r_file.read(reinterpret_cast<uint8_t *>(&charges), sizeof(Charge) * 2);
-    }
-    else if (r_file.size() == sizeof(Charge)) {
-        if (last_charge_record > 1) {
-            File tmp = LittleFS.open(chargeRecordFilename(last_charge_record - 1));
-            tmp.seek(tmp.size() - sizeof(Charge) * 2);
-            tmp.read(reinterpret_cast<uint8_t *>(&charges), sizeof(Charge));
-        }
-        r_file.seek(r_file.size() - sizeof(Charge));
-        r_file.read(reinterpret_cast<uint8_t *>(&charges[1]), sizeof(Charge));
-    }
+    last_file.valid_size += len;
+    return true;
+}
+
+bool ChargeTracker::appendStart(const ChargeStart &cs)
+{
+    if (last_file.valid_size == 0) {
+        ChargeRecordFileHeader header;
+        charge_record_encode_header(last_file.first_sequence, &header);
 
-    if (repair_logic(&charges[1])) {
-        r_file.seek(r_file.size() - sizeof(Charge));
-        r_file.write(reinterpret_cast<uint8_t *>(&charges[1]), sizeof(Charge));
-        logger.printfln("Repaired previous broken charge.");
-        last_charges.get(last_charges.count() - 1)->get("energy_charged")->updateFloat(charges[1].ce.meter_end - charges[1].cs.meter_start);
+        if (!appendToLastFile(&header, sizeof(header)))
+            return false;
     }
+
+    ChargeStartEntry entry;
+    charge_record_encode_start(cs, last_file.first_sequence + last_file.charges, &entry);
+
+    if (!appendToLastFile(&entry, sizeof(entry)))
+        return false;
+
+    last_file.open_charge = true;
+    last_file.open_start = cs;
     return true;
 }
 
+// Full files, files of the first format and files with a broken header are
+// left as they are and records continue in a new file.
+void ChargeTracker::startNewFile()
+{
+    uint32_t first_sequence = last_file.v2 ? last_file.first_sequence + last_file.charges : 0;
+
+    this->charges_before_last_file += last_file.charges;
+    ++this->last_charge_record;
+
+    logger.printfln("Continuing charge records in the new file %s", chargeRecordFilename(this->last_charge_record).c_str());
+
+    last_file.v2 = true;
+    last_file.first_sequence = first_sequence;
+    last_file.charges = 0;
+    last_file.open_charge = false;
+    last_file.valid_size = 0;
+    last_file.file_size = 0;
+
+    removeOldRecords();
+    updateState();
+}
+
 bool ChargeTracker::startCharge(uint32_t timestamp_minutes, float meter_start, uint8_t user_id, uint32_t evse_uptime, uint8_t auth_type, Config::ConfVariant auth_info) {
 #if MODULE_REQUIRE_METER_AVAILABLE()
     if (!require_meter.allow_charging(meter_start))
@@ -155,35 +164,43 @@ bool ChargeTracker::startCharge(uint32_t timestamp_minutes, float meter_start, u
 
     std::lock_guard<std::mutex> lock{records_mutex};
 
-    if (!repair_last(meter_start)) {
+    if (last_file.open_charge) {
+        logger.printfln("Can't track start of charge: Last charge end was not tracked!");
+        // TODO: for robustness we would have to write the last end here? Also write duration 0, so we know this is a "faked" end. Still write the correct meter state.
         return false;
     }
 
-    ChargeStart cs;
-    File file = LittleFS.open(chargeRecordFilename(this->last_charge_record), "a", true);
-
-    if (file.size() == CHARGE_RECORD_MAX_FILE_SIZE) {
-        ++this->last_charge_record;
-        String new_file_name = chargeRecordFilename(this->last_charge_record);
-        logger.printfln("Last charge record file %s is full. Creating the new file %s", file.name(), new_file_name.c_str());
-        file.close();
-
-        removeOldRecords();
-        updateState();
+    // A damaged tail is overwritten, but a file without a valid header can't be continued.
+    bool header_broken = last_file.valid_size == 0 && last_file.file_size != 0;
 
-        file = LittleFS.open(new_file_name, "w", true);
-    }
+    if (!last_file.v2 || last_file.charges >= CHARGE_RECORD_V2_CHARGES_PER_FILE || header_broken)
+        startNewFile();
 
+    ChargeStart cs;
     cs.timestamp_minutes = timestamp_minutes;
     cs.meter_start = meter_start;
     cs.user_id = user_id;
 
-    uint8_t buf[sizeof(ChargeStart)] = {0};
-    memcpy(buf, &cs, sizeof(cs));
+    if (!appendStart(cs))
+        return false;
 
-    file.write(buf, sizeof(cs));
     logger.printfln("Tracked start of charge.");
 
+    // The record of the previous charge is not rewritten. Readers repair it
+    // the same way with the start of this charge.
+    if (recent_charge_count > 0) {
+        Charge charges[3] = {recent_charges[0], recent_charges[1], Charge{}};
+        charges[2].cs.meter_start = meter_start;
+
+        if (repair_logic(&charges[1])) {
+            logger.printfln("Repaired previous broken charge.");
+            recent_charges[1] = charges[1];
+
+            if (last_charges.count() > 0)
+                last_charges.get(last_charges.count() - 1)->get("energy_charged")->updateFloat(charges[1].ce.meter_end - charges[1].cs.meter_start);
+        }
+    }
+
     current_charge.get("user_id")->updateInt(user_id);
     current_charge.get("meter_start")->updateFloat(meter_start);
     current_charge.get("evse_uptime_start")->updateUint(evse_uptime);
@@ -197,35 +214,66 @@ bool ChargeTracker::startCharge(uint32_t timestamp_minutes, float meter_start, u
 void ChargeTracker::endCharge(uint32_t charge_duration_seconds, float meter_end)
 {
     std::lock_guard<std::mutex> lock{records_mutex};
+
+    if (!last_file.open_charge) {
+        logger.printfln("Can't track end of charge: Last charge start was not tracked or file is damaged!");
+        // TODO: How to handle this case? Add a charge start with the same meter value as the last end?
+        // If we check in ::setup() whether a charge is running, this can never happen.
+        return;
+    }
+
+    ChargeStart cs = last_file.open_start;
     ChargeEnd ce;
+    ce.charge_duration = charge_duration_seconds;
+    ce.meter_end = meter_end;
 
-    {
-        File file = LittleFS.open(chargeRecordFilename(this->last_charge_record), "a");
-        if ((file.size() % CHARGE_RECORD_SIZE) != sizeof(ChargeStart)) {
-            logger.printfln("Can't track end of charge: Last charge start was not tracked or file is damaged! Offset is %u bytes. Expected %u", file.size() % CHARGE_RECORD_SIZE, sizeof(ChargeStart));
-            // TODO: How to handle this case? Add a charge start with the same meter value as the last end?
-            // This would also mean that all the size checks of startCharge have to be duplicated!
-            // If we check in ::setup() whether a charge is running, this can never happen.
+    if (!last_file.v2 && last_file.valid_size != last_file.file_size) {
+        // Entries of the first format have no CRC, so an end written over the
+        // damaged tail could not be told apart from it. Move the start of
+        // this charge to a new file instead.
+        startNewFile();
+
+        if (!appendStart(cs))
             return;
-        }
+    }
 
-        ce.charge_duration = charge_duration_seconds;
-        ce.meter_end = meter_end;
+    if (last_file.v2) {
+        ChargeEndEntry entry;
+        charge_record_encode_end(ce, last_file.first_sequence + last_file.charges, &entry);
 
+        if (!appendToLastFile(&entry, sizeof(entry)))
+            return;
+    } else {
+        // A charge that was started before the update to the second format.
         uint8_t buf[sizeof(ChargeEnd)] = {0};
         memcpy(buf, &ce, sizeof(ce));
 
-        file.write(buf, sizeof(ce));
+        if (!appendToLastFile(buf, sizeof(buf)))
+            return;
     }
+
+    ++last_file.charges;
+    last_file.open_charge = false;
+
     logger.printfln("Tracked end of charge.");
 
-    // We've just written the charge record in the file. It is always safe to read it back again.
+    Charge charge;
+    charge.cs = cs;
+    charge.ce = ce;
+
     if (last_charges.count() == CHARGE_RECORD_LAST_CHARGES_SIZE)
         last_charges.remove(0);
 
-    File f = LittleFS.open(chargeRecordFilename(this->last_charge_record));
-    f.seek(-CHARGE_RECORD_SIZE, SeekMode::SeekEnd);
-    this->readNRecords(&f, 1);
+    this->addLastCharges(&charge, 1);
+
+    if (recent_charge_count == 0) {
+        recent_charges[1] = Charge{};
+        recent_charges[1].ce.meter_end = NAN;
+    }
+
+    recent_charges[0] = recent_charges[1];
+    recent_charges[1] = charge;
+    recent_charge_count = min(recent_charge_count + 1, (size_t)2);
 
     current_charge.get("user_id")->updateInt(-1);
     current_charge.get("meter_start")->updateFloat(0);
@@ -237,65 +285,70 @@ void ChargeTracker::endCharge(uint32_t charge_duration_seconds, float meter_end)
     updateState();
 }
 
+// Sets or clears the bit of every user that started a charge tracked in the file.
+void ChargeTracker::markUsersInFile(uint32_t file, Charge *charges, uint32_t users_bitmap[8], bool set)
+{
+    ChargeRecordFileInfo info;
+    File f = LittleFS.open(chargeRecordFilename(file));
+    charge_record_file_scan(f, &info, charges, CHARGE_RECORD_MAX_CHARGES_PER_FILE);
+
+    size_t count = min(info.charges, (size_t)CHARGE_RECORD_MAX_CHARGES_PER_FILE);
+
+    for (size_t i = 0; i <= count; ++i) {
+        uint8_t user_id;
+
+        if (i < count)
+            user_id = charges[i].cs.user_id;
+        else if (info.open_charge)
+            user_id = info.open_start.user_id;
+        else
+            break;
+
+        if (set)
+            users_bitmap[user_id / 32] |= (1u << (user_id % 32));
+        else
+            users_bitmap[user_id / 32] &= ~(1u << (user_id % 32));
+    }
+}
+
 bool ChargeTracker::is_user_tracked(uint8_t user_id)
 {
-    const size_t user_id_offset = offsetof(ChargeStart, user_id);
+    auto charges = heap_alloc_array<Charge>(CHARGE_RECORD_MAX_CHARGES_PER_FILE);
+    uint32_t users_bitmap[8] = {0}; // one bit per user
 
-    for (int file = this->first_charge_record; file <= this->last_charge_record; ++file) {
-        File f = LittleFS.open(chargeRecordFilename(file));
-        size_t size = f.size();
-        // LittleFS caches internally, so we can read single bytes without a huge performance loss.
-        for (size_t i = 0; i < size; i += CHARGE_RECORD_SIZE) {
-            f.seek(i + user_id_offset);
-            int read_user_id = f.read();
-            if (read_user_id < 0)
-                continue;
-            if (user_id == read_user_id)
-                return true;
-        }
+    for (uint32_t file = this->first_charge_record; file <= this->last_charge_record; ++file) {
+        markUsersInFile(file, charges.get(), users_bitmap, true);
+
+        if ((users_bitmap[user_id / 32] & (1u << (user_id % 32))) != 0)
+            return true;
     }
     return false;
 }
 
 void ChargeTracker::removeOldRecords()
 {
-    const size_t user_id_offset = offsetof(ChargeStart, user_id);
-
+    auto charges = heap_alloc_array<Charge>(CHARGE_RECORD_MAX_CHARGES_PER_FILE);
     uint32_t users_to_delete[8] = {0}; // one bit per user
 
-    while (this->last_charge_record - this->first_charge_record >= 30) {
+    while (this->last_charge_record - this->first_charge_record >= CHARGE_RECORD_FILE_COUNT) {
         String name = chargeRecordFilename(this->first_charge_record);
         logger.printfln("Got %u charge records. Dropping the first one (%s)", this->last_charge_record - this->first_charge_record, name.c_str());
+
+        markUsersInFile(this->first_charge_record, charges.get(), users_to_delete, true);
+
         {
             File f = LittleFS.open(name, "r");
-            size_t size = f.size();
-            for (size_t i = 0; i < size; i += CHARGE_RECORD_SIZE) {
-                f.seek(i + user_id_offset);
-                int x = f.read();
-                if (x < 0)
-                    continue;
-                uint8_t user_id = x;
-                users_to_delete[user_id / 32] |= (1 << (user_id % 32));
-            }
+            this->charges_before_last_file -= min(charge_record_file_count(f), this->charges_before_last_file);
         }
+
         LittleFS.remove(name);
         ++this->first_charge_record;
     }
 
     //users_to_delete has now set a bit for every user_id that was used in the deleted charge records.
     //Clear this bit for every user that is still used in the current charge records.
-    for (int file = this->first_charge_record; file < this->last_charge_record; ++file) {
-        File f = LittleFS.open(chargeRecordFilename(file));
-        size_t size = f.size();
-        // LittleFS caches internally, so we can read single bytes without a huge performance loss.
-        for (size_t i = 0; i < size; i += CHARGE_RECORD_SIZE) {
-            f.seek(i + user_id_offset);
-            int x = f.read();
-            if (x < 0)
-                continue;
-            uint8_t user_id = x;
-            users_to_delete[user_id / 32] &= ~(1 << (user_id % 32));
-        }
+    for (uint32_t file = this->first_charge_record; file <= this->last_charge_record; ++file) {
+        markUsersInFile(file, charges.get(), users_to_delete, false);
     }
 
     // Now only users that are safe to remove remain.
@@ -317,7 +370,8 @@ bool ChargeTracker::setupRecords()
     File folder = LittleFS.open(CHARGE_RECORD_FOLDER);
     File f;
 
-    uint32_t found_blobs[32] = {0};
+    // A crash while rotating can leave one file more than removeOldRecords keeps.
+    uint32_t found_blobs[CHARGE_RECORD_FILE_COUNT + 1] = {0};
     size_t found_blobs_size = sizeof(found_blobs) / sizeof(found_blobs[0]);
     int found_blob_counter = 0;
 
@@ -343,7 +397,7 @@ bool ChargeTracker::setupRecords()
             continue;
         }
 
-        if (found_blob_counter > found_blobs_size) {
+        if (found_blob_counter >= found_blobs_size) {
             logger.printfln("Too many charge records found!");
             return false;
         }
@@ -364,6 +418,10 @@ bool ChargeTracker::setupRecords()
     uint32_t last = found_blobs[found_blob_counter - 1];
 
     logger.printfln("Charge Tracker found %u record%s: first is %u, last is %u", found_blob_counter, found_blob_counter == 1 ? "" : "s", first, last);
+
+    // Only count valid records: Readers stop at the first invalid one.
+    size_t charges_before_last = 0;
+
     for (int i = 0; i < found_blob_counter - 1; ++i) {
         if (found_blobs[i] + 1 != found_blobs[i + 1]) {
             logger.printfln("Non-consecutive charge records found! (Next after %u is %u. Expected was %u", found_blobs[i], found_blobs[i+1], found_blobs[i] + 1);
@@ -371,38 +429,43 @@ bool ChargeTracker::setupRecords()
         }
 
         f = LittleFS.open(chargeRecordFilename(found_blobs[i]));
-        if (f.size() != CHARGE_RECORD_MAX_FILE_SIZE) {
+        if (f.size() > CHARGE_RECORD_MAX_FILE_SIZE) {
             logger.printfln("Charge record %s is too long: %u bytes", f.name(), f.size());
             return false;
         }
+
+        charges_before_last += charge_record_file_count(f);
     }
 
     String last_file_name = chargeRecordFilename(found_blobs[found_blob_counter - 1]);
-    f = LittleFS.open(last_file_name, "a");
-    size_t last_file_size = f.size();
-    logger.printfln("Last charge record size is %u (%u, %u)", last_file_size, f.size(), (last_file_size % CHARGE_RECORD_SIZE));
-    f.close();
-    if (last_file_size > CHARGE_RECORD_MAX_FILE_SIZE) {
+    f = LittleFS.open(last_file_name);
+    if (f.size() > CHARGE_RECORD_MAX_FILE_SIZE) {
         logger.printfln("Last charge record %s is too long: %u bytes", f.name(), f.size());
         return false;
     }
 
+    charge_record_file_scan(f, &last_file, nullptr, 0);
+
+    logger.printfln("Last charge record has %u complete charge%s%s", last_file.charges, last_file.charges == 1 ? "" : "s", last_file.open_charge ? " and a running charge" : "");
+
+    if (last_file.valid_size != last_file.file_size)
+        logger.printfln("Damaged end of last charge record will be overwritten (%u of %u bytes are valid)", last_file.valid_size, last_file.file_size);
+
     this->first_charge_record = first;
     this->last_charge_record = last;
+    this->charges_before_last_file = charges_before_last;
 
     return true;
 }
 
 size_t ChargeTracker::completeRecordsInLastFile()
 {
-    File file = LittleFS.open(chargeRecordFilename(this->last_charge_record));
-    return file.size() / CHARGE_RECORD_SIZE;
+    return last_file.charges;
 }
 
 bool ChargeTracker::currentlyCharging()
 {
-    File file = LittleFS.open(chargeRecordFilename(this->last_charge_record));
-    return (file.size() % CHARGE_RECORD_SIZE) == sizeof(ChargeStart);
+    return last_file.open_charge;
 }
 
 bool charged_invalid(ChargeStart cs, ChargeEnd ce)
@@ -410,18 +473,111 @@ bool charged_invalid(ChargeStart cs, ChargeEnd ce)
     return isnan(cs.meter_start) || isnan(ce.meter_end) || ce.meter_end < cs.meter_start;
 }
 
-void ChargeTracker::readNRecords(File *f, size_t records_to_read)
+size_t ChargeTracker::readCharges(uint32_t file, Charge *charges)
 {
-    uint8_t buf[CHARGE_RECORD_SIZE];
-    ChargeStart cs;
-    ChargeEnd ce;
+    ChargeRecordFileInfo info;
+
+    {
+        File f = LittleFS.open(chargeRecordFilename(file));
+        charge_record_file_scan(f, &info, charges + 1, CHARGE_RECORD_MAX_CHARGES_PER_FILE);
+    }
+
+    size_t count = min(info.charges, (size_t)CHARGE_RECORD_MAX_CHARGES_PER_FILE);
+
+    charges[0] = Charge{};
+    charges[0].ce.meter_end = NAN;
+
+    if (file > this->first_charge_record) {
+        File f = LittleFS.open(chargeRecordFilename(file - 1));
+        size_t previous_count = charge_record_file_count(f);
+
+        if (previous_count == 0 || !charge_record_file_read_charge(f, previous_count - 1, &charges[0]))
+            charges[0].ce.meter_end = NAN;
+    }
+
+    Charge *next = &charges[count + 1];
+    *next = Charge{};
+    next->cs.meter_start = NAN;
+
+    if (file < this->last_charge_record) {
+        File f = LittleFS.open(chargeRecordFilename(file + 1));
+
+        if (!charge_record_file_read_start(f, 0, &next->cs))
+            next->cs.meter_start = NAN;
+    } else if (info.open_charge) {
+        next->cs = info.open_start;
+    }
+
+    // Records are repaired when reading them, so that files never have to be rewritten.
+    for (size_t i = 1; i <= count; ++i)
+        repair_logic(&charges[i]);
+
+    return count;
+}
+
+// If the first charge of a file is known to be too old,
+// all charges of the files before it are too old as well.
+uint32_t ChargeTracker::findFirstExportFile(uint32_t start_timestamp_min)
+{
+    std::lock_guard<std::mutex> lock{records_mutex};
+
+    uint32_t first_file = this->first_charge_record;
+
+    if (start_timestamp_min == 0)
+        return first_file;
+
+    for (uint32_t i = this->first_charge_record + 1; i <= this->last_charge_record; ++i) {
+        File f = LittleFS.open(chargeRecordFilename(i));
+        ChargeStart cs;
+
+        if (!charge_record_file_read_start(f, 0, &cs) || cs.timestamp_minutes == 0)
+            continue;
+
+        if (cs.timestamp_minutes >= start_timestamp_min)
+            break;
+
+        first_file = i;
+    }
+
+    return first_file;
+}
+
+bool ChargeTracker::readNextExportFile(uint32_t *next_file, uint32_t start_timestamp_min, Charge *charges, size_t *count, size_t *first)
+{
+    std::lock_guard<std::mutex> lock{records_mutex};
+
+    // Old files are removed if a new file is started during the export.
+    *next_file = std::max(*next_file, this->first_charge_record);
 
-    for (int i = 0; i < records_to_read; ++i) {
-        memset(buf, 0, sizeof(buf));
-        f->read(buf, CHARGE_RECORD_SIZE);
+    if (*next_file > this->last_charge_record)
+        return false;
 
-        memcpy(&cs, buf, sizeof(cs));
-        memcpy(&ce, buf + sizeof(cs), sizeof(ce));
+    *count = readCharges(*next_file, charges);
+    *first = 0;
+    ++*next_file;
+
+    if (start_timestamp_min == 0)
+        return true;
+
+    // We know when this charge started and it was before the requested start date.
+    // This means that all charges before and including this one can't be relevant.
+    for (size_t i = *count; i > 0; --i) {
+        uint32_t timestamp_minutes = charges[i].cs.timestamp_minutes;
+
+        if (timestamp_minutes != 0 && timestamp_minutes < start_timestamp_min) {
+            *first = i;
+            break;
+        }
+    }
+
+    return true;
+}
+
+void ChargeTracker::addLastCharges(const Charge *charges, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const ChargeStart &cs = charges[i].cs;
+        const ChargeEnd &ce = charges[i].ce;
 
         last_charges.add();
         last_charges.get(last_charges.count() - 1)->get("timestamp_minutes")->updateUint(cs.timestamp_minutes);
@@ -433,18 +589,11 @@ void ChargeTracker::readNRecords(File *f, size_t records_to_read)
 
 void ChargeTracker::updateState()
 {
-    auto records = this->last_charge_record - this->first_charge_record + 1;
-    state.get("tracked_charges")->updateUint((records - 1) * (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE) + completeRecordsInLastFile());
+    state.get("tracked_charges")->updateUint(this->charges_before_last_file + completeRecordsInLastFile());
 
     File f = LittleFS.open(chargeRecordFilename(this->first_charge_record));
     ChargeStart cs;
-    if (f.size() >= sizeof(cs)) {
-        uint8_t buf[sizeof(cs)];
-
-        memset(buf, 0, sizeof(buf));
-        f.read(buf, sizeof(cs));
-
-        memcpy(&cs, buf, sizeof(cs));
+    if (charge_record_file_read_start(f, 0, &cs)) {
         state.get("first_charge_timestamp")->updateUint(cs.timestamp_minutes);
     }
 }
@@ -459,40 +608,55 @@ void ChargeTracker::setup()
     if (!LittleFS.exists(chargeRecordFilename(this->last_charge_record)))
         LittleFS.open(chargeRecordFilename(this->last_charge_record), "w", true);
 
-    repair_charges();
-
     api.restorePersistentConfig("charge_tracker/config", &config);
 
     // Fill charge_tracker/last_charges
-    bool charging = currentlyCharging();
+    auto charges = heap_alloc_array<Charge>(CHARGE_RECORD_MAX_CHARGES_PER_FILE + 2);
     size_t records_in_last_file = completeRecordsInLastFile();
 
-    if (records_in_last_file < CHARGE_RECORD_LAST_CHARGES_SIZE && LittleFS.exists(chargeRecordFilename(this->last_charge_record - 1))) {
-        size_t records_to_read = CHARGE_RECORD_LAST_CHARGES_SIZE - records_in_last_file;
-        File f = LittleFS.open(chargeRecordFilename(this->last_charge_record - 1));
-        f.seek(-(records_to_read * CHARGE_RECORD_SIZE), SeekMode::SeekEnd);
+    if (records_in_last_file < CHARGE_RECORD_LAST_CHARGES_SIZE && this->last_charge_record > this->first_charge_record) {
+        size_t count = readCharges(this->last_charge_record - 1, charges.get());
+        size_t records_to_add = min(CHARGE_RECORD_LAST_CHARGES_SIZE - records_in_last_file, count);
 
-        this->readNRecords(&f, records_to_read);
+        this->addLastCharges(&charges[1 + count - records_to_add], records_to_add);
+
+        if (records_in_last_file == 0 && count > 0) {
+            recent_charges[0] = charges[count - 1];
+            recent_charges[1] = charges[count];
+            recent_charge_count = 2;
+        }
     }
 
-    size_t records_to_read = min(records_in_last_file, (size_t)CHARGE_RECORD_LAST_CHARGES_SIZE);
-    {
-        File f = LittleFS.open(chargeRecordFilename(this->last_charge_record));
-        f.seek(-(records_to_read * CHARGE_RECORD_SIZE) - (charging ? sizeof(ChargeStart) : 0), SeekMode::SeekEnd);
-        this->readNRecords(&f, records_to_read);
+    size_t count = readCharges(this->last_charge_record, charges.get());
+    size_t records_to_add = min(count, (size_t)CHARGE_RECORD_LAST_CHARGES_SIZE);
+    this->addLastCharges(&charges[1 + count - records_to_add], records_to_add);
+
+    // charges[0] is the last charge of the previous file or a charge without meter values.
+    if (count > 0) {
+        recent_charges[0] = charges[count - 1];
+        recent_charges[1] = charges[count];
+        recent_charge_count = 2;
     }
 
     updateState();
 }
 
-bool user_configured(const uint8_t configured_users[MAX_ACTIVE_USERS], uint8_t user_id)
+// One bit per user ID.
+#define CONFIGURED_USERS_WORDS (MAX_PASSIVE_USERS / 32)
+
+bool user_configured(const uint32_t configured_users[CONFIGURED_USERS_WORDS], uint8_t user_id)
 {
-    for (int i = 0; i < MAX_ACTIVE_USERS; ++i) {
-        if (configured_users[i] == user_id) {
-            return true;
-        }
-    }
-    return false;
+    return (configured_users[user_id / 32] & (1u << (user_id % 32))) != 0;
+}
+
+#define USER_FILTER_ALL_USERS -2
+#define USER_FILTER_DELETED_USERS -1
+
+static bool user_included(int user_filter, const uint32_t configured_users[CONFIGURED_USERS_WORDS], uint8_t user_id)
+{
+    return user_filter == USER_FILTER_ALL_USERS
+        || (user_filter == USER_FILTER_DELETED_USERS && !user_configured(configured_users, user_id))
+        || user_id == user_filter;
 }
 
 static size_t timestamp_min_to_date_time_string(char buf[17], uint32_t timestamp_min, bool english)
@@ -514,19 +678,13 @@ static size_t timestamp_min_to_date_time_string(char buf[17], uint32_t timestamp
     return sprintf_u(buf, "%2.2i.%2.2i.%4.4i %2.2i:%2.2i", t.tm_mday, t.tm_mon + 1, t.tm_year + 1900, t.tm_hour, t.tm_min);
 }
 
-static int get_display_name(uint8_t user_id, char *ret_buf)
-{
-    int result = 0;
-    task_scheduler.await([&result, user_id, ret_buf](){result = users.get_display_name(user_id, ret_buf);});
-    return result;
-}
-
 static char *tracked_charge_to_string(char *buf, ChargeStart cs, ChargeEnd ce, bool english, uint32_t electricity_price)
 {
     buf += 1 + timestamp_min_to_date_time_string(buf, cs.timestamp_minutes, english);
 
-    get_display_name(cs.user_id, buf);
-    buf += 1 + strnlen(buf, DISPLAY_NAME_LENGTH);
+    int display_name_len = users.get_display_name(cs.user_id, buf);
+    buf[display_name_len] = '\0';
+    buf += 1 + display_name_len;
 
     if (charged_invalid(cs, ce)) {
         memcpy(buf, "N/A", ARRAY_SIZE("N/A"));
@@ -589,6 +747,126 @@ static char *tracked_charge_to_string(char *buf, ChargeStart cs, ChargeEnd ce, b
     return buf;
 }
 
+#define EXPORT_BUFFER_SIZE 2048
+// Space kept free for the next row: 6 bytes per character of an escaped display name plus
+// all other fields. Rows that still don't fit (absurd meter values) are truncated by the StringWriter.
+#define EXPORT_MAX_ROW_LENGTH (6 * DISPLAY_NAME_LENGTH + 320)
+
+static void export_csv_string(StringWriter *sw, const char *str, size_t len)
+{
+    sw->putc('"');
+
+    for (size_t i = 0; i < len; ++i) {
+        if (str[i] == '"')
+            sw->putc('"');
+
+        sw->putc(str[i]);
+    }
+
+    sw->putc('"');
+}
+
+static void export_json_string(StringWriter *sw, const char *str, size_t len)
+{
+    sw->putc('"');
+
+    for (size_t i = 0; i < len; ++i) {
+        char c = str[i];
+
+        if (c == '"' || c == '\\') {
+            sw->putc('\\');
+            sw->putc(c);
+        } else if (static_cast<uint8_t>(c) < 0x20) {
+            sw->printf("\\u%04x", static_cast<unsigned>(c));
+        } else {
+            sw->putc(c);
+        }
+    }
+
+    sw->putc('"');
+}
+
+static void export_charge(StringWriter *sw, bool ndjson, const ChargeStart &cs, const ChargeEnd &ce, const char *display_name, size_t display_name_len, uint32_t electricity_price)
+{
+    // Fields that are not known are empty in CSV and null in NDJSON.
+    const char *unknown = ndjson ? "null" : "";
+    char start_time[24];
+
+    if (cs.timestamp_minutes != 0) {
+        time_t timestamp = static_cast<time_t>(cs.timestamp_minutes) * 60;
+        struct tm t;
+        gmtime_r(&timestamp, &t);
+        strftime(start_time, sizeof(start_time), ndjson ? "\"%Y-%m-%dT%H:%M:%SZ\"" : "%Y-%m-%dT%H:%M:%SZ", &t);
+    } else {
+        strcpy(start_time, unknown);
+    }
+
+    if (ndjson)
+        sw->printf("{\"start_time\":%s,\"timestamp_minutes\":%u,\"charge_duration\":%u,\"user_id\":%u,\"display_name\":",
+                   start_time, cs.timestamp_minutes, ce.charge_duration, cs.user_id);
+    else
+        sw->printf("%s,%u,%u,%u,", start_time, cs.timestamp_minutes, ce.charge_duration, cs.user_id);
+
+    if (ndjson)
+        export_json_string(sw, display_name, display_name_len);
+    else
+        export_csv_string(sw, display_name, display_name_len);
+
+    sw->printf(ndjson ? ",\"meter_start\":" : ",");
+
+    if (isnan(cs.meter_start))
+        sw->puts(unknown);
+    else
+        sw->printf("%.3f", cs.meter_start);
+
+    sw->printf(ndjson ? ",\"meter_end\":" : ",");
+
+    if (isnan(ce.meter_end))
+        sw->puts(unknown);
+    else
+        sw->printf("%.3f", ce.meter_end);
+
+    sw->printf(ndjson ? ",\"energy_charged\":" : ",");
+
+    bool invalid = charged_invalid(cs, ce);
+    double charged = invalid ? 0 : ce.meter_end - cs.meter_start;
+
+    if (invalid)
+        sw->puts(unknown);
+    else
+        sw->printf("%.3f", charged);
+
+    sw->printf(ndjson ? ",\"cost\":" : ",");
+
+    if (invalid || electricity_price == 0) {
+        sw->puts(unknown);
+    } else {
+        uint32_t cost = round(charged * electricity_price / 100.0f);
+        sw->printf("%u.%02u", cost / 100, cost % 100);
+    }
+
+    sw->puts(ndjson ? "}\n" : "\r\n");
+}
+
+// Accepts only complete decimal numbers in [min_value, max_value].
+static bool parse_query_param(WebServerRequest &request, const char *key, int64_t min_value, int64_t max_value, int64_t *value)
+{
+    const char *str = request.queryParamCStr(key);
+
+    if (str == nullptr)
+        return true;
+
+    char *end;
+    errno = 0;
+    long long result = strtoll(str, &end, 10);
+
+    if (errno != 0 || end == str || *end != '\0' || result < min_value || result > max_value)
+        return false;
+
+    *value = result;
+    return true;
+}
+
 static bool repair_logic(Charge *buf)
 {
     bool repaired = false;
@@ -648,49 +926,6 @@ static bool repair_logic(Charge *buf)
     return repaired;
 }
 
-void ChargeTracker::repair_charges()
-{
-    auto buf = heap_alloc_array<Charge>(258);
-    uint32_t num_repaired = 0;
-    Charge transfer;
-    transfer.ce.meter_end = NAN;
-
-    for (int i = this->first_charge_record; i <= this->last_charge_record; ++i) {
-        bool file_needs_repair = false;
-        memset(reinterpret_cast<uint8_t *>(&buf[1]), 0, sizeof(Charge) * 257);
-
-        File f = LittleFS.open(chargeRecordFilename(i));
-        if (i < this->last_charge_record) {
-            File next_f = LittleFS.open(chargeRecordFilename(i + 1));
-            int read = next_f.read(reinterpret_cast<uint8_t *>(&buf[257]), sizeof(Charge));
-            if (read != sizeof(Charge))
-                buf[257].cs.meter_start = NAN;
-        }
-        else
-            buf[257].cs.meter_start = NAN;
-
-        int read = f.read(reinterpret_cast<uint8_t *>(&buf[1]), sizeof(Charge) * 257);
-        if (read == -1 || read == 0) {
-            break;
-        }
-
-        for (int a = 1; a < read / sizeof(Charge); a++) {
-            if (repair_logic(&buf[a])) {
-                file_needs_repair = true;
-                num_repaired++;
-            }
-        }
-        if (file_needs_repair) {
-            File write_f = LittleFS.open(chargeRecordFilename(i), "w");
-            write_f.write(reinterpret_cast<uint8_t *>(&buf[1]), read);
-        }
-        buf[0] = buf[256];
-    }
-    if (num_repaired != 0) {
-        logger.printfln("Repaired %u charge-entries.", num_repaired);
-    }
-}
-
 void ChargeTracker::register_urls()
 {
     // We have to do this here, not at the end of setup,
@@ -704,25 +939,22 @@ void ChargeTracker::register_urls()
     server.on_HTTPThread("/charge_tracker/charge_log", HTTP_GET, [this](WebServerRequest request) {
         std::lock_guard<std::mutex> lock{records_mutex};
 
-        auto url_buf = heap_alloc_array<char>(CHARGE_RECORD_MAX_FILE_SIZE);
-        if (url_buf == nullptr) {
+        auto charges = heap_alloc_array<Charge>(CHARGE_RECORD_MAX_CHARGES_PER_FILE + 2);
+        if (charges == nullptr) {
             return request.send(507);
         }
 
-        File file = LittleFS.open(chargeRecordFilename(this->last_charge_record));
-        size_t file_size = (this->last_charge_record - this->first_charge_record) * CHARGE_RECORD_MAX_FILE_SIZE + file.size();
-
         // Don't do a chunked response without any chunk. The webserver does strange things in this case
-        if (file_size == 0) {
+        if (this->charges_before_last_file + completeRecordsInLastFile() == 0) {
             return request.send(200, "application/octet-stream", "", 0);
         }
 
+        // Records are always sent in the first format, independent of the format of their file.
         request.beginChunkedResponse(200, "application/octet-stream");
-        for (int i = this->first_charge_record; i <= this->last_charge_record; ++i) {
-            File f = LittleFS.open(chargeRecordFilename(i));
-            int read = f.read((uint8_t *)url_buf.get(), CHARGE_RECORD_MAX_FILE_SIZE);
-            int trunc = read - (read % CHARGE_RECORD_SIZE);
-            request.sendChunk(url_buf.get(), trunc);
+        for (uint32_t i = this->first_charge_record; i <= this->last_charge_record; ++i) {
+            size_t count = readCharges(i, charges.get());
+            if (count > 0)
+                request.sendChunk(reinterpret_cast<const char *>(&charges[1]), count * CHARGE_RECORD_SIZE);
         }
         return request.endChunkedResponse();
     });
@@ -748,8 +980,6 @@ void ChargeTracker::register_urls()
 
     server.on_HTTPThread("/charge_tracker/pdf", HTTP_PUT, [this](WebServerRequest request) {
         logger.printfln("Beginning PDF generation. Please ignore timeout errors (rc -1 etc.) until it is done.");
-        #define USER_FILTER_ALL_USERS -2
-        #define USER_FILTER_DELETED_USERS -1
         int user_filter = USER_FILTER_ALL_USERS;
         uint32_t start_timestamp_min = 0;
         uint32_t end_timestamp_min = 0;
@@ -807,26 +1037,20 @@ void ChargeTracker::register_urls()
                             //50 "Gesamtbetrag 99999.99€ (Strompreis 123.45 ct/kWh)" + \0
                             //= 314
 
-
+        // Totals are summed up while the table lines are generated.
+        // The stats are written after the last page, so no pass over the records is necessary up front.
         double charged_sum = 0;
         uint32_t charged_cost_sum = 0;
         bool seen_charges_without_meter = false;
 
-        int charge_records = 0;
-        int first_file = -1;
-        int first_charge = -1;
-        int last_file = -1;
-        int last_charge = -1;
-
-        std::lock_guard<std::mutex> lock{records_mutex};
-
-        uint8_t configured_users[MAX_ACTIVE_USERS] = {};
+        uint32_t configured_users[CONFIGURED_USERS_WORDS] = {};
         uint32_t electricity_price;
         String dev_name;
-        auto await_result = task_scheduler.await([this, configured_users, &electricity_price, &dev_name]() mutable {
+        auto await_result = task_scheduler.await([this, &configured_users, &electricity_price, &dev_name]() mutable {
             electricity_price = this->config.get("electricity_price")->asUint();
-            for (int i = 0; i < users.config.get("users")->count(); ++i) {
-                configured_users[i] = users.config.get("users")->get(i)->get("id")->asUint();
+            for (uint16_t user_id = 0; user_id < MAX_PASSIVE_USERS; ++user_id) {
+                if (users.is_user_configured(user_id))
+                    configured_users[user_id / 32] |= 1u << (user_id % 32);
             }
             dev_name = device_name.display_name.get("display_name")->asString();
             if (device_name.display_name.get("display_name")->asString() != device_name.name.get("name")->asString())
@@ -835,124 +1059,6 @@ void ChargeTracker::register_urls()
         if (await_result == TaskScheduler::AwaitResult::Timeout)
             return request.send(500, "text/plain", "Failed to generate PDF: Task timed out");
 
-        {
-            char charge_buf[sizeof(ChargeStart) + sizeof(ChargeEnd)];
-            ChargeStart cs;
-            ChargeEnd ce;
-
-            for (int i = this->first_charge_record; i <= this->last_charge_record; ++i) {
-                File f = LittleFS.open(chargeRecordFilename(i));
-
-                for (int j = 0; j < (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE); ++j) {
-                    if (f.read((uint8_t *)charge_buf, CHARGE_RECORD_SIZE) != CHARGE_RECORD_SIZE)
-                        // This file is not "full". We don't have any tracked charges left.
-                        goto search_done;
-
-                    memcpy(&cs, charge_buf, sizeof(ChargeStart));
-                    memcpy(&ce, charge_buf + sizeof(ChargeStart), sizeof(ChargeEnd));
-
-                    if (cs.timestamp_minutes != 0 && start_timestamp_min != 0 && cs.timestamp_minutes < start_timestamp_min) {
-                        // We know when this charge started and it was before the requested start date.
-                        // This means that all charges before and including this one can't be relevant.
-                        charge_records = 0;
-                        first_file = -1;
-                        first_charge = -1;
-                        charged_sum = 0;
-                        charged_cost_sum = 0;
-                        continue;
-                    }
-
-                    if (cs.timestamp_minutes != 0 && end_timestamp_min != 0 && cs.timestamp_minutes > end_timestamp_min) {
-                        // This charge started after the requested end date. We are done searching.
-                        last_file = i;
-                        last_charge = j;
-                        goto search_done;
-                    }
-
-                    bool include_user = user_filter == USER_FILTER_ALL_USERS || (user_filter == USER_FILTER_DELETED_USERS && !user_configured(configured_users, cs.user_id)) || cs.user_id == user_filter;
-                    if (!include_user)
-                        continue;
-
-                    if (first_file == -1)
-                        first_file = i;
-
-                    if (first_charge == -1)
-                        first_charge = j;
-
-                    last_file = i;
-                    last_charge = j;
-                    ++charge_records;
-
-                    if (charged_invalid(cs, ce))
-                        seen_charges_without_meter = true;
-                    else {
-                        double charged = ce.meter_end - cs.meter_start;
-                        charged_sum += charged;
-                        if (electricity_price != 0)
-                            charged_cost_sum += round(charged * electricity_price / 100.0f);
-                    }
-                }
-            }
-        }
-search_done:
-
-        char *stats_head = stats_buf;
-        stats_head += 1 + sprintf_u(stats_head, "%s: %s", english ? "Charger" : "Wallbox", dev_name.c_str());
-
-        stats_head += sprintf_u(stats_head, "%s: ", english ? "Exported on" : "Exportiert an");
-        stats_head += 1 + timestamp_min_to_date_time_string(stats_head, current_timestamp_min, english);
-
-        stats_head += sprintf_u(stats_head, "%s: ", english ? "Exported users" : "Exportierte Benutzer");
-        if (user_filter == -2)
-            stats_head += sprintf_u(stats_head, "%s", english ? "all users" : "Alle Benutzer");
-        else if (user_filter == -1)
-            stats_head += sprintf_u(stats_head, "%s", english ? "deleted users" : "Gelöschte Benutzer");
-        else
-            stats_head += get_display_name(user_filter, stats_head);
-        ++stats_head;
-
-        stats_head += sprintf_u(stats_head, "%s: ", english ? "Exported period" : "Exportierter Zeitraum");
-        if (start_timestamp_min == 0)
-            stats_head += sprintf_u(stats_head, "%s", english ? "record start" : "Aufzeichnungsbeginn");
-        else
-            stats_head += timestamp_min_to_date_time_string(stats_head, start_timestamp_min, english);
-
-        stats_head += sprintf_u(stats_head, "%s", english ? " to " : " bis ");
-
-        if (end_timestamp_min == 0)
-            stats_head += sprintf_u(stats_head, "%s", english ? "record end" : (start_timestamp_min == 0 ? "-ende" : "Aufzeichnungsende"));
-        else
-            stats_head += timestamp_min_to_date_time_string(stats_head, end_timestamp_min, english);
-        ++stats_head;
-
-        int written = sprintf_u(stats_head, "%s: %9.3f kWh", english ? "Total energy of exported charges" : "Gesamtenergie exportierter Ladevorgänge", charged_sum);
-        if (!english)
-            for (int i = 0; i < written; ++i)
-                if (stats_head[i] == '.')
-                    stats_head[i] = ',';
-        stats_head += 1 + written;
-
-        if (electricity_price != 0) {
-            written = sprintf_u(stats_head, "%s: %d.%02d€ (%.2f ct/kWh)%s",
-                            english ? "Total cost" : "Gesamtkosten",
-                            charged_cost_sum / 100, charged_cost_sum % 100,
-                            electricity_price / 100.0f,
-                            seen_charges_without_meter ? (english ? " Incomplete!" : " Unvollständig!") : "");
-            if (!english)
-                for (int i = 0; i < written; ++i)
-                    if (stats_head[i] == '.')
-                        stats_head[i] = ',';
-            stats_head += 1 + written;
-        }
-
-        // TODO: this is currently unnecessary, however if we support other ways of requesting a PDF
-        // we have to lock the pdf generator.
-        std::lock_guard<std::mutex> lock2{pdf_mutex};
-
-        int current_file = (first_file > -1 ? first_file : this->first_charge_record);
-        int current_charge = (first_charge > -1 ? first_charge : 0);
-        last_file = (last_file >= 0) ? last_file : this->last_charge_record;
-
 #define TABLE_LINE_LEN (17 /*start date: 01.02.3456 12:34\0 or 3456-02-01 12:34\0*/ \
                       + 33 /*display name: max 32 chars + \0*/ \
                       + 8  /*charged: (assumed max) "999.999\0" kWh else truncated to "> 1000\0"*/ \
@@ -960,9 +1066,20 @@ search_done:
                       + 16 /* meter start max 99'999'999.999\0*/ \
                       + 8) /* cost max 9999.99\0 else truncated to >10000*/
 
-        char table_lines_buffer[8 * TABLE_LINE_LEN];
+        auto charges = heap_alloc_array<Charge>(CHARGE_RECORD_MAX_CHARGES_PER_FILE + 2);
+        auto table_lines_buffer = heap_alloc_array<char>(PDF_TABLE_LINES_PER_PAGE * TABLE_LINE_LEN);
+        if (charges == nullptr || table_lines_buffer == nullptr)
+            return request.send(507);
+
+        uint32_t next_file = findFirstExportFile(start_timestamp_min);
+
+        // TODO: this is currently unnecessary, however if we support other ways of requesting a PDF
+        // we have to lock the pdf generator.
+        std::lock_guard<std::mutex> lock2{pdf_mutex};
 
-        File f;
+        size_t loaded_count = 0;
+        size_t current_charge = 0;
+        bool all_charges_done = false;
 
         request.beginChunkedResponse(200, "application/pdf");
 
@@ -984,85 +1101,230 @@ search_done:
 
         init_pdf_generator(&request,
                            "Title",
-                           stats_buf, (electricity_price == 0) ? 5 : 6,
+                           [&stats_buf,
+                            &charged_sum,
+                            &charged_cost_sum,
+                            &seen_charges_without_meter,
+                            &dev_name,
+                            user_filter,
+                            start_timestamp_min,
+                            end_timestamp_min,
+                            current_timestamp_min,
+                            electricity_price,
+                            english]() -> const char * {
+            char *stats_head = stats_buf;
+            stats_head += 1 + sprintf_u(stats_head, "%s: %s", english ? "Charger" : "Wallbox", dev_name.c_str());
+
+            stats_head += sprintf_u(stats_head, "%s: ", english ? "Exported on" : "Exportiert an");
+            stats_head += 1 + timestamp_min_to_date_time_string(stats_head, current_timestamp_min, english);
+
+            stats_head += sprintf_u(stats_head, "%s: ", english ? "Exported users" : "Exportierte Benutzer");
+            if (user_filter == -2)
+                stats_head += sprintf_u(stats_head, "%s", english ? "all users" : "Alle Benutzer");
+            else if (user_filter == -1)
+                stats_head += sprintf_u(stats_head, "%s", english ? "deleted users" : "Gelöschte Benutzer");
+            else
+                stats_head += users.get_display_name(user_filter, stats_head);
+            *stats_head++ = '\0';
+
+            stats_head += sprintf_u(stats_head, "%s: ", english ? "Exported period" : "Exportierter Zeitraum");
+            if (start_timestamp_min == 0)
+                stats_head += sprintf_u(stats_head, "%s", english ? "record start" : "Aufzeichnungsbeginn");
+            else
+                stats_head += timestamp_min_to_date_time_string(stats_head, start_timestamp_min, english);
+
+            stats_head += sprintf_u(stats_head, "%s", english ? " to " : " bis ");
+
+            if (end_timestamp_min == 0)
+                stats_head += sprintf_u(stats_head, "%s", english ? "record end" : (start_timestamp_min == 0 ? "-ende" : "Aufzeichnungsende"));
+            else
+                stats_head += timestamp_min_to_date_time_string(stats_head, end_timestamp_min, english);
+            ++stats_head;
+
+            int written = sprintf_u(stats_head, "%s: %9.3f kWh", english ? "Total energy of exported charges" : "Gesamtenergie exportierter Ladevorgänge", charged_sum);
+            if (!english)
+                for (int i = 0; i < written; ++i)
+                    if (stats_head[i] == '.')
+                        stats_head[i] = ',';
+            stats_head += 1 + written;
+
+            if (electricity_price != 0) {
+                written = sprintf_u(stats_head, "%s: %d.%02d€ (%.2f ct/kWh)%s",
+                                english ? "Total cost" : "Gesamtkosten",
+                                charged_cost_sum / 100, charged_cost_sum % 100,
+                                electricity_price / 100.0f,
+                                seen_charges_without_meter ? (english ? " Incomplete!" : " Unvollständig!") : "");
+                if (!english)
+                    for (int i = 0; i < written; ++i)
+                        if (stats_head[i] == '.')
+                            stats_head[i] = ',';
+                stats_head += 1 + written;
+            }
+
+            return stats_buf;
+        },
+                           (electricity_price == 0) ? 5 : 6,
                            letterhead.get(), letterhead_lines,
                            english ? table_header_en : table_header_de,
-                           charge_records,
                            [this,
                             user_filter,
+                            start_timestamp_min,
+                            end_timestamp_min,
                             &table_lines_buffer,
-                            &f,
-                            first_file,
-                            first_charge,
-                            last_file,
-                            last_charge,
-                            &current_file,
+                            &charges,
+                            &next_file,
+                            &loaded_count,
                             &current_charge,
+                            &all_charges_done,
+                            &charged_sum,
+                            &charged_cost_sum,
+                            &seen_charges_without_meter,
                             electricity_price,
                             english,
                             configured_users]
-                           (const char * * table_lines) {
-            memset(table_lines_buffer, 0, ARRAY_SIZE(table_lines_buffer));
-
+                           (const char * * table_lines, int max_lines) {
             int lines_generated = 0;
-            char *table_lines_head = table_lines_buffer;
+            char *table_lines_head = table_lines_buffer.get();
 
-            char charge_buf[CHARGE_RECORD_SIZE];
             ChargeStart cs;
             ChargeEnd ce;
 
-            while (current_file <= last_file) {
-                if (current_charge >= (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE)) {
-                    current_charge = 0;
+            while (!all_charges_done && lines_generated < max_lines) {
+                if (current_charge >= loaded_count) {
+                    if (!readNextExportFile(&next_file, start_timestamp_min, charges.get(), &loaded_count, &current_charge)) {
+                        all_charges_done = true;
+                        break;
+                    }
+
+                    continue;
+                }
+
+                cs = charges[current_charge + 1].cs;
+                ce = charges[current_charge + 1].ce;
+                ++current_charge;
+
+                if (cs.timestamp_minutes != 0 && end_timestamp_min != 0 && cs.timestamp_minutes > end_timestamp_min) {
+                    // This charge started after the requested end date. We are done.
+                    all_charges_done = true;
+                    break;
                 }
 
-                if (!f) {
-                    f =  LittleFS.open(chargeRecordFilename(current_file));
-                    f.seek(CHARGE_RECORD_SIZE * current_charge);
+                if (!user_included(user_filter, configured_users, cs.user_id))
+                    continue;
+
+                if (charged_invalid(cs, ce))
+                    seen_charges_without_meter = true;
+                else {
+                    double charged = ce.meter_end - cs.meter_start;
+                    charged_sum += charged;
+                    if (electricity_price != 0)
+                        charged_cost_sum += round(charged * electricity_price / 100.0f);
                 }
 
-                for (; current_charge < (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE); ++current_charge) {
-                    if ((lines_generated == 8) || (current_file == last_file && current_charge > last_charge))
-                        break;
-                    if (f.read((uint8_t *)charge_buf, CHARGE_RECORD_SIZE) != CHARGE_RECORD_SIZE)
-                        break;
+                table_lines_head = tracked_charge_to_string(table_lines_head, cs, ce, english, electricity_price);
+                ++lines_generated;
+            }
+            *table_lines = table_lines_buffer.get();
+            return lines_generated;
+        });
+        logger.printfln("PDF generation done.");
+        return request.endChunkedResponse();
+    });
 
-                    memcpy(&cs, charge_buf, sizeof(ChargeStart));
-                    memcpy(&ce, charge_buf + sizeof(ChargeStart), sizeof(ChargeEnd));
+    // GET /charge_tracker/export?format=csv&user_filter=-2&start_timestamp_min=0&end_timestamp_min=0
+    // Sends the tracked charges as CSV (default) or NDJSON. Records are decoded one file at a time,
+    // so memory use does not depend on the number of tracked charges.
+    server.on_HTTPThread("/charge_tracker/export", HTTP_GET, [this](WebServerRequest request) {
+        const char *format = request.queryParamCStr("format");
+        bool ndjson = false;
 
-                    // No need to filter via start/end: we already know the first and last charge to be shown.
-                    bool include_user = user_filter == USER_FILTER_ALL_USERS || (user_filter == USER_FILTER_DELETED_USERS && !user_configured(configured_users, cs.user_id)) || cs.user_id == user_filter;
-                    if (!include_user)
-                        continue;
+        if (format != nullptr && strcmp(format, "ndjson") == 0)
+            ndjson = true;
+        else if (format != nullptr && strcmp(format, "csv") != 0)
+            return request.send(400, "text/plain", "Unknown format. Supported are csv and ndjson");
 
+        int64_t user_filter_param = USER_FILTER_ALL_USERS;
+        int64_t start_timestamp_min_param = 0;
+        int64_t end_timestamp_min_param = 0;
 
-                    table_lines_head = tracked_charge_to_string(table_lines_head, cs, ce, english, electricity_price);
-                    ++lines_generated;
-                }
+        if (!parse_query_param(request, "user_filter", USER_FILTER_ALL_USERS, MAX_PASSIVE_USERS - 1, &user_filter_param)
+         || !parse_query_param(request, "start_timestamp_min", 0, UINT32_MAX, &start_timestamp_min_param)
+         || !parse_query_param(request, "end_timestamp_min", 0, UINT32_MAX, &end_timestamp_min_param))
+            return request.send(400, "text/plain", "Invalid filter");
 
-                f.close();
-                if (current_charge >= (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE)) {
-                    ++current_file;
-                    current_charge = 0;
-                }
+        int user_filter = static_cast<int>(user_filter_param);
+        uint32_t start_timestamp_min = static_cast<uint32_t>(start_timestamp_min_param);
+        uint32_t end_timestamp_min = static_cast<uint32_t>(end_timestamp_min_param);
 
-                // >= last_charge is intentionally here: we already have this charge
-                if ((lines_generated == 8))
-                    break;
+        uint32_t configured_users[CONFIGURED_USERS_WORDS] = {};
+        uint32_t electricity_price;
+        auto await_result = task_scheduler.await([this, &configured_users, &electricity_price]() mutable {
+            electricity_price = this->config.get("electricity_price")->asUint();
+            for (uint16_t user_id = 0; user_id < MAX_PASSIVE_USERS; ++user_id) {
+                if (users.is_user_configured(user_id))
+                    configured_users[user_id / 32] |= 1u << (user_id % 32);
+            }
+        });
+        if (await_result == TaskScheduler::AwaitResult::Timeout)
+            return request.send(500, "text/plain", "Failed to export charges: Task timed out");
 
-                if (current_file == last_file && current_charge >= last_charge) {
+        auto charges = heap_alloc_array<Charge>(CHARGE_RECORD_MAX_CHARGES_PER_FILE + 2);
+        auto buf = heap_alloc_array<char>(EXPORT_BUFFER_SIZE);
+        if (charges == nullptr || buf == nullptr)
+            return request.send(507);
+
+        StringWriter sw(buf.get(), EXPORT_BUFFER_SIZE);
+
+        if (!ndjson)
+            sw.puts("start_time,timestamp_minutes,charge_duration,user_id,display_name,meter_start,meter_end,energy_charged,cost\r\n");
+
+        const char *content_type = ndjson ? "application/x-ndjson; charset=utf-8" : "text/csv; charset=utf-8";
+        bool response_started = false;
+
+        uint32_t next_file = findFirstExportFile(start_timestamp_min);
+        size_t count;
+        size_t first;
+        bool done = false;
+
+        while (!done && readNextExportFile(&next_file, start_timestamp_min, charges.get(), &count, &first)) {
+            for (size_t i = first; i < count; ++i) {
+                ChargeStart cs = charges[i + 1].cs;
+                ChargeEnd ce = charges[i + 1].ce;
+
+                if (cs.timestamp_minutes != 0 && end_timestamp_min != 0 && cs.timestamp_minutes > end_timestamp_min) {
+                    done = true;
                     break;
                 }
+
+                if (!user_included(user_filter, configured_users, cs.user_id))
+                    continue;
+
+                char display_name[DISPLAY_NAME_LENGTH];
+                size_t display_name_len = users.get_display_name(cs.user_id, display_name);
+
+                export_charge(&sw, ndjson, cs, ce, display_name, display_name_len, electricity_price);
+
+                if (sw.getRemainingLength() < EXPORT_MAX_ROW_LENGTH) {
+                    if (!response_started) {
+                        request.beginChunkedResponse(200, content_type);
+                        response_started = true;
+                    }
+
+                    if (request.sendChunk(sw.getPtr(), static_cast<ssize_t>(sw.getLength())) != ESP_OK)
+                        return request.endChunkedResponse();
+
+                    sw.clear();
+                }
             }
-            if (!f)
-                f.close();
+        }
 
+        // Don't do a chunked response without any chunk. The webserver does strange things in this case
+        if (!response_started)
+            return request.send(200, content_type, sw.getPtr(), static_cast<ssize_t>(sw.getLength()));
 
+        if (sw.getLength() > 0)
+            request.sendChunk(sw.getPtr(), static_cast<ssize_t>(sw.getLength()));
 
-            *table_lines = table_lines_buffer;
-            return lines_generated;
-        });
-        logger.printfln("PDF generation done.");
         return request.endChunkedResponse();
     });
 }
@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include "module.h"
+#include "charge_record_file.h"
 
 #define CHARGE_TRACKER_MAX_REPAIR 200
 
@@ -51,7 +52,11 @@ public:
     size_t completeRecordsInLastFile();
     bool currentlyCharging();
 
-    void readNRecords(File *f, size_t records_to_read);
+    // Reads and repairs the complete charges of a file into charges[1..count].
+    // charges[0] and charges[count + 1] receive the neighbouring charges the
+    // repair needs. charges must have room for CHARGE_RECORD_MAX_CHARGES_PER_FILE + 2 charges.
+    size_t readCharges(uint32_t file, Charge *charges);
+    void addLastCharges(const Charge *charges, size_t count);
 
     ConfigRoot last_charges;
     ConfigRoot current_charge;
@@ -63,6 +68,23 @@ public:
     std::mutex pdf_mutex;
 
 private:
-    bool repair_last(float);
-    void repair_charges();
+    bool appendToLastFile(const void *buf, size_t len);
+    bool appendStart(const ChargeStart &cs);
+    void startNewFile();
+    void markUsersInFile(uint32_t file, Charge *charges, uint32_t users_bitmap[8], bool set);
+
+    // Exports read one file at a time and only hold records_mutex while reading it.
+    uint32_t findFirstExportFile(uint32_t start_timestamp_min);
+    // Reads the next file of an export like readCharges and advances next_file. first is set
+    // to the first charge that can have started at or after start_timestamp_min.
+    // Returns false if all files were read.
+    bool readNextExportFile(uint32_t *next_file, uint32_t start_timestamp_min, Charge *charges, size_t *count, size_t *first);
+
+    ChargeRecordFileInfo last_file = {true, 0, 0, false, ChargeStart{}, 0, 0};
+    size_t charges_before_last_file = 0;
+
+    // The two most recently completed charges. Used to repair the previous
+    // charge when the next one starts.
+    Charge recent_charges[2];
+    size_t recent_charge_count = 0;
 };
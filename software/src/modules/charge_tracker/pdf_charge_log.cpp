@@ -75,39 +75,51 @@ float table_column_offsets[] {
 };
 
 #define TABLE_LINES_FIRST_PAGE 32
-#define TABLE_LINES_PER_PAGE 40
+#define TABLE_LINES_PER_PAGE PDF_TABLE_LINES_PER_PAGE
 
 #define TABLE_LINES_PER_OBJECT 8
 
-int get_streams_per_page(bool first_page, int *table_lines_to_place)
+static_assert(TABLE_LINES_FIRST_PAGE <= TABLE_LINES_PER_PAGE, "First page can't have more table lines than the others");
+
+// The page number and the stats depend on all table lines and are written after the last page.
+int get_deferred_streams_per_page(bool first_page)
+{
+    return first_page ? 2  // page number, stats
+                      : 1; // page number
+}
+
+int get_streams_per_page(bool first_page, int table_lines)
 {
-    int result = 0;
+    int result = get_deferred_streams_per_page(first_page);
     if (first_page) {
-        result += 1  // letter head
-                + 1; // stats
+        result += 1; // letter head
     }
-    result += 1 // table header
-            + 1  // logo background
-            + 1; // page number
+    result += 1  // table header
+            + 1; // logo background
 
-    int to_place = std::min(*table_lines_to_place, first_page ? TABLE_LINES_FIRST_PAGE : TABLE_LINES_PER_PAGE);
-    *table_lines_to_place -= to_place;
-
-    result += ceil((float)to_place / TABLE_LINES_PER_OBJECT) // table content
+    result += ceil((float)table_lines / TABLE_LINES_PER_OBJECT) // table content
             + 1;    // line borders
 
     return result;
 }
 
+// Table lines are stored as TABLE_HEADER_COLS null-terminated strings each.
+static const char *skip_table_lines(const char *table_lines, int lines)
+{
+    for (int i = 0; i < lines * TABLE_HEADER_COLS; ++i)
+        table_lines += strlen(table_lines) + 1;
+
+    return table_lines;
+}
+
 int init_pdf_generator(WebServerRequest *request,
                        const char *title,
-                       const char *stats,
+                       std::function<const char *(void)> stats_cb,
                        int stats_lines,
                        const char *letterhead,
                        int letterhead_lines,
                        const char *table_header,
-                       uint16_t tracked_charges,
-                       std::function<int(const char **)> table_lines_cb)
+                       std::function<int(const char **, int)> table_lines_cb)
 {
     struct pdf_info info;
     memset(&info, 0, sizeof(info));
@@ -122,29 +134,25 @@ int init_pdf_generator(WebServerRequest *request,
         return len;
     });
     int pages_created = 0;
-    int pages_to_be_created = 0;
-    int table_lines_last_page = 0;
 
-    int table_content_placed = 0;
-    int table_lines_to_place = 0;
+    // Only the lines of the page that is currently written are held in memory.
+    const char *page_table_lines = nullptr;
+    int page_table_line_count = 0;
 
-    table_lines_to_place = tracked_charges;
+    pdf_add_page_callback(pdf, [&pages_created, &page_table_lines, &page_table_line_count, table_lines_cb](struct pdf_doc *pdf_doc, uint32_t page_num) -> int {
+        bool first_page = page_num == 0;
 
-    while (table_lines_to_place > 0) {
-        table_lines_last_page = table_lines_to_place;
-        int streams = get_streams_per_page(pages_to_be_created == 0, &table_lines_to_place);
-        pdf_notify_page(pdf, streams, 1);
-        ++pages_to_be_created;
-    }
+        page_table_line_count = table_lines_cb(&page_table_lines, first_page ? TABLE_LINES_FIRST_PAGE : TABLE_LINES_PER_PAGE);
 
-    table_lines_to_place = tracked_charges;
+        // The first page is created even without table lines to show the stats.
+        if (!first_page && page_table_line_count == 0)
+            return 0;
+
+        if (pdf_append_page(pdf_doc, get_streams_per_page(first_page, page_table_line_count), 1, get_deferred_streams_per_page(first_page)) == nullptr)
+            return -1;
 
-    pdf_add_page_callback(pdf, [&table_lines_last_page, &pages_created, &table_lines_to_place](struct pdf_doc *pdf_doc, uint32_t page_num) -> int {
-        table_lines_last_page = table_lines_to_place;
-        int streams = get_streams_per_page(pages_created == 0, &table_lines_to_place);
-        pdf_append_page(pdf_doc, streams, 1);
         ++pages_created;
-        return 0;
+        return 1;
     });
 
     pdf_add_image_callback(pdf, [](struct pdf_doc *pdf_doc, uint32_t page_num, uint32_t image_num) -> int {
@@ -152,35 +160,36 @@ int init_pdf_generator(WebServerRequest *request,
     });
 
 
-    pdf_add_stream_callback(pdf, [pages_to_be_created, table_lines_last_page, &table_content_placed, tracked_charges, table_lines_cb, stats, stats_lines, letterhead, letterhead_lines, table_header](struct pdf_doc *pdf_doc, uint32_t page_num, uint32_t stream_num) -> int {
-        // Logo background
-        if (stream_num == 0)
-            return pdf_add_filled_rectangle(pdf_doc, NULL, 0, PDF_A4_HEIGHT - TOP_MARGIN, PDF_A4_WIDTH, 75, 0, LOGO_BACKGROUND, 0);
-        --stream_num;
-
+    pdf_add_stream_callback(pdf, [&pages_created, &page_table_lines, &page_table_line_count, stats_cb, stats_lines, letterhead, letterhead_lines, table_header](struct pdf_doc *pdf_doc, uint32_t page_num, uint32_t stream_num) -> int {
         // Page number
         if (stream_num == 0) {
             float width = 0.0f;
             char buf[32] = {};
-            snprintf(buf, ARRAY_SIZE(buf), "Seite %d von %d", page_num + 1, pages_to_be_created);
+            snprintf(buf, ARRAY_SIZE(buf), "Seite %d von %d", page_num + 1, pages_created);
             pdf_get_font_text_width(pdf_doc, DEFAULT_FONT, buf, FONT_SIZE, &width);
             return pdf_add_text(pdf_doc, NULL, buf, FONT_SIZE, (PDF_A4_WIDTH - width) / 2, BOTTOM_MARGIN, PDF_BLACK);
         }
         --stream_num;
 
-        // First page
+        // Stats block (top right) on the first page
         if (page_num == 0) {
-            // Stats block (top right)
             if (stream_num == 0) {
                 float offsets[2] = {0, LINE_WIDTH};
-                return pdf_add_multiple_text_spacing(pdf_doc, NULL, stats, stats_lines, 1, FONT_SIZE, LEFT_MARGIN + table_column_offsets[2], PDF_A4_HEIGHT - TOP_MARGIN - 10 - (LINE_HEIGHT * 1), PDF_BLACK, 0, LINE_HEIGHT, offsets);
+                return pdf_add_multiple_text_spacing(pdf_doc, NULL, stats_cb(), stats_lines, 1, FONT_SIZE, LEFT_MARGIN + table_column_offsets[2], PDF_A4_HEIGHT - TOP_MARGIN - 10 - (LINE_HEIGHT * 1), PDF_BLACK, 0, LINE_HEIGHT, offsets);
             }
             --stream_num;
+        }
+
+        // Logo background
+        if (stream_num == 0)
+            return pdf_add_filled_rectangle(pdf_doc, NULL, 0, PDF_A4_HEIGHT - TOP_MARGIN, PDF_A4_WIDTH, 75, 0, LOGO_BACKGROUND, 0);
+        --stream_num;
 
-            // Letter head (top left)
+        // Letter head (top left) on the first page
+        if (page_num == 0) {
             if (stream_num == 0) {
                 float offsets[2] = {0, LETTERHEAD_WIDTH};
-                return pdf_add_multiple_text_spacing(pdf_doc, NULL, letterhead, letterhead_lines, 1, FONT_SIZE, LETTERHEAD_LEFT_MARGIN, PDF_A4_HEIGHT - TOP_MARGIN - 10 - (LINE_HEIGHT * (stream_num + 1)), PDF_BLACK, 0, LINE_HEIGHT, offsets);
+                return pdf_add_multiple_text_spacing(pdf_doc, NULL, letterhead, letterhead_lines, 1, FONT_SIZE, LETTERHEAD_LEFT_MARGIN, PDF_A4_HEIGHT - TOP_MARGIN - 10 - LINE_HEIGHT, PDF_BLACK, 0, LINE_HEIGHT, offsets);
             }
             --stream_num;
         }
@@ -195,10 +204,9 @@ int init_pdf_generator(WebServerRequest *request,
 
         { // Table lines
             auto table_line_offset = content_offset - (LINE_HEIGHT * 1.2 * (stream_num + 1)) - LINE_HEIGHT * 0.3;
-            auto table_lines = (page_num + 1) == pages_to_be_created ? table_lines_last_page : (page_num == 0 ? TABLE_LINES_FIRST_PAGE : TABLE_LINES_PER_PAGE);
 
             if (stream_num == 0) {
-                return pdf_add_horizontal_lines(pdf_doc, nullptr, LEFT_MARGIN, table_line_offset, PDF_A4_WIDTH - RIGHT_MARGIN, table_line_offset, 0.5, PDF_BLACK, LINE_HEIGHT * 1.2, table_lines, true);
+                return pdf_add_horizontal_lines(pdf_doc, nullptr, LEFT_MARGIN, table_line_offset, PDF_A4_WIDTH - RIGHT_MARGIN, table_line_offset, 0.5, PDF_BLACK, LINE_HEIGHT * 1.2, page_table_line_count, true);
             }
 
             --stream_num;
@@ -207,19 +215,14 @@ int init_pdf_generator(WebServerRequest *request,
         // Table content
         auto table_text_offset = content_offset - (LINE_HEIGHT * 1.2 * (1 + ((int)(stream_num * TABLE_LINES_PER_OBJECT))));
 
-        auto lines = std::min(8, tracked_charges - table_content_placed);
-        table_content_placed += lines;
-
-        const char *lines_string;
-        int lines_generated = table_lines_cb(&lines_string);
-        // TODO: check if lines_generated != lines and if so handle this somehow.
-        (void) lines_generated;
+        int first_line = stream_num * TABLE_LINES_PER_OBJECT;
+        int lines = std::min(TABLE_LINES_PER_OBJECT, page_table_line_count - first_line);
 
-        return pdf_add_multiple_text_spacing(pdf_doc, NULL, lines_string, lines, 6, FONT_SIZE, LEFT_MARGIN, table_text_offset, PDF_BLACK, 0, LINE_HEIGHT * 1.2, table_column_offsets);
+        return pdf_add_multiple_text_spacing(pdf_doc, NULL, skip_table_lines(page_table_lines, first_line), lines, 6, FONT_SIZE, LEFT_MARGIN, table_text_offset, PDF_BLACK, 0, LINE_HEIGHT * 1.2, table_column_offsets);
     });
 
-    pdf_save_file(pdf);
+    int result = pdf_save_file(pdf);
     pdf_destroy(pdf);
 
-    return 0;
+    return result;
 }
@@ -17,17 +17,24 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#pragma once
+
 #include <stdint.h>
 #include <algorithm>
 
 #include "web_server.h"
 
+// Maximum number of table lines requested from table_lines_cb at once.
+#define PDF_TABLE_LINES_PER_PAGE 40
+
+// Pages are written as soon as table_lines_cb delivered their lines.
+// table_lines_cb(&lines, max_lines) returns the number of lines placed in lines and 0 when all lines are done.
+// stats_cb is called after the last table line was requested, so that the stats can cover all lines.
 int init_pdf_generator(WebServerRequest *request,
                        const char *title,
-                       const char *stats,
+                       std::function<const char *(void)> stats_cb,
                        int stats_lines,
                        const char *letterhead,
                        int letterhead_lines,
                        const char *table_header,
-                       uint16_t tracked_charges,
-                       std::function<int(const char **)> table_lines_cb);
+                       std::function<int(const char **, int)> table_lines_cb);
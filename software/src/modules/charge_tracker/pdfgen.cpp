@@ -221,6 +221,8 @@ struct image_t {
 struct page_t {
     uint16_t stream_count;
     uint16_t image_count;
+    // The first deferred_stream_count streams are written after all pages.
+    uint16_t deferred_stream_count;
     int page_number;
 };
 
@@ -248,11 +250,12 @@ struct pdf_doc {
     std::unique_ptr<struct pdf_object[]> objects;
     std::unique_ptr<uint16_t[]> offsets;
     std::vector<int> page_indices;
+    std::vector<uint8_t> page_deferred_stream_counts;
+    std::vector<uint32_t> deferred_offsets;
     size_t objects_in_use = 0;
     size_t offsets_in_use = 0;
     int current_page_id = 0;
     int pages_index = 0;
-    int page_count = 0;
     int first_object_index = 0;
     bool write_error_occurred;
 
@@ -642,30 +645,23 @@ int pdf_set_font(struct pdf_doc *pdf, const char *font)
     return 0;
 }
 
-void pdf_notify_page(struct pdf_doc *pdf, uint32_t stream_count, uint32_t image_count) {
-    if (pdf->pages_index == 0) {
-        pdf->pages_index += pdf->objects_in_use;
-    }
-
-    pdf->pages_index += 1 // page
-                       + stream_count // streams
-                       + image_count * 2;  // images and imagestreams
-
-    ++pdf->page_count;
-}
-
-struct pdf_object *pdf_append_page(struct pdf_doc *pdf, uint32_t stream_count, uint32_t image_count)
+struct pdf_object *pdf_append_page(struct pdf_doc *pdf, uint32_t stream_count, uint32_t image_count, uint32_t deferred_stream_count)
 {
     struct pdf_object *page;
 
+    if (deferred_stream_count > stream_count)
+        return nullptr;
+
     page = pdf_add_object(pdf, OBJ_page);
 
     if (!page)
         return nullptr;
 
     pdf->page_indices.push_back(page->index);
+    pdf->page_deferred_stream_counts.push_back(deferred_stream_count);
     page->page.stream_count = stream_count;
     page->page.image_count = image_count;
+    page->page.deferred_stream_count = deferred_stream_count;
     page->page.page_number = pdf->page_number++;
 
     return page;
@@ -774,6 +770,17 @@ static int pdf_save_object(struct pdf_doc *pdf, int index)
     if (object->type == OBJ_none)
         return -ENOENT;
 
+    if (pdf->offsets_in_use >= PDF_MAX_OBJECTS)
+        return pdf_set_err(pdf, -ENOMEM, "Too many PDF objects");
+
+    // The pages object and deferred streams get their offset in pdf_save_deferred_objects.
+    // No other object can have a distance of 0 to the previous one.
+    if (object->type == OBJ_pages
+     || (object->type == OBJ_stream && object->index - object->page_id - 1 < pdf_get_page(pdf, object)->page.deferred_stream_count)) {
+        pdf->offsets[pdf->offsets_in_use++] = 0;
+        return 0;
+    }
+
     pdf->offsets[pdf->offsets_in_use++] = pdf->write_buf_written - pdf->last_write_buf_written;
     pdf->last_write_buf_written = pdf->write_buf_written;
 
@@ -882,36 +889,13 @@ static int pdf_save_object(struct pdf_doc *pdf, int index)
                 object->font.name);
         break;
 
-    case OBJ_pages: {
-        int npages = 0;
-
-        pdf_printf(pdf, "<<\r\n"
-                    "  /Type /Pages\r\n"
-                    "  /Kids [ ");
-        for(int i : pdf->page_indices) {
-            pdf_printf(pdf, "%d 0 R ", i);
-            npages++;
-        }
-        /*for (struct pdf_object *page = pdf_find_first_object(pdf, OBJ_page); page; page = pdf_find_next_object(pdf, page, OBJ_page)) {
-            npages++;
-            pdf_printf(pdf, "%d 0 R ", page->index);
-        }*/
-
-        pdf_printf(pdf, "]\r\n");
-        pdf_printf(pdf, "  /Count %d\r\n", npages);
-        pdf_printf(pdf, ">>\r\n");
-        break;
-    }
-
     case OBJ_catalog: {
-        struct pdf_object *pages = pdf_find_first_object(pdf, OBJ_pages);
-
         pdf_printf(pdf, "<<\r\n"
                     "  /Type /Catalog\r\n");
         pdf_printf(pdf,
                 "  /Pages %d 0 R\r\n"
                 ">>\r\n",
-                pages->index);
+                pdf->pages_index);
         break;
     }
 
@@ -925,6 +909,40 @@ static int pdf_save_object(struct pdf_doc *pdf, int index)
     return 0;
 }
 
+// Writes the pages object and all deferred streams. Their objects are
+// already gone, but their indices follow from the page indices.
+static int pdf_save_deferred_objects(struct pdf_doc *pdf)
+{
+    pdf->deferred_offsets.push_back(pdf->write_buf_written);
+
+    pdf_printf(pdf, "%d 0 obj\r\n", pdf->pages_index);
+    pdf_printf(pdf, "<<\r\n"
+                "  /Type /Pages\r\n"
+                "  /Kids [ ");
+    for (int i : pdf->page_indices)
+        pdf_printf(pdf, "%d 0 R ", i);
+
+    pdf_printf(pdf, "]\r\n");
+    pdf_printf(pdf, "  /Count %u\r\n", pdf->page_indices.size());
+    pdf_printf(pdf, ">>\r\n");
+    pdf_printf(pdf, "endobj\r\n");
+
+    for (size_t p = 0; p < pdf->page_indices.size(); ++p) {
+        for (uint32_t s = 0; s < pdf->page_deferred_stream_counts[p]; ++s) {
+            if (pdf->write_error_occurred)
+                return -1;
+
+            pdf->deferred_offsets.push_back(pdf->write_buf_written);
+
+            pdf_printf(pdf, "%d 0 obj\r\n", pdf->page_indices[p] + 1 + s);
+            pdf->stream_fn(pdf, p, s);
+            pdf_printf(pdf, "endobj\r\n");
+        }
+    }
+
+    return 0;
+}
+
 // Slightly modified djb2 hash algorithm to get pseudo-random ID
 static uint64_t hash(uint64_t hash, const void *data, size_t len)
 {
@@ -961,12 +979,19 @@ int pdf_save_file(struct pdf_doc *pdf)
             xref_count++;
     }
 
-    pdf->page_indices.reserve(pdf->page_count);
-    for (int p = 0; p < pdf->page_count; ++p) {
+    // Reserve the pages object now: Every page references it, but the number of pages is known only at the end.
+    auto *pages = pdf_add_object(pdf, OBJ_pages);
+    if (!pages) {
+        return -1;
+    }
+    pdf->pages_index = pages->index;
+
+    for (int p = 0; ; ++p) {
         if (pdf->write_error_occurred)
             return -1;
 
-        pdf->page_fn(pdf, p);
+        if (pdf->page_fn(pdf, p) <= 0)
+            break;
 
         // dump page objects
         for (; i < pdf->objects_in_use + pdf->first_object_index; i++) {
@@ -1017,14 +1042,7 @@ int pdf_save_file(struct pdf_doc *pdf)
     }
 */
 
-    // Insert the pages and catalog objects last, we will know all page offsets by now.
-    auto *pages = pdf_add_object(pdf, OBJ_pages);
-    if (!pages) {
-        return -1;
-    }
-    if (pdf_save_object(pdf, pages->index) >= 0)
-        xref_count++;
-
+    // Insert the catalog object last, followed by the deferred objects.
     auto *catalog = pdf_add_object(pdf, OBJ_catalog);
     if (!catalog) {
         return -1;
@@ -1032,13 +1050,21 @@ int pdf_save_file(struct pdf_doc *pdf)
     if (pdf_save_object(pdf, catalog->index) >= 0)
         xref_count++;
 
+    if (pdf_save_deferred_objects(pdf) < 0)
+        return -1;
+
     /* xref */
     xref_offset = pdf->write_buf_written;
     pdf_printf(pdf, "xref\r\n");
     pdf_printf(pdf, "0 %d\r\n", xref_count + 1);
     pdf_printf(pdf, "0000000000 65535 f\r\n");
     int offset = 0;
+    size_t deferred = 0;
     for (int o = 0; o < pdf->offsets_in_use; o++) {
+        if (pdf->offsets[o] == 0) {
+            pdf_printf(pdf, "%10.10" PRIu32 " 00000 n\r\n", pdf->deferred_offsets[deferred++]);
+            continue;
+        }
         offset += pdf->offsets[o];
         pdf_printf(pdf, "%10.10d 00000 n\r\n", offset);
     }
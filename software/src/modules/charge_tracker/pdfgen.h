@@ -300,14 +300,19 @@ float pdf_page_width(const struct pdf_object *page);
 /**
  * Add a new page to the given pdf
  * @param pdf PDF document to append page to
+ * @param stream_count Number of streams of the page
+ * @param image_count Number of images of the page
+ * @param deferred_stream_count Number of streams at the start of the page
+ *  that are written after all pages, for content that depends on the whole document
  * @return new page object
  */
-struct pdf_object *pdf_append_page(struct pdf_doc *pdf, uint32_t stream_count, uint32_t image_count);
+struct pdf_object *pdf_append_page(struct pdf_doc *pdf, uint32_t stream_count, uint32_t image_count, uint32_t deferred_stream_count = 0);
 
 /**
- * Save the given pdf document to the given FILE output
+ * Save the given pdf document to the write callback.
+ * Pages are requested from the page callback until it returns 0
+ * and written as soon as they are appended.
  * @param pdf PDF document to save
- * @param fp FILE pointer to store the data into (must be writable)
  * @return < 0 on failure, >= 0 on success
  */
 int pdf_save_file(struct pdf_doc *pdf);
@@ -439,10 +444,9 @@ int pdf_add_png_image_data(struct pdf_doc *pdf, struct pdf_object *page, float x
 int pdf_add_write_callback(struct pdf_doc *pdf, std::function<ssize_t(const void *buf, size_t len)> cb);
 int pdf_add_stream_callback(struct pdf_doc *pdf, std::function<int(struct pdf_doc *pdf, uint32_t page_num, uint32_t stream_num)> cb);
 int pdf_add_image_callback(struct pdf_doc *pdf, std::function<int(struct pdf_doc *pdf, uint32_t page_num, uint32_t image_num)> cb);
+// The page callback returns > 0 after appending a page and 0 when the document is complete.
 int pdf_add_page_callback(struct pdf_doc *pdf, std::function<int(struct pdf_doc *pdf, uint32_t page_num)> cb);
 
-void pdf_notify_page(struct pdf_doc *pdf, uint32_t stream_count, uint32_t image_count);
-
 /*int pdf_add_image(struct pdf_doc *pdf, struct pdf_object *page,
                          struct pdf_object *image, float x, float y,
                          float width, float height);*/
@@ -42,6 +42,23 @@
 
 extern CMNetworking cm_networking;
 
+void CMNetworking::pre_setup()
+{
+    rx_stats = Config::Object({
+        {"unknown_sender", Config::Uint32(0)},
+        {"queue_drops", Config::Uint32(0)},
+        {"chargers", Config::Array(
+            {},
+            new Config{Config::Object({
+                {"rx", Config::Uint32(0)},
+                {"dropped", Config::Uint32(0)},
+                {"rate", Config::Float(0)} // packets per second
+            })},
+            0, MAX_CONTROLLED_CHARGERS, Config::type_id<Config::ConfObject>()
+        )}
+    });
+}
+
 void CMNetworking::setup()
 {
     mdns_init();
@@ -50,6 +67,8 @@ void CMNetworking::setup()
 
 void CMNetworking::register_urls()
 {
+    api.addState("charge_manager/rx_stats", &rx_stats);
+
     api.addCommand("charge_manager/scan", Config::Null(), {}, [this]() {
         start_scan();
     }, true);
@@ -95,7 +114,12 @@ static void dns_callback(const char *host, const ip_addr_t *ip, void *args)
 
 void CMNetworking::resolve_hostname(uint8_t charger_idx)
 {
-    if ((this->needs_mdns & (1 << charger_idx)) != 0) {
+    if (charger_idx >= charger_count)
+        return;
+
+    CMChargerConnection &conn = connections[charger_idx];
+
+    if (conn.needs_mdns) {
         if (!periodic_scan_task_started)
             task_scheduler.scheduleWithFixedDelay([this](){this->start_scan();}, 0, 60 * 1000);
         periodic_scan_task_started = true;
@@ -103,7 +127,7 @@ void CMNetworking::resolve_hostname(uint8_t charger_idx)
     }
 
     ip_addr_t ip;
-    int err = dns_gethostbyname_addrtype_lwip_ctx(this->hosts[charger_idx], &ip, dns_callback, &resolve_state[charger_idx], LWIP_DNS_ADDRTYPE_IPV4);
+    int err = dns_gethostbyname_addrtype_lwip_ctx(this->hosts[charger_idx], &ip, dns_callback, &conn.resolve_state, LWIP_DNS_ADDRTYPE_IPV4);
 
     if (err == ERR_VAL)
         logger.printfln("Charge manager has charger configured with hostname %s, but no DNS server is configured!", this->hosts[charger_idx]);
@@ -117,7 +141,7 @@ void CMNetworking::resolve_hostname(uint8_t charger_idx)
     std::memcpy(&in, &ip.u_addr, sizeof(ip4_addr_t));
 
     std::lock_guard<std::mutex> lock{dns_resolve_mutex};
-    if (resolve_state[charger_idx] != RESOLVE_STATE_RESOLVED || dest_addrs[charger_idx].sin_addr.s_addr != in) {
+    if (conn.resolve_state != RESOLVE_STATE_RESOLVED || conn.dest_addr.sin_addr.s_addr != in) {
         const char *ip_str = ipaddr_ntoa(&ip);
         // Show resolved hostname only if it wasn't already an IP
         if (strcmp(this->hosts[charger_idx], ip_str) != 0) {
@@ -125,13 +149,13 @@ void CMNetworking::resolve_hostname(uint8_t charger_idx)
         }
     }
 
-    dest_addrs[charger_idx].sin_addr.s_addr = in;
-    resolve_state[charger_idx] = RESOLVE_STATE_RESOLVED;
+    set_dest_addr(charger_idx, in);
+    conn.resolve_state = RESOLVE_STATE_RESOLVED;
 }
 
 bool CMNetworking::is_resolved(uint8_t charger_idx)
 {
-    return resolve_state[charger_idx] == RESOLVE_STATE_RESOLVED;
+    return charger_idx < charger_count && connections[charger_idx].resolve_state == RESOLVE_STATE_RESOLVED;
 }
 
 void CMNetworking::clear_cached_hostname(uint8_t charger_idx)
@@ -235,18 +259,20 @@ void CMNetworking::resolve_via_mdns(mdns_result_t *entry)
 {
     if (entry->addr && entry->addr->addr.type == IPADDR_TYPE_V4) {
         for (size_t i = 0; i < charger_count; ++i) {
-            if ((this->needs_mdns & (1 << i)) == 0)
+            CMChargerConnection &conn = this->connections[i];
+
+            if (!conn.needs_mdns)
                 continue;
 
             String host = String(this->hosts[i]);
             host = host.substring(0, host.length() - 6);
 
             if (host == entry->hostname) {
-                this->dest_addrs[i].sin_addr.s_addr = entry->addr->addr.u_addr.ip4.addr;
-                if (this->resolve_state[i] != RESOLVE_STATE_RESOLVED) {
+                this->set_dest_addr(i, entry->addr->addr.u_addr.ip4.addr);
+                if (conn.resolve_state != RESOLVE_STATE_RESOLVED) {
                     logger.printfln("Resolved %s to %s (via mDNS scan)", this->hosts[i], ipaddr_ntoa((const ip_addr*)&entry->addr->addr));
                 }
-                this->resolve_state[i] = RESOLVE_STATE_RESOLVED;
+                conn.resolve_state = RESOLVE_STATE_RESOLVED;
             }
         }
     }
@@ -33,29 +33,56 @@
 #include <functional>
 
 #if defined(BOARD_HAS_PSRAM)
-#define MAX_CONTROLLED_CHARGERS 32
+#define MAX_CONTROLLED_CHARGERS 128
 #else
 #define MAX_CONTROLLED_CHARGERS 10
 #endif
 
 struct cm_state_v1;
 struct cm_state_v2;
+struct cm_state_v3;
+struct cm_state_packet;
+
+// Client side of the protocol: Receives commands from a manager and sends
+// state packets back to the address the last valid command came from.
+struct CMClientLink {
+    int sock = -1;
+    bool manager_addr_valid = false;
+    struct sockaddr_storage manager_addr;
+    uint32_t last_successful_recv = 0;
+    uint16_t last_seen_seq_num = 255;
+    uint16_t next_seq_num = 0;
+};
+
+struct CMChargerConnection {
+    struct sockaddr_in dest_addr;
+    uint32_t rx_packets;
+    // Packets that failed validation, were stale or reported that management is disabled.
+    uint32_t rx_dropped;
+    uint32_t rx_packets_last_stats;
+    uint16_t last_seen_seq_num;
+    uint8_t resolve_state;
+    bool needs_mdns;
+};
 
 class CMNetworking final : public IModule
 {
 public:
     CMNetworking(){}
+    void pre_setup() override;
     void setup() override;
     void register_urls() override;
 
     int create_socket(uint16_t port, bool blocking);
 
-    void register_manager(const char *const *const hosts,
+    // Returns false if the manager could not be started, for example because
+    // the per-charger state could not be allocated.
+    bool register_manager(const char *const *const hosts,
                           int charger_count,
-                          std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *)> manager_callback,
+                          std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *, cm_state_v3 *)> manager_callback,
                           std::function<void(uint8_t, uint8_t)> manager_error_callback);
 
-    bool send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_disconnect_requested);
+    bool send_manager_update(uint8_t client_id, uint32_t allocated_current, bool cp_disconnect_requested);
 
     void register_client(std::function<void(uint16_t, bool)> client_callback);
     bool send_client_update(uint32_t esp32_uid,
@@ -70,6 +97,11 @@ public:
                             bool managed,
                             bool cp_disconnected_state);
 
+    // Lets a charge manager act as a client of a parent manager. The port must
+    // differ from CHARGE_MANAGEMENT_PORT if this device is a managed charger too.
+    void register_uplink(uint16_t port, std::function<void(uint32_t, bool)> uplink_callback);
+    bool send_uplink_update(const cm_state_v1 *v1, const cm_state_v2 *v2, const cm_state_v3 *v3);
+
     bool get_scan_results(CoolString &result);
 
     void resolve_hostname(uint8_t charger_idx);
@@ -87,24 +119,41 @@ public:
     std::mutex dns_resolve_mutex;
     mdns_result_t *scan_results = nullptr;
 
+    ConfigRoot rx_stats;
+
 private:
-    int manager_sock;
+    int manager_sock = -1;
 
     #define RESOLVE_STATE_UNKNOWN 0
     #define RESOLVE_STATE_NOT_RESOLVED 1
     #define RESOLVE_STATE_RESOLVED 2
 
-    uint8_t resolve_state[MAX_CONTROLLED_CHARGERS] = {};
-    struct sockaddr_in dest_addrs[MAX_CONTROLLED_CHARGERS] = {};
+    // Allocated for charger_count chargers in register_manager.
+    CMChargerConnection *connections = nullptr;
     const char *const *hosts = nullptr;
     int charger_count = 0;
-    // one bit per charger
-    uint32_t needs_mdns = 0;
-    static_assert(MAX_CONTROLLED_CHARGERS <= 32);
 
-    int client_sock;
-    bool manager_addr_valid = false;
-    struct sockaddr_storage manager_addr;
+    // Maps a charger's IPv4 address to its index to identify the source of
+    // a state packet. Open addressing with linear probing; entries store
+    // the charger index + 1, 0 marks an empty slot. Rebuilt on the next
+    // lookup after a charger's address changed.
+    uint8_t *addr_index = nullptr;
+    uint32_t addr_index_bits = 0;
+    bool addr_index_dirty = true;
+    static_assert(MAX_CONTROLLED_CHARGERS < 255);
+
+    void set_dest_addr(uint8_t charger_idx, in_addr_t addr);
+    void rebuild_addr_index();
+    int find_charger_idx(const struct sockaddr_in *addr);
+    void update_rx_stats(uint32_t queue_drops, uint32_t interval_ms);
+
+    uint32_t rx_unknown_sender = 0;
+
+    CMClientLink client_link;
+    CMClientLink uplink;
+
+    void register_client_link(CMClientLink *link, uint16_t port, std::function<void(uint32_t, bool)> &&callback);
+    bool send_state_packet(CMClientLink *link, cm_state_packet *state_pkt);
 
     void start_scan();
     bool mdns_result_is_charger(mdns_result_t *entry, const char **ret_version, const char **ret_enabled, const char **ret_display_name);
@@ -25,8 +25,8 @@
 #define CHARGE_MANAGEMENT_PORT (CHARGE_MANAGER_PORT + 1)
 
 // Increment when changing packet structs
-#define CM_COMMAND_VERSION 1
-#define CM_STATE_VERSION 2
+#define CM_COMMAND_VERSION 2
+#define CM_STATE_VERSION 3
 
 // Minimum protocol version supported
 #define CM_COMMAND_VERSION_MIN 1
@@ -67,13 +67,23 @@ struct [[gnu::packed]] cm_command_v1 {
 #define CM_COMMAND_V1_LENGTH (sizeof(cm_command_v1))
 static_assert(CM_COMMAND_V1_LENGTH == 4);
 
+// Sub-managers aggregate the current of several chargers,
+// which does not fit into the 16 bit fields of v1.
+struct [[gnu::packed]] cm_command_v2 {
+    uint32_t allocated_current;
+};
+
+#define CM_COMMAND_V2_LENGTH (sizeof(cm_command_v2))
+static_assert(CM_COMMAND_V2_LENGTH == 4);
+
 struct [[gnu::packed]] cm_command_packet {
     cm_packet_header header;
     cm_command_v1 v1;
+    cm_command_v2 v2;
 };
 
 #define CM_COMMAND_PACKET_LENGTH (sizeof(cm_command_packet))
-static_assert(CM_COMMAND_PACKET_LENGTH == 12);
+static_assert(CM_COMMAND_PACKET_LENGTH == 16);
 
 #define CM_FEATURE_FLAGS_CP_DISCONNECT_BIT_POS 6
 #define CM_FEATURE_FLAGS_CP_DISCONNECT_MASK (1 << CM_FEATURE_FLAGS_CP_DISCONNECT_BIT_POS)
@@ -178,11 +188,21 @@ struct [[gnu::packed]] cm_state_v2 {
 #define CM_STATE_V2_LENGTH (sizeof(cm_state_v2))
 static_assert(CM_STATE_V2_LENGTH == 4, "Unexpected CM_STATE_V2_LENGTH");
 
+// Unclamped versions of the v1 currents. v1 carries the same values, clamped to 65535 mA.
+struct [[gnu::packed]] cm_state_v3 {
+    uint32_t allowed_charging_current;
+    uint32_t supported_current;
+};
+
+#define CM_STATE_V3_LENGTH (sizeof(cm_state_v3))
+static_assert(CM_STATE_V3_LENGTH == 8, "Unexpected CM_STATE_V3_LENGTH");
+
 struct [[gnu::packed]] cm_state_packet {
     cm_packet_header header;
     cm_state_v1 v1;
     cm_state_v2 v2;
+    cm_state_v3 v3;
 };
 
 #define CM_STATE_PACKET_LENGTH (sizeof(cm_state_packet))
-static_assert(CM_STATE_PACKET_LENGTH == 84, "Unexpected CM_STATE_PACKET_LENGTH");
+static_assert(CM_STATE_PACKET_LENGTH == 92, "Unexpected CM_STATE_PACKET_LENGTH");
@@ -34,6 +34,7 @@
 #include "lwip/opt.h"
 #include "lwip/dns.h"
 #include <cstring>
+#include <algorithm>
 
 int CMNetworking::create_socket(uint16_t port, bool blocking)
 {
@@ -77,6 +78,7 @@ int CMNetworking::create_socket(uint16_t port, bool blocking)
 static const uint8_t cm_command_packet_length_versions[] = {
     sizeof(struct cm_packet_header),
     sizeof(struct cm_packet_header) + sizeof(struct cm_command_v1),
+    sizeof(struct cm_packet_header) + sizeof(struct cm_command_v1) + sizeof(struct cm_command_v2),
 };
 static_assert(ARRAY_SIZE(cm_command_packet_length_versions) == (CM_COMMAND_VERSION + 1), "Unexpected amount of command packet length versions.");
 
@@ -84,6 +86,7 @@ static const uint8_t cm_state_packet_length_versions[] = {
     sizeof(struct cm_packet_header),
     sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1),
     sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1) + sizeof(struct cm_state_v2),
+    sizeof(struct cm_packet_header) + sizeof(struct cm_state_v1) + sizeof(struct cm_state_v2) + sizeof(struct cm_state_v3),
 };
 static_assert(ARRAY_SIZE(cm_state_packet_length_versions) == (CM_STATE_VERSION + 1), "Unexpected amount of state packet length versions.");
 
@@ -161,6 +164,8 @@ static bool endswith(const char *haystack, const char *needle)
 struct ManagerTaskArgs {
     int manager_sock;
     QueueHandle_t manager_queue;
+    // Only written by the receive task.
+    uint32_t queue_drops;
 };
 
 struct ManagerQueueItem {
@@ -183,8 +188,9 @@ static void manager_task(void *arg)
     ManagerQueueItem item;
     memset(&item, 0, sizeof(ManagerQueueItem));
 
-    auto manager_sock = ((ManagerTaskArgs *)arg)->manager_sock;
-    auto manager_queue = ((ManagerTaskArgs *)arg)->manager_queue;
+    auto args = (ManagerTaskArgs *)arg;
+    auto manager_sock = args->manager_sock;
+    auto manager_queue = args->manager_queue;
 
     for (;;) {
         socklen_t socklen = sizeof(item.source_addr);
@@ -193,32 +199,166 @@ static void manager_task(void *arg)
             item.len = -errno;
 
         // If the queue is full, just drop the item.
-        xQueueSendToBack(manager_queue, &item, 0);
+        if (xQueueSendToBack(manager_queue, &item, 0) != pdTRUE)
+            ++args->queue_drops;
     }
 }
 
-void CMNetworking::register_manager(const char *const *const hosts,
+// Fibonacci hashing: The high bits of the product depend on all bits of the address.
+static uint32_t hash_addr(in_addr_t addr, in_port_t port, uint32_t bits)
+{
+    return ((static_cast<uint32_t>(addr) ^ (static_cast<uint32_t>(port) << 16)) * 2654435769u) >> (32 - bits);
+}
+
+static bool same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+void CMNetworking::set_dest_addr(uint8_t charger_idx, in_addr_t addr)
+{
+    if (connections[charger_idx].dest_addr.sin_addr.s_addr == addr)
+        return;
+
+    connections[charger_idx].dest_addr.sin_addr.s_addr = addr;
+    addr_index_dirty = true;
+}
+
+void CMNetworking::rebuild_addr_index()
+{
+    uint32_t mask = (1u << addr_index_bits) - 1;
+
+    memset(addr_index, 0, mask + 1);
+
+    for (int idx = 0; idx < charger_count; ++idx) {
+        const struct sockaddr_in *addr = &connections[idx].dest_addr;
+
+        // Not resolved yet.
+        if (addr->sin_addr.s_addr == 0)
+            continue;
+
+        uint32_t slot = hash_addr(addr->sin_addr.s_addr, addr->sin_port, addr_index_bits);
+
+        // If two chargers resolve to the same address, the first one wins, as with a linear search.
+        while (addr_index[slot] != 0 && !same_addr(&connections[addr_index[slot] - 1].dest_addr, addr))
+            slot = (slot + 1) & mask;
+
+        if (addr_index[slot] == 0)
+            addr_index[slot] = static_cast<uint8_t>(idx + 1);
+    }
+
+    addr_index_dirty = false;
+}
+
+int CMNetworking::find_charger_idx(const struct sockaddr_in *addr)
+{
+    if (addr_index_dirty)
+        rebuild_addr_index();
+
+    uint32_t mask = (1u << addr_index_bits) - 1;
+    uint32_t slot = hash_addr(addr->sin_addr.s_addr, addr->sin_port, addr_index_bits);
+
+    // The table is at most half full, so there is always an empty slot.
+    while (addr_index[slot] != 0) {
+        const struct sockaddr_in *dest_addr = &connections[addr_index[slot] - 1].dest_addr;
+
+        if (same_addr(dest_addr, addr))
+            return addr->sin_family == dest_addr->sin_family ? addr_index[slot] - 1 : -1;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return -1;
+}
+
+void CMNetworking::update_rx_stats(uint32_t queue_drops, uint32_t interval_ms)
+{
+    rx_stats.get("unknown_sender")->updateUint(rx_unknown_sender);
+    rx_stats.get("queue_drops")->updateUint(queue_drops);
+
+    for (int idx = 0; idx < charger_count; ++idx) {
+        CMChargerConnection &conn = connections[idx];
+        Config *charger = static_cast<Config *>(rx_stats.get("chargers")->get(static_cast<size_t>(idx)));
+
+        charger->get("rx")->updateUint(conn.rx_packets);
+        charger->get("dropped")->updateUint(conn.rx_dropped);
+        charger->get("rate")->updateFloat(static_cast<float>(conn.rx_packets - conn.rx_packets_last_stats) * 1000.0f / static_cast<float>(interval_ms));
+
+        conn.rx_packets_last_stats = conn.rx_packets;
+    }
+}
+
+bool CMNetworking::register_manager(const char *const *const hosts,
                                     int charger_count,
-                                    std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *)> manager_callback,
+                                    std::function<void(uint8_t /* client_id */, cm_state_v1 *, cm_state_v2 *, cm_state_v3 *)> manager_callback,
                                     std::function<void(uint8_t, uint8_t)> manager_error_callback)
 {
-    this->hosts = hosts;
+    // Hosts can have a port suffix, for example for sub-managers,
+    // which receive commands on a different port, or to run several
+    // instances on one machine. Resolve only the host name part.
+    auto host_names = heap_alloc_array<const char *>(static_cast<size_t>(charger_count));
+    auto ports = heap_alloc_array<uint16_t>(static_cast<size_t>(charger_count));
+
+    for (int i = 0; i < charger_count; ++i) {
+        host_names[i] = hosts[i];
+        ports[i] = CHARGE_MANAGEMENT_PORT;
+
+        const char *colon = strrchr(hosts[i], ':');
+
+        // IPv6 addresses are not supported, so any colon starts a port.
+        if (colon == nullptr || colon == hosts[i] || colon[1] == '\0')
+            continue;
+
+        char *end;
+        unsigned long port = strtoul(colon + 1, &end, 10);
+
+        if (*end != '\0' || port == 0 || port > 65535) {
+            logger.printfln("cm_protocol: Ignoring invalid port in host %s", hosts[i]);
+            continue;
+        }
+
+        // Leaked intentionally: The manager runs until reboot.
+        host_names[i] = strndup(hosts[i], static_cast<size_t>(colon - hosts[i]));
+        ports[i] = static_cast<uint16_t>(port);
+    }
+
+    this->hosts = host_names.release();
+
+    // Twice as many slots as chargers keeps the probe sequences short.
+    addr_index_bits = 1;
+    while ((1u << addr_index_bits) < static_cast<uint32_t>(charger_count) * 2)
+        ++addr_index_bits;
+
+    connections = static_cast<CMChargerConnection *>(heap_caps_calloc_prefer(charger_count, sizeof(CMChargerConnection), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
+    addr_index = static_cast<uint8_t *>(heap_caps_calloc_prefer(1u << addr_index_bits, sizeof(uint8_t), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
+    if (connections == nullptr || addr_index == nullptr) {
+        logger.printfln("cm_protocol: Failed to allocate charger connections");
+        free(connections);
+        free(addr_index);
+        connections = nullptr;
+        addr_index = nullptr;
+        return false;
+    }
+
     this->charger_count = charger_count;
 
     for (int i = 0; i < charger_count; ++i) {
-        if (endswith(hosts[i], ".local"))
-            needs_mdns |= 1 << i;
-
-        dest_addrs[i].sin_addr.s_addr = 0;
-        resolve_state[i] = RESOLVE_STATE_UNKNOWN;
-        resolve_hostname(i);
-        dest_addrs[i].sin_family = AF_INET;
-        dest_addrs[i].sin_port = htons(CHARGE_MANAGEMENT_PORT);
+        CMChargerConnection &conn = connections[i];
+
+        conn.needs_mdns = endswith(this->hosts[i], ".local");
+        conn.last_seen_seq_num = 0xFFFF;
+        conn.dest_addr.sin_addr.s_addr = 0;
+        conn.resolve_state = RESOLVE_STATE_UNKNOWN;
+        conn.dest_addr.sin_family = AF_INET;
+        conn.dest_addr.sin_port = htons(ports[i]);
+        resolve_hostname(static_cast<uint8_t>(i));
+
+        rx_stats.get("chargers")->add();
     }
 
     manager_sock = create_socket(CHARGE_MANAGER_PORT, true);
     if (manager_sock < 0)
-        return;
+        return false;
 
     // LWIP stores LWIP_UDP_RECVMBOX_SIZE (configured to 6)
     // UDP packets in the socket's receive buffer.
@@ -230,14 +370,14 @@ void CMNetworking::register_manager(const char *const *const hosts,
     ManagerTaskData *task_data = static_cast<ManagerTaskData *>(heap_caps_calloc(1, sizeof(ManagerTaskData), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
     if (!task_data) {
         logger.printfln("cm_protocol: Failed to allocate task data");
-        return;
+        return false;
     }
 
     uint8_t *queue_storage = static_cast<uint8_t *>(heap_caps_calloc_prefer(this->charger_count, sizeof(ManagerQueueItem), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
     if (!queue_storage) {
         logger.printfln("cm_protocol: Failed to allocate queue storage");
         free(task_data);
-        return;
+        return false;
     }
 
     QueueHandle_t manager_queue = xQueueCreateStatic(
@@ -248,6 +388,7 @@ void CMNetworking::register_manager(const char *const *const hosts,
 
     task_data->args.manager_sock  = manager_sock;
     task_data->args.manager_queue = manager_queue;
+    task_data->args.queue_drops   = 0;
 
     TaskHandle_t xTask = xTaskCreateStatic(
         manager_task,
@@ -265,19 +406,11 @@ void CMNetworking::register_manager(const char *const *const hosts,
     #endif
 
     task_scheduler.scheduleWithFixedDelay([this, manager_callback, manager_error_callback, manager_queue](){
-        static uint16_t last_seen_seq_num[MAX_CONTROLLED_CHARGERS];
-        static bool initialized = false;
-        if (!initialized) {
-            memset(last_seen_seq_num, 255, sizeof(last_seen_seq_num));
-            initialized = true;
-        }
-
         ManagerQueueItem item;
 
-        // Try to receive up to four packets in one go to catch up on the backlog.
-        // Don't receive every available packet to smooth out bursts of packets.
-        static_assert(MAX_CONTROLLED_CHARGERS <= 32);
-        for (int poll_ctr = 0; poll_ctr < 4; ++poll_ctr) {
+        // Drain at most as many packets as the queue holds, so that a burst
+        // can't keep the main loop busy, but a full queue is always emptied.
+        for (int poll_ctr = 0; poll_ctr < this->charger_count; ++poll_ctr) {
             if (!xQueueReceive(manager_queue, &item, 0))
                 return;
 
@@ -288,65 +421,75 @@ void CMNetworking::register_manager(const char *const *const hosts,
             if (len < 0) {
                 if (len != -EAGAIN && len != -EWOULDBLOCK)
                     logger.printfln("recvfrom failed: %s", strerror(-len));
-                return;
+                continue;
             }
 
-            int charger_idx = -1;
-            for(int idx = 0; idx < this->charger_count; ++idx)
-                if (source_addr.sin_family == dest_addrs[idx].sin_family &&
-                    source_addr.sin_port == dest_addrs[idx].sin_port &&
-                    source_addr.sin_addr.s_addr == dest_addrs[idx].sin_addr.s_addr) {
-                        charger_idx = idx;
-                        break;
-                }
+            int charger_idx = find_charger_idx(&source_addr);
 
             // Don't log in the first 20 seconds after startup: We are probably still resolving hostnames.
             if (charger_idx == -1) {
+                ++rx_unknown_sender;
                 if (deadline_elapsed(20000))
                     logger.printfln("Received packet from unknown %s. Is the config complete?", inet_ntoa(source_addr.sin_addr));
-                return;
+                continue;
             }
 
+            CMChargerConnection &conn = connections[charger_idx];
+
             String validation_error = validate_state_packet_header(&state_pkt, len);
             if (!validation_error.isEmpty()) {
+                ++conn.rx_dropped;
                 logger.printfln("Received state packet from %s (%s) (%i bytes) failed validation: %s",
                                 charge_manager.get_charger_name(charger_idx),
                                 inet_ntoa(source_addr.sin_addr),
                                 len,
                                 validation_error.c_str());
                 manager_error_callback(charger_idx, CM_NETWORKING_ERROR_INVALID_HEADER);
-                return;
+                continue;
             }
 
-            if (seq_num_invalid(state_pkt.header.seq_num, last_seen_seq_num[charger_idx])) {
+            if (seq_num_invalid(state_pkt.header.seq_num, conn.last_seen_seq_num)) {
+                ++conn.rx_dropped;
                 logger.printfln("Received stale (out of order?) state packet from %s (%s). Last seen seq_num is %u, Received seq_num is %u",
                                 charge_manager.get_charger_name(charger_idx),
                                 inet_ntoa(source_addr.sin_addr),
-                                last_seen_seq_num[charger_idx],
+                                conn.last_seen_seq_num,
                                 state_pkt.header.seq_num);
-                return;
+                continue;
             }
 
-            last_seen_seq_num[charger_idx] = state_pkt.header.seq_num;
+            conn.last_seen_seq_num = state_pkt.header.seq_num;
 
             if (!CM_STATE_FLAGS_MANAGED_IS_SET(state_pkt.v1.state_flags)) {
+                ++conn.rx_dropped;
                 manager_error_callback(charger_idx, CM_NETWORKING_ERROR_NOT_MANAGED);
                 logger.printfln("%s (%s) reports managed is not activated!",
                     charge_manager.get_charger_name(charger_idx),
                     inet_ntoa(source_addr.sin_addr));
-                return;
+                continue;
             }
 
-            manager_callback(charger_idx, &state_pkt.v1, state_pkt.header.version >= 2 ? &state_pkt.v2 : nullptr);
+            ++conn.rx_packets;
+
+            manager_callback(charger_idx,
+                             &state_pkt.v1,
+                             state_pkt.header.version >= 2 ? &state_pkt.v2 : nullptr,
+                             state_pkt.header.version >= 3 ? &state_pkt.v3 : nullptr);
         }
     }, 100, 100);
+
+    task_scheduler.scheduleWithFixedDelay([this, task_data](){
+        update_rx_stats(task_data->args.queue_drops, 10000);
+    }, 10000, 10000);
+
+    return true;
 }
 
-bool CMNetworking::send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_disconnect_requested)
+bool CMNetworking::send_manager_update(uint8_t client_id, uint32_t allocated_current, bool cp_disconnect_requested)
 {
     static uint16_t next_seq_num = 1;
 
-    if (manager_sock < 0)
+    if (manager_sock < 0 || connections == nullptr)
         return true;
 
     resolve_hostname(client_id);
@@ -360,10 +503,11 @@ bool CMNetworking::send_manager_update(uint8_t client_id, uint16_t allocated_cur
     ++next_seq_num;
     command_pkt.header.version = CM_COMMAND_VERSION;
 
-    command_pkt.v1.allocated_current = allocated_current;
+    command_pkt.v1.allocated_current = static_cast<uint16_t>(std::min<uint32_t>(allocated_current, 65535));
     command_pkt.v1.command_flags = cp_disconnect_requested << CM_COMMAND_FLAGS_CPPDISC_BIT_POS;
+    command_pkt.v2.allocated_current = allocated_current;
 
-    int err = sendto(manager_sock, &command_pkt, sizeof(command_pkt), MSG_DONTWAIT, (sockaddr *)&dest_addrs[client_id], sizeof(dest_addrs[client_id]));
+    int err = sendto(manager_sock, &command_pkt, sizeof(command_pkt), MSG_DONTWAIT, (sockaddr *)&connections[client_id].dest_addr, sizeof(connections[client_id].dest_addr));
 
     if (err < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -386,22 +530,36 @@ bool CMNetworking::send_manager_update(uint8_t client_id, uint16_t allocated_cur
 
 void CMNetworking::register_client(std::function<void(uint16_t, bool)> client_callback)
 {
-    client_sock = create_socket(CHARGE_MANAGEMENT_PORT, false);
+    // Chargers support at most 32 A, so the v1 current is sufficient.
+    register_client_link(&client_link, CHARGE_MANAGEMENT_PORT, [client_callback](uint32_t allocated_current, bool cp_disconnect_requested) {
+        client_callback(static_cast<uint16_t>(std::min<uint32_t>(allocated_current, 65535)), cp_disconnect_requested);
+    });
+}
 
-    if (client_sock < 0)
-        return;
+void CMNetworking::register_uplink(uint16_t port, std::function<void(uint32_t, bool)> uplink_callback)
+{
+    register_client_link(&uplink, port, std::move(uplink_callback));
+}
+
+void CMNetworking::register_client_link(CMClientLink *link, uint16_t port, std::function<void(uint32_t, bool)> &&callback)
+{
+    link->sock = create_socket(port, false);
 
-    memset(&manager_addr, 0, sizeof(manager_addr));
+    if (link->sock < 0)
+        return;
 
-    task_scheduler.scheduleWithFixedDelay([this, client_callback](){
-        static uint16_t last_seen_seq_num = 255;
-        static uint32_t last_successful_recv = millis();
+    memset(&link->manager_addr, 0, sizeof(link->manager_addr));
+    link->manager_addr_valid = false;
+    link->last_seen_seq_num = 255;
+    link->last_successful_recv = millis();
+    link->next_seq_num = 0;
 
+    task_scheduler.scheduleWithFixedDelay([link, callback](){
         struct cm_command_packet command_pkt;
 
         struct sockaddr_storage temp_addr;
         socklen_t socklen = sizeof(temp_addr);
-        int len = recvfrom(client_sock, &command_pkt, sizeof(command_pkt), 0, (struct sockaddr *)&temp_addr, &socklen);
+        int len = recvfrom(link->sock, &command_pkt, sizeof(command_pkt), 0, (struct sockaddr *)&temp_addr, &socklen);
 
         if (len < 0) {
             if (errno != EAGAIN && errno != EWOULDBLOCK)
@@ -409,8 +567,8 @@ void CMNetworking::register_client(std::function<void(uint16_t, bool)> client_ca
 
             // If we have not received a valid packet for one minute, invalidate manager_addr.
             // Otherwise we would send state packets to this address forever.
-            if (deadline_elapsed(last_successful_recv + 60 * 1000))
-                manager_addr_valid = false;
+            if (deadline_elapsed(link->last_successful_recv + 60 * 1000))
+                link->manager_addr_valid = false;
 
             return;
         }
@@ -424,26 +582,28 @@ void CMNetworking::register_client(std::function<void(uint16_t, bool)> client_ca
             return;
         }
 
-        if (seq_num_invalid(command_pkt.header.seq_num, last_seen_seq_num)) {
-            logger.printfln("received stale (out of order?) command packet. last seen seq_num is %u, received seq_num is %u", last_seen_seq_num, command_pkt.header.seq_num);
+        if (seq_num_invalid(command_pkt.header.seq_num, link->last_seen_seq_num)) {
+            logger.printfln("received stale (out of order?) command packet. last seen seq_num is %u, received seq_num is %u", link->last_seen_seq_num, command_pkt.header.seq_num);
             return;
         }
 
-        last_seen_seq_num = command_pkt.header.seq_num;
+        link->last_seen_seq_num = command_pkt.header.seq_num;
 
-        if (manager_addr_valid && memcmp(&manager_addr, &temp_addr, manager_addr.s2_len) != 0) {
+        if (link->manager_addr_valid && memcmp(&link->manager_addr, &temp_addr, link->manager_addr.s2_len) != 0) {
             char manager_str[16];
             char temp_str[16];
-            inet_ntoa_r(((struct sockaddr_in*)&manager_addr)->sin_addr, manager_str, sizeof(manager_str));
-            inet_ntoa_r(((struct sockaddr_in*)&temp_addr   )->sin_addr, temp_str,    sizeof(temp_str   ));
+            inet_ntoa_r(((struct sockaddr_in*)&link->manager_addr)->sin_addr, manager_str, sizeof(manager_str));
+            inet_ntoa_r(((struct sockaddr_in*)&temp_addr         )->sin_addr, temp_str,    sizeof(temp_str   ));
             logger.printfln("cm_networking: Warning: Manager address changed from %s to %s.", manager_str, temp_str);
         }
 
-        last_successful_recv = millis();
-        manager_addr = temp_addr;
-        manager_addr_valid = true;
+        link->last_successful_recv = millis();
+        link->manager_addr = temp_addr;
+        link->manager_addr_valid = true;
+
+        uint32_t allocated_current = command_pkt.header.version >= 2 ? command_pkt.v2.allocated_current : command_pkt.v1.allocated_current;
 
-        client_callback(command_pkt.v1.allocated_current, CM_COMMAND_FLAGS_CPPDISC_IS_SET(command_pkt.v1.command_flags));
+        callback(allocated_current, CM_COMMAND_FLAGS_CPPDISC_IS_SET(command_pkt.v1.command_flags));
         //logger.printfln("Received command packet. Allocated current is %u", command_pkt.v1.allocated_current);
     }, 100, 100);
 }
@@ -460,20 +620,13 @@ bool CMNetworking::send_client_update(uint32_t esp32_uid,
                                       bool managed,
                                       bool cp_disconnected_state)
 {
-    static uint16_t next_seq_num = 0;
-
-    if (!manager_addr_valid) {
+    if (!client_link.manager_addr_valid) {
         //logger.printfln("manager addr not valid.");
         return false;
     }
     //logger.printfln("Sending state packet.");
 
     struct cm_state_packet state_pkt;
-    state_pkt.header.magic = CM_PACKET_MAGIC;
-    state_pkt.header.length = CM_STATE_PACKET_LENGTH;
-    state_pkt.header.seq_num = next_seq_num;
-    ++next_seq_num;
-    state_pkt.header.version = CM_STATE_VERSION;
 
     bool has_meter_values = api.hasFeature("meter_all_values");
     bool has_meter_phases = api.hasFeature("meter_phases");
@@ -539,7 +692,34 @@ bool CMNetworking::send_client_update(uint32_t esp32_uid,
 
     state_pkt.v2.time_since_state_change = time_since_state_change;
 
-    int err = sendto(client_sock, &state_pkt, sizeof(state_pkt), 0, (sockaddr *)&manager_addr, sizeof(manager_addr));
+    state_pkt.v3.allowed_charging_current = allowed_charging_current;
+    state_pkt.v3.supported_current = supported_current;
+
+    return send_state_packet(&client_link, &state_pkt);
+}
+
+bool CMNetworking::send_uplink_update(const cm_state_v1 *v1, const cm_state_v2 *v2, const cm_state_v3 *v3)
+{
+    if (!uplink.manager_addr_valid)
+        return false;
+
+    struct cm_state_packet state_pkt;
+    state_pkt.v1 = *v1;
+    state_pkt.v2 = *v2;
+    state_pkt.v3 = *v3;
+
+    return send_state_packet(&uplink, &state_pkt);
+}
+
+bool CMNetworking::send_state_packet(CMClientLink *link, cm_state_packet *state_pkt)
+{
+    state_pkt->header.magic = CM_PACKET_MAGIC;
+    state_pkt->header.length = CM_STATE_PACKET_LENGTH;
+    state_pkt->header.seq_num = link->next_seq_num;
+    ++link->next_seq_num;
+    state_pkt->header.version = CM_STATE_VERSION;
+
+    int err = sendto(link->sock, state_pkt, sizeof(*state_pkt), 0, (sockaddr *)&link->manager_addr, sizeof(link->manager_addr));
     if (err < 0) {
         if (errno != EAGAIN && errno != EWOULDBLOCK)
             logger.printfln("CM failed to send state: %s (%d)", strerror(errno), errno);
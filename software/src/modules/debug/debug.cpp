@@ -23,6 +23,7 @@
 #include "debug.h"
 
 #include <Arduino.h>
+#include <algorithm>
 #include "esp_debug_helpers.h"
 #include "esp_system.h"
 #include "esp_task.h"
@@ -32,6 +33,7 @@
 #include "soc/spi_reg.h"
 
 #include "api.h"
+#include "heap_profiler.h"
 #include "task_scheduler.h"
 #include "string_builder.h"
 
@@ -165,6 +167,47 @@ void Debug::pre_setup()
     );
 
 
+#ifdef DEBUG_HEAP_PROFILER
+    state_heap_owners = Config::Array({},
+        new Config{Config::Object({
+            {"name",        Config::Str("", 0, 32)},
+            {"live_bytes",  Config::Uint32(0)},
+            {"peak_bytes",  Config::Uint32(0)},
+            {"live_blocks", Config::Uint32(0)},
+            {"allocs",      Config::Uint32(0)},
+        })},
+        0, HEAP_PROFILER_MAX_OWNERS, Config::type_id<Config::ConfObject>()
+    );
+
+    // Owner names are known before the modules' pre_setup.
+    for (size_t i = 0; i < HEAP_PROFILER_MAX_OWNERS; i++) {
+        uint8_t owner = static_cast<uint8_t>(i);
+        const char *name = heap_profiler_get_owner_name(owner);
+
+        if (name == nullptr) {
+            continue;
+        }
+
+        heap_owners.push_back(owner);
+
+        Config *conf = static_cast<Config *>(state_heap_owners.add());
+        conf->get("name")->updateString(name);
+    }
+
+    state_heap_sites = Config::Object({
+        {"untracked_allocs", Config::Uint32(0)},
+        {"sites", Config::Array({},
+            new Config{Config::Object({
+                {"pc",        Config::Uint32(0)},
+                {"caller_pc", Config::Uint32(0)},
+                {"count",     Config::Uint32(0)},
+                {"bytes",     Config::Uint32(0)},
+            })},
+            0, HEAP_PROFILER_MAX_SITES, Config::type_id<Config::ConfObject>()
+        )},
+    });
+#endif
+
     task_handles.reserve(16);
     register_task(xTaskGetCurrentTaskHandle(),      getArduinoLoopTaskStackSize());
     register_task(xTaskGetIdleTaskHandleForCPU(0),  sizeof(StackType_t) * configMINIMAL_STACK_SIZE);
@@ -232,6 +275,10 @@ void Debug::setup()
         this->integrity_check_runs = 0;
         this->integrity_check_runtime_sum = 0;
         this->integrity_check_runtime_max = 0;
+
+#ifdef DEBUG_HEAP_PROFILER
+        this->update_heap_profiler_states();
+#endif
     }, 1000, 1000);
 
     // Don't show HWM changes during the first two minutes after boot.
@@ -244,6 +291,46 @@ void Debug::setup()
     initialized = true;
 }
 
+#ifdef DEBUG_HEAP_PROFILER
+void Debug::update_heap_profiler_states()
+{
+    for (size_t i = 0; i < heap_owners.size(); i++) {
+        HeapProfilerOwnerStats stats;
+        heap_profiler_get_owner_stats(heap_owners[i], &stats);
+
+        Config *conf = static_cast<Config *>(state_heap_owners.get(i));
+        conf->get("live_bytes")->updateUint(stats.live_bytes);
+        conf->get("peak_bytes")->updateUint(stats.peak_bytes);
+        conf->get("live_blocks")->updateUint(stats.live_blocks);
+        conf->get("allocs")->updateUint(stats.allocs);
+    }
+
+    HeapProfilerSite sites[HEAP_PROFILER_MAX_SITES];
+    size_t site_count = heap_profiler_get_sites(sites, ARRAY_SIZE(sites));
+
+    // Largest allocation volume first.
+    std::sort(sites, sites + site_count, [](const HeapProfilerSite &a, const HeapProfilerSite &b) {
+        return a.bytes > b.bytes;
+    });
+
+    state_heap_sites.get("untracked_allocs")->updateUint(heap_profiler_get_untracked_allocs());
+
+    Config *conf_sites = static_cast<Config *>(state_heap_sites.get("sites"));
+
+    while (conf_sites->count() < site_count) {
+        conf_sites->add();
+    }
+
+    for (size_t i = 0; i < site_count; i++) {
+        Config *conf = static_cast<Config *>(conf_sites->get(i));
+        conf->get("pc")->updateUint(sites[i].pc[0]);
+        conf->get("caller_pc")->updateUint(sites[i].pc[1]);
+        conf->get("count")->updateUint(sites[i].count);
+        conf->get("bytes")->updateUint(sites[i].bytes);
+    }
+}
+#endif
+
 #ifdef DEBUG_FS_ENABLE
 const char * const fs_browser_header = "<script>"
 "async function uploadFile() {"
@@ -317,6 +404,10 @@ void Debug::register_urls()
     api.addState("debug/state_fast", &state_fast);
     api.addState("debug/state_slow", &state_slow);
     api.addState("debug/state_hwm", &state_hwm);
+#ifdef DEBUG_HEAP_PROFILER
+    api.addState("debug/heap_owners", &state_heap_owners);
+    api.addState("debug/heap_sites", &state_heap_sites);
+#endif
 
     server.on_HTTPThread("/debug/crash", HTTP_GET, [](WebServerRequest req) {
         esp_system_abort("Crash requested");
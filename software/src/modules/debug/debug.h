@@ -47,6 +47,14 @@ public:
     void register_task(TaskHandle_t handle, uint32_t stack_size);
 
 private:
+#ifdef DEBUG_HEAP_PROFILER
+    void update_heap_profiler_states();
+
+    ConfigRoot state_heap_owners;
+    ConfigRoot state_heap_sites;
+    std::vector<uint8_t> heap_owners; // owner of each entry in state_heap_owners
+#endif
+
     ConfigRoot state_static;
     ConfigRoot state_fast;
     ConfigRoot state_slow;
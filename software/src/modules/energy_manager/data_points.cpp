@@ -27,6 +27,7 @@
 #include <time.h>
 
 #include "event_log.h"
+#include "malloc_tools.h"
 #include "task_scheduler.h"
 
 #define MAX_DATA_AGE 30000 // milliseconds
@@ -35,6 +36,8 @@
 
 //#define DEBUG_LOGGING
 
+static EMHistoryCache history_cache;
+
 static_assert(METERS_SLOTS <= 7, "Too many meters slots");
 
 static const char *get_data_status_string(uint8_t status)
@@ -581,6 +584,9 @@ bool EnergyManager::set_wallbox_5min_data_point(const struct tm *utc, const stru
         uint8_t local_day = local->tm_mday;
         uint8_t local_hour = local->tm_hour;
         uint8_t local_minute = (local->tm_min / 5) * 5;
+
+        history_cache.invalidate({EMHistoryKind::Wallbox5min, local_year, local_month, local_day, uid});
+
         char *buf;
         int buf_written = asprintf(&buf,
                                    "{\"topic\":\"energy_manager/history_wallbox_5min_changed\","
@@ -650,6 +656,8 @@ bool EnergyManager::set_wallbox_daily_data_point(const struct tm *local, uint32_
             snprintf(energy_str, sizeof(energy_str), "%.2f", (double)energy / 100.0); // daWh -> kWh
         }
 
+        history_cache.invalidate({EMHistoryKind::WallboxDaily, year, month, 0, uid});
+
         char *buf;
         int buf_written = asprintf(&buf,
                                    "{\"topic\":\"energy_manager/history_wallbox_daily_changed\","
@@ -734,6 +742,9 @@ bool EnergyManager::set_energy_manager_5min_data_point(const struct tm *utc,
         uint8_t local_day = local->tm_mday;
         uint8_t local_hour = local->tm_hour;
         uint8_t local_minute = (local->tm_min / 5) * 5;
+
+        history_cache.invalidate({EMHistoryKind::EnergyManager5min, local_year, local_month, local_day, 0});
+
         char *buf;
         int buf_written = asprintf(&buf,
                                    "{\"topic\":\"energy_manager/history_energy_manager_5min_changed\","
@@ -826,6 +837,8 @@ bool EnergyManager::set_energy_manager_daily_data_point(const struct tm *local,
             }
         }
 
+        history_cache.invalidate({EMHistoryKind::EnergyManagerDaily, year, month, 0, 0});
+
         char *buf;
         int buf_written = asprintf(&buf,
                                    "{\"topic\":\"energy_manager/history_energy_manager_daily_changed\","
@@ -873,15 +886,388 @@ typedef struct {
     uint8_t utc_end_month;
     uint8_t utc_end_day;
     uint16_t utc_end_slots;
+
+    // history cache fill state
+    bool busy;
+    bool prefetch;
+    uint32_t busy_deadline;
+    EMHistoryCacheKey cache_key;
+    uint32_t cache_generation;
+    uint8_t *cache_buf;
+    uint16_t cache_used;
+    bool cache_overflow;
 } StreamMetadata;
 
-static StreamMetadata metadata_array[4];
+static StreamMetadata metadata_array[EM_HISTORY_KIND_COUNT];
 
 struct [[gnu::packed]] Wallbox5minData {
     uint8_t flags; // bit 0-2 = charger state, bit 7 = no data (read only)
     uint16_t power; // W
 };
 
+struct [[gnu::packed]] EnergyManager5MinData {
+    uint8_t flags; // bit 0 = 1p/3p, bit 1-2 = input, bit 3 = relay, bit 7 = no data
+    int32_t power[7]; // W
+};
+
+// A stream that didn't finish after this time is assumed to be dead.
+#define HISTORY_STREAM_TIMEOUT 5000 // milliseconds
+#define HISTORY_PREFETCH_QUEUE_SIZE 4
+
+// Largest block per kind: 25 hours of 5min data points (day of DST end) or 31 days of daily data points.
+static const uint16_t history_cache_block_sizes[EM_HISTORY_KIND_COUNT] = {
+    25 * 12 * sizeof(Wallbox5minData),
+    31 * sizeof(uint32_t),
+    25 * 12 * sizeof(EnergyManager5MinData),
+    31 * 14 * sizeof(uint32_t),
+};
+
+static std::list<EMHistoryCacheKey> history_prefetch_queue;
+static Ownership history_prefetch_ownership;
+
+// Prefetched blocks only go into the cache, the formatted JSON is discarded.
+class NullChunkedResponse : public IChunkedResponse
+{
+public:
+    void begin(bool /*success*/) {}
+    bool writef(const char * /*fmt*/, ...) { return true; }
+    bool flush() { return true; }
+    void end(String /*error*/) {}
+    void alive() {}
+
+protected:
+    bool write_impl(const char * /*buf*/, size_t /*buf_size*/) { return true; }
+};
+
+static NullChunkedResponse history_prefetch_response;
+
+static bool history_stream_busy(const StreamMetadata *metadata)
+{
+    return metadata->busy && !deadline_elapsed(metadata->busy_deadline);
+}
+
+static void history_stream_start(StreamMetadata *metadata, const EMHistoryCacheKey &key, bool prefetch)
+{
+    metadata->busy = true;
+    metadata->prefetch = prefetch;
+    metadata->busy_deadline = millis() + HISTORY_STREAM_TIMEOUT;
+    metadata->cache_key = key;
+    metadata->cache_generation = history_cache.get_generation();
+    metadata->cache_used = 0;
+    metadata->cache_overflow = false;
+
+    if (metadata->cache_buf == nullptr) {
+        metadata->cache_buf = static_cast<uint8_t *>(malloc_psram(history_cache_block_sizes[static_cast<size_t>(key.kind)]));
+    }
+}
+
+static void history_stream_append(StreamMetadata *metadata, const void *data, uint16_t length)
+{
+    if (metadata->cache_buf == nullptr || metadata->cache_overflow) {
+        return;
+    }
+
+    if (metadata->cache_used + length > history_cache_block_sizes[static_cast<size_t>(metadata->cache_key.kind)]) {
+        metadata->cache_overflow = true;
+        return;
+    }
+
+    memcpy(metadata->cache_buf + metadata->cache_used, data, length);
+    metadata->cache_used += length;
+}
+
+static void history_queue_prefetch(const EMHistoryCacheKey &key)
+{
+    if (history_cache.contains(key)) {
+        return;
+    }
+
+    for (const EMHistoryCacheKey &queued : history_prefetch_queue) {
+        if (queued == key) {
+            return;
+        }
+    }
+
+    if (history_prefetch_queue.size() >= HISTORY_PREFETCH_QUEUE_SIZE) {
+        history_prefetch_queue.pop_front();
+    }
+
+    history_prefetch_queue.push_back(key);
+}
+
+// UIs page through the history one day or month at a time.
+// Read the blocks next to the requested one while the SD card is idle.
+static void history_queue_adjacent_prefetches(const EMHistoryCacheKey &key)
+{
+    if (key.day != 0) {
+        for (int delta : {-1, 1}) {
+            struct tm local;
+
+            memset(&local, 0, sizeof(local));
+
+            local.tm_year = key.year + 100;
+            local.tm_mon = key.month - 1;
+            local.tm_mday = key.day + delta;
+            local.tm_hour = 12;
+            local.tm_isdst = -1;
+
+            time_t t = mktime(&local); // normalizes the date
+
+            if (t > time(nullptr) || local.tm_year < 100) {
+                continue;
+            }
+
+            EMHistoryCacheKey adjacent = key;
+
+            adjacent.year = local.tm_year - 100;
+            adjacent.month = local.tm_mon + 1;
+            adjacent.day = local.tm_mday;
+
+            history_queue_prefetch(adjacent);
+        }
+    }
+    else if (key.year > 0 || key.month > 1) {
+        EMHistoryCacheKey previous = key;
+
+        if (previous.month > 1) {
+            --previous.month;
+        }
+        else {
+            --previous.year;
+            previous.month = 12;
+        }
+
+        history_queue_prefetch(previous);
+    }
+}
+
+static void history_stream_done(StreamMetadata *metadata, bool success)
+{
+    if (!metadata->busy) {
+        return;
+    }
+
+    // Don't cache a block if a data point was written while it was read, it might be incomplete.
+    if (success && !metadata->cache_overflow && metadata->cache_buf != nullptr && metadata->cache_generation == history_cache.get_generation()) {
+        history_cache.put(metadata->cache_key, metadata->cache_buf, metadata->cache_used);
+
+        if (!metadata->prefetch) {
+            history_queue_adjacent_prefetches(metadata->cache_key);
+        }
+    }
+
+    metadata->busy = false;
+    metadata->prefetch = false;
+}
+
+static void normalize_wallbox_5min_data(uint8_t *data, uint16_t length)
+{
+    for (uint16_t i = 0; i + sizeof(Wallbox5minData) <= length; i += sizeof(Wallbox5minData)) {
+        Wallbox5minData *p = (Wallbox5minData *)&data[i];
+
+        if ((p->flags & 0x80 /* no data */) != 0) {
+            p->power = UINT16_MAX;
+        }
+    }
+}
+
+static bool write_wallbox_5min_data(IChunkedResponse *response, const uint8_t *data, uint16_t length)
+{
+    bool write_success = true;
+
+    for (uint16_t i = 0; i < length && write_success; i += sizeof(Wallbox5minData)) {
+        const Wallbox5minData *p = (const Wallbox5minData *)&data[i];
+
+        if ((p->flags & 0x80 /* no data */) == 0) {
+            write_success = response->writef("%u", p->flags);
+        } else {
+            write_success = response->writef("null");
+        }
+
+        if (write_success) {
+            if (p->power != UINT16_MAX) {
+                write_success = response->writef(",%u", p->power);
+            } else {
+                write_success = response->writef(",null");
+            }
+
+            if (write_success && i < length - sizeof(Wallbox5minData)) {
+                write_success = response->write(",");
+            }
+        }
+    }
+
+    return write_success;
+}
+
+static void normalize_energy_manager_5min_data(uint8_t *data, uint16_t length)
+{
+    for (uint16_t i = 0; i + sizeof(EnergyManager5MinData) <= length; i += sizeof(EnergyManager5MinData)) {
+        EnergyManager5MinData *p = (EnergyManager5MinData *)&data[i];
+
+        if ((p->flags & 0x80 /* no data */) != 0) {
+            for (int k = 0; k < 7; ++k) {
+                p->power[k] = INT32_MAX;
+            }
+        }
+    }
+}
+
+static bool write_energy_manager_5min_data(IChunkedResponse *response, const uint8_t *data, uint16_t length)
+{
+    bool write_success = true;
+
+    for (uint16_t i = 0; i < length && write_success; i += sizeof(EnergyManager5MinData)) {
+        const EnergyManager5MinData *p = (const EnergyManager5MinData *)&data[i];
+
+        if ((p->flags & 0x80 /* no data */) == 0) {
+            write_success = response->writef("%u", p->flags);
+        } else {
+            write_success = response->writef("null");
+        }
+
+        if (write_success) {
+            for (int k = 0; k < 7 && write_success; ++k) {
+                if (p->power[k] != INT32_MAX) {
+                    write_success = response->writef(",%d", p->power[k]);
+                } else {
+                    write_success = response->writef(",null");
+                }
+            }
+
+            if (write_success && i < length - sizeof(EnergyManager5MinData)) {
+                write_success = response->write(",");
+            }
+        }
+    }
+
+    return write_success;
+}
+
+static bool write_daily_data(IChunkedResponse *response, const uint32_t *data, uint16_t count)
+{
+    bool write_success = true;
+
+    for (uint16_t i = 0; i < count && write_success; ++i) {
+        if (data[i] != UINT32_MAX) {
+            write_success = response->writef("%.2f", (double)data[i] / 100.0); // daWh -> kWh
+        } else {
+            write_success = response->write("null");
+        }
+
+        if (write_success && i < count - 1) {
+            write_success = response->write(",");
+        }
+    }
+
+    return write_success;
+}
+
+static void history_send_cached(EMHistoryKind kind, const uint8_t *data, uint16_t length, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id)
+{
+    OwnershipGuard ownership_guard(response_ownership, response_owner_id);
+
+    if (!ownership_guard.have_ownership()) {
+        return;
+    }
+
+    response->begin(true);
+
+    bool write_success = response->write("[");
+
+    if (write_success) {
+        switch (kind) {
+        case EMHistoryKind::Wallbox5min:
+            write_success = write_wallbox_5min_data(response, data, length);
+            break;
+
+        case EMHistoryKind::EnergyManager5min:
+            write_success = write_energy_manager_5min_data(response, data, length);
+            break;
+
+        case EMHistoryKind::WallboxDaily:
+        case EMHistoryKind::EnergyManagerDaily:
+            write_success = write_daily_data(response, (const uint32_t *)data, length / sizeof(uint32_t));
+            break;
+        }
+    }
+
+    if (write_success) {
+        write_success = response->write("]");
+    }
+
+    write_success &= response->flush();
+    response->end(write_success ? "" : "write error");
+}
+
+void EnergyManager::history_response(const EMHistoryCacheKey &key, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id)
+{
+    uint16_t length;
+    const uint8_t *data = history_cache.get(key, &length);
+
+    if (data != nullptr) {
+        history_send_cached(key.kind, data, length, response, response_ownership, response_owner_id);
+        return;
+    }
+
+    StreamMetadata *metadata = &metadata_array[static_cast<size_t>(key.kind)];
+
+    if (history_stream_busy(metadata) && metadata->prefetch) {
+        // A prefetch is using the callback of this kind, retry after it is done. It might even fill the cache for this request.
+        task_scheduler.scheduleOnce([this, key, response, response_ownership, response_owner_id](){
+            history_response(key, response, response_ownership, response_owner_id);
+        }, 10);
+        return;
+    }
+
+    history_stream(key, false, response, response_ownership, response_owner_id);
+}
+
+void EnergyManager::history_stream(const EMHistoryCacheKey &key, bool prefetch, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id)
+{
+    switch (key.kind) {
+    case EMHistoryKind::Wallbox5min:
+        history_wallbox_5min_stream(key, prefetch, response, response_ownership, response_owner_id);
+        break;
+
+    case EMHistoryKind::WallboxDaily:
+        history_wallbox_daily_stream(key, prefetch, response, response_ownership, response_owner_id);
+        break;
+
+    case EMHistoryKind::EnergyManager5min:
+        history_energy_manager_5min_stream(key, prefetch, response, response_ownership, response_owner_id);
+        break;
+
+    case EMHistoryKind::EnergyManagerDaily:
+        history_energy_manager_daily_stream(key, prefetch, response, response_ownership, response_owner_id);
+        break;
+    }
+}
+
+void EnergyManager::prefetch_history()
+{
+    if (history_prefetch_queue.empty()) {
+        return;
+    }
+
+    // Only use the SD card if no other history stream is running.
+    for (const StreamMetadata &metadata : metadata_array) {
+        if (history_stream_busy(&metadata)) {
+            return;
+        }
+    }
+
+    EMHistoryCacheKey key = history_prefetch_queue.front();
+
+    history_prefetch_queue.pop_front();
+
+    if (history_cache.contains(key)) {
+        return;
+    }
+
+    history_stream(key, true, &history_prefetch_response, &history_prefetch_ownership, history_prefetch_ownership.current());
+}
+
 static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint16_t data_length, uint16_t data_chunk_offset, uint8_t data_chunk_data[60], void *user_data)
 {
     StreamMetadata *metadata = (StreamMetadata *)user_data;
@@ -890,6 +1276,7 @@ static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint1
     OwnershipGuard ownership_guard(metadata->response_ownership, metadata->response_owner_id);
 
     if (!ownership_guard.have_ownership()) {
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_wallbox_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -914,43 +1301,26 @@ static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint1
         write_success &= response->flush();
         response->end(write_success ? "" : "write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_wallbox_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
 
     uint16_t actual_length = data_length - data_chunk_offset;
-    uint16_t i;
-    Wallbox5minData *p;
 
     if (actual_length > 60) {
         actual_length = 60;
     }
 
+    normalize_wallbox_5min_data(data_chunk_data, actual_length);
+    history_stream_append(metadata, data_chunk_data, actual_length);
+
     if (metadata->write_comma && write_success) {
         write_success = response->write(",");
     }
 
-    for (i = 0; i < actual_length && write_success; i += sizeof(Wallbox5minData)) {
-        p = (Wallbox5minData *)&data_chunk_data[i];
-
-        if ((p->flags & 0x80 /* no data */) == 0) {
-            write_success = response->writef("%u", p->flags);
-        } else {
-            p->power = UINT16_MAX;
-            write_success = response->writef("null");
-        }
-
-        if (write_success) {
-            if (p->power != UINT16_MAX) {
-                write_success = response->writef(",%u", p->power);
-            } else {
-                write_success = response->writef(",null");
-            }
-
-            if (write_success && i < actual_length - sizeof(Wallbox5minData)) {
-                write_success = response->write(",");
-            }
-        }
+    if (write_success) {
+        write_success = write_wallbox_5min_data(response, data_chunk_data, actual_length);
     }
 
     metadata->write_comma = true;
@@ -962,6 +1332,7 @@ static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint1
                 response->flush();
                 response->end("write error");
 
+                history_stream_done(metadata, false);
                 tf_warp_energy_manager_register_sd_wallbox_data_points_low_level_callback(device, nullptr, nullptr);
             } else {
                 task_scheduler.scheduleOnce([device, metadata, response]{
@@ -994,6 +1365,7 @@ static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint1
                             response->end("continuation error");
                         }
 
+                        history_stream_done(metadata, false);
                         tf_warp_energy_manager_register_sd_wallbox_data_points_low_level_callback(device, nullptr, nullptr);
                     }
                 }, 0);
@@ -1007,6 +1379,7 @@ static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint1
             write_success &= response->flush();
             response->end(write_success ? "" : "write error");
 
+            history_stream_done(metadata, write_success);
             tf_warp_energy_manager_register_sd_wallbox_data_points_low_level_callback(device, nullptr, nullptr);
         }
 
@@ -1016,6 +1389,7 @@ static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint1
     if (!write_success) {
         response->end("write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_wallbox_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1023,13 +1397,26 @@ static void wallbox_5min_data_points_handler(TF_WARPEnergyManager *device, uint1
 
 void EnergyManager::history_wallbox_5min_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id)
 {
-    uint32_t uid = history_wallbox_5min.get("uid")->asUint();
+    EMHistoryCacheKey key;
+
+    key.kind = EMHistoryKind::Wallbox5min;
+    key.year = history_wallbox_5min.get("year")->asUint() - 2000;
+    key.month = history_wallbox_5min.get("month")->asUint();
+    key.day = history_wallbox_5min.get("day")->asUint();
+    key.uid = history_wallbox_5min.get("uid")->asUint();
+
+    history_response(key, response, response_ownership, response_owner_id);
+}
+
+void EnergyManager::history_wallbox_5min_stream(const EMHistoryCacheKey &key, bool prefetch, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id)
+{
+    uint32_t uid = key.uid;
 
     // history is stored with date in UTC to avoid DST overlap problems.
     // API accepts date in localtime, convert from localtime to UTC
-    uint8_t local_year = history_wallbox_5min.get("year")->asUint() - 2000;
-    uint8_t local_month = history_wallbox_5min.get("month")->asUint();
-    uint8_t local_day = history_wallbox_5min.get("day")->asUint();
+    uint8_t local_year = key.year;
+    uint8_t local_month = key.month;
+    uint8_t local_day = key.day;
 
     struct tm local_start;
     struct tm local_end;
@@ -1118,7 +1505,7 @@ void EnergyManager::history_wallbox_5min_response(IChunkedResponse *response, Ow
         }
     }
     else {
-        StreamMetadata *metadata = &metadata_array[0];
+        StreamMetadata *metadata = &metadata_array[static_cast<size_t>(key.kind)];
 
         metadata->response = response;
         metadata->response_ownership = response_ownership;
@@ -1132,6 +1519,8 @@ void EnergyManager::history_wallbox_5min_response(IChunkedResponse *response, Ow
         metadata->utc_end_day = utc_end_day;
         metadata->utc_end_slots = utc_end_slots;
 
+        history_stream_start(metadata, key, prefetch);
+
         tf_warp_energy_manager_register_sd_wallbox_data_points_low_level_callback(&device, wallbox_5min_data_points_handler, metadata);
     }
 
@@ -1150,6 +1539,7 @@ static void wallbox_daily_data_points_handler(TF_WARPEnergyManager *device,
     OwnershipGuard ownership_guard(metadata->response_ownership, metadata->response_owner_id);
 
     if (!ownership_guard.have_ownership()) {
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_wallbox_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1175,31 +1565,25 @@ static void wallbox_daily_data_points_handler(TF_WARPEnergyManager *device,
         write_success &= response->flush();
         response->end(write_success ? "" : "write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_wallbox_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
 
     uint16_t actual_length = data_length - data_chunk_offset;
-    uint16_t i;
 
     if (actual_length > 15) {
         actual_length = 15;
     }
 
+    history_stream_append(metadata, data_chunk_data, actual_length * sizeof(uint32_t));
+
     if (metadata->write_comma && write_success) {
         write_success = response->write(",");
     }
 
-    for (i = 0; i < actual_length && write_success; ++i) {
-        if (data_chunk_data[i] != UINT32_MAX) {
-            write_success = response->writef("%.2f", (double)data_chunk_data[i] / 100.0); // daWh -> kWh
-        } else {
-            write_success = response->write("null");
-        }
-
-        if (write_success && i < actual_length - 1) {
-            write_success = response->write(",");
-        }
+    if (write_success) {
+        write_success = write_daily_data(response, data_chunk_data, actual_length);
     }
 
     metadata->write_comma = true;
@@ -1213,6 +1597,7 @@ static void wallbox_daily_data_points_handler(TF_WARPEnergyManager *device,
         write_success &= response->flush();
         response->end(write_success ? "" : "write error");
 
+        history_stream_done(metadata, write_success);
         tf_warp_energy_manager_register_sd_wallbox_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1220,6 +1605,7 @@ static void wallbox_daily_data_points_handler(TF_WARPEnergyManager *device,
     if (!write_success) {
         response->end("write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_wallbox_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1246,11 +1632,28 @@ void EnergyManager::history_wallbox_daily_response(IChunkedResponse *response,
                                                    Ownership *response_ownership,
                                                    uint32_t response_owner_id)
 {
-    uint32_t uid = history_wallbox_daily.get("uid")->asUint();
+    EMHistoryCacheKey key;
+
+    key.kind = EMHistoryKind::WallboxDaily;
+    key.year = history_wallbox_daily.get("year")->asUint() - 2000;
+    key.month = history_wallbox_daily.get("month")->asUint();
+    key.day = 0;
+    key.uid = history_wallbox_daily.get("uid")->asUint();
+
+    history_response(key, response, response_ownership, response_owner_id);
+}
+
+void EnergyManager::history_wallbox_daily_stream(const EMHistoryCacheKey &key,
+                                                 bool prefetch,
+                                                 IChunkedResponse *response,
+                                                 Ownership *response_ownership,
+                                                 uint32_t response_owner_id)
+{
+    uint32_t uid = key.uid;
 
     // date in local time to have the days properly aligned
-    uint8_t year = history_wallbox_daily.get("year")->asUint() - 2000;
-    uint8_t month = history_wallbox_daily.get("month")->asUint();
+    uint8_t year = key.year;
+    uint8_t month = key.month;
 
     uint8_t status;
     int rc = tf_warp_energy_manager_get_sd_wallbox_daily_data_points(&device, uid, year, month, 1, days_per_month(2000 + year, month), &status);
@@ -1278,7 +1681,7 @@ void EnergyManager::history_wallbox_daily_response(IChunkedResponse *response,
         }
     }
     else {
-        StreamMetadata *metadata = &metadata_array[1];
+        StreamMetadata *metadata = &metadata_array[static_cast<size_t>(key.kind)];
 
         metadata->response = response;
         metadata->response_ownership = response_ownership;
@@ -1287,17 +1690,14 @@ void EnergyManager::history_wallbox_daily_response(IChunkedResponse *response,
         metadata->write_comma = false;
         metadata->next_offset = 0;
 
+        history_stream_start(metadata, key, prefetch);
+
         tf_warp_energy_manager_register_sd_wallbox_daily_data_points_low_level_callback(&device, wallbox_daily_data_points_handler, metadata);
     }
 
     check_bricklet_reachable(rc, "history_wallbox_daily_response");
 }
 
-struct [[gnu::packed]] EnergyManager5MinData {
-    uint8_t flags; // bit 0 = 1p/3p, bit 1-2 = input, bit 3 = relay, bit 7 = no data
-    int32_t power[7]; // W
-};
-
 static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device,
                                                     uint16_t data_length,
                                                     uint16_t data_chunk_offset,
@@ -1310,6 +1710,7 @@ static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device
     OwnershipGuard ownership_guard(metadata->response_ownership, metadata->response_owner_id);
 
     if (!ownership_guard.have_ownership()) {
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_energy_manager_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1335,48 +1736,26 @@ static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device
         write_success &= response->flush();
         response->end(write_success ? "" : "write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_energy_manager_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
 
     uint16_t actual_length = data_length - data_chunk_offset;
-    uint16_t i;
-    EnergyManager5MinData *p;
 
     if (actual_length > 58) {
         actual_length = 58;
     }
 
+    normalize_energy_manager_5min_data(data_chunk_data, actual_length);
+    history_stream_append(metadata, data_chunk_data, actual_length);
+
     if (metadata->write_comma && write_success) {
         write_success = response->write(",", 1);
     }
 
-    for (i = 0; i < actual_length && write_success; i += sizeof(EnergyManager5MinData)) {
-        p = (EnergyManager5MinData *)&data_chunk_data[i];
-
-        if ((p->flags & 0x80 /* no data */) == 0) {
-            write_success = response->writef("%u", p->flags);
-        } else {
-            write_success = response->writef("null");
-
-            for (int k = 0; k < 7; ++k) {
-                p->power[k] = INT32_MAX;
-            }
-        }
-
-        if (write_success) {
-            for (int k = 0; k < 7 && write_success; ++k) {
-                if (p->power[k] != INT32_MAX) {
-                    write_success = response->writef(",%d", p->power[k]);
-                } else {
-                    write_success = response->writef(",null");
-                }
-            }
-
-            if (write_success && i < actual_length - sizeof(EnergyManager5MinData)) {
-                write_success = response->write(",");
-            }
-        }
+    if (write_success) {
+        write_success = write_energy_manager_5min_data(response, data_chunk_data, actual_length);
     }
 
     metadata->write_comma = true;
@@ -1388,6 +1767,7 @@ static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device
                 response->flush();
                 response->end("write error");
 
+                history_stream_done(metadata, false);
                 tf_warp_energy_manager_register_sd_energy_manager_data_points_low_level_callback(device, nullptr, nullptr);
             } else {
                 task_scheduler.scheduleOnce([device, metadata, response]{
@@ -1419,6 +1799,7 @@ static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device
                             response->end("continuation error");
                         }
 
+                        history_stream_done(metadata, false);
                         tf_warp_energy_manager_register_sd_energy_manager_data_points_low_level_callback(device, nullptr, nullptr);
                     }
                 }, 0);
@@ -1432,6 +1813,7 @@ static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device
             write_success &= response->flush();
             response->end(write_success ? "" : "write error");
 
+            history_stream_done(metadata, write_success);
             tf_warp_energy_manager_register_sd_energy_manager_data_points_low_level_callback(device, nullptr, nullptr);
         }
 
@@ -1441,6 +1823,7 @@ static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device
     if (!write_success) {
         response->end("write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_energy_manager_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1449,12 +1832,29 @@ static void energy_manager_5min_data_points_handler(TF_WARPEnergyManager *device
 void EnergyManager::history_energy_manager_5min_response(IChunkedResponse *response,
                                                          Ownership *response_ownership,
                                                          uint32_t response_owner_id)
+{
+    EMHistoryCacheKey key;
+
+    key.kind = EMHistoryKind::EnergyManager5min;
+    key.year = history_energy_manager_5min.get("year")->asUint() - 2000;
+    key.month = history_energy_manager_5min.get("month")->asUint();
+    key.day = history_energy_manager_5min.get("day")->asUint();
+    key.uid = 0;
+
+    history_response(key, response, response_ownership, response_owner_id);
+}
+
+void EnergyManager::history_energy_manager_5min_stream(const EMHistoryCacheKey &key,
+                                                       bool prefetch,
+                                                       IChunkedResponse *response,
+                                                       Ownership *response_ownership,
+                                                       uint32_t response_owner_id)
 {
     // history is stored with date in UTC to avoid DST overlap problems.
     // API accepts date in localtime, convert from localtime to UTC
-    uint8_t local_year = history_energy_manager_5min.get("year")->asUint() - 2000;
-    uint8_t local_month = history_energy_manager_5min.get("month")->asUint();
-    uint8_t local_day = history_energy_manager_5min.get("day")->asUint();
+    uint8_t local_year = key.year;
+    uint8_t local_month = key.month;
+    uint8_t local_day = key.day;
 
     struct tm local_start;
     struct tm local_end;
@@ -1541,7 +1941,7 @@ void EnergyManager::history_energy_manager_5min_response(IChunkedResponse *respo
         }
     }
     else {
-        StreamMetadata *metadata = &metadata_array[2];
+        StreamMetadata *metadata = &metadata_array[static_cast<size_t>(key.kind)];
 
         metadata->response = response;
         metadata->response_ownership = response_ownership;
@@ -1554,6 +1954,8 @@ void EnergyManager::history_energy_manager_5min_response(IChunkedResponse *respo
         metadata->utc_end_day = utc_end_day;
         metadata->utc_end_slots = utc_end_slots;
 
+        history_stream_start(metadata, key, prefetch);
+
         tf_warp_energy_manager_register_sd_energy_manager_data_points_low_level_callback(&device, energy_manager_5min_data_points_handler, metadata);
     }
 
@@ -1572,6 +1974,7 @@ static void energy_manager_daily_data_points_handler(TF_WARPEnergyManager *devic
     OwnershipGuard ownership_guard(metadata->response_ownership, metadata->response_owner_id);
 
     if (!ownership_guard.have_ownership()) {
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_energy_manager_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1597,12 +2000,12 @@ static void energy_manager_daily_data_points_handler(TF_WARPEnergyManager *devic
         write_success &= response->flush();
         response->end(write_success ? "" : "write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_energy_manager_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
 
     uint16_t actual_length = data_length - data_chunk_offset;
-    uint16_t i;
 
     if (actual_length > 14) {
         actual_length = 14;
@@ -1620,16 +2023,10 @@ static void energy_manager_daily_data_points_handler(TF_WARPEnergyManager *devic
     memmove(&data_chunk_data[1], &data_chunk_data[2], sizeof(uint32_t) * 6);
     data_chunk_data[7] = energy_export_0;
 
-    for (i = 0; i < actual_length && write_success; ++i) {
-        if (data_chunk_data[i] != UINT32_MAX) {
-            write_success = response->writef("%.2f", (double)data_chunk_data[i] / 100.0); // daWh -> kWh
-        } else {
-            write_success = response->write("null");
-        }
+    history_stream_append(metadata, data_chunk_data, actual_length * sizeof(uint32_t));
 
-        if (write_success && i < actual_length - 1) {
-            write_success = response->write(",");
-        }
+    if (write_success) {
+        write_success = write_daily_data(response, data_chunk_data, actual_length);
     }
 
     metadata->write_comma = true;
@@ -1643,6 +2040,7 @@ static void energy_manager_daily_data_points_handler(TF_WARPEnergyManager *devic
         write_success &= response->flush();
         response->end(write_success ? "" : "write error");
 
+        history_stream_done(metadata, write_success);
         tf_warp_energy_manager_register_sd_energy_manager_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1650,6 +2048,7 @@ static void energy_manager_daily_data_points_handler(TF_WARPEnergyManager *devic
     if (!write_success) {
         response->end("write error");
 
+        history_stream_done(metadata, false);
         tf_warp_energy_manager_register_sd_energy_manager_daily_data_points_low_level_callback(device, nullptr, nullptr);
         return;
     }
@@ -1658,10 +2057,27 @@ static void energy_manager_daily_data_points_handler(TF_WARPEnergyManager *devic
 void EnergyManager::history_energy_manager_daily_response(IChunkedResponse *response,
                                                           Ownership *response_ownership,
                                                           uint32_t response_owner_id)
+{
+    EMHistoryCacheKey key;
+
+    key.kind = EMHistoryKind::EnergyManagerDaily;
+    key.year = history_energy_manager_daily.get("year")->asUint() - 2000;
+    key.month = history_energy_manager_daily.get("month")->asUint();
+    key.day = 0;
+    key.uid = 0;
+
+    history_response(key, response, response_ownership, response_owner_id);
+}
+
+void EnergyManager::history_energy_manager_daily_stream(const EMHistoryCacheKey &key,
+                                                        bool prefetch,
+                                                        IChunkedResponse *response,
+                                                        Ownership *response_ownership,
+                                                        uint32_t response_owner_id)
 {
     // date in local time to have the days properly aligned
-    uint8_t year = history_energy_manager_daily.get("year")->asUint() - 2000;
-    uint8_t month = history_energy_manager_daily.get("month")->asUint();
+    uint8_t year = key.year;
+    uint8_t month = key.month;
 
     uint8_t status;
     int rc = tf_warp_energy_manager_get_sd_energy_manager_daily_data_points(&device, year, month, 1, days_per_month(2000 + year, month), &status);
@@ -1689,7 +2105,7 @@ void EnergyManager::history_energy_manager_daily_response(IChunkedResponse *resp
         }
     }
     else {
-        StreamMetadata *metadata = &metadata_array[3];
+        StreamMetadata *metadata = &metadata_array[static_cast<size_t>(key.kind)];
 
         metadata->response = response;
         metadata->response_ownership = response_ownership;
@@ -1698,6 +2114,8 @@ void EnergyManager::history_energy_manager_daily_response(IChunkedResponse *resp
         metadata->write_comma = false;
         metadata->next_offset = 0;
 
+        history_stream_start(metadata, key, prefetch);
+
         tf_warp_energy_manager_register_sd_energy_manager_daily_data_points_low_level_callback(&device, energy_manager_daily_data_points_handler, metadata);
     }
 
@@ -238,6 +238,7 @@ void EnergyManager::setup()
 
     task_scheduler.scheduleWithFixedDelay([this](){collect_data_points();}, 15000, 10000);
     task_scheduler.scheduleWithFixedDelay([this](){set_pending_data_points();}, 15000, 100);
+    task_scheduler.scheduleWithFixedDelay([this](){prefetch_history();}, 15000, 100);
 
     start_network_check_task();
 
@@ -30,6 +30,7 @@
 
 #include "device_module.h"
 #include "em_rgb_led.h"
+#include "history_cache.h"
 #include "structs.h"
 #include "warp_energy_manager_bricklet_firmware_bin.embedded.h"
 
@@ -144,6 +145,13 @@ private:
     void history_wallbox_daily_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
     void history_energy_manager_5min_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
     void history_energy_manager_daily_response(IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void history_response(const EMHistoryCacheKey &key, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void history_stream(const EMHistoryCacheKey &key, bool prefetch, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void history_wallbox_5min_stream(const EMHistoryCacheKey &key, bool prefetch, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void history_wallbox_daily_stream(const EMHistoryCacheKey &key, bool prefetch, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void history_energy_manager_5min_stream(const EMHistoryCacheKey &key, bool prefetch, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void history_energy_manager_daily_stream(const EMHistoryCacheKey &key, bool prefetch, IChunkedResponse *response, Ownership *response_ownership, uint32_t response_owner_id);
+    void prefetch_history();
     bool set_wallbox_5min_data_point(const struct tm *utc, const struct tm *local, uint32_t uid, uint8_t flags, uint16_t power /* W */);
     bool set_wallbox_daily_data_point(const struct tm *local, uint32_t uid, uint32_t energy /* daWh */);
     bool set_energy_manager_5min_data_point(const struct tm *utc, const struct tm *local, uint8_t flags, const int32_t power[7] /* W */);
@@ -0,0 +1,116 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "history_cache.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+
+#include "malloc_tools.h"
+
+EMHistoryCache::Entry *EMHistoryCache::find(const EMHistoryCacheKey &key)
+{
+    for (Entry &entry : entries) {
+        if (entry.data != nullptr && entry.key == key) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+const uint8_t *EMHistoryCache::get(const EMHistoryCacheKey &key, uint16_t *length)
+{
+    Entry *entry = find(key);
+
+    if (entry == nullptr) {
+        return nullptr;
+    }
+
+    entry->last_used = ++use_counter;
+    *length = entry->length;
+
+    return entry->data;
+}
+
+bool EMHistoryCache::contains(const EMHistoryCacheKey &key) const
+{
+    for (const Entry &entry : entries) {
+        if (entry.data != nullptr && entry.key == key) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void EMHistoryCache::put(const EMHistoryCacheKey &key, const uint8_t *data, uint16_t length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    Entry *victim = find(key);
+
+    if (victim == nullptr) {
+        victim = &entries[0];
+
+        for (Entry &entry : entries) {
+            if (entry.data == nullptr) {
+                victim = &entry;
+                break;
+            }
+
+            if (entry.last_used < victim->last_used) {
+                victim = &entry;
+            }
+        }
+    }
+
+    heap_caps_free(victim->data);
+
+    victim->data = static_cast<uint8_t *>(malloc_psram(length));
+
+    if (victim->data == nullptr) {
+        return;
+    }
+
+    memcpy(victim->data, data, length);
+
+    victim->key = key;
+    victim->length = length;
+    victim->last_used = ++use_counter;
+}
+
+void EMHistoryCache::invalidate(const EMHistoryCacheKey &key)
+{
+    ++generation;
+
+    Entry *entry = find(key);
+
+    if (entry == nullptr) {
+        return;
+    }
+
+    heap_caps_free(entry->data);
+
+    entry->data = nullptr;
+    entry->length = 0;
+}
@@ -0,0 +1,80 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define EM_HISTORY_CACHE_ENTRIES 32
+
+enum class EMHistoryKind : uint8_t {
+    Wallbox5min = 0,
+    WallboxDaily = 1,
+    EnergyManager5min = 2,
+    EnergyManagerDaily = 3,
+};
+
+#define EM_HISTORY_KIND_COUNT 4
+
+// Dates are local dates as passed to the history API. day is 0 for the
+// monthly (daily data point) blocks. uid is 0 for energy manager blocks.
+struct EMHistoryCacheKey {
+    EMHistoryKind kind;
+    uint8_t year; // since 2000
+    uint8_t month;
+    uint8_t day;
+    uint32_t uid;
+
+    bool operator==(const EMHistoryCacheKey &other) const
+    {
+        return kind == other.kind && year == other.year && month == other.month && day == other.day && uid == other.uid;
+    }
+};
+
+// LRU cache of decoded SD card history blocks, stored in PSRAM. A block is
+// the normalized bricklet stream data of one history response, i.e. one
+// (local) day of 5min data points or one month of daily data points.
+class EMHistoryCache
+{
+public:
+    EMHistoryCache() {}
+
+    const uint8_t *get(const EMHistoryCacheKey &key, uint16_t *length);
+    bool contains(const EMHistoryCacheKey &key) const;
+    void put(const EMHistoryCacheKey &key, const uint8_t *data, uint16_t length);
+    void invalidate(const EMHistoryCacheKey &key);
+
+    // Bumped by every invalidation. A block that was read from the SD card
+    // while the generation changed might be stale and must not be put.
+    uint32_t get_generation() const { return generation; }
+
+private:
+    struct Entry {
+        EMHistoryCacheKey key;
+        uint8_t *data = nullptr;
+        uint16_t length = 0;
+        uint32_t last_used = 0;
+    };
+
+    Entry *find(const EMHistoryCacheKey &key);
+
+    Entry entries[EM_HISTORY_CACHE_ENTRIES];
+    uint32_t use_counter = 0;
+    uint32_t generation = 0;
+};
@@ -79,7 +79,14 @@ int64_t Event::registerEvent(const String &path, const std::vector<ConfPath> val
         // Store callback after possibly calling it,
         // because the function object is forwarded to the vector and cannot be used locally afterwards.
         if (store_callback) {
-            state_updates.push_back({eventID, i, config, std::forward<std::function<EventResult(const Config *)>>(callback)});
+            StateUpdateRegistration registration{eventID, config, std::forward<std::function<EventResult(const Config *)>>(callback)};
+
+            // A running dispatch iterates over the handlers of its state.
+            if (state_update_in_progress.load(std::memory_order_consume)) {
+                pending_registrations.push_back({i, std::move(registration)});
+            } else {
+                storeRegistration(i, std::move(registration));
+            }
         }
 
         return eventID;
@@ -89,6 +96,16 @@ int64_t Event::registerEvent(const String &path, const std::vector<ConfPath> val
     return -1;
 }
 
+void Event::storeRegistration(size_t stateIdx, StateUpdateRegistration &&registration)
+{
+    // States added before the Event backend was registered are not sized by addState.
+    if (state_updates.size() <= stateIdx) {
+        state_updates.resize(stateIdx + 1);
+    }
+
+    state_updates[stateIdx].push_back(std::move(registration));
+}
+
 void Event::deregisterEvent(int64_t eventID)
 {
     if (eventID == -1)
@@ -99,50 +116,87 @@ void Event::deregisterEvent(int64_t eventID)
         return;
     }
 
-    for (auto it = state_updates.begin(); it != state_updates.end(); ++it) {
-        if (it->eventID == eventID) {
-            state_updates.erase(it);
-            return;
+    for (auto &registrations : state_updates) {
+        for (auto it = registrations.begin(); it != registrations.end(); ++it) {
+            if (it->eventID == eventID) {
+                registrations.erase(it);
+                return;
+            }
         }
     }
 }
 
-void Event::addCommand(size_t commandIdx, const CommandRegistration &reg)
+void Event::pushStateUpdateNow(size_t stateIdx)
 {
-}
+    // Called by a state update handler. The API's state update loop will pick up this update.
+    if (state_update_in_progress.load(std::memory_order_consume)) {
+        return;
+    }
 
-void Event::addState(size_t stateIdx, const StateRegistration &reg)
-{
-}
+    if (stateIdx >= state_updates.size() || state_updates[stateIdx].empty()) {
+        return;
+    }
 
-void Event::addRawCommand(size_t rawCommandIdx, const RawCommandRegistration &reg)
-{
-}
+    dispatchStateUpdate(stateIdx);
 
-void Event::addResponse(size_t responseIdx, const ResponseRegistration &reg)
-{
+    // Don't call the handlers again from the API's state update loop.
+    api.states[stateIdx].config->clear_updated(1 << backendIdx);
 }
 
-bool Event::pushStateUpdate(size_t stateIdx, const String &payload, const String &path)
+void Event::dispatchStateUpdate(size_t stateIdx)
 {
+    auto &registrations = state_updates[stateIdx];
+
     state_update_in_progress.store(true, std::memory_order_release);
 
-    for (size_t i = 0; i < state_updates.size();) {
+    for (size_t i = 0; i < registrations.size();) {
         EventResult result = EventResult::OK;
 
-        const auto &reg = state_updates[i];
-        if (reg.stateIdx == stateIdx && reg.config->was_updated(1 << backendIdx)) {
+        const auto &reg = registrations[i];
+        if (reg.config->was_updated(1 << backendIdx)) {
             result = reg.callback(reg.config);
         }
 
         if (result == EventResult::OK)
             ++i;
         else
-            state_updates.erase(state_updates.begin() + i);
+            registrations.erase(registrations.begin() + i);
     }
 
     state_update_in_progress.store(false, std::memory_order_release);
 
+    for (PendingRegistration &pending : pending_registrations) {
+        storeRegistration(pending.stateIdx, std::move(pending.registration));
+    }
+
+    pending_registrations.clear();
+}
+
+void Event::addCommand(size_t commandIdx, const CommandRegistration &reg)
+{
+}
+
+void Event::addState(size_t stateIdx, const StateRegistration &reg)
+{
+    if (state_updates.size() <= stateIdx) {
+        state_updates.resize(stateIdx + 1);
+    }
+}
+
+void Event::addRawCommand(size_t rawCommandIdx, const RawCommandRegistration &reg)
+{
+}
+
+void Event::addResponse(size_t responseIdx, const ResponseRegistration &reg)
+{
+}
+
+bool Event::pushStateUpdate(size_t stateIdx, const String &payload, const String &path)
+{
+    if (stateIdx < state_updates.size()) {
+        dispatchStateUpdate(stateIdx);
+    }
+
     return true;
 }
 
@@ -153,11 +207,8 @@ bool Event::pushRawStateUpdate(const String &payload, const String &path)
 
 IAPIBackend::WantsStateUpdate Event::wantsStateUpdate(size_t stateIdx)
 {
-    for (size_t i = 0; i < state_updates.size(); ++i) {
-        const auto &reg = state_updates[i];
-        if (reg.stateIdx == stateIdx) {
-            return IAPIBackend::WantsStateUpdate::AsConfig;
-        }
+    if (stateIdx < state_updates.size() && !state_updates[stateIdx].empty()) {
+        return IAPIBackend::WantsStateUpdate::AsConfig;
     }
     return IAPIBackend::WantsStateUpdate::No;
 }
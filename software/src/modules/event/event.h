@@ -32,7 +32,6 @@ enum class EventResult {
 
 struct StateUpdateRegistration {
     int64_t eventID;
-    size_t stateIdx;
     Config *config;
     std::function<EventResult(const Config *)> callback;
 };
@@ -52,6 +51,12 @@ public:
     int64_t registerEvent(const String &path, const std::vector<ConfPath> values, std::function<EventResult(const Config *)> &&callback);
     void deregisterEvent(int64_t eventID);
 
+    // Calls the event handlers registered for this state immediately instead
+    // of waiting for the API's state update loop. Use this for frequently
+    // updated states that other modules react on, after updating all values.
+    // stateIdx is the index returned by api.addState.
+    void pushStateUpdateNow(size_t stateIdx);
+
     // IAPIBackend implementation
     void addCommand(size_t commandIdx, const CommandRegistration &reg) override;
     void addState(size_t stateIdx, const StateRegistration &reg) override;
@@ -62,8 +67,19 @@ public:
     WantsStateUpdate wantsStateUpdate(size_t stateIdx) override;
 
 private:
+    struct PendingRegistration {
+        size_t stateIdx;
+        StateUpdateRegistration registration;
+    };
+
+    void storeRegistration(size_t stateIdx, StateUpdateRegistration &&registration);
+    void dispatchStateUpdate(size_t stateIdx);
+
     size_t backendIdx;
-    std::vector<StateUpdateRegistration> state_updates;
+    // Indexed by stateIdx. Sized in addState, so that it is never resized while handlers run.
+    std::vector<std::vector<StateUpdateRegistration>> state_updates;
+    // Registered by event handlers while they run. Stored after the dispatch.
+    std::vector<PendingRegistration> pending_registrations;
     std::atomic<bool> state_update_in_progress;
 
     int64_t lastEventID = -1;
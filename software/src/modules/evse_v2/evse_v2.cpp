@@ -828,156 +828,213 @@ void EVSEV2::update_all_data()
     if (!initialized)
         return;
 
-    // get_all_data_1
-    uint8_t iec61851_state;
-    uint8_t charger_state;
-    uint8_t contactor_state;
-    uint8_t contactor_error;
-    uint16_t allowed_charging_current;
-    uint8_t error_state;
-    uint8_t lock_state;
-    uint8_t dc_fault_current_state;
-    uint8_t jumper_configuration;
-    bool has_lock_switch;
-    uint8_t evse_version;
-    struct meter_data meter_data;
-
-    // get_all_data_2
-    uint8_t shutdown_input_configuration;
-    uint8_t input_configuration;
-    uint8_t output_configuration;
-    int16_t indication;
-    uint16_t duration;
-    uint16_t color_h;
-    uint8_t color_s;
-    uint8_t color_v;
-    uint8_t button_cfg;
-    uint32_t button_press_time;
-    uint32_t button_release_time;
-    bool button_pressed;
-    bool ev_wakeup_enabled;
-    bool cp_disconnect;
-    bool boost_mode_enabled;
-    int16_t temperature;
-    uint8_t phases_current;
-    uint8_t phases_requested;
-    uint8_t phases_state;
-    uint8_t phases_info;
-    bool phase_auto_switch_enabled;
-    uint8_t phases_connected_;
+    // The previous poll is still in flight or its data was not applied yet.
+    if (all_data_step != AllDataStep::Idle || all_data_apply_pending)
+        return;
 
-    // get_low_level_state
-    uint8_t led_state;
-    uint16_t cp_pwm_duty_cycle;
-    uint16_t adc_values[7];
-    int16_t voltages[7];
-    uint32_t resistances[2];
-    bool gpio[24];
-    uint32_t charging_time;
-    uint32_t time_since_state_change;
-    uint32_t time_since_dc_fault_check;
-    uint32_t uptime;
+    // The getters are sent as asynchronous requests. Each response handler
+    // sends the next request, so the main loop and with it the other
+    // Bricklets don't wait for the EVSE's responses.
+    if (!send_all_data_request(AllDataStep::AllData1))
+        return;
 
-    // get_all_charging_slots
-    uint16_t max_current[20];
-    uint8_t active_and_clear_on_disconnect[20];
+    // The first call happens during setup. Other modules expect the data to be available afterwards.
+    if (!all_data_received) {
+        TF_HAL *hal = device.tfp->spitfp->hal;
 
-    int rc = tf_evse_v2_get_all_data_1(&device,
-                                       &iec61851_state,
-                                       &charger_state,
-                                       &contactor_state,
-                                       &contactor_error,
-                                       &allowed_charging_current,
-                                       &error_state,
-                                       &lock_state,
-                                       &dc_fault_current_state,
-                                       &jumper_configuration,
-                                       &has_lock_switch,
-                                       &evse_version,
-                                       &meter_data.meter_type,
-                                       &meter_data.power,
-                                       meter_data.currents,
-                                       meter_data.phases_active,
-                                       meter_data.phases_connected,
-                                       meter_data.error_count);
+        while (all_data_step != AllDataStep::Idle)
+            tf_hal_tick(hal, 0);
 
-    if (rc != TF_E_OK) {
-        logger.printfln("all_data_1 %d", rc);
-        is_in_bootloader(rc);
-        return;
+        if (all_data_apply_pending)
+            apply_all_data();
     }
+}
 
-    rc = tf_evse_v2_get_all_data_2(&device,
-                                   &shutdown_input_configuration,
-                                   &input_configuration,
-                                   &output_configuration,
-                                   &indication,
-                                   &duration,
-                                   &color_h,
-                                   &color_s,
-                                   &color_v,
-                                   &button_cfg,
-                                   &button_press_time,
-                                   &button_release_time,
-                                   &button_pressed,
-                                   &ev_wakeup_enabled,
-                                   &cp_disconnect,
-                                   &boost_mode_enabled,
-                                   &temperature,
-                                   &phases_current,
-                                   &phases_requested,
-                                   &phases_state,
-                                   &phases_info,
-                                   &phase_auto_switch_enabled,
-                                   &phases_connected_);
+bool EVSEV2::send_all_data_request(AllDataStep step)
+{
+    uint8_t fid;
+    uint8_t payload[1];
+    uint8_t payload_size = 0;
+
+    switch (step) {
+        case AllDataStep::AllData1:
+            fid = TF_EVSE_V2_FUNCTION_GET_ALL_DATA_1;
+            break;
+
+        case AllDataStep::AllData2:
+            fid = TF_EVSE_V2_FUNCTION_GET_ALL_DATA_2;
+            break;
+
+        case AllDataStep::LowLevelState:
+            fid = TF_EVSE_V2_FUNCTION_GET_LOW_LEVEL_STATE;
+            break;
+
+        case AllDataStep::AllChargingSlots:
+            fid = TF_EVSE_V2_FUNCTION_GET_ALL_CHARGING_SLOTS;
+            break;
+
+        case AllDataStep::ExternalSlotDefault:
+            fid = TF_EVSE_V2_FUNCTION_GET_CHARGING_SLOT_DEFAULT;
+            payload[0] = CHARGING_SLOT_EXTERNAL;
+            payload_size = 1;
+            break;
+
+        default:
+            return false;
+    }
+
+    int rc = tf_tfp_send_async(device.tfp, fid, payload, payload_size, tf_hal_get_timeout(device.tfp->spitfp->hal),
+        [](void *user_data, int result, TF_PacketBuffer *response, uint8_t length) {
+            static_cast<EVSEV2 *>(user_data)->handle_all_data_response(result, response, length);
+        }, this);
 
     if (rc != TF_E_OK) {
-        logger.printfln("all_data_2 %d", rc);
-        is_in_bootloader(rc);
-        return;
+        // TF_E_LOCKED: Another request is still being sent. Try again with the next poll.
+        if (rc != TF_E_LOCKED)
+            logger.printfln("Sending all data request %u failed: %d", static_cast<unsigned>(step), rc);
+
+        all_data_step = AllDataStep::Idle;
+        return false;
     }
 
-    rc = tf_evse_v2_get_low_level_state(&device,
-                                        &led_state,
-                                        &cp_pwm_duty_cycle,
-                                        adc_values,
-                                        voltages,
-                                        resistances,
-                                        gpio,
-                                        &charging_time,
-                                        &time_since_state_change,
-                                        &time_since_dc_fault_check,
-                                        &uptime);
+    all_data_step = step;
+    return true;
+}
 
-    if (rc != TF_E_OK) {
-        logger.printfln("ll_state %d", rc);
-        is_in_bootloader(rc);
+void EVSEV2::handle_all_data_response(int result, TF_PacketBuffer *response, uint8_t length)
+{
+    static const char * const step_names[] = {"", "all_data_1", "all_data_2", "ll_state", "slots", "external slot default"};
+    static const uint8_t response_lengths[] = {0, 55, 32, 58, 60, 4};
+
+    AllDataStep step = all_data_step;
+    all_data_step = AllDataStep::Idle;
+
+    // A blocking call to the EVSE aborted the request. The next poll starts over.
+    if (result == TF_E_LOCKED)
         return;
-    }
 
-    rc = tf_evse_v2_get_all_charging_slots(&device, max_current, active_and_clear_on_disconnect);
+    if (result == TF_E_OK && length != response_lengths[static_cast<size_t>(step)])
+        result = TF_E_WRONG_RESPONSE_LENGTH;
 
-    if (rc != TF_E_OK) {
-        logger.printfln("slots %d", rc);
-        is_in_bootloader(rc);
+    if (result != TF_E_OK) {
+        logger.printfln("%s %d", step_names[static_cast<size_t>(step)], result);
+
+        // is_in_bootloader calls a blocking getter. Don't call it from within the HAL's tick.
+        task_scheduler.scheduleOnce([this, result]() {
+            is_in_bootloader(result);
+        }, 0);
         return;
     }
 
-    uint16_t external_default_current;
-    bool external_default_enabled;
-    bool external_default_clear_on_disconnect;
+    AllData *d = &all_data;
+    AllDataStep next_step;
+
+    switch (step) {
+        case AllDataStep::AllData1:
+            d->iec61851_state = tf_packet_buffer_read_uint8_t(response);
+            d->charger_state = tf_packet_buffer_read_uint8_t(response);
+            d->contactor_state = tf_packet_buffer_read_uint8_t(response);
+            d->contactor_error = tf_packet_buffer_read_uint8_t(response);
+            d->allowed_charging_current = tf_packet_buffer_read_uint16_t(response);
+            d->error_state = tf_packet_buffer_read_uint8_t(response);
+            d->lock_state = tf_packet_buffer_read_uint8_t(response);
+            d->dc_fault_current_state = tf_packet_buffer_read_uint8_t(response);
+            d->jumper_configuration = tf_packet_buffer_read_uint8_t(response);
+            d->has_lock_switch = tf_packet_buffer_read_bool(response);
+            d->evse_version = tf_packet_buffer_read_uint8_t(response);
+            d->meter_data.meter_type = tf_packet_buffer_read_uint8_t(response);
+            d->meter_data.power = tf_packet_buffer_read_float(response);
+            for (size_t i = 0; i < 3; ++i)
+                d->meter_data.currents[i] = tf_packet_buffer_read_float(response);
+            tf_packet_buffer_read_bool_array(response, d->meter_data.phases_active, 3);
+            tf_packet_buffer_read_bool_array(response, d->meter_data.phases_connected, 3);
+            for (size_t i = 0; i < 6; ++i)
+                d->meter_data.error_count[i] = tf_packet_buffer_read_uint32_t(response);
+
+            next_step = AllDataStep::AllData2;
+            break;
+
+        case AllDataStep::AllData2:
+            d->shutdown_input_configuration = tf_packet_buffer_read_uint8_t(response);
+            d->input_configuration = tf_packet_buffer_read_uint8_t(response);
+            d->output_configuration = tf_packet_buffer_read_uint8_t(response);
+            d->indication = tf_packet_buffer_read_int16_t(response);
+            d->duration = tf_packet_buffer_read_uint16_t(response);
+            d->color_h = tf_packet_buffer_read_uint16_t(response);
+            d->color_s = tf_packet_buffer_read_uint8_t(response);
+            d->color_v = tf_packet_buffer_read_uint8_t(response);
+            d->button_cfg = tf_packet_buffer_read_uint8_t(response);
+            d->button_press_time = tf_packet_buffer_read_uint32_t(response);
+            d->button_release_time = tf_packet_buffer_read_uint32_t(response);
+            d->button_pressed = tf_packet_buffer_read_bool(response);
+            d->ev_wakeup_enabled = tf_packet_buffer_read_bool(response);
+            d->cp_disconnect = tf_packet_buffer_read_bool(response);
+            d->boost_mode_enabled = tf_packet_buffer_read_bool(response);
+            d->temperature = tf_packet_buffer_read_int16_t(response);
+            d->phases_current = tf_packet_buffer_read_uint8_t(response);
+            d->phases_requested = tf_packet_buffer_read_uint8_t(response);
+            d->phases_state = tf_packet_buffer_read_uint8_t(response);
+            d->phases_info = tf_packet_buffer_read_uint8_t(response);
+            d->phase_auto_switch_enabled = tf_packet_buffer_read_bool(response);
+            d->phases_connected_ = tf_packet_buffer_read_uint8_t(response);
+
+            next_step = AllDataStep::LowLevelState;
+            break;
+
+        case AllDataStep::LowLevelState:
+            d->led_state = tf_packet_buffer_read_uint8_t(response);
+            d->cp_pwm_duty_cycle = tf_packet_buffer_read_uint16_t(response);
+            for (size_t i = 0; i < 7; ++i)
+                d->adc_values[i] = tf_packet_buffer_read_uint16_t(response);
+            for (size_t i = 0; i < 7; ++i)
+                d->voltages[i] = tf_packet_buffer_read_int16_t(response);
+            for (size_t i = 0; i < 2; ++i)
+                d->resistances[i] = tf_packet_buffer_read_uint32_t(response);
+            tf_packet_buffer_read_bool_array(response, d->gpio, 24);
+            d->charging_time = tf_packet_buffer_read_uint32_t(response);
+            d->time_since_state_change = tf_packet_buffer_read_uint32_t(response);
+            d->time_since_dc_fault_check = tf_packet_buffer_read_uint32_t(response);
+            d->uptime = tf_packet_buffer_read_uint32_t(response);
+
+            next_step = AllDataStep::AllChargingSlots;
+            break;
+
+        case AllDataStep::AllChargingSlots:
+            for (size_t i = 0; i < 20; ++i)
+                d->max_current[i] = tf_packet_buffer_read_uint16_t(response);
+            for (size_t i = 0; i < 20; ++i)
+                d->active_and_clear_on_disconnect[i] = tf_packet_buffer_read_uint8_t(response);
+
+            next_step = AllDataStep::ExternalSlotDefault;
+            break;
+
+        case AllDataStep::ExternalSlotDefault:
+            d->external_default_current = tf_packet_buffer_read_uint16_t(response);
+            d->external_default_enabled = tf_packet_buffer_read_bool(response);
+            d->external_default_clear_on_disconnect = tf_packet_buffer_read_bool(response);
+
+            // Updating the states can trigger automation actions that call
+            // blocking bindings functions. Don't do this within the HAL's tick.
+            all_data_received = true;
+            all_data_apply_pending = true;
+            task_scheduler.scheduleOnce([this]() {
+                apply_all_data();
+            }, 0);
+            return;
 
-    rc = tf_evse_v2_get_charging_slot_default(&device,
-                                              CHARGING_SLOT_EXTERNAL,
-                                              &external_default_current,
-                                              &external_default_enabled,
-                                              &external_default_clear_on_disconnect);
+        default:
+            return;
+    }
 
-    if (rc != TF_E_OK) {
-        logger.printfln("external slot default %d", rc);
-        is_in_bootloader(rc);
+    send_all_data_request(next_step);
+}
+
+void EVSEV2::apply_all_data()
+{
+    if (!all_data_apply_pending)
         return;
-    }
+
+    all_data_apply_pending = false;
 
     // We don't allow firmware updates when a vehicle is connected,
     // to be sure a potential EVSE firmware update does not interrupt a
@@ -987,37 +1044,37 @@ void EVSEV2::update_all_data()
     // then the EVSE could potentially start to charge, which is okay,
     // as the ESP firmware is already running, so we can for example
     // track the charge.
-    firmware_update_allowed = charger_state == 0 || charger_state == 4;
+    firmware_update_allowed = all_data.charger_state == 0 || all_data.charger_state == 4;
 
     // get_state
 
-    evse_common.state.get("iec61851_state")->updateUint(iec61851_state);
-    evse_common.state.get("charger_state")->updateUint(charger_state);
-    evse_common.state.get("contactor_state")->updateUint(contactor_state);
-    bool contactor_error_changed = evse_common.state.get("contactor_error")->updateUint(contactor_error);
-    evse_common.state.get("allowed_charging_current")->updateUint(allowed_charging_current);
-    bool error_state_changed = evse_common.state.get("error_state")->updateUint(error_state);
-    evse_common.state.get("lock_state")->updateUint(lock_state);
+    evse_common.state.get("iec61851_state")->updateUint(all_data.iec61851_state);
+    evse_common.state.get("charger_state")->updateUint(all_data.charger_state);
+    evse_common.state.get("contactor_state")->updateUint(all_data.contactor_state);
+    bool contactor_error_changed = evse_common.state.get("contactor_error")->updateUint(all_data.contactor_error);
+    evse_common.state.get("allowed_charging_current")->updateUint(all_data.allowed_charging_current);
+    bool error_state_changed = evse_common.state.get("error_state")->updateUint(all_data.error_state);
+    evse_common.state.get("lock_state")->updateUint(all_data.lock_state);
 
-    uint8_t dc_fault_pins =  (dc_fault_current_state & 0x38) >> 3; //0b0011'1000
-    uint8_t dc_sensor_type = (dc_fault_current_state & 0x40) >> 6; //0b0100'0000
-    dc_fault_current_state = (dc_fault_current_state & 0x07) >> 0; //0b0000'0111
+    uint8_t dc_fault_pins =  (all_data.dc_fault_current_state & 0x38) >> 3; //0b0011'1000
+    uint8_t dc_sensor_type = (all_data.dc_fault_current_state & 0x40) >> 6; //0b0100'0000
+    uint8_t dc_fault_current_state = (all_data.dc_fault_current_state & 0x07) >> 0; //0b0000'0111
 
     bool dc_fault_current_state_changed = evse_common.state.get("dc_fault_current_state")->updateUint(dc_fault_current_state);
     evse_common.low_level_state.get("dc_fault_pins")->updateUint(dc_fault_pins);
     evse_common.low_level_state.get("dc_fault_sensor_type")->updateUint(dc_sensor_type);
 
     if (contactor_error_changed) {
-        if (contactor_error != 0) {
-            logger.printfln("Contactor error %u PE error %u", contactor_error >> 1, contactor_error & 1);
+        if (all_data.contactor_error != 0) {
+            logger.printfln("Contactor error %u PE error %u", all_data.contactor_error >> 1, all_data.contactor_error & 1);
         } else {
             logger.printfln("Contactor/PE error cleared");
         }
     }
 
     if (error_state_changed) {
-        if (error_state != 0) {
-            logger.printfln("Error state %d", error_state);
+        if (all_data.error_state != 0) {
+            logger.printfln("Error state %d", all_data.error_state);
         } else {
             logger.printfln("Error state cleared");
         }
@@ -1036,126 +1093,128 @@ void EVSEV2::update_all_data()
     }
 
     // get_hardware_configuration
-    evse_common.hardware_configuration.get("jumper_configuration")->updateUint(jumper_configuration);
-    evse_common.hardware_configuration.get("has_lock_switch")->updateBool(has_lock_switch);
-    evse_common.hardware_configuration.get("evse_version")->updateUint(evse_version);
-    evse_common.hardware_configuration.get("energy_meter_type")->updateUint(meter_data.meter_type);
+    evse_common.hardware_configuration.get("jumper_configuration")->updateUint(all_data.jumper_configuration);
+    evse_common.hardware_configuration.get("has_lock_switch")->updateBool(all_data.has_lock_switch);
+    evse_common.hardware_configuration.get("evse_version")->updateUint(all_data.evse_version);
+    evse_common.hardware_configuration.get("energy_meter_type")->updateUint(all_data.meter_data.meter_type);
 
     // get_low_level_state
-    evse_common.low_level_state.get("led_state")->updateUint(led_state);
-    evse_common.low_level_state.get("cp_pwm_duty_cycle")->updateUint(cp_pwm_duty_cycle);
+    evse_common.low_level_state.get("led_state")->updateUint(all_data.led_state);
+    evse_common.low_level_state.get("cp_pwm_duty_cycle")->updateUint(all_data.cp_pwm_duty_cycle);
 
-    for (int i = 0; i < sizeof(adc_values) / sizeof(adc_values[0]); ++i)
-        evse_common.low_level_state.get("adc_values")->get(i)->updateUint(adc_values[i]);
+    for (int i = 0; i < sizeof(all_data.adc_values) / sizeof(all_data.adc_values[0]); ++i)
+        evse_common.low_level_state.get("adc_values")->get(i)->updateUint(all_data.adc_values[i]);
 
-    for (int i = 0; i < sizeof(voltages) / sizeof(voltages[0]); ++i)
-        evse_common.low_level_state.get("voltages")->get(i)->updateInt(voltages[i]);
+    for (int i = 0; i < sizeof(all_data.voltages) / sizeof(all_data.voltages[0]); ++i)
+        evse_common.low_level_state.get("voltages")->get(i)->updateInt(all_data.voltages[i]);
 
-    for (int i = 0; i < sizeof(resistances) / sizeof(resistances[0]); ++i)
-        evse_common.low_level_state.get("resistances")->get(i)->updateUint(resistances[i]);
+    for (int i = 0; i < sizeof(all_data.resistances) / sizeof(all_data.resistances[0]); ++i)
+        evse_common.low_level_state.get("resistances")->get(i)->updateUint(all_data.resistances[i]);
 
-    for (int i = 0; i < sizeof(gpio) / sizeof(gpio[0]); ++i)
-        evse_common.low_level_state.get("gpio")->get(i)->updateBool(gpio[i]);
+    for (int i = 0; i < sizeof(all_data.gpio) / sizeof(all_data.gpio[0]); ++i)
+        evse_common.low_level_state.get("gpio")->get(i)->updateBool(all_data.gpio[i]);
 
 #if MODULE_AUTOMATION_AVAILABLE()
     static InputState last_shutdown_input_state = InputState::Unknown;
 
-    InputState shutdown_input_state = gpio[5] ? InputState::Closed : InputState::Open;
+    InputState shutdown_input_state = all_data.gpio[5] ? InputState::Closed : InputState::Open;
     if (last_shutdown_input_state != shutdown_input_state) {
         // We need to schedule this since the first call of update_all_data happens before automation is initialized.
-        task_scheduler.scheduleOnce([this, gpio]() {
-            automation.trigger_action(AutomationTriggerID::EVSEShutdownInput, (void *)&gpio[5], &trigger_action);
+        bool shutdown_input = all_data.gpio[5];
+        task_scheduler.scheduleOnce([this, shutdown_input]() {
+            automation.trigger_action(AutomationTriggerID::EVSEShutdownInput, (void *)&shutdown_input, &trigger_action);
         }, 0);
         last_shutdown_input_state = shutdown_input_state;
     }
 
     static InputState last_input_state = InputState::Unknown;
 
-    InputState input_state = gpio[16] ? InputState::Closed : InputState::Open;
+    InputState input_state = all_data.gpio[16] ? InputState::Closed : InputState::Open;
     if (last_input_state != input_state) {
         // We need to schedule this since the first call of update_all_data happens before automation is initialized.
-        task_scheduler.scheduleOnce([this, gpio]() {
-            automation.trigger_action(AutomationTriggerID::EVSEGPInput, (void *)&gpio[16], &trigger_action);
+        bool input = all_data.gpio[16];
+        task_scheduler.scheduleOnce([this, input]() {
+            automation.trigger_action(AutomationTriggerID::EVSEGPInput, (void *)&input, &trigger_action);
         }, 0);
         last_input_state = input_state;
     }
 #endif
 
-    evse_common.low_level_state.get("charging_time")->updateUint(charging_time);
-    evse_common.low_level_state.get("time_since_state_change")->updateUint(time_since_state_change);
-    evse_common.low_level_state.get("uptime")->updateUint(uptime);
-    evse_common.low_level_state.get("time_since_dc_fault_check")->updateUint(time_since_dc_fault_check);
+    evse_common.low_level_state.get("charging_time")->updateUint(all_data.charging_time);
+    evse_common.low_level_state.get("time_since_state_change")->updateUint(all_data.time_since_state_change);
+    evse_common.low_level_state.get("uptime")->updateUint(all_data.uptime);
+    evse_common.low_level_state.get("time_since_dc_fault_check")->updateUint(all_data.time_since_dc_fault_check);
 
     for (int i = 0; i < CHARGING_SLOT_COUNT; ++i) {
-        evse_common.slots.get(i)->get("max_current")->updateUint(max_current[i]);
-        evse_common.slots.get(i)->get("active")->updateBool(SLOT_ACTIVE(active_and_clear_on_disconnect[i]));
-        evse_common.slots.get(i)->get("clear_on_disconnect")->updateBool(SLOT_CLEAR_ON_DISCONNECT(active_and_clear_on_disconnect[i]));
+        evse_common.slots.get(i)->get("max_current")->updateUint(all_data.max_current[i]);
+        evse_common.slots.get(i)->get("active")->updateBool(SLOT_ACTIVE(all_data.active_and_clear_on_disconnect[i]));
+        evse_common.slots.get(i)->get("clear_on_disconnect")->updateBool(SLOT_CLEAR_ON_DISCONNECT(all_data.active_and_clear_on_disconnect[i]));
     }
 
     evse_common.auto_start_charging.get("auto_start_charging")->updateBool(
         !evse_common.slots.get(CHARGING_SLOT_AUTOSTART_BUTTON)->get("clear_on_disconnect")->asBool());
 
     // get_gpio_configuration
-    gpio_configuration.get("shutdown_input")->updateUint(shutdown_input_configuration);
-    gpio_configuration.get("input")->updateUint(input_configuration);
-    gpio_configuration.get("output")->updateUint(output_configuration);
+    gpio_configuration.get("shutdown_input")->updateUint(all_data.shutdown_input_configuration);
+    gpio_configuration.get("input")->updateUint(all_data.input_configuration);
+    gpio_configuration.get("output")->updateUint(all_data.output_configuration);
 
     // get_button_configuration
-    button_configuration.get("button")->updateUint(button_cfg);
+    button_configuration.get("button")->updateUint(all_data.button_cfg);
 
 #if MODULE_AUTOMATION_AVAILABLE()
-    if (button_pressed && !evse_common.button_state.get("button_pressed")->asBool())
+    if (all_data.button_pressed && !evse_common.button_state.get("button_pressed")->asBool())
         automation.trigger_action(AutomationTriggerID::EVSEButton, nullptr, &trigger_action);
 #endif
 
     // get_button_state
-    evse_common.button_state.get("button_press_time")->updateUint(button_press_time);
-    evse_common.button_state.get("button_release_time")->updateUint(button_release_time);
-    evse_common.button_state.get("button_pressed")->updateBool(button_pressed);
+    evse_common.button_state.get("button_press_time")->updateUint(all_data.button_press_time);
+    evse_common.button_state.get("button_release_time")->updateUint(all_data.button_release_time);
+    evse_common.button_state.get("button_pressed")->updateBool(all_data.button_pressed);
 
-    ev_wakeup.get("enabled")->updateBool(ev_wakeup_enabled);
-    phase_auto_switch.get("enabled")->updateBool(phase_auto_switch_enabled);
-    phases_connected.get("phases")->updateUint(phases_connected_);
-    evse_common.boost_mode.get("enabled")->updateBool(boost_mode_enabled);
+    ev_wakeup.get("enabled")->updateBool(all_data.ev_wakeup_enabled);
+    phase_auto_switch.get("enabled")->updateBool(all_data.phase_auto_switch_enabled);
+    phases_connected.get("phases")->updateUint(all_data.phases_connected_);
+    evse_common.boost_mode.get("enabled")->updateBool(all_data.boost_mode_enabled);
 
-    control_pilot_disconnect.get("disconnect")->updateBool(cp_disconnect);
+    control_pilot_disconnect.get("disconnect")->updateBool(all_data.cp_disconnect);
 
     // get_indicator_led
-    evse_common.indicator_led.get("indication")->updateInt(indication);
-    evse_common.indicator_led.get("duration")->updateUint(duration);
-    evse_common.indicator_led.get("color_h")->updateUint(color_h);
-    evse_common.indicator_led.get("color_s")->updateUint(color_s);
-    evse_common.indicator_led.get("color_v")->updateUint(color_v);
+    evse_common.indicator_led.get("indication")->updateInt(all_data.indication);
+    evse_common.indicator_led.get("duration")->updateUint(all_data.duration);
+    evse_common.indicator_led.get("color_h")->updateUint(all_data.color_h);
+    evse_common.indicator_led.get("color_s")->updateUint(all_data.color_s);
+    evse_common.indicator_led.get("color_v")->updateUint(all_data.color_v);
 
-    evse_common.auto_start_charging.get("auto_start_charging")->updateBool(!SLOT_CLEAR_ON_DISCONNECT(active_and_clear_on_disconnect[CHARGING_SLOT_AUTOSTART_BUTTON]));
+    evse_common.auto_start_charging.get("auto_start_charging")->updateBool(!SLOT_CLEAR_ON_DISCONNECT(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_AUTOSTART_BUTTON]));
 
-    evse_common.management_enabled.get("enabled")->updateBool(SLOT_ACTIVE(active_and_clear_on_disconnect[CHARGING_SLOT_CHARGE_MANAGER]));
+    evse_common.management_enabled.get("enabled")->updateBool(SLOT_ACTIVE(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_CHARGE_MANAGER]));
 
-    evse_common.user_enabled.get("enabled")->updateBool(SLOT_ACTIVE(active_and_clear_on_disconnect[CHARGING_SLOT_USER]));
+    evse_common.user_enabled.get("enabled")->updateBool(SLOT_ACTIVE(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_USER]));
 
-    evse_common.modbus_enabled.get("enabled")->updateBool(SLOT_ACTIVE(active_and_clear_on_disconnect[CHARGING_SLOT_MODBUS_TCP]));
-    evse_common.ocpp_enabled.get("enabled")->updateBool(SLOT_ACTIVE(active_and_clear_on_disconnect[CHARGING_SLOT_OCPP]));
+    evse_common.modbus_enabled.get("enabled")->updateBool(SLOT_ACTIVE(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_MODBUS_TCP]));
+    evse_common.ocpp_enabled.get("enabled")->updateBool(SLOT_ACTIVE(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_OCPP]));
 
-    evse_common.external_enabled.get("enabled")->updateBool(SLOT_ACTIVE(active_and_clear_on_disconnect[CHARGING_SLOT_EXTERNAL]));
-    evse_common.external_clear_on_disconnect.get("clear_on_disconnect")->updateBool(SLOT_CLEAR_ON_DISCONNECT(active_and_clear_on_disconnect[CHARGING_SLOT_EXTERNAL]));
+    evse_common.external_enabled.get("enabled")->updateBool(SLOT_ACTIVE(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_EXTERNAL]));
+    evse_common.external_clear_on_disconnect.get("clear_on_disconnect")->updateBool(SLOT_CLEAR_ON_DISCONNECT(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_EXTERNAL]));
 
-    evse_common.global_current.get("current")->updateUint(max_current[CHARGING_SLOT_GLOBAL]);
-    evse_common.management_current.get("current")->updateUint(max_current[CHARGING_SLOT_CHARGE_MANAGER]);
-    evse_common.external_current.get("current")->updateUint(max_current[CHARGING_SLOT_EXTERNAL]);
-    evse_common.user_current.get("current")->updateUint(max_current[CHARGING_SLOT_USER]);
+    evse_common.global_current.get("current")->updateUint(all_data.max_current[CHARGING_SLOT_GLOBAL]);
+    evse_common.management_current.get("current")->updateUint(all_data.max_current[CHARGING_SLOT_CHARGE_MANAGER]);
+    evse_common.external_current.get("current")->updateUint(all_data.max_current[CHARGING_SLOT_EXTERNAL]);
+    evse_common.user_current.get("current")->updateUint(all_data.max_current[CHARGING_SLOT_USER]);
 
-    evse_common.external_defaults.get("current")->updateUint(external_default_current);
-    evse_common.external_defaults.get("clear_on_disconnect")->updateBool(external_default_clear_on_disconnect);
+    evse_common.external_defaults.get("current")->updateUint(all_data.external_default_current);
+    evse_common.external_defaults.get("clear_on_disconnect")->updateBool(all_data.external_default_clear_on_disconnect);
 
-    evse_common.require_meter_enabled.get("enabled")->updateBool(SLOT_ACTIVE(active_and_clear_on_disconnect[CHARGING_SLOT_REQUIRE_METER]));
+    evse_common.require_meter_enabled.get("enabled")->updateBool(SLOT_ACTIVE(all_data.active_and_clear_on_disconnect[CHARGING_SLOT_REQUIRE_METER]));
 
-    gp_output.get("gp_output")->updateUint(gpio[10] ? TF_EVSE_V2_OUTPUT_CONNECTED_TO_GROUND : TF_EVSE_V2_OUTPUT_HIGH_IMPEDANCE);
+    gp_output.get("gp_output")->updateUint(all_data.gpio[10] ? TF_EVSE_V2_OUTPUT_CONNECTED_TO_GROUND : TF_EVSE_V2_OUTPUT_HIGH_IMPEDANCE);
 
-    evse_common.low_level_state.get("temperature")->updateInt(temperature);
-    evse_common.low_level_state.get("phases_current")->updateUint(phases_current);
-    evse_common.low_level_state.get("phases_requested")->updateUint(phases_requested);
-    evse_common.low_level_state.get("phases_state")->updateUint(phases_state);
-    evse_common.low_level_state.get("phases_info")->updateUint(phases_info);
+    evse_common.low_level_state.get("temperature")->updateInt(all_data.temperature);
+    evse_common.low_level_state.get("phases_current")->updateUint(all_data.phases_current);
+    evse_common.low_level_state.get("phases_requested")->updateUint(all_data.phases_requested);
+    evse_common.low_level_state.get("phases_state")->updateUint(all_data.phases_state);
+    evse_common.low_level_state.get("phases_info")->updateUint(all_data.phases_info);
 
 #if MODULE_WATCHDOG_AVAILABLE()
     static size_t watchdog_handle = watchdog.add("evse_v2_all_data", "EVSE not reachable");
@@ -1163,7 +1222,7 @@ void EVSEV2::update_all_data()
 #endif
 
 #if MODULE_METERS_EVSE_V2_AVAILABLE()
-    meters_evse_v2.update_from_evse_v2_all_data(&meter_data);
+    meters_evse_v2.update_from_evse_v2_all_data(&all_data.meter_data);
 #endif
 }
 
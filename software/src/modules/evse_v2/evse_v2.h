@@ -109,6 +109,87 @@ public:
     };
 
 private:
+    // Responses of the getters polled by update_all_data.
+    struct AllData {
+        // get_all_data_1
+        uint8_t iec61851_state;
+        uint8_t charger_state;
+        uint8_t contactor_state;
+        uint8_t contactor_error;
+        uint16_t allowed_charging_current;
+        uint8_t error_state;
+        uint8_t lock_state;
+        uint8_t dc_fault_current_state;
+        uint8_t jumper_configuration;
+        bool has_lock_switch;
+        uint8_t evse_version;
+        struct meter_data meter_data;
+
+        // get_all_data_2
+        uint8_t shutdown_input_configuration;
+        uint8_t input_configuration;
+        uint8_t output_configuration;
+        int16_t indication;
+        uint16_t duration;
+        uint16_t color_h;
+        uint8_t color_s;
+        uint8_t color_v;
+        uint8_t button_cfg;
+        uint32_t button_press_time;
+        uint32_t button_release_time;
+        bool button_pressed;
+        bool ev_wakeup_enabled;
+        bool cp_disconnect;
+        bool boost_mode_enabled;
+        int16_t temperature;
+        uint8_t phases_current;
+        uint8_t phases_requested;
+        uint8_t phases_state;
+        uint8_t phases_info;
+        bool phase_auto_switch_enabled;
+        uint8_t phases_connected_;
+
+        // get_low_level_state
+        uint8_t led_state;
+        uint16_t cp_pwm_duty_cycle;
+        uint16_t adc_values[7];
+        int16_t voltages[7];
+        uint32_t resistances[2];
+        bool gpio[24];
+        uint32_t charging_time;
+        uint32_t time_since_state_change;
+        uint32_t time_since_dc_fault_check;
+        uint32_t uptime;
+
+        // get_all_charging_slots
+        uint16_t max_current[20];
+        uint8_t active_and_clear_on_disconnect[20];
+
+        // get_charging_slot_default(CHARGING_SLOT_EXTERNAL)
+        uint16_t external_default_current;
+        bool external_default_enabled;
+        bool external_default_clear_on_disconnect;
+    };
+
+    // The request of update_all_data that is in flight.
+    enum class AllDataStep : uint8_t {
+        Idle,
+        AllData1,
+        AllData2,
+        LowLevelState,
+        AllChargingSlots,
+        ExternalSlotDefault,
+    };
+
+    bool send_all_data_request(AllDataStep step);
+    void handle_all_data_response(int result, TF_PacketBuffer *response, uint8_t length);
+    void apply_all_data();
+
+    AllData all_data;
+    AllDataStep all_data_step = AllDataStep::Idle;
+    bool all_data_received = false;
+    bool all_data_apply_pending = false;
+
     ConfigRoot reset_dc_fault_current_state;
     ConfigRoot gpio_configuration;
     ConfigRoot gpio_configuration_update;
@@ -44,6 +44,11 @@ extern int8_t green_led_pin;
 // Newer firmwares contain a firmware info page.
 #define FIRMWARE_INFO_OFFSET (0xd000 - 0x1000)
 #define FIRMWARE_INFO_LENGTH 0x1000
+// Offset of the app image in the firmware file.
+#define FIRMWARE_OFFSET (0x10000 - 0x1000)
+// An interrupted upload keeps its buffers so that it can be continued.
+// The web interface gives up on a stalled upload after two minutes.
+#define UPLOAD_TIMEOUT_MS (5 * 60 * 1000)
 
 static TaskHandle_t xTaskBuffer;
 
@@ -87,9 +92,39 @@ void factory_reset(bool restart_esp)
 
 void FirmwareUpdate::setup()
 {
+    task_scheduler.scheduleWithFixedDelay([this](){
+        this->check_upload_timeout();
+    }, 10000, 10000);
+
     initialized = true;
 }
 
+// An aborted upload never calls the final handler.
+void FirmwareUpdate::check_upload_timeout()
+{
+    std::unique_lock<std::mutex> lock{upload_mutex, std::try_to_lock};
+
+    // An upload handler is running, so the upload is not abandoned.
+    if (!lock.owns_lock())
+        return;
+
+    if (!firmware_writer.is_running() && !Update.isRunning())
+        return;
+
+    if (!deadline_elapsed(last_upload_chunk + UPLOAD_TIMEOUT_MS))
+        return;
+
+    logger.printfln("Aborting firmware update: Received no data for %d seconds", UPLOAD_TIMEOUT_MS / 1000);
+
+    if (firmware_writer.is_running())
+        firmware_writer.abort();
+
+    if (Update.isRunning())
+        Update.abort();
+
+    firmware_update_running = false;
+}
+
 void FirmwareUpdate::reset_firmware_info()
 {
     calculated_checksum = 0;
@@ -182,26 +217,65 @@ String FirmwareUpdate::check_firmware_info(bool firmware_info_found, bool detect
     return "";
 }
 
+// An interrupted firmware upload can be continued. The client sends the
+// length of the whole file, the CRC32 of the app image (i.e. of the file
+// without the first FIRMWARE_OFFSET bytes) and the offset of the request
+// body in the file. /flash_firmware_offset returns where to continue.
+void FirmwareUpdate::parse_upload_headers(WebServerRequest &request)
+{
+    String length = request.header("X-Update-Length");
+    String offset = request.header("X-Update-Offset");
+    String crc32 = request.header("X-Update-CRC32");
+
+    upload_length = length.isEmpty() ? request.contentLength() : strtoul(length.c_str(), nullptr, 10);
+    upload_offset = offset.isEmpty() ? 0 : strtoul(offset.c_str(), nullptr, 10);
+    upload_crc32_known = !crc32.isEmpty();
+    upload_crc32 = upload_crc32_known ? strtoul(crc32.c_str(), nullptr, 16) : 0;
+}
+
+// Returns 0 if the upload has to start from the beginning.
+size_t FirmwareUpdate::get_resume_offset()
+{
+    if (!upload_crc32_known || upload_length <= FIRMWARE_OFFSET || !firmware_writer.is_resumable(upload_length - FIRMWARE_OFFSET, upload_crc32))
+        return 0;
+
+    // The firmware info page was checked before the first sector of the app image was received.
+    size_t offset = firmware_writer.resume();
+    return offset == 0 ? 0 : offset + FIRMWARE_OFFSET;
+}
+
 bool FirmwareUpdate::handle_update_chunk(int command, WebServerRequest request, size_t chunk_index, uint8_t *data, size_t chunk_length, bool final, size_t complete_length) {
     // The firmware files are merged with the bootloader, partition table, firmware_info and slot configuration bins.
     // The bootloader starts at offset 0x1000, which is the first byte in the firmware file.
     // The first firmware slot (i.e. the one that is flashed over USB) starts at 0x10000.
     // So we have to skip the first 0x10000 - 0x1000 bytes, after them the actual firmware starts.
     // Don't skip anything if we flash the LittleFS.
-    const size_t firmware_offset = command == U_FLASH ? 0x10000 - 0x1000 : 0;
+    const size_t firmware_offset = command == U_FLASH ? FIRMWARE_OFFSET : 0;
     static bool firmware_info_found = false;
 
-    if (chunk_index == 0 && !Update.begin(complete_length - firmware_offset, command)) {
-        logger.printfln("Failed to start update: %s", Update.errorString());
-        request.send(400, "text/plain", Update.errorString());
-        Update.abort();
-        update_aborted = true;
-        return true;
-    }
+    last_upload_chunk = millis();
 
     if (chunk_index == 0) {
         reset_firmware_info();
         firmware_info_found = false;
+
+        // Drop an abandoned upload. The firmware writer does this itself in begin().
+        if (command != U_FLASH && Update.isRunning())
+            Update.abort();
+
+        // App images are written by the firmware writer, so that receiving and writing overlap.
+        bool started = command == U_FLASH ? firmware_writer.begin(complete_length - firmware_offset, upload_crc32_known, upload_crc32)
+                                          : Update.begin(complete_length - firmware_offset, command);
+
+        if (!started) {
+            const char *error = command == U_FLASH ? firmware_writer.get_error() : Update.errorString();
+            logger.printfln("Failed to start update: %s", error);
+            request.send(400, "text/plain", error);
+            if (command != U_FLASH)
+                Update.abort();
+            update_aborted = true;
+            return true;
+        }
     }
 
     if (update_aborted) {
@@ -212,11 +286,15 @@ bool FirmwareUpdate::handle_update_chunk(int command, WebServerRequest request,
         firmware_info_found = handle_firmware_info_chunk(chunk_index, data, chunk_length);
     }
 
-    if (chunk_index + chunk_length >= FIRMWARE_INFO_OFFSET + FIRMWARE_INFO_LENGTH) {
+    // Only check once: Resumed uploads start after the info page.
+    if (chunk_index < FIRMWARE_INFO_OFFSET + FIRMWARE_INFO_LENGTH && chunk_index + chunk_length >= FIRMWARE_INFO_OFFSET + FIRMWARE_INFO_LENGTH) {
         String error = this->check_firmware_info(firmware_info_found, false, true);
         if (!error.isEmpty()) {
             request.send(400, "application/json", error.c_str());
-            Update.abort();
+            if (command == U_FLASH)
+                firmware_writer.abort();
+            else
+                Update.abort();
             update_aborted = true;
             return true;
         }
@@ -235,6 +313,25 @@ bool FirmwareUpdate::handle_update_chunk(int command, WebServerRequest request,
         length -= to_skip;
     }
 
+    if (command == U_FLASH) {
+        // The writer aborts the update on errors.
+        if (!firmware_writer.write(start, length)) {
+            logger.printfln("Failed to write update chunk with length %u: %s", length, firmware_writer.get_error());
+            request.send(400, "text/plain", (String("Failed to write update: ") + firmware_writer.get_error()).c_str());
+            this->firmware_update_running = false;
+            return false;
+        }
+
+        if (final && !firmware_writer.end()) {
+            logger.printfln("Failed to apply update: %s", firmware_writer.get_error());
+            request.send(400, "text/plain", (String("Failed to apply update: ") + firmware_writer.get_error()).c_str());
+            this->firmware_update_running = false;
+            return false;
+        }
+
+        return true;
+    }
+
     auto written = Update.write(start, length);
     if (written != length) {
         logger.printfln("Failed to write update chunk with length %u; written %u, error: %s", length, written, Update.errorString());
@@ -301,25 +398,54 @@ void FirmwareUpdate::register_urls()
         return true;
     });
 
+    server.on_HTTPThread("/flash_firmware_offset", HTTP_GET, [this](WebServerRequest request){
+        std::lock_guard<std::mutex> lock{upload_mutex};
+
+        parse_upload_headers(request);
+
+        char buf[32];
+        snprintf(buf, ARRAY_SIZE(buf), "{\"offset\":%u}", get_resume_offset());
+        return request.send(200, "application/json", buf);
+    });
+
     server.on_HTTPThread("/flash_firmware", HTTP_POST, [this](WebServerRequest request){
+        std::lock_guard<std::mutex> lock{upload_mutex};
+
         if (update_aborted)
             return request.unsafe_ResponseAlreadySent(); // Already sent in upload callback.
 
         this->firmware_update_running = false;
 
-        if(!Update.hasError()) {
-            logger.printfln("Firmware flashed successfully! Rebooting in one second.");
-            task_scheduler.scheduleOnce([](){ESP.restart();}, 1000);
-        }
+        if (!firmware_writer.is_finished())
+            return request.send(400, "text/plain", "Firmware is incomplete");
 
-        return request.send(Update.hasError() ? 400: 200, "text/plain", Update.hasError() ? Update.errorString() : "Update OK");
+        logger.printfln("Firmware flashed successfully! Rebooting in one second.");
+        task_scheduler.scheduleOnce([](){ESP.restart();}, 1000);
+
+        return request.send(200, "text/plain", "Update OK");
     },[this](WebServerRequest request, String filename, size_t index, uint8_t *data, size_t len, bool final){
+        std::lock_guard<std::mutex> lock{upload_mutex};
+
+        if (index == 0) {
+            parse_upload_headers(request);
+
+            if (upload_offset != 0 && get_resume_offset() != upload_offset) {
+                logger.printfln("Failed to continue update at offset %u", upload_offset);
+                request.send(409, "text/plain", "firmware_update.script.resume_failed");
+                // The web interface doesn't retry after this error.
+                firmware_writer.abort();
+                this->firmware_update_running = false;
+                return false;
+            }
+        }
 
         this->firmware_update_running = true;
-        return handle_update_chunk(U_FLASH, request, index, data, len, final, request.contentLength());
+        return handle_update_chunk(U_FLASH, request, upload_offset + index, data, len, final, upload_length);
     });
 
     server.on_HTTPThread("/flash_spiffs", HTTP_POST, [this](WebServerRequest request){
+        std::lock_guard<std::mutex> lock{upload_mutex};
+
         if(!Update.hasError()) {
             logger.printfln("SPFFS flashed successfully! Rebooting in one second.");
             task_scheduler.scheduleOnce([](){ESP.restart();}, 1000);
@@ -327,6 +453,13 @@ void FirmwareUpdate::register_urls()
 
         return request.send(Update.hasError() ? 400: 200, "text/plain", Update.hasError() ? Update.errorString() : "Update OK");
     },[this](WebServerRequest request, String filename, size_t index, uint8_t *data, size_t len, bool final){
+        std::lock_guard<std::mutex> lock{upload_mutex};
+
+        if (index == 0) {
+            upload_offset = 0;
+            upload_crc32_known = false;
+        }
+
         return handle_update_chunk(U_SPIFFS, request, index, data, len, final, request.contentLength());
     });
 
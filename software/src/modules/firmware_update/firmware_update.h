@@ -22,9 +22,11 @@
 #include "config.h"
 
 #include <stdint.h>
+#include <mutex>
 
 #include "module.h"
 #include "web_server.h"
+#include "firmware_writer.h"
 
 void factory_reset(bool restart_esp = true);
 
@@ -38,6 +40,9 @@ public:
     bool firmware_update_running = false;
 
 private:
+    void check_upload_timeout();
+    void parse_upload_headers(WebServerRequest &request);
+    size_t get_resume_offset();
     bool handle_update_chunk(int command, WebServerRequest request, size_t chunk_index, uint8_t *data, size_t chunk_length, bool final, size_t complete_length);
     void reset_firmware_info();
     bool handle_firmware_info_chunk(size_t chunk_index, uint8_t *data, size_t chunk_length);
@@ -56,4 +61,15 @@ private:
     uint32_t checksum_offset = 0;
     bool update_aborted = false;
     bool info_found = false;
+
+    // Held by the upload handlers on the HTTP thread while they use the
+    // firmware writer or Update.
+    std::mutex upload_mutex;
+    uint32_t last_upload_chunk = 0;
+
+    FirmwareWriter firmware_writer;
+    size_t upload_offset = 0;
+    size_t upload_length = 0;
+    bool upload_crc32_known = false;
+    uint32_t upload_crc32 = 0;
 };
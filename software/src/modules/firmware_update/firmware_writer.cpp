@@ -0,0 +1,345 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "firmware_writer.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "esp_image_format.h"
+#include "esp_ota_ops.h"
+#include "esp_rom_crc.h"
+
+#include "event_log.h"
+#include "module_dependencies.h"
+
+#include "gcc_warnings.h"
+
+#define FIRMWARE_WRITER_TASK_STACK_SIZE 2560
+// The task has to wait for the flash anyway, so it can run with the priority of the web server.
+#define FIRMWARE_WRITER_TASK_PRIORITY (tskIDLE_PRIORITY + 5)
+// Erasing and writing a sector takes some ms. If no buffer is free after
+// this time, the flash is stuck.
+#define FIRMWARE_WRITER_BUFFER_TIMEOUT_MS 10000
+
+bool FirmwareWriter::fail(const char *message)
+{
+    error = message;
+    logger.printfln("Firmware update failed: %s", message);
+    abort();
+    return false;
+}
+
+bool FirmwareWriter::start_task()
+{
+    if (jobs != nullptr) {
+        return true;
+    }
+
+    jobs = xQueueCreate(2, sizeof(WriteJob));
+    free_buffers = xQueueCreate(2, sizeof(uint8_t *));
+
+    if (jobs == nullptr || free_buffers == nullptr) {
+        if (jobs != nullptr) {
+            vQueueDelete(jobs);
+            jobs = nullptr;
+        }
+
+        if (free_buffers != nullptr) {
+            vQueueDelete(free_buffers);
+            free_buffers = nullptr;
+        }
+
+        return false;
+    }
+
+    // The task runs forever. Between updates it only waits for the next job.
+    TaskHandle_t task;
+    if (xTaskCreate(task_fn, "fw_writer", FIRMWARE_WRITER_TASK_STACK_SIZE, this, FIRMWARE_WRITER_TASK_PRIORITY, &task) != pdPASS) {
+        vQueueDelete(jobs);
+        vQueueDelete(free_buffers);
+        jobs = nullptr;
+        free_buffers = nullptr;
+        return false;
+    }
+
+#if MODULE_DEBUG_AVAILABLE()
+    debug.register_task(task, FIRMWARE_WRITER_TASK_STACK_SIZE);
+#endif
+
+    return true;
+}
+
+void FirmwareWriter::task_fn(void *arg)
+{
+    static_cast<FirmwareWriter *>(arg)->run();
+}
+
+void FirmwareWriter::run()
+{
+    WriteJob job;
+
+    for (;;) {
+        xQueueReceive(jobs, &job, portMAX_DELAY);
+
+        // Skip the remaining jobs after an error. abort() or resume() picks up the error.
+        if (write_error == ESP_OK) {
+            esp_err_t err = esp_partition_erase_range(partition, job.offset, FIRMWARE_WRITER_BUFFER_SIZE);
+
+            if (err == ESP_OK) {
+                err = esp_partition_write(partition, job.offset, job.buffer, job.length);
+            }
+
+            if (err != ESP_OK) {
+                write_error_offset = job.offset;
+                write_error = err;
+            }
+        }
+
+        xQueueSend(free_buffers, &job.buffer, portMAX_DELAY);
+    }
+}
+
+// Waits until the task has written all submitted buffers. The buffers that
+// are not in use for receiving are returned in buffers_out.
+bool FirmwareWriter::drain(uint8_t **buffers_out)
+{
+    size_t count = fill_buffer == nullptr ? 2 : 1;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (xQueueReceive(free_buffers, &buffers_out[i], pdMS_TO_TICKS(FIRMWARE_WRITER_BUFFER_TIMEOUT_MS)) != pdTRUE) {
+            // Give back what was taken; the task still owns the rest.
+            for (size_t k = 0; k < i; ++k) {
+                xQueueSend(free_buffers, &buffers_out[k], 0);
+            }
+
+            return false;
+        }
+    }
+
+    if (fill_buffer != nullptr) {
+        buffers_out[1] = fill_buffer;
+        fill_buffer = nullptr;
+        fill_length = 0;
+    }
+
+    return true;
+}
+
+void FirmwareWriter::release_buffers()
+{
+    if (!buffers_allocated) {
+        return;
+    }
+
+    uint8_t *buffers[2];
+
+    if (!drain(buffers)) {
+        // The task still holds a buffer. Leak both instead of freeing memory that is in use.
+        logger.printfln("Firmware writer did not finish in time");
+        buffers_allocated = false;
+        return;
+    }
+
+    free(buffers[0]);
+    free(buffers[1]);
+    buffers_allocated = false;
+}
+
+bool FirmwareWriter::begin(size_t image_length_, bool check_crc32_, uint32_t image_crc32)
+{
+    abort();
+    error = "";
+    finished = false;
+
+    partition = esp_ota_get_next_update_partition(nullptr);
+
+    if (partition == nullptr) {
+        return fail("No OTA partition found");
+    }
+
+    if (image_length_ == 0 || image_length_ > partition->size) {
+        return fail("Firmware does not fit into the OTA partition");
+    }
+
+    if (!start_task()) {
+        return fail("Failed to start firmware writer task");
+    }
+
+    uint8_t *buffers[2] = {
+        static_cast<uint8_t *>(malloc(FIRMWARE_WRITER_BUFFER_SIZE)),
+        static_cast<uint8_t *>(malloc(FIRMWARE_WRITER_BUFFER_SIZE)),
+    };
+
+    if (buffers[0] == nullptr || buffers[1] == nullptr) {
+        free(buffers[0]);
+        free(buffers[1]);
+        return fail("Not enough memory for firmware buffers");
+    }
+
+    // Drops buffers that the task returned after release_buffers gave up on them.
+    xQueueReset(free_buffers);
+    xQueueSend(free_buffers, &buffers[0], 0);
+    xQueueSend(free_buffers, &buffers[1], 0);
+    buffers_allocated = true;
+
+    image_length = image_length_;
+    check_crc32 = check_crc32_;
+    expected_crc32 = image_crc32;
+    crc32 = 0;
+    buffer_offset = 0;
+    fill_buffer = nullptr;
+    fill_length = 0;
+    write_error = ESP_OK;
+    running = true;
+
+    return true;
+}
+
+bool FirmwareWriter::is_resumable(size_t image_length_, uint32_t image_crc32) const
+{
+    return running && check_crc32 && image_length == image_length_ && expected_crc32 == image_crc32;
+}
+
+size_t FirmwareWriter::resume()
+{
+    uint8_t *buffers[2];
+
+    if (!drain(buffers)) {
+        fail("Firmware writer did not finish in time");
+        return 0;
+    }
+
+    xQueueSend(free_buffers, &buffers[0], 0);
+    xQueueSend(free_buffers, &buffers[1], 0);
+
+    if (write_error != ESP_OK) {
+        logger.printfln("Failed to write firmware at offset 0x%x: %s (0x%x)", write_error_offset, esp_err_to_name(write_error), static_cast<unsigned>(write_error));
+        fail("Failed to write firmware");
+        return 0;
+    }
+
+    return buffer_offset;
+}
+
+bool FirmwareWriter::submit()
+{
+    crc32 = esp_rom_crc32_le(crc32, fill_buffer, fill_length);
+
+    WriteJob job = {fill_buffer, buffer_offset, fill_length};
+    xQueueSend(jobs, &job, portMAX_DELAY);
+
+    buffer_offset += fill_length;
+    fill_buffer = nullptr;
+    fill_length = 0;
+
+    if (write_error != ESP_OK) {
+        // Collect the error and the buffers.
+        resume();
+        return false;
+    }
+
+    return true;
+}
+
+bool FirmwareWriter::write(const uint8_t *data, size_t length)
+{
+    if (!running) {
+        return false;
+    }
+
+    if (buffer_offset + fill_length + length > image_length) {
+        return fail("Firmware is longer than announced");
+    }
+
+    if (buffer_offset == 0 && fill_length == 0 && length > 0 && data[0] != ESP_IMAGE_HEADER_MAGIC) {
+        return fail("Firmware image has no valid header");
+    }
+
+    while (length > 0) {
+        if (fill_buffer == nullptr && xQueueReceive(free_buffers, &fill_buffer, pdMS_TO_TICKS(FIRMWARE_WRITER_BUFFER_TIMEOUT_MS)) != pdTRUE) {
+            fill_buffer = nullptr;
+            return fail("Firmware writer did not finish in time");
+        }
+
+        size_t to_copy = std::min(length, FIRMWARE_WRITER_BUFFER_SIZE - fill_length);
+
+        memcpy(fill_buffer + fill_length, data, to_copy);
+        fill_length += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if (fill_length == FIRMWARE_WRITER_BUFFER_SIZE && !submit()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FirmwareWriter::end()
+{
+    if (!running) {
+        return false;
+    }
+
+    if (fill_length > 0 && !submit()) {
+        return false;
+    }
+
+    size_t written = resume();
+
+    if (!running) {
+        return false;
+    }
+
+    if (written != image_length) {
+        logger.printfln("Firmware is incomplete: Got %u of %u bytes", written, image_length);
+        return fail("Firmware is incomplete");
+    }
+
+    if (check_crc32 && crc32 != expected_crc32) {
+        logger.printfln("Firmware CRC32 mismatch: Expected %08lx, got %08lx", static_cast<unsigned long>(expected_crc32), static_cast<unsigned long>(crc32));
+        return fail("Firmware CRC32 mismatch");
+    }
+
+    // Validates the image, including its SHA-256 digest.
+    esp_err_t err = esp_ota_set_boot_partition(partition);
+
+    if (err != ESP_OK) {
+        logger.printfln("Failed to activate firmware: %s (0x%x)", esp_err_to_name(err), static_cast<unsigned>(err));
+        return fail("Firmware image is invalid");
+    }
+
+    release_buffers();
+    running = false;
+    finished = true;
+
+    return true;
+}
+
+void FirmwareWriter::abort()
+{
+    release_buffers();
+
+    running = false;
+    fill_buffer = nullptr;
+    fill_length = 0;
+    buffer_offset = 0;
+}
@@ -0,0 +1,102 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#define FIRMWARE_WRITER_BUFFER_SIZE SPI_FLASH_SEC_SIZE
+
+// Writes an app image to the next OTA partition. Received data is collected
+// in two sector buffers: While a separate task erases and writes one of them,
+// the next sector is received into the other one.
+//
+// Only complete sectors are written before end(), so an interrupted upload
+// can continue at the offset returned by resume() as long as the image length
+// and CRC32 match. The CRC32 is calculated while receiving the image and
+// checked before the partition is activated.
+class FirmwareWriter
+{
+public:
+    FirmwareWriter() {}
+
+    // Aborts a running image. Pass check_crc32 = false if the CRC32 is not
+    // known. Such an image can't be resumed.
+    bool begin(size_t image_length, bool check_crc32, uint32_t image_crc32);
+
+    bool is_resumable(size_t image_length, uint32_t image_crc32) const;
+    // Waits until all complete sectors are written and drops a partially
+    // received sector. Returns the offset in the image to continue at.
+    size_t resume();
+
+    bool write(const uint8_t *data, size_t length);
+    // Writes the last sector, checks the CRC32 and activates the partition.
+    bool end();
+    void abort();
+
+    bool is_running() const { return running; }
+    bool is_finished() const { return finished; }
+    const char *get_error() const { return error; }
+
+private:
+    struct WriteJob {
+        uint8_t *buffer;
+        size_t offset;
+        size_t length;
+    };
+
+    static void task_fn(void *arg);
+    void run();
+
+    bool start_task();
+    bool submit();
+    bool drain(uint8_t **buffers_out);
+    void release_buffers();
+    bool fail(const char *message);
+
+    const esp_partition_t *partition = nullptr;
+
+    QueueHandle_t jobs = nullptr;
+    QueueHandle_t free_buffers = nullptr;
+    bool buffers_allocated = false;
+
+    uint8_t *fill_buffer = nullptr;
+    size_t fill_length = 0;
+    // Image offset of the first byte in fill_buffer.
+    size_t buffer_offset = 0;
+
+    size_t image_length = 0;
+    bool check_crc32 = false;
+    uint32_t expected_crc32 = 0;
+    // CRC32 of the image up to buffer_offset.
+    uint32_t crc32 = 0;
+
+    // Set by the task, only read after drain().
+    volatile esp_err_t write_error = ESP_OK;
+    volatile size_t write_error_offset = 0;
+
+    bool running = false;
+    bool finished = false;
+    const char *error = "";
+};
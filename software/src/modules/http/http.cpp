@@ -19,18 +19,29 @@
 
 #include "http.h"
 
+#include <algorithm>
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_random.h"
+
 #include "api.h"
+#include "string_builder.h"
 #include "task_scheduler.h"
 #include "web_server.h"
 
 #include "module_dependencies.h"
 
+// Max payload size of raw commands and responses.
+// Command payloads are deserialized while they are received and are not limited.
 #if defined(BOARD_HAS_PSRAM)
 #define RECV_BUF_SIZE 4096
 #else
 #define RECV_BUF_SIZE 2048
 #endif
 
+#define COMMAND_RECV_CHUNK_SIZE 256
+
 class HTTPChunkedResponse : public IBaseChunkedResponse
 {
 public:
@@ -70,64 +81,62 @@ private:
     WebServerRequest *request;
 };
 
-static char recv_buf[RECV_BUF_SIZE] = {0};
-
-bool custom_uri_match(const char *ref_uri, const char *in_uri, size_t len)
+// Reader for ArduinoJson that receives the request payload in small chunks.
+class RequestPayloadReader
 {
-    if (boot_stage <= BootStage::REGISTER_URLS)
-        return false;
-
-    if (ref_uri == nullptr || in_uri == nullptr)
-        return false;
-
-    // Don't match the API handler.
-    if (strncmp_with_same_len("/*", in_uri, len) == 0)
-        return false;
-
-    size_t ref_len = strlen(ref_uri);
-
-    if (ref_len == 0)
-        return false;
-
-    // Match other wildcard handlers if:
-    // - ref_uri is a wildcard handler (it ends in *)
-    // - ref_uri is is not the API handler
-    // - in_uri is at least as long as the wildcard handler without the *
-    // - in_uri and ref_uri are the same up to one char before the *
-    if ((ref_uri[ref_len - 1] == '*')
-     && (strncmp_with_same_len(ref_uri, "/*", 2) != 0)
-     && (strnlen(in_uri, len) >= (ref_len - 1))
-     && (strncmp(ref_uri, in_uri, MIN(ref_len - 1, len)) == 0)) {
-        return true;
+public:
+    RequestPayloadReader(WebServerRequest *request): request(request) {}
+
+    int read()
+    {
+        if (pos == len && !fill())
+            return -1;
+
+        return static_cast<uint8_t>(buf[pos++]);
     }
 
-    // Match directly registered URLs.
-    if (strncmp_with_same_len(ref_uri, in_uri, len) == 0)
-        return true;
+    size_t readBytes(char *dst, size_t dst_len)
+    {
+        size_t copied = 0;
 
-    // Only match in_uri with APIs if ref_uri is the registered API handler.
-    if (strncmp_with_same_len(ref_uri, "/*", 2) != 0 || len < 2)
-        return false;
+        while (copied < dst_len && (pos < len || fill())) {
+            size_t to_copy = std::min(dst_len - copied, len - pos);
 
-    // Use + 1 to compare: in_uri starts with /; the api paths don't.
-    for (size_t i = 0; i < api.commands.size(); i++)
-        if (api.commands[i].path_len == len - 1 && memcmp(api.commands[i].path, in_uri + 1, len - 1) == 0)
-            return true;
+            memcpy(dst + copied, buf + pos, to_copy);
+            copied += to_copy;
+            pos += to_copy;
+        }
 
-    for (size_t i = 0; i < api.states.size(); i++)
-        if (api.states[i].path_len == len - 1 && memcmp(api.states[i].path, in_uri + 1, len - 1) == 0)
-            return true;
+        return copied;
+    }
 
-    for (size_t i = 0; i < api.raw_commands.size(); i++)
-        if (api.raw_commands[i].path_len == len - 1 && memcmp(api.raw_commands[i].path, in_uri + 1, len - 1) == 0)
-            return true;
+    int get_error() const { return error; }
 
-    for (size_t i = 0; i < api.responses.size(); i++)
-        if (api.responses[i].path_len == len - 1 && memcmp(api.responses[i].path, in_uri + 1, len - 1) == 0)
-            return true;
+private:
+    bool fill()
+    {
+        int received = request->receiveChunk(buf, sizeof(buf));
 
-    return false;
-}
+        if (received <= 0) {
+            error = received;
+            return false;
+        }
+
+        pos = 0;
+        len = static_cast<size_t>(received);
+
+        return true;
+    }
+
+    WebServerRequest *request;
+    char buf[COMMAND_RECV_CHUNK_SIZE];
+    size_t pos = 0;
+    size_t len = 0;
+    int error = 0;
+};
+
+// Leading / + path (path_len is an uint8_t) + _update suffix
+#define API_URI_BUF_SIZE (1 + 255 + 7)
 
 #if MODULE_AUTOMATION_AVAILABLE()
 enum class HttpTriggerMethod : uint8_t {
@@ -141,8 +150,15 @@ enum class HttpTriggerMethod : uint8_t {
 
 void Http::pre_setup()
 {
+    state_handler = server.createHandler_HTTPThread([this](WebServerRequest request){return api_state_handler(request);});
+    command_handler = server.createHandler_HTTPThread([this](WebServerRequest request){return api_command_handler(request);});
+    raw_command_handler = server.createHandler_HTTPThread([this](WebServerRequest request){return api_raw_command_handler(request);});
+    response_handler = server.createHandler_HTTPThread([this](WebServerRequest request){return api_response_handler(request);});
+
     api.registerBackend(this);
 
+    etag_prefix = esp_random();
+
 #if MODULE_AUTOMATION_AVAILABLE()
     automation.register_trigger(
         AutomationTriggerID::HTTP,
@@ -162,27 +178,37 @@ void Http::setup()
     initialized = true;
 }
 
-static WebServerRequestReturnProtect run_command(WebServerRequest req, size_t cmdidx)
+WebServerRequestReturnProtect Http::run_command(WebServerRequest req, size_t cmdidx)
 {
     CommandRegistration &reg = api.commands[cmdidx];
 
-    // TODO: Use streamed parsing
-    int bytes_written = req.receive(recv_buf, RECV_BUF_SIZE);
-    if (bytes_written == -1) {
-        // buffer was not large enough
-        return req.send(413);
-    }
-
-    if (bytes_written < 0) {
-        logger.printfln("Failed to receive command payload: error code %d", bytes_written);
-        return req.send(400);
-    }
-
     String message;
-    if (bytes_written == 0 && reg.config->is_null()) {
+    if (req.contentLength() == 0) {
+        if (!reg.config->is_null())
+            return req.send(400, "text/plain; charset=utf-8", ConfigRoot::deserialization_error_to_string(DeserializationError::EmptyInput).c_str());
+
         message = api.callCommand(reg, nullptr, 0);
     } else {
-        message = api.callCommand(reg, recv_buf, bytes_written);
+        size_t doc_size;
+        {
+            std::lock_guard<std::mutex> lock{cache_mutex};
+            doc_size = command_doc_sizes[cmdidx];
+        }
+
+        // Strings are copied into the document, so it is sized for the config's max string lengths.
+        DynamicJsonDocument doc(doc_size);
+        RequestPayloadReader reader(&req);
+        DeserializationError error = deserializeJson(doc, reader);
+
+        if (reader.get_error() < 0) {
+            logger.printfln("Failed to receive command payload: error code %d", reader.get_error());
+            return req.send(400);
+        }
+
+        if (error)
+            return req.send(400, "text/plain; charset=utf-8", ConfigRoot::deserialization_error_to_string(error).c_str());
+
+        message = api.callCommand(reg, doc.as<JsonVariant>());
     }
 
     if (message.isEmpty()) {
@@ -191,132 +217,252 @@ static WebServerRequestReturnProtect run_command(WebServerRequest req, size_t cm
     return req.send(400, "text/plain; charset=utf-8", message.c_str());
 }
 
-// Use + 1 to compare: req.uriCStr() starts with /; the api paths don't.
-WebServerRequestReturnProtect Http::api_handler_get(WebServerRequest req)
+void Http::format_etag(char *buf, size_t buf_len, uint32_t generation)
+{
+    snprintf(buf, buf_len, "\"%08" PRIx32 "-%" PRIu32 "\"", etag_prefix, generation);
+}
+
+// The route of every API handler passes the index of its registration as route argument.
+WebServerRequestReturnProtect Http::api_state_handler(WebServerRequest req)
 {
-    size_t req_uri_len = strlen(req.uriCStr() + 1);
+    size_t i = req.routeArg();
+    const char *if_none_match = req.headerCStr("If-None-Match");
+    // Quotes + prefix + dash + generation
+    char etag[2 + 8 + 1 + 10 + 1];
+    String response;
+    bool cached = false;
+    bool not_modified = false;
 
-    for (size_t i = 0; i < api.states.size(); i++)
     {
-        if (api.states[i].path_len != req_uri_len || memcmp(api.states[i].path, req.uriCStr() + 1, req_uri_len) != 0)
-            continue;
+        std::lock_guard<std::mutex> lock{cache_mutex};
+        const StateCache &cache = state_cache[i];
 
-        String response;
-        auto result = task_scheduler.await([&response, i]() {
+        if (cache.valid) {
+            format_etag(etag, sizeof(etag), cache.generation);
+
+            // Also matches weak validators and lists of ETags.
+            if (if_none_match != nullptr && strstr(if_none_match, etag) != nullptr) {
+                not_modified = true;
+            } else {
+                response = cache.payload;
+            }
+
+            cached = true;
+        }
+    }
+
+    if (not_modified) {
+        req.addResponseHeader("ETag", etag);
+        return req.send(304);
+    }
+
+    if (!cached) {
+        uint32_t generation = 0;
+        auto result = task_scheduler.await([this, &response, &generation, i]() {
             response = api.states[i].config->to_string_except(api.states[i].keys_to_censor, api.states[i].keys_to_censor_len);
+
+            std::lock_guard<std::mutex> lock{cache_mutex};
+            StateCache &cache = state_cache[i];
+
+            cache.payload = response;
+            cache.generation++;
+            cache.valid = true;
+            cache.requested = true;
+
+            generation = cache.generation;
         });
         if (result == TaskScheduler::AwaitResult::Timeout)
             return req.send(500, "text/plain", "Failed to get config. Task timed out.");
 
-        return req.send(200, "application/json; charset=utf-8", response.c_str());
+        format_etag(etag, sizeof(etag), generation);
     }
 
-    for (size_t i = 0; i < api.commands.size(); i++)
-        if (api.commands[i].path_len == req_uri_len && memcmp(api.commands[i].path, req.uriCStr() + 1, req_uri_len) == 0 && api.commands[i].config->is_null())
-            return run_command(req, i);
+    req.addResponseHeader("ETag", etag);
+    req.addResponseHeader("Cache-Control", "no-cache");
+    return req.send(200, "application/json; charset=utf-8", response.c_str(), static_cast<ssize_t>(response.length()));
+}
 
-    // If we reach this point, the url matcher found an API with the req.uri() as path, but we did not.
-    // This was probably a raw command or a command that requires a payload. Return 405 - Method not allowed
-    return req.send(405, "text/plain", "Request method for this URI is not handled by server");
+WebServerRequestReturnProtect Http::api_command_handler(WebServerRequest req)
+{
+    return run_command(req, req.routeArg());
 }
 
-WebServerRequestReturnProtect Http::api_handler_put(WebServerRequest req)
+WebServerRequestReturnProtect Http::api_raw_command_handler(WebServerRequest req)
 {
-    size_t req_uri_len = strlen(req.uriCStr() + 1);
+    size_t i = req.routeArg();
 
-    for (size_t i = 0; i < api.commands.size(); i++)
-        if (api.commands[i].path_len == req_uri_len && memcmp(api.commands[i].path, req.uriCStr() + 1, req_uri_len) == 0)
-            return run_command(req, i);
+    // Raw commands need the whole payload.
+    if (req.contentLength() > RECV_BUF_SIZE)
+        return req.send(413);
 
-    for (size_t i = 0; i < api.raw_commands.size(); i++)
-    {
-        if (api.raw_commands[i].path_len != req_uri_len || memcmp(api.raw_commands[i].path, req.uriCStr() + 1, req_uri_len) != 0)
-            continue;
-
-        // TODO: Use streamed parsing
-        int bytes_written = req.receive(recv_buf, RECV_BUF_SIZE);
-        if (bytes_written == -1) {
-            // buffer was not large enough
-            return req.send(413);
-        } else if (bytes_written <= 0) {
-            logger.printfln("Failed to receive raw command payload: error code %d", bytes_written);
-            return req.send(400);
-        }
+    auto recv_buf = heap_alloc_array<char>(req.contentLength());
+    int bytes_written = req.receive(recv_buf.get(), req.contentLength());
+    if (bytes_written <= 0) {
+        logger.printfln("Failed to receive raw command payload: error code %d", bytes_written);
+        return req.send(400);
+    }
 
-        String message;
-        auto result = task_scheduler.await([&message, i, bytes_written]() {
-            message = api.raw_commands[i].callback(recv_buf, bytes_written);
-        });
-        if (result == TaskScheduler::AwaitResult::Timeout)
-            return req.send(500, "text/plain", "Failed to call raw command. Task timed out.");
+    String message;
+    auto result = task_scheduler.await([&message, &recv_buf, i, bytes_written]() {
+        message = api.raw_commands[i].callback(recv_buf.get(), bytes_written);
+    });
+    if (result == TaskScheduler::AwaitResult::Timeout)
+        return req.send(500, "text/plain", "Failed to call raw command. Task timed out.");
 
-        if (message.isEmpty()) {
-            return req.send(200);
-        }
-        return req.send(400, "text/plain; charset=utf-8", message.c_str());
+    if (message.isEmpty()) {
+        return req.send(200);
     }
+    return req.send(400, "text/plain; charset=utf-8", message.c_str());
+}
 
-    for (size_t i = 0; i < api.responses.size(); i++)
-    {
-        if (api.responses[i].path_len != req_uri_len || memcmp(api.responses[i].path, req.uriCStr() + 1, req_uri_len) != 0)
-            continue;
-
-        // TODO: Use streamed parsing
-        int bytes_written = req.receive(recv_buf, RECV_BUF_SIZE);
-        if (bytes_written == -1) {
-            // buffer was not large enough
-            return req.send(413);
-        } else if (bytes_written < 0) {
-            logger.printfln("Failed to receive response payload: error code %d", bytes_written);
-            return req.send(400);
-        }
+WebServerRequestReturnProtect Http::api_response_handler(WebServerRequest req)
+{
+    size_t i = req.routeArg();
 
-        uint32_t response_owner_id = response_ownership.current();
-        HTTPChunkedResponse http_response(&req);
-        QueuedChunkedResponse queued_response(&http_response, 500);
-        BufferedChunkedResponse buffered_response(&queued_response);
+    if (req.contentLength() > RECV_BUF_SIZE)
+        return req.send(413);
 
-        task_scheduler.scheduleOnce(
-            [this, i, bytes_written, &buffered_response, response_owner_id] {
-                api.callResponse(api.responses[i], recv_buf, bytes_written, &buffered_response, &response_ownership, response_owner_id);
-            },
-            0);
+    // Allocate at least one byte: The buffer is passed on even if the payload is empty.
+    auto recv_buf = heap_alloc_array<char>(std::max(req.contentLength(), static_cast<size_t>(1)));
+    int bytes_written = req.receive(recv_buf.get(), req.contentLength());
+    if (bytes_written < 0) {
+        logger.printfln("Failed to receive response payload: error code %d", bytes_written);
+        return req.send(400);
+    }
 
-        String error = queued_response.wait();
+    uint32_t response_owner_id = response_ownership.current();
+    HTTPChunkedResponse http_response(&req);
+    QueuedChunkedResponse queued_response(&http_response, 500);
+    BufferedChunkedResponse buffered_response(&queued_response);
 
-        if (!error.isEmpty()) {
-            logger.printfln("Response processing failed after update: %s (%s %s)", error.c_str(), req.methodString(), req.uriCStr());
-        }
+    task_scheduler.scheduleOnce(
+        [this, i, bytes_written, &recv_buf, &buffered_response, response_owner_id] {
+            api.callResponse(api.responses[i], recv_buf.get(), bytes_written, &buffered_response, &response_ownership, response_owner_id);
+        },
+        0);
 
-        response_ownership.next();
-        return WebServerRequestReturnProtect{};
-    }
+    String error = queued_response.wait();
 
-    if (req.uri().endsWith("_update")) {
-        return req.send(405, "text/plain", "Request method for this URI is not handled by server");
+    if (!error.isEmpty()) {
+        logger.printfln("Response processing failed after update: %s (%s %s)", error.c_str(), req.methodString(), req.uriCStr());
     }
 
-    for (size_t i = 0; i < api.states.size(); i++)
-    {
-        if (api.states[i].path_len != req_uri_len || memcmp(api.states[i].path, req.uriCStr() + 1, req_uri_len) != 0)
-            continue;
+    response_ownership.next();
+    return WebServerRequestReturnProtect{};
+}
 
-        String uri_update = req.uri() + "_update";
-        for (size_t a = 0; a < api.commands.size(); a++)
-            if (api.commands[a].path_len == uri_update.length() - 1 && memcmp(api.commands[a].path, uri_update.c_str() + 1, uri_update.length() - 1) == 0)
-                return run_command(req, a);
+struct StatePathPattern {
+    const char *path;
+    size_t path_len;
+    bool is_prefix;
+};
+
+static bool state_path_matches(const std::vector<StatePathPattern> &patterns, const StateRegistration &reg)
+{
+    if (patterns.empty())
+        return true;
 
-        // If we've found the api state that matches req.uriCStr() but did not find a corresponding command with _update,
-        // break here because there can't be two states with the same path. We don't have to check the rest.
-        break;
+    for (const StatePathPattern &pattern : patterns) {
+        if (pattern.is_prefix) {
+            if (reg.path_len >= pattern.path_len && memcmp(reg.path, pattern.path, pattern.path_len) == 0)
+                return true;
+        } else if (reg.path_len == pattern.path_len && memcmp(reg.path, pattern.path, pattern.path_len) == 0) {
+            return true;
+        }
     }
 
-    // If we reach this point, the url matcher found an API with the req.uri() as path, but we did not.
-    // This was probably a raw command or a command that requires a payload. Return 405 - Method not allowed
-    return req.send(405, "text/plain", "Request method for this URI is not handled by server");
+    return false;
 }
 
+// GET /api_batch?paths=evse/state,meters/*
+// Sends the requested states (or all states if no paths are given) as one
+// NDJSON document in the framing of the web socket's initial dump. A path
+// ending in * selects all states starting with the part before the *.
+// An empty line marks the end of the dump; it is missing if the dump was aborted.
+WebServerRequestReturnProtect Http::api_batch_handler(WebServerRequest req)
+{
+    std::vector<StatePathPattern> patterns;
+    std::unique_ptr<char[]> paths_buf;
+    const char *paths = nullptr;
+
+    // Decode into a buffer owned by this request: A long path list does not
+    // fit into the request scratch arena. Without a paths parameter, all states
+    // are sent. A paths parameter that can't be decoded must not fall back to that.
+    size_t query_len = req.queryLength();
+    if (query_len > 0) {
+        if (query_len >= RECV_BUF_SIZE)
+            return req.send(414, "text/plain", "Query too long");
+
+        paths_buf = heap_alloc_array<char>(query_len + 1);
+
+        esp_err_t err = req.queryParam("paths", paths_buf.get(), query_len + 1);
+        if (err == ESP_OK)
+            paths = paths_buf.get();
+        else if (err != ESP_ERR_NOT_FOUND)
+            return req.send(400, "text/plain", "Failed to parse paths");
+    }
+
+    while (paths != nullptr && *paths != '\0') {
+        size_t len = strcspn(paths, ",");
+
+        if (len > 0) {
+            bool is_prefix = paths[len - 1] == '*';
+            patterns.push_back({paths, is_prefix ? len - 1 : len, is_prefix});
+        }
+
+        paths += len;
+
+        if (*paths == ',')
+            ++paths;
+    }
+
+    // Same buffer size as the web socket's initial dump.
+    StringBuilder sb;
+
+    if (!sb.setCapacity(4096 + 128))
+        return req.send(503, "text/plain", "Not enough memory to send states");
+
+    size_t i = 0;
+    bool done = false;
+    bool response_started = false;
+
+    while (!done) {
+        auto result = task_scheduler.await([&i, &done, &sb, &patterns]() {
+            done = api.appendStateDump(&sb, &i, [&patterns](const StateRegistration &reg) {
+                return state_path_matches(patterns, reg);
+            });
+        });
+
+        if (result != TaskScheduler::AwaitResult::Done) {
+            if (!response_started)
+                return req.send(500, "text/plain", "Failed to get states. Task timed out.");
+
+            break;
+        }
+
+        // A single state does not fit into the buffer.
+        if (!done && sb.getLength() == 0)
+            break;
+
+        if (done)
+            sb.putc('\n');
 
+        if (!response_started) {
+            req.beginChunkedResponse(200, "application/x-ndjson; charset=utf-8");
+            response_started = true;
+        }
+
+        if (req.sendChunk(sb.getPtr(), static_cast<ssize_t>(sb.getLength())) != ESP_OK)
+            return req.endChunkedResponse();
+
+        sb.clear();
+    }
+
+    if (!response_started)
+        return req.send(500, "text/plain", "Failed to get states. A state exceeds the buffer capacity.");
+
+    return req.endChunkedResponse();
+}
 
 Http::HttpTriggerActionResult Http::trigger_action(Config *trigger_config, void *user_data) {
 #if MODULE_AUTOMATION_AVAILABLE()
@@ -423,35 +569,123 @@ WebServerRequestReturnProtect Http::automation_trigger_handler(WebServerRequest
 
 void Http::register_urls()
 {
+    server.on_HTTPThread("/api_batch", HTTP_GET, [this](WebServerRequest request){return api_batch_handler(request);});
+
 #if MODULE_AUTOMATION_AVAILABLE()
     server.on("/automation_trigger/*", HTTP_GET, [this](WebServerRequest request){return automation_trigger_handler(request);});
     server.on("/automation_trigger/*", HTTP_PUT, [this](WebServerRequest request){return automation_trigger_handler(request);});
     server.on("/automation_trigger/*", HTTP_POST, [this](WebServerRequest request){return automation_trigger_handler(request);});
 #endif
+}
 
-    server.on_HTTPThread("/*", HTTP_GET, [this](WebServerRequest request){return api_handler_get(request);});
-    server.on_HTTPThread("/*", HTTP_PUT, [this](WebServerRequest request){return api_handler_put(request);});
-    server.on_HTTPThread("/*", HTTP_POST, [this](WebServerRequest request){return api_handler_put(request);});
+// API paths don't start with /; URIs do.
+static size_t build_api_uri(char *buf, const char *path, size_t path_len)
+{
+    buf[0] = '/';
+    memcpy(buf + 1, path, path_len);
+    return path_len + 1;
 }
 
 void Http::addCommand(size_t commandIdx, const CommandRegistration &reg)
 {
+    char uri[API_URI_BUF_SIZE];
+    size_t uri_len = build_api_uri(uri, reg.path, reg.path_len);
+
+    server.addRoute(uri, uri_len, HTTP_PUT, command_handler, commandIdx);
+    server.addRoute(uri, uri_len, HTTP_POST, command_handler, commandIdx);
+
+    // The size only depends on the config's schema. Calculate it here,
+    // because the config must not be accessed from the HTTP thread.
+    {
+        std::lock_guard<std::mutex> lock{cache_mutex};
+        if (command_doc_sizes.size() <= commandIdx)
+            command_doc_sizes.resize(commandIdx + 1, 0);
+
+        command_doc_sizes[commandIdx] = reg.config->json_size(false);
+    }
+
+    if (reg.config->is_null())
+        server.addRoute(uri, uri_len, HTTP_GET, command_handler, commandIdx);
+
+    // Also accept updates of a state that has an _update command on the state's URI.
+    const size_t suffix_len = strlen("_update");
+
+    if (uri_len > suffix_len && memcmp(uri + uri_len - suffix_len, "_update", suffix_len) == 0) {
+        bool uri_matched;
+
+        if (server.routes.match(uri, uri_len - suffix_len, HTTP_GET, &uri_matched).handler == state_handler)
+            add_state_update_routes(uri, uri_len - suffix_len, commandIdx);
+    }
 }
 
 void Http::addState(size_t stateIdx, const StateRegistration &reg)
 {
+    char uri[API_URI_BUF_SIZE];
+    size_t uri_len = build_api_uri(uri, reg.path, reg.path_len);
+
+    server.addRoute(uri, uri_len, HTTP_GET, state_handler, stateIdx);
+
+    {
+        std::lock_guard<std::mutex> lock{cache_mutex};
+        if (state_cache.size() <= stateIdx)
+            state_cache.resize(stateIdx + 1, StateCache{String(), 0, false, false});
+    }
+
+    // The _update command might have been registered before the state.
+    memcpy(uri + uri_len, "_update", strlen("_update"));
+
+    bool uri_matched;
+    WebServerRouteMatch match = server.routes.match(uri, uri_len + strlen("_update"), HTTP_PUT, &uri_matched);
+
+    if (match.handler == command_handler)
+        add_state_update_routes(uri, uri_len, match.arg);
+}
+
+void Http::add_state_update_routes(const char *state_uri, size_t state_uri_len, size_t commandIdx)
+{
+    // Don't log if the state's URI is a command's URI too. The command has precedence.
+    server.routes.insert(state_uri, state_uri_len, HTTP_PUT, command_handler, commandIdx);
+    server.routes.insert(state_uri, state_uri_len, HTTP_POST, command_handler, commandIdx);
 }
 
 void Http::addRawCommand(size_t rawCommandIdx, const RawCommandRegistration &reg)
 {
+    char uri[API_URI_BUF_SIZE];
+    size_t uri_len = build_api_uri(uri, reg.path, reg.path_len);
+
+    server.addRoute(uri, uri_len, HTTP_PUT, raw_command_handler, rawCommandIdx);
+    server.addRoute(uri, uri_len, HTTP_POST, raw_command_handler, rawCommandIdx);
 }
 
 void Http::addResponse(size_t responseIdx, const ResponseRegistration &reg)
 {
+    char uri[API_URI_BUF_SIZE];
+    size_t uri_len = build_api_uri(uri, reg.path, reg.path_len);
+
+    server.addRoute(uri, uri_len, HTTP_PUT, response_handler, responseIdx);
+    server.addRoute(uri, uri_len, HTTP_POST, response_handler, responseIdx);
 }
 
 bool Http::pushStateUpdate(size_t stateIdx, const String &payload, const String &path)
 {
+    if (stateIdx >= state_cache.size() || !state_cache[stateIdx].requested)
+        return true;
+
+    std::lock_guard<std::mutex> lock{cache_mutex};
+    StateCache &cache = state_cache[stateIdx];
+
+    cache.generation++;
+
+    // The payload is only serialized if another backend wants it as string.
+    // Otherwise the next GET request serializes the state again.
+    if (payload.isEmpty()) {
+        cache.valid = false;
+        cache.payload = String();
+    } else {
+        cache.valid = true;
+        cache.payload = payload;
+    }
+
     return true;
 }
 
@@ -462,5 +696,10 @@ bool Http::pushRawStateUpdate(const String &payload, const String &path)
 
 IAPIBackend::WantsStateUpdate Http::wantsStateUpdate(size_t stateIdx)
 {
-    return IAPIBackend::WantsStateUpdate::No;
+    // Only states that are polled via HTTP have a cache to invalidate.
+    // The main thread is the only writer of requested, so no lock is needed here.
+    if (stateIdx >= state_cache.size())
+        return IAPIBackend::WantsStateUpdate::No;
+
+    return state_cache[stateIdx].requested ? IAPIBackend::WantsStateUpdate::AsConfig : IAPIBackend::WantsStateUpdate::No;
 }
@@ -19,14 +19,15 @@
 
 #pragma once
 
+#include <mutex>
+#include <vector>
+
 #include "config.h"
 
 #include "module.h"
 #include "api.h"
 #include "tools.h"
 
-bool custom_uri_match(const char *ref_uri, const char *in_uri, size_t len);
-
 class Http final : public IAPIBackend
 {
 public:
@@ -43,8 +44,11 @@ public:
     bool pushStateUpdate(size_t stateIdx, const String &payload, const String &path) override;
     bool pushRawStateUpdate(const String &payload, const String &path) override;
     WantsStateUpdate wantsStateUpdate(size_t stateIdx) override;
-    WebServerRequestReturnProtect api_handler_get(WebServerRequest req);
-    WebServerRequestReturnProtect api_handler_put(WebServerRequest req);
+    WebServerRequestReturnProtect api_state_handler(WebServerRequest req);
+    WebServerRequestReturnProtect api_command_handler(WebServerRequest req);
+    WebServerRequestReturnProtect api_raw_command_handler(WebServerRequest req);
+    WebServerRequestReturnProtect api_response_handler(WebServerRequest req);
+    WebServerRequestReturnProtect api_batch_handler(WebServerRequest req);
 
     WebServerRequestReturnProtect automation_trigger_handler(WebServerRequest req);
 
@@ -66,4 +70,34 @@ public:
     HttpTriggerActionResult trigger_action(Config *trigger_config, void *user_data);
 
     Ownership response_ownership;
+
+private:
+    WebServerRequestReturnProtect run_command(WebServerRequest req, size_t cmdidx);
+    void add_state_update_routes(const char *state_uri, size_t state_uri_len, size_t commandIdx);
+    void format_etag(char *buf, size_t buf_len, uint32_t generation);
+
+    // Serialized payload of a state, served to GET requests without waking
+    // the main thread. A state is only cached after it was requested once.
+    // The cache is invalidated by the API's state update loop, so it can lag
+    // behind the state by the update interval, like the web socket does.
+    struct StateCache {
+        String payload;
+        uint32_t generation;
+        bool valid;
+        bool requested;
+    };
+
+    // Indexed by state index. Written by the main thread, read by the HTTP thread.
+    std::vector<StateCache> state_cache;
+    // Capacity of the JSON document to deserialize a command's payload into, indexed by command index.
+    std::vector<size_t> command_doc_sizes;
+    // Protects state_cache and command_doc_sizes.
+    std::mutex cache_mutex;
+    // Random per boot, so that ETags of different boots don't collide.
+    uint32_t etag_prefix = 0;
+
+    WebServerHandler *state_handler = nullptr;
+    WebServerHandler *command_handler = nullptr;
+    WebServerHandler *raw_command_handler = nullptr;
+    WebServerHandler *response_handler = nullptr;
 };
@@ -59,6 +59,7 @@ void Meters::pre_setup()
             0, METERS_MAX_VALUES_PER_METER, Config::type_id<Config::ConfFloat>()
         );
 
+        meter_slot.values_state_idx = SIZE_MAX;
         meter_slot.values_last_updated_at = INT64_MIN;
         meter_slot.values_last_changed_at = INT64_MIN;
 
@@ -141,6 +142,7 @@ void Meters::setup()
         }
         if (configured_meter_class != MeterClassID::None) {
             meter_slot.power_history.setup();
+            add_tiered_history(slot, MeterValueID::PowerActiveLSumImExDiff);
         }
 
         meter->setup(*static_cast<const Config *>(meter_slot.config_union.get()));
@@ -171,6 +173,13 @@ void Meters::setup()
         METER_VALUE_HISTORY_VALUE_TYPE val_min = std::numeric_limits<METER_VALUE_HISTORY_VALUE_TYPE>::lowest();
         StringBuilder sb;
 
+        // Allocate on the first tick, after all modules had the chance to add their tiered histories.
+        if (!tiered_histories_allocated) {
+            setup_tiered_histories();
+        }
+
+        uint32_t now_s = static_cast<uint32_t>(static_cast<int64_t>(now_us()) / 1000000);
+
         for (uint32_t slot = 0; slot < METERS_SLOTS; slot++) {
             MeterSlot &meter_slot = this->meter_slots[slot];
 
@@ -181,6 +190,10 @@ void Meters::setup()
             else {
                 valid_samples[slot] = false;
             }
+
+            for (TieredValueHistory &tiered_history : meter_slot.tiered_histories) {
+                tiered_history.tick(now_s);
+            }
         }
 
         last_live_update = now;
@@ -274,7 +287,7 @@ void Meters::register_urls()
         api.addState(get_path(slot, Meters::PathType::State),    &meter_slot.state);
         api.addState(get_path(slot, Meters::PathType::Errors),   &meter_slot.errors);
         api.addState(get_path(slot, Meters::PathType::ValueIDs), &meter_slot.value_ids);
-        api.addState(get_path(slot, Meters::PathType::Values),   &meter_slot.values, {}, METERS_VALUES_LOW_LATENCY);
+        meter_slot.values_state_idx = api.addState(get_path(slot, Meters::PathType::Values), &meter_slot.values, {}, METERS_VALUES_LOW_LATENCY);
 
         const String base_path = get_path(slot, Meters::PathType::Base);
 
@@ -371,6 +384,32 @@ void Meters::register_urls()
         return request.endChunkedResponse();
     });
 
+    // URL format: /meters/tiered_history/<slot>/<value_id>
+    server.on("/meters/tiered_history/*", HTTP_GET, [this](WebServerRequest request) {
+        const char *suffix = request.uriCStr() + strlen("/meters/tiered_history/");
+        char *slot_end;
+        char *value_id_end;
+        uint32_t slot = strtoul(suffix, &slot_end, 10);
+
+        if (slot_end == suffix || *slot_end != '/' || slot >= METERS_SLOTS) {
+            return request.send(400, "text/plain", "Invalid meter slot");
+        }
+
+        uint32_t value_id = strtoul(slot_end + 1, &value_id_end, 10);
+
+        if (value_id_end == slot_end + 1 || *value_id_end != '\0') {
+            return request.send(400, "text/plain", "Invalid value ID");
+        }
+
+        for (TieredValueHistory &tiered_history : meter_slots[slot].tiered_histories) {
+            if (static_cast<uint32_t>(tiered_history.value_id) == value_id) {
+                return tiered_history.send(static_cast<uint32_t>(static_cast<int64_t>(now_us()) / 1000000), request);
+            }
+        }
+
+        return request.send(404, "text/plain", "No tiered history for this value ID");
+    });
+
 #if MODULE_METERS_LEGACY_API_AVAILABLE()
     if (meters_legacy_api.get_linked_meter_slot() < METERS_SLOTS) {
         api.addState("meter/error_counters", &meter_slots[meters_legacy_api.get_linked_meter_slot()].errors);
@@ -646,6 +685,12 @@ void Meters::update_value(uint32_t slot, uint32_t index, float new_value)
     if (index == meter_slot.index_cache_single_values[INDEX_CACHE_POWER_REAL]) {
         meter_slot.power_history.add_sample(new_value);
     }
+
+    for (TieredValueHistory &tiered_history : meter_slot.tiered_histories) {
+        if (tiered_history.value_index == index) {
+            tiered_history.add_sample(new_value);
+        }
+    }
 }
 
 void Meters::update_all_values(uint32_t slot, const float new_values[])
@@ -688,6 +733,16 @@ void Meters::update_all_values(uint32_t slot, const float new_values[])
         if (get_power_real(slot, &power) == MeterValueAvailability::Fresh) {
             meter_slot.power_history.add_sample(power);
         }
+
+        for (TieredValueHistory &tiered_history : meter_slot.tiered_histories) {
+            if (tiered_history.value_index < value_count) {
+                tiered_history.add_sample(new_values[tiered_history.value_index]);
+            }
+        }
+
+#if MODULE_EVENT_AVAILABLE()
+        event.pushStateUpdateNow(meter_slot.values_state_idx);
+#endif
     }
 }
 
@@ -736,6 +791,16 @@ void Meters::update_all_values(uint32_t slot, const Config *new_values)
         if (get_power_real(slot, &power) == MeterValueAvailability::Fresh) {
             meter_slot.power_history.add_sample(power);
         }
+
+        for (TieredValueHistory &tiered_history : meter_slot.tiered_histories) {
+            if (tiered_history.value_index < value_count) {
+                tiered_history.add_sample(new_values->get(static_cast<uint16_t>(tiered_history.value_index))->asFloat());
+            }
+        }
+
+#if MODULE_EVENT_AVAILABLE()
+        event.pushStateUpdateNow(meter_slot.values_state_idx);
+#endif
     }
 }
 
@@ -781,6 +846,10 @@ void Meters::declare_value_ids(uint32_t slot, const MeterValueID new_value_ids[]
     meter_slot.index_cache_currents[INDEX_CACHE_CURRENT_L2 ]         = meters_find_id_index(new_value_ids, value_id_count, MeterValueID::CurrentL2Import);
     meter_slot.index_cache_currents[INDEX_CACHE_CURRENT_L3 ]         = meters_find_id_index(new_value_ids, value_id_count, MeterValueID::CurrentL3Import);
 
+    for (TieredValueHistory &tiered_history : meter_slot.tiered_histories) {
+        tiered_history.value_index = meters_find_id_index(new_value_ids, value_id_count, tiered_history.value_id);
+    }
+
     meter_slot.values_declared = true;
     logger.printfln("Meter in slot %u declared %u values.", slot, value_id_count);
 
@@ -790,6 +859,81 @@ void Meters::declare_value_ids(uint32_t slot, const MeterValueID new_value_ids[]
     }
 }
 
+// Tiered histories can be added until the end of setup. Histories added later
+// are allocated immediately from what is left of the memory budget.
+bool Meters::add_tiered_history(uint32_t slot, MeterValueID value_id)
+{
+    if (slot >= METERS_SLOTS) {
+        logger.printfln("Tried to add tiered history for meter in non-existent slot %u.", slot);
+        return false;
+    }
+
+    MeterSlot &meter_slot = meter_slots[slot];
+
+    for (const TieredValueHistory &tiered_history : meter_slot.tiered_histories) {
+        if (tiered_history.value_id == value_id) {
+            return true;
+        }
+    }
+
+    meter_slot.tiered_histories.emplace_front(value_id);
+    TieredValueHistory &tiered_history = meter_slot.tiered_histories.front();
+
+    if (meter_slot.values_declared) {
+        uint16_t value_id_count = static_cast<uint16_t>(meter_slot.value_ids.count());
+
+        for (uint16_t i = 0; i < value_id_count; i++) {
+            if (static_cast<MeterValueID>(meter_slot.value_ids.get(i)->asUint()) == value_id) {
+                tiered_history.value_index = i;
+                break;
+            }
+        }
+    }
+
+    if (tiered_histories_allocated) {
+        return tiered_history.setup(tiered_history_budget(1));
+    }
+
+    return true;
+}
+
+#if defined(BOARD_HAS_PSRAM)
+#define METERS_TIERED_HISTORY_MEMORY_CAPS MALLOC_CAP_SPIRAM
+#define METERS_TIERED_HISTORY_MEMORY_DIVISOR 4
+#else
+#define METERS_TIERED_HISTORY_MEMORY_CAPS MALLOC_CAP_32BIT
+#define METERS_TIERED_HISTORY_MEMORY_DIVISOR 16
+#endif
+
+// Share a fraction of the currently free memory between history_count histories.
+size_t Meters::tiered_history_budget(size_t history_count)
+{
+    if (history_count == 0) {
+        return 0;
+    }
+
+    return heap_caps_get_free_size(METERS_TIERED_HISTORY_MEMORY_CAPS) / METERS_TIERED_HISTORY_MEMORY_DIVISOR / history_count;
+}
+
+void Meters::setup_tiered_histories()
+{
+    size_t history_count = 0;
+
+    for (MeterSlot &meter_slot : meter_slots) {
+        history_count += static_cast<size_t>(std::distance(meter_slot.tiered_histories.begin(), meter_slot.tiered_histories.end()));
+    }
+
+    size_t budget = tiered_history_budget(history_count);
+
+    for (MeterSlot &meter_slot : meter_slots) {
+        for (TieredValueHistory &tiered_history : meter_slot.tiered_histories) {
+            tiered_history.setup(budget);
+        }
+    }
+
+    tiered_histories_allocated = true;
+}
+
 bool Meters::get_cached_real_power_index(uint32_t slot, uint32_t *index)
 {
     *index = meter_slots[slot].index_cache_single_values[INDEX_CACHE_POWER_REAL];
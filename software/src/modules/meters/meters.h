@@ -24,10 +24,12 @@
 #include "meter_value_availability.h"
 
 #include <stdint.h>
+#include <forward_list>
 
 #include "config.h"
 #include "module.h"
 #include "value_history.h"
+#include "tiered_value_history.h"
 #include "meter_value_id.h"
 #include "tools.h"
 
@@ -89,6 +91,7 @@ public:
     void update_all_values(uint32_t slot, const float new_values[]);
     void update_all_values(uint32_t slot, const Config *new_values);
     void declare_value_ids(uint32_t slot, const MeterValueID value_ids[], uint32_t value_id_count);
+    bool add_tiered_history(uint32_t slot, MeterValueID value_id);
 
     bool get_cached_real_power_index(uint32_t slot, uint32_t *index);
 
@@ -106,6 +109,8 @@ private:
     public:
         ConfigRoot value_ids;
         ConfigRoot values;
+        // For Event::pushStateUpdateNow. SIZE_MAX until register_urls.
+        size_t values_state_idx;
 
         micros_t values_last_updated_at;
         micros_t values_last_changed_at;
@@ -124,6 +129,7 @@ private:
         ConfigRoot last_reset;
 
         ValueHistory power_history;
+        std::forward_list<TieredValueHistory> tiered_histories;
     };
 
     MeterGenerator *get_generator_for_class(MeterClassID meter_class);
@@ -132,6 +138,8 @@ private:
     MeterValueAvailability get_single_value(uint32_t slot, uint32_t kind, float *value, micros_t max_age_us);
 
     float live_samples_per_second();
+    size_t tiered_history_budget(size_t history_count);
+    void setup_tiered_histories();
 
     MeterSlot meter_slots[METERS_SLOTS];
 
@@ -148,6 +156,7 @@ private:
     uint32_t last_live_update = 0;
     uint32_t last_history_update = 0;
     uint32_t last_history_slot = UINT32_MAX;
+    bool tiered_histories_allocated = false;
 
     int samples_this_interval = 0;
     uint32_t begin_this_interval = 0;
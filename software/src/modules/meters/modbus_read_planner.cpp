@@ -0,0 +1,102 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "modbus_read_planner.h"
+
+#include <algorithm>
+
+#include "gcc_warnings.h"
+
+void modbus_plan_reads(const ModbusReadBlock *spans, size_t span_count, uint16_t max_words, uint16_t max_gap, std::vector<ModbusReadBlock> *blocks)
+{
+    blocks->clear();
+
+    if (span_count == 0 || max_words == 0) {
+        return;
+    }
+
+    std::vector<ModbusReadBlock> sorted(spans, spans + span_count);
+
+    std::sort(sorted.begin(), sorted.end(), [](const ModbusReadBlock &a, const ModbusReadBlock &b) {
+        return a.start < b.start;
+    });
+
+    // Block ends are exclusive and 32 bit wide, so that a span ending at the
+    // last register does not overflow.
+    uint32_t block_start = 0;
+    uint32_t block_end = 0;
+    bool block_open = false;
+
+    for (const ModbusReadBlock &span : sorted) {
+        if (span.len == 0) {
+            continue;
+        }
+
+        uint32_t span_start = span.start;
+        uint32_t span_end = span_start + span.len;
+
+        if (block_open) {
+            if (span_end <= block_end) {
+                // Already covered by the current block.
+                continue;
+            }
+
+            uint32_t gap = span_start > block_end ? span_start - block_end : 0;
+
+            if (gap <= max_gap && span_end - block_start <= max_words) {
+                block_end = span_end;
+                continue;
+            }
+
+            if (gap == 0) {
+                // The span overlaps or touches the current block, but the
+                // merged block would be too long. Only read the rest of it.
+                span_start = block_end;
+            }
+
+            blocks->push_back({static_cast<uint16_t>(block_start), static_cast<uint16_t>(block_end - block_start)});
+        }
+
+        // Split spans that don't fit into a single read.
+        while (span_end - span_start > max_words) {
+            blocks->push_back({static_cast<uint16_t>(span_start), max_words});
+            span_start += max_words;
+        }
+
+        block_start = span_start;
+        block_end = span_end;
+        block_open = true;
+    }
+
+    if (block_open) {
+        blocks->push_back({static_cast<uint16_t>(block_start), static_cast<uint16_t>(block_end - block_start)});
+    }
+}
+
+void modbus_plan_reads(const uint16_t *registers, size_t register_count, uint16_t register_len, uint16_t max_words, uint16_t max_gap, std::vector<ModbusReadBlock> *blocks)
+{
+    std::vector<ModbusReadBlock> spans;
+    spans.reserve(register_count);
+
+    for (size_t i = 0; i < register_count; ++i) {
+        spans.push_back({registers[i], register_len});
+    }
+
+    modbus_plan_reads(spans.data(), spans.size(), max_words, max_gap, blocks);
+}
@@ -0,0 +1,41 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+struct ModbusReadBlock {
+    uint16_t start;
+    uint16_t len;
+};
+
+// Coalesces the register spans that have to be read into as few block reads
+// as possible. Two spans are read with a single request if at most max_gap
+// unneeded registers lie between them and the resulting block is not longer
+// than max_words registers. Spans longer than max_words are split. The spans
+// don't have to be sorted and may overlap.
+void modbus_plan_reads(const ModbusReadBlock *spans, size_t span_count, uint16_t max_words, uint16_t max_gap, std::vector<ModbusReadBlock> *blocks);
+
+// Same as above for values that all occupy register_len registers,
+// for example 2 for the float values of most meters.
+void modbus_plan_reads(const uint16_t *registers, size_t register_count, uint16_t register_len, uint16_t max_words, uint16_t max_gap, std::vector<ModbusReadBlock> *blocks);
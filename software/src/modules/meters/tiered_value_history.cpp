@@ -0,0 +1,243 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "tiered_value_history.h"
+
+#include <math.h>
+
+#include "esp_heap_caps.h"
+
+#include "event_log.h"
+#include "malloc_tools.h"
+#include "string_builder.h"
+#include "tools.h"
+
+#include "gcc_warnings.h"
+
+// Keep at least this many buckets per tier, even if memory is tight.
+#define TIERED_HISTORY_MIN_CAPACITY 60
+
+size_t TieredValueHistory::bytes_desired()
+{
+    size_t bytes = 0;
+
+    for (const TieredValueHistoryTierSpec &spec : tiered_history_tier_specs) {
+        bytes += spec.desired_capacity * sizeof(TieredValueHistoryBucket);
+    }
+
+    return bytes;
+}
+
+bool TieredValueHistory::setup(size_t budget_bytes)
+{
+    size_t desired = bytes_desired();
+    float scale = budget_bytes >= desired ? 1.0f : static_cast<float>(budget_bytes) / static_cast<float>(desired);
+
+    for (size_t i = 0; i < TIERED_HISTORY_TIER_COUNT; ++i) {
+        Tier &tier = tiers[i];
+        uint32_t capacity = static_cast<uint32_t>(static_cast<float>(tiered_history_tier_specs[i].desired_capacity) * scale);
+
+        tier.capacity = max(capacity, static_cast<uint32_t>(TIERED_HISTORY_MIN_CAPACITY));
+#if defined(BOARD_HAS_PSRAM)
+        tier.buckets = static_cast<TieredValueHistoryBucket *>(malloc_psram(tier.capacity * sizeof(TieredValueHistoryBucket)));
+#else
+        tier.buckets = static_cast<TieredValueHistoryBucket *>(malloc_32bit_addressed(tier.capacity * sizeof(TieredValueHistoryBucket)));
+#endif
+
+        if (tier.buckets == nullptr) {
+            logger.printfln("Failed to allocate %u buckets for tiered history of value ID %u", tier.capacity, static_cast<uint32_t>(value_id));
+
+            for (size_t k = 0; k <= i; ++k) {
+                heap_caps_free(tiers[k].buckets);
+                tiers[k].buckets = nullptr;
+                tiers[k].capacity = 0;
+            }
+
+            return false;
+        }
+
+        tier.start = 0;
+        tier.used = 0;
+        tier.current_slot = UINT32_MAX;
+        tier.reset_accumulator();
+    }
+
+    return true;
+}
+
+void TieredValueHistory::add_sample(float sample)
+{
+    if (isnan(sample)) {
+        return;
+    }
+
+    for (Tier &tier : tiers) {
+        if (tier.acc_count == 0) {
+            tier.acc_min = sample;
+            tier.acc_max = sample;
+        } else {
+            tier.acc_min = min(tier.acc_min, sample);
+            tier.acc_max = max(tier.acc_max, sample);
+        }
+
+        tier.acc_sum += static_cast<double>(sample);
+        ++tier.acc_count;
+    }
+}
+
+// Must be called at least once per finest tier interval, otherwise buckets
+// of the finest tier are skipped and recorded as empty.
+void TieredValueHistory::tick(uint32_t now_s)
+{
+    if (!is_setup()) {
+        return;
+    }
+
+    for (size_t i = 0; i < TIERED_HISTORY_TIER_COUNT; ++i) {
+        Tier &tier = tiers[i];
+        uint32_t interval_s = tiered_history_tier_specs[i].interval_s;
+        uint32_t slot = now_s / interval_s;
+
+        if (tier.current_slot == UINT32_MAX) {
+            // Samples seen before the first tick belong to the first bucket.
+            tier.current_slot = slot;
+            continue;
+        }
+
+        if (slot == tier.current_slot) {
+            continue;
+        }
+
+        TieredValueHistoryBucket bucket;
+
+        if (tier.acc_count == 0) {
+            bucket = {NAN, NAN, NAN};
+        } else {
+            bucket.min = tier.acc_min;
+            bucket.max = tier.acc_max;
+            bucket.avg = static_cast<float>(tier.acc_sum / tier.acc_count);
+        }
+
+        tier.push(bucket);
+
+        // Record slots that passed without a tick as empty.
+        uint32_t skipped = min(slot - tier.current_slot - 1, tier.capacity);
+
+        for (uint32_t k = 0; k < skipped; ++k) {
+            tier.push({NAN, NAN, NAN});
+        }
+
+        tier.reset_accumulator();
+        tier.current_slot = slot;
+        tier.last_push_s = slot * interval_s;
+    }
+}
+
+WebServerRequestReturnProtect TieredValueHistory::send(uint32_t now_s, WebServerRequest &request)
+{
+    if (!is_setup()) {
+        return request.send(503, "text/plain", "Tiered history not allocated yet");
+    }
+
+    char buf[1024];
+    StringWriter sw(buf, sizeof(buf));
+
+    auto flush_if_full = [&request, &sw]() {
+        if (sw.getRemainingLength() >= 64) {
+            return true;
+        }
+
+        bool ok = request.sendChunk(sw.getPtr(), static_cast<ssize_t>(sw.getLength())) == ESP_OK;
+        sw.clear();
+        return ok;
+    };
+
+    request.beginChunkedResponse(200, "application/json; charset=utf-8");
+
+    sw.printf("{\"value_id\":%u,\"tiers\":[", static_cast<uint32_t>(value_id));
+
+    for (size_t i = 0; i < TIERED_HISTORY_TIER_COUNT; ++i) {
+        const Tier &tier = tiers[i];
+
+        sw.printf("%s{\"interval\":%u,\"offset\":%u,\"samples\":[", i == 0 ? "" : ",", tiered_history_tier_specs[i].interval_s, now_s - tier.last_push_s);
+
+        for (uint32_t k = 0; k < tier.used; ++k) {
+            uint32_t idx = tier.start + k;
+
+            if (idx >= tier.capacity) {
+                idx -= tier.capacity;
+            }
+
+            const TieredValueHistoryBucket &bucket = tier.buckets[idx];
+            const char *sep = k == 0 ? "" : ",";
+
+            if (isnan(bucket.avg)) {
+                sw.printf("%snull", sep);
+            } else {
+                sw.printf("%s[%.3f,%.3f,%.3f]", sep, static_cast<double>(bucket.min), static_cast<double>(bucket.max), static_cast<double>(bucket.avg));
+            }
+
+            if (!flush_if_full()) {
+                return request.endChunkedResponse();
+            }
+        }
+
+        sw.puts("]}");
+
+        if (!flush_if_full()) {
+            return request.endChunkedResponse();
+        }
+    }
+
+    sw.puts("]}");
+
+    request.sendChunk(sw.getPtr(), static_cast<ssize_t>(sw.getLength()));
+
+    return request.endChunkedResponse();
+}
+
+void TieredValueHistory::Tier::push(const TieredValueHistoryBucket &bucket)
+{
+    uint32_t end = start + used;
+
+    if (end >= capacity) {
+        end -= capacity;
+    }
+
+    buckets[end] = bucket;
+
+    if (used < capacity) {
+        ++used;
+    } else {
+        // Overwrote the oldest bucket.
+        ++start;
+
+        if (start >= capacity) {
+            start = 0;
+        }
+    }
+}
+
+void TieredValueHistory::Tier::reset_accumulator()
+{
+    acc_min = NAN;
+    acc_max = NAN;
+    acc_sum = 0;
+    acc_count = 0;
+}
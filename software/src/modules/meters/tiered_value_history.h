@@ -0,0 +1,89 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "meter_value_id.h"
+#include "web_server.h"
+
+// Downsampling tiers, finest first. Every tier aggregates the raw samples
+// directly, so min and max are exact for every bucket of every tier.
+// The desired capacities are reduced at runtime if not enough memory is
+// available, see TieredValueHistory::setup().
+#define TIERED_HISTORY_TIER_COUNT 4
+
+struct TieredValueHistoryTierSpec {
+    uint32_t interval_s;
+    uint32_t desired_capacity;
+};
+
+static const TieredValueHistoryTierSpec tiered_history_tier_specs[TIERED_HISTORY_TIER_COUNT] = {
+    {1,       60 * 60},  // 1 second buckets for 1 hour
+    {60,      48 * 60},  // 1 minute buckets for 48 hours
+    {15 * 60, 7 * 96},   // 15 minute buckets for 7 days
+    {60 * 60, 31 * 24},  // 1 hour buckets for 31 days
+};
+
+// A bucket without any samples is stored as all NaN.
+struct TieredValueHistoryBucket {
+    float min;
+    float max;
+    float avg;
+};
+
+class TieredValueHistory
+{
+public:
+    TieredValueHistory(MeterValueID value_id) : value_id(value_id) {}
+
+    static size_t bytes_desired();
+
+    bool setup(size_t budget_bytes);
+    bool is_setup() const { return tiers[0].buckets != nullptr; }
+    void add_sample(float sample);
+    void tick(uint32_t now_s);
+    WebServerRequestReturnProtect send(uint32_t now_s, WebServerRequest &request);
+
+    const MeterValueID value_id;
+    uint32_t value_index = UINT32_MAX;
+
+private:
+    struct Tier {
+        TieredValueHistoryBucket *buckets = nullptr;
+        uint32_t capacity = 0;
+        uint32_t start = 0;
+        uint32_t used = 0;
+
+        uint32_t current_slot = UINT32_MAX;
+        uint32_t last_push_s = 0;
+
+        float acc_min;
+        float acc_max;
+        double acc_sum;
+        uint32_t acc_count = 0;
+
+        void push(const TieredValueHistoryBucket &bucket);
+        void reset_accumulator();
+    };
+
+    Tier tiers[TIERED_HISTORY_TIER_COUNT];
+};
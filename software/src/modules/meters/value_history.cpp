@@ -82,6 +82,14 @@ void ValueHistory::register_urls(String base_url)
 
         return request.send(200, "application/json; charset=utf-8", sb.getPtr(), static_cast<ssize_t>(sb.getLength()));
     });
+
+    server.on(("/" + base_url + "history_binary").c_str(), HTTP_GET, [this](WebServerRequest request) {
+        return send_history_binary(millis(), request);
+    });
+
+    server.on(("/" + base_url + "live_binary").c_str(), HTTP_GET, [this](WebServerRequest request) {
+        return send_live_binary(millis(), request);
+    });
 }
 
 void ValueHistory::register_urls_empty(String base_url)
@@ -97,6 +105,24 @@ void ValueHistory::register_urls_empty(String base_url)
     server.on(("/" + base_url + "live").c_str(), HTTP_GET, [this, empty_live, empty_live_len](WebServerRequest request) {
         return request.send(200, "application/json; charset=utf-8", empty_live, empty_live_len);
     });
+
+    // Static because the lambdas outlive this function.
+    static ValueHistoryBinaryHeader empty_header = {
+        VALUE_HISTORY_BINARY_VERSION,
+        sizeof(METER_VALUE_HISTORY_VALUE_TYPE),
+        0,
+        0,
+        0.0f,
+        std::numeric_limits<METER_VALUE_HISTORY_VALUE_TYPE>::lowest(),
+    };
+
+    server.on(("/" + base_url + "history_binary").c_str(), HTTP_GET, [](WebServerRequest request) {
+        return request.send(200, "application/octet-stream", reinterpret_cast<const char *>(&empty_header), sizeof(empty_header));
+    });
+
+    server.on(("/" + base_url + "live_binary").c_str(), HTTP_GET, [](WebServerRequest request) {
+        return request.send(200, "application/octet-stream", reinterpret_cast<const char *>(&empty_header), sizeof(empty_header));
+    });
 }
 
 void ValueHistory::add_sample(float sample)
@@ -234,6 +260,53 @@ void ValueHistory::format_history_samples(StringBuilder *sb)
     }
 }
 
+// Streams the ring's samples directly from its buffer.
+// Must be called in the main thread, so that the ring is not modified while sending.
+template <typename RingT>
+static WebServerRequestReturnProtect send_ring_binary(WebServerRequest &request, RingT &ring, uint32_t offset, float samples_per_second)
+{
+    const METER_VALUE_HISTORY_VALUE_TYPE *spans[2];
+    size_t span_lens[2];
+    size_t used = ring.get_spans(&spans[0], &span_lens[0], &spans[1], &span_lens[1]);
+
+    ValueHistoryBinaryHeader header;
+    header.version = VALUE_HISTORY_BINARY_VERSION;
+    header.sample_size = sizeof(METER_VALUE_HISTORY_VALUE_TYPE);
+    header.sample_count = static_cast<uint16_t>(used);
+    header.offset = offset;
+    header.samples_per_second = samples_per_second;
+    header.sentinel = std::numeric_limits<METER_VALUE_HISTORY_VALUE_TYPE>::lowest();
+
+    request.beginChunkedResponse(200, "application/octet-stream");
+
+    if (request.sendChunk(reinterpret_cast<const char *>(&header), sizeof(header)) != ESP_OK) {
+        return request.endChunkedResponse();
+    }
+
+    for (size_t i = 0; i < 2; ++i) {
+        // A zero-length chunk would terminate the response.
+        if (span_lens[i] == 0) {
+            continue;
+        }
+
+        if (request.sendChunk(reinterpret_cast<const char *>(spans[i]), static_cast<ssize_t>(span_lens[i] * sizeof(METER_VALUE_HISTORY_VALUE_TYPE))) != ESP_OK) {
+            break;
+        }
+    }
+
+    return request.endChunkedResponse();
+}
+
+WebServerRequestReturnProtect ValueHistory::send_live_binary(uint32_t now, WebServerRequest &request)
+{
+    return send_ring_binary(request, live, now - live_last_update, samples_per_second());
+}
+
+WebServerRequestReturnProtect ValueHistory::send_history_binary(uint32_t now, WebServerRequest &request)
+{
+    return send_ring_binary(request, history, now - history_last_update, 1.0f / (HISTORY_MINUTE_INTERVAL * 60));
+}
+
 float ValueHistory::samples_per_second()
 {
     float samples_per_second = 0;
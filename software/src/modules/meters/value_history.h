@@ -64,6 +64,22 @@ static_assert(std::numeric_limits<int>::max() >= METER_VALUE_HISTORY_VALUE_MAX);
 
 class StringBuilder;
 
+// Header of the binary live/history responses. All fields are little endian.
+// The header is followed by sample_count samples of sample_size bytes each,
+// oldest sample first. Samples equal to sentinel mark missing values.
+struct [[gnu::packed]] ValueHistoryBinaryHeader {
+    uint8_t  version;
+    uint8_t  sample_size;
+    uint16_t sample_count;
+    uint32_t offset;
+    float    samples_per_second;
+    int32_t  sentinel;
+};
+
+static_assert(sizeof(ValueHistoryBinaryHeader) == 16);
+
+#define VALUE_HISTORY_BINARY_VERSION 1
+
 class ValueHistory
 {
 public:
@@ -80,6 +96,8 @@ public:
     void format_live_samples(StringBuilder *sb);
     void format_history(uint32_t now, StringBuilder *sb);
     void format_history_samples(StringBuilder *sb);
+    WebServerRequestReturnProtect send_live_binary(uint32_t now, WebServerRequest &request);
+    WebServerRequestReturnProtect send_history_binary(uint32_t now, WebServerRequest &request);
     float samples_per_second();
 
     int64_t sum_this_interval = 0;
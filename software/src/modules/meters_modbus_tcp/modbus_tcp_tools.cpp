@@ -44,6 +44,11 @@ const char* get_modbus_result_code_name(Modbus::ResultCode rc)
     }
 }
 
+bool is_modbus_exception(Modbus::ResultCode rc)
+{
+    return rc >= 0x01 && rc <= 0x0B;
+}
+
 void modbus_bswap_registers(uint16_t *register_start, size_t register_count)
 {
     for (size_t i = 0; i < register_count; i++) {
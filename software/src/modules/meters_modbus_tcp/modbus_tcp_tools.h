@@ -31,6 +31,10 @@
 
 [[gnu::const]] const char* get_modbus_result_code_name(Modbus::ResultCode event);
 
+// True if the device answered with a Modbus exception response,
+// false for success and client-side errors like timeouts.
+[[gnu::const]] bool is_modbus_exception(Modbus::ResultCode rc);
+
 void modbus_bswap_registers(uint16_t *register_start, size_t register_count);
 
 #if defined(__GNUC__)
@@ -0,0 +1,117 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "float_array_parser.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gcc_warnings.h"
+
+// Longest number the API emits is well below this.
+#define MAX_NUMBER_LENGTH 31
+
+static size_t skip_whitespace(const char *data, size_t data_len, size_t pos)
+{
+    while (pos < data_len && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || data[pos] == '\r')) {
+        ++pos;
+    }
+
+    return pos;
+}
+
+static bool is_number_char(char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+bool parse_json_float_array(const char *data, size_t data_len, float *values, size_t max_values, size_t *value_count)
+{
+    size_t pos = skip_whitespace(data, data_len, 0);
+    size_t count = 0;
+
+    if (pos >= data_len || data[pos] != '[') {
+        return false;
+    }
+
+    pos = skip_whitespace(data, data_len, pos + 1);
+
+    if (pos < data_len && data[pos] == ']') {
+        *value_count = 0;
+        return skip_whitespace(data, data_len, pos + 1) == data_len;
+    }
+
+    for (;;) {
+        if (count >= max_values || pos >= data_len) {
+            return false;
+        }
+
+        if (data_len - pos >= 4 && memcmp(data + pos, "null", 4) == 0) {
+            values[count] = NAN;
+            pos += 4;
+        }
+        else {
+            // data is not null-terminated, strtof needs a copy.
+            char number[MAX_NUMBER_LENGTH + 1];
+            size_t number_len = 0;
+
+            while (pos < data_len && is_number_char(data[pos])) {
+                if (number_len >= MAX_NUMBER_LENGTH) {
+                    return false;
+                }
+
+                number[number_len++] = data[pos++];
+            }
+
+            if (number_len == 0) {
+                return false;
+            }
+
+            number[number_len] = '\0';
+
+            char *end;
+            values[count] = strtof(number, &end);
+
+            if (end != number + number_len) {
+                return false;
+            }
+        }
+
+        ++count;
+        pos = skip_whitespace(data, data_len, pos);
+
+        if (pos >= data_len) {
+            return false;
+        }
+
+        if (data[pos] == ']') {
+            break;
+        }
+
+        if (data[pos] != ',') {
+            return false;
+        }
+
+        pos = skip_whitespace(data, data_len, pos + 1);
+    }
+
+    *value_count = count;
+    return skip_whitespace(data, data_len, pos + 1) == data_len;
+}
@@ -23,13 +23,18 @@
 #include "module_dependencies.h"
 
 #include <ArduinoJson.h>
+#include <string.h>
 
 #include "event_log.h"
+#include "float_array_parser.h"
 #include "modules/meters/meter_value_id.h"
-//#include "tools.h"
+#include "tools.h"
 
 #include "gcc_warnings.h"
 
+// JSON values are ignored while binary values are received.
+#define BINARY_VALUES_TIMEOUT_MS 10000
+
 MeterClassID MeterMqttMirror::get_class() const
 {
     return MeterClassID::MqttMirror;
@@ -46,9 +51,11 @@ void MeterMqttMirror::setup(const Config &ephemeral_config)
     }
 
     String values_topic = meter_path;
+    String values_binary_topic = meter_path;
 
     if (automatic) {
         values_topic.concat("/values");
+        values_binary_topic.concat("/values_bin");
 
         mqtt.subscribe(meter_path + "/value_ids",
             [this](const char *topic, size_t topic_len, char *data, size_t data_len) {
@@ -62,7 +69,13 @@ void MeterMqttMirror::setup(const Config &ephemeral_config)
     // Ignoring retained message. Need fresh data for the meter.
     mqtt.subscribe(values_topic,
         [this](const char *topic, size_t topic_len, char *data, size_t data_len) {
-            this->onMessage(topic, topic_len, data, data_len, &MeterMqttMirror::handle_mqtt_values);
+            this->handle_mqtt_values(topic, topic_len, data, data_len);
+    }, Mqtt::Retained::IgnoreSilent);
+
+    // Only published if the source enabled it.
+    mqtt.subscribe(values_binary_topic,
+        [this](const char * /*topic*/, size_t /*topic_len*/, char *data, size_t data_len) {
+            this->handle_mqtt_values_binary(data, data_len);
     }, Mqtt::Retained::IgnoreSilent);
 }
 
@@ -146,23 +159,75 @@ void MeterMqttMirror::handle_mqtt_value_ids(const JsonArrayConst &array)
     }
 }
 
-void MeterMqttMirror::handle_mqtt_values(const JsonArrayConst &array)
+void MeterMqttMirror::handle_mqtt_values(const char *topic, size_t topic_len, const char *data, size_t data_len)
 {
     if (!accepting_updates)
         return;
 
-    if (array.size() != declared_values_count) {
-        logger.printfln("Unexpected amount of values from mirrored meter: %u, expected %u", array.size(), declared_values_count);
-        return;
+    if (binary_values_active) {
+        if (!deadline_elapsed(binary_values_deadline))
+            return;
+
+        logger.printfln("No binary values received for %d ms; using JSON values.", BINARY_VALUES_TIMEOUT_MS);
+        binary_values_active = false;
     }
 
+    // Values are parsed directly into floats. Deserializing into a document first is too slow at high update rates.
     float values[METERS_MAX_VALUES_PER_METER];
-    size_t i = 0;
-    // Use iterator because each getElement(index) call has a complexity of O(n).
-    for (const JsonVariantConst v : array) {
-        values[i] = v.as<float>();
-        i++;
+    size_t value_count;
+
+    if (!parse_json_float_array(data, data_len, values, METERS_MAX_VALUES_PER_METER, &value_count)) {
+        logger.printfln("Failed to parse values received on MQTT topic %.*s", static_cast<int>(topic_len), topic);
+        return;
+    }
+
+    if (value_count != declared_values_count) {
+        logger.printfln("Unexpected amount of values from mirrored meter: %u, expected %u", value_count, declared_values_count);
+        return;
+    }
+
+    meters.update_all_values(slot, values);
+}
+
+void MeterMqttMirror::handle_mqtt_values_binary(const char *data, size_t data_len)
+{
+    if (!accepting_updates)
+        return;
+
+    MeterMqttMirrorBinaryHeader header;
+
+    if (data_len < sizeof(header)) {
+        logger.printfln("Binary values payload too short: %u", data_len);
+        return;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (header.version != METER_MQTT_MIRROR_BINARY_VERSION) {
+        logger.printfln("Unsupported binary values version %u", header.version);
+        return;
     }
 
+    if (header.value_count != declared_values_count) {
+        logger.printfln("Unexpected amount of binary values from mirrored meter: %u, expected %u", header.value_count, declared_values_count);
+        return;
+    }
+
+    if (data_len != sizeof(header) + header.value_count * sizeof(float)) {
+        logger.printfln("Binary values payload has wrong length %u for %u values", data_len, header.value_count);
+        return;
+    }
+
+    if (!binary_values_active) {
+        logger.printfln("Receiving binary values; ignoring JSON values.");
+        binary_values_active = true;
+    }
+
+    binary_values_deadline = millis() + BINARY_VALUES_TIMEOUT_MS;
+
+    // Payload is not aligned.
+    float values[METERS_MAX_VALUES_PER_METER];
+    memcpy(values, data + sizeof(header), header.value_count * sizeof(float));
+
     meters.update_all_values(slot, values);
 }
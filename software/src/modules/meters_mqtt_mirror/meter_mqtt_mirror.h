@@ -28,6 +28,19 @@
     #pragma GCC diagnostic ignored "-Weffc++"
 #endif
 
+#define METER_MQTT_MIRROR_BINARY_VERSION 1
+
+// Payload of meters/<slot>/values_bin: This header, followed by value_count
+// little-endian floats in the order of meters/<slot>/value_ids. NaN marks
+// unavailable values.
+struct [[gnu::packed]] MeterMqttMirrorBinaryHeader {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t value_count;
+};
+
+static_assert(sizeof(MeterMqttMirrorBinaryHeader) == 4, "Unexpected MeterMqttMirrorBinaryHeader size");
+
 class MeterMqttMirror final : public IMeter
 {
 public:
@@ -44,11 +57,14 @@ public:
 private:
     void onMessage(const char *topic, size_t topic_len, char *data, size_t data_len, void (MeterMqttMirror::*message_handler)(const JsonArrayConst &json_array));
     void handle_mqtt_value_ids(const JsonArrayConst &array);
-    void handle_mqtt_values(const JsonArrayConst &array);
+    void handle_mqtt_values(const char *topic, size_t topic_len, const char *data, size_t data_len);
+    void handle_mqtt_values_binary(const char *data, size_t data_len);
 
     uint32_t slot;
     uint32_t declared_values_count = 0;
     bool     accepting_updates = false;
+    bool     binary_values_active = false;
+    uint32_t binary_values_deadline = 0;
 };
 
 #if defined(__GNUC__)
@@ -20,6 +20,8 @@
 #include "meters_mqtt_mirror.h"
 #include "module_dependencies.h"
 
+#include <string.h>
+
 #include "gcc_warnings.h"
 
 void MetersMqttMirror::pre_setup()
@@ -40,6 +42,57 @@ void MetersMqttMirror::pre_setup()
     }};
 
     meters.register_meter_generator(get_class(), this);
+
+    config = ConfigRoot{Config::Object({
+        {"publish_binary_values", Config::Bool(false)},
+    })};
+}
+
+void MetersMqttMirror::register_urls()
+{
+    api.addPersistentConfig("meters_mqtt_mirror/config", &config);
+}
+
+void MetersMqttMirror::register_events()
+{
+    // Changes only take effect after a reboot, same as the MQTT config.
+    if (!config.get("publish_binary_values")->asBool())
+        return;
+
+    for (uint32_t slot = 0; slot < METERS_SLOTS; slot++) {
+        event.registerEvent(meters.get_path(slot, Meters::PathType::Values), {}, [this, slot](const Config *values) {
+            publish_values_binary(slot, values);
+            return EventResult::OK;
+        });
+    }
+}
+
+// Mirrors can follow this compact format at higher rates than the JSON values.
+void MetersMqttMirror::publish_values_binary(uint32_t slot, const Config *values)
+{
+    size_t value_count = values->count();
+
+    if (value_count == 0 || value_count > METERS_MAX_VALUES_PER_METER)
+        return;
+
+    char buf[sizeof(MeterMqttMirrorBinaryHeader) + METERS_MAX_VALUES_PER_METER * sizeof(float)];
+    MeterMqttMirrorBinaryHeader header;
+
+    header.version = METER_MQTT_MIRROR_BINARY_VERSION;
+    header.reserved = 0;
+    header.value_count = static_cast<uint16_t>(value_count);
+
+    memcpy(buf, &header, sizeof(header));
+
+    for (size_t i = 0; i < value_count; i++) {
+        float value = values->get(static_cast<uint16_t>(i))->asFloat();
+        memcpy(buf + sizeof(header) + i * sizeof(float), &value, sizeof(float));
+    }
+
+    String path = meters.get_path(slot, Meters::PathType::Values);
+    path.concat("_bin");
+
+    mqtt.publish_with_prefix(path, buf, sizeof(header) + value_count * sizeof(float), false);
 }
 
 MeterClassID MetersMqttMirror::get_class() const
@@ -39,6 +39,8 @@ class MetersMqttMirror final : public IModule, public MeterGenerator
 public:
     // for IModule
     void pre_setup() override;
+    void register_urls() override;
+    void register_events() override;
 
     // for MeterGenerator
     [[gnu::const]] MeterClassID get_class() const override;
@@ -48,7 +50,10 @@ public:
     [[gnu::const]] virtual const Config *get_errors_prototype() override;
 
 private:
+    void publish_values_binary(uint32_t slot, const Config *values);
+
     Config config_prototype;
+    ConfigRoot config;
 };
 
 #if defined(__GNUC__)
@@ -10,20 +10,23 @@
 #define PHASE_ACTIVE_CURRENT_THRES 0.3f // ampere
 #define PHASE_CONNECTED_VOLTAGE_THRES 180.0f // volts
 
-struct RegRead {
-    uint16_t start;
-    uint16_t len;
-};
+// Maximum number of registers read with one request. Limited by the Modbus frame size.
+#define RS485_MAX_READ_REGISTERS 125
+
+// Two reads are merged into one if at most this many unneeded registers lie between them.
+#define RS485_MAX_READ_GAP 16
 
 struct MeterInfo {
     uint16_t meter_id; // read from holding register 64515
     uint8_t meter_type; // will be written into meter/state["type"] if holding register 64515 contains the meter_id
 
-    const RegRead *to_read_slow;
-    size_t to_read_slow_len;
+    // Start registers of the float values read by the slow and fast read cycles.
+    // The block reads for both cycles are planned with modbus_plan_reads.
+    const uint16_t *registers_slow;
+    size_t registers_slow_len;
 
-    const RegRead *to_read_fast;
-    size_t to_read_fast_len;
+    const uint16_t *registers_fast;
+    size_t registers_fast_len;
 
     void (*const slow_read_done_fn)(const uint16_t *registers, uint32_t meter_slot, ConfigRoot *reset);
     void (*const fast_read_done_fn)(const uint16_t *registers, uint32_t meter_slot, uint32_t idx_power, uint32_t idx_energy_rel, uint32_t idx_energy_abs, uint32_t idx_current_l1, uint32_t idx_voltage_l1);
@@ -33,7 +33,7 @@
 #include "sdm72dmv2_defs.h"
 #include "sdm72dm_defs.h"
 
-static uint16_t write_buf[100];
+static uint16_t write_buf[RS485_MAX_READ_REGISTERS];
 static uint16_t registers[400];
 
 static MeterInfo *supported_meters[] = {
@@ -65,6 +65,12 @@ void MeterRS485Bricklet::changeMeterType(size_t supported_meter_idx)
     value_index_energy_abs = meters_find_id_index(ids, id_count, MeterValueID::EnergyActiveLSumImExSum);
     value_index_current_l1 = meters_find_id_index(ids, id_count, MeterValueID::CurrentL1ImExSum);
     value_index_voltage_l1 = meters_find_id_index(ids, id_count, MeterValueID::VoltageL1N);
+
+    modbus_plan_reads(meter_in_use->registers_fast, meter_in_use->registers_fast_len, 2, RS485_MAX_READ_REGISTERS, RS485_MAX_READ_GAP, &reads_fast);
+    modbus_plan_reads(meter_in_use->registers_slow, meter_in_use->registers_slow_len, 2, RS485_MAX_READ_REGISTERS, RS485_MAX_READ_GAP, &reads_slow);
+
+    modbus_read_state_fast = 0;
+    modbus_read_state_slow = 0;
 }
 
 void MeterRS485Bricklet::cb_read_meter_type(TF_RS485 *rs485, uint8_t request_id, int8_t exception_code, uint16_t *holding_registers, uint16_t holding_registers_length) {
@@ -239,14 +245,14 @@ void MeterRS485Bricklet::register_urls(const String &base_url)
 {
 }
 
-const RegRead *MeterRS485Bricklet::getNextRead(bool *trigger_fast_read_done, bool *trigger_slow_read_done)
+const ModbusReadBlock *MeterRS485Bricklet::getNextRead(bool *trigger_fast_read_done, bool *trigger_slow_read_done)
 {
     *trigger_fast_read_done = false;
     *trigger_slow_read_done = false;
 
-    if (modbus_read_state_fast != this->meter_in_use->to_read_fast_len) {
+    if (modbus_read_state_fast != reads_fast.size()) {
         last_read_was_fast = true;
-        const RegRead *result = &this->meter_in_use->to_read_fast[modbus_read_state_fast];
+        const ModbusReadBlock *result = &reads_fast[modbus_read_state_fast];
         ++modbus_read_state_fast;
         return result;
     }
@@ -256,23 +262,23 @@ const RegRead *MeterRS485Bricklet::getNextRead(bool *trigger_fast_read_done, boo
     if (last_read_was_fast) {
         *trigger_fast_read_done = true;
 
-        if (modbus_read_state_slow == this->meter_in_use->to_read_slow_len) {
+        if (modbus_read_state_slow == reads_slow.size()) {
             modbus_read_state_slow = 0;
         }
-        if (this->meter_in_use->to_read_slow_len != 0) {
+        if (reads_slow.size() != 0) {
             last_read_was_fast = false;
-            const RegRead *result = &this->meter_in_use->to_read_slow[modbus_read_state_slow];
+            const ModbusReadBlock *result = &reads_slow[modbus_read_state_slow];
             ++modbus_read_state_slow;
             return result;
         }
     }
-    if (modbus_read_state_slow == this->meter_in_use->to_read_slow_len) {
+    if (modbus_read_state_slow == reads_slow.size()) {
         *trigger_slow_read_done = true;
     }
 
     modbus_read_state_fast = 0;
     last_read_was_fast = true;
-    const RegRead *result = &this->meter_in_use->to_read_fast[modbus_read_state_fast];
+    const ModbusReadBlock *result = &reads_fast[modbus_read_state_fast];
     ++modbus_read_state_fast;
     return result;
 }
@@ -314,7 +320,7 @@ void MeterRS485Bricklet::tick()
 
     bool trigger_fast_read_done;
     bool trigger_slow_read_done;
-    const RegRead *next_read = getNextRead(&trigger_fast_read_done, &trigger_slow_read_done);
+    const ModbusReadBlock *next_read = getNextRead(&trigger_fast_read_done, &trigger_slow_read_done);
 
     auto last_callback_data_done = callback_data.done;
 
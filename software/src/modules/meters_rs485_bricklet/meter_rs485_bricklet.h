@@ -22,12 +22,14 @@
 #include "module_dependencies.h"
 
 #include <math.h>
+#include <vector>
 
 #include "bindings/bricklet_rs485.h"
 
 #include "config.h"
 #include "modules/meters/meter_defs.h"
 #include "modules/meters/imeter.h"
+#include "modules/meters/modbus_read_planner.h"
 
 #include "meter_defs.h"
 
@@ -100,8 +102,11 @@ private:
 
     bool meter_change_warning_printed = false;
 
-    const RegRead *getNextRead(bool *trigger_fast_read_done, bool *trigger_slow_read_done);
+    const ModbusReadBlock *getNextRead(bool *trigger_fast_read_done, bool *trigger_slow_read_done);
 
+    // Re-planned whenever the meter type and with it the value IDs change.
+    std::vector<ModbusReadBlock> reads_fast;
+    std::vector<ModbusReadBlock> reads_slow;
     size_t modbus_read_state_fast = 0;
     size_t modbus_read_state_slow = 0;
     bool last_read_was_fast = false;
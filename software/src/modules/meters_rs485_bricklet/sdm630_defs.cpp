@@ -5,18 +5,6 @@
 
 #include "modules/meters/sdm_helpers.h"
 
-static const RegRead sdm630_slow[] {
-    {1, 88},
-    {101, 8},
-    {201, 70},
-    {335, 48}
-};
-
-static const RegRead sdm630_fast[]{
-    {7, 6}, // current per phase
-    {53, 2}, // power
-};
-
 static const uint16_t sdm630_registers_to_read[] = {
 	1,3,5,7,9,11,13,15,17,19,21,23,25,27,29,31,33,35,37,39,41,43,47,49,53,57,61,63,67,71,73,75,77,79,81,83,85,87,101,103,105,107,201,203,205,207,225,235,237,239,241,243,245,249,251,259,261,263,265,267,269,335,337,339,341,343,345,347,349,351,353,355,357,359,361,363,365,367,369,371,373,375,377,379,381
 };
@@ -65,10 +53,10 @@ static void sdm630_slow_read_done(const uint16_t *all_regs, uint32_t meter_slot,
 MeterInfo sdm630 {
     0x0070,
     2,
-    sdm630_slow,
-    sizeof(sdm630_slow) / sizeof(sdm630_slow[0]),
-    sdm630_fast,
-    sizeof(sdm630_fast) / sizeof(sdm630_fast[0]),
+    sdm630_registers_to_read,
+    ARRAY_SIZE(sdm630_registers_to_read),
+    sdm630_registers_fast_to_read,
+    ARRAY_SIZE(sdm630_registers_fast_to_read),
     sdm630_slow_read_done,
     sdm630_fast_read_done,
     "SDM630",
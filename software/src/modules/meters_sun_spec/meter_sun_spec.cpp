@@ -23,6 +23,10 @@
 #include "modules/meters_modbus_tcp/modbus_tcp_tools.h"
 #include "module_dependencies.h"
 
+#include <stddef.h>
+#include <LittleFS.h>
+#include "esp_rom_crc.h"
+
 #include "event_log.h"
 #include "modules/meters_sun_spec/models/model_001.h"
 #include "task_scheduler.h"
@@ -33,12 +37,24 @@
 #define COMMON_MODEL_ID 1
 #define NON_IMPLEMENTED_UINT16 0xFFFF
 
+// The common model is 65 or 66 registers long. Only the first 65 are read.
+#define COMMON_MODEL_BLOCK_LENGTH 65
+
+#define MAX_PROBE_FAILURES 5
+
+#define SCAN_CACHE_FOLDER "/meters_sun_spec"
+
 static const uint16_t scan_base_addresses[] {
     40000,
     50000,
     0
 };
 
+static String get_scan_cache_path(uint32_t slot)
+{
+    return SCAN_CACHE_FOLDER "/scan_cache_" + String(slot);
+}
+
 MeterClassID MeterSunSpec::get_class() const
 {
     return MeterClassID::SunSpec;
@@ -61,6 +77,8 @@ void MeterSunSpec::setup(const Config &ephemeral_config)
         return;
     }
 
+    load_scan_cache();
+
     task_scheduler.scheduleOnce([this]() {
         this->read_allowed = false;
         this->start_connection();
@@ -76,7 +94,12 @@ void MeterSunSpec::setup(const Config &ephemeral_config)
 
 void MeterSunSpec::connect_callback()
 {
-    scan_start();
+    if (scan_cache_valid) {
+        probe_start();
+    }
+    else {
+        scan_start();
+    }
 }
 
 void MeterSunSpec::disconnect_callback()
@@ -122,8 +145,34 @@ void MeterSunSpec::read_done_callback()
         return;
     }
 
+    if (scan_cache_unconfirmed) {
+        const uint16_t *header = generic_read_request.data[0];
+
+        if (header[0] != model_id || header[1] != scan_cache.model_block_length) {
+            logger.printfln("Cached location of model %u in slot %u is outdated, rescanning", model_id, slot);
+            read_allowed = false;
+            drop_scan_cache();
+            scan_start();
+            return;
+        }
+
+        scan_cache_unconfirmed = false;
+
+        if (!values_declared) {
+            if (!model_parser->restore_values(scan_cache.detected_values)) {
+                logger.printfln("Restoring values of model %u in slot %u failed.", model_id, slot);
+                read_allowed = false;
+                drop_scan_cache();
+                scan_start();
+                return;
+            }
+            values_declared = true;
+            registers_to_read = scan_cache.registers_to_read;
+            generic_read_request.register_count = registers_to_read;
+        }
+    }
+
     if (!values_declared) {
-        size_t registers_to_read = 0;
         if (!model_parser->detect_values(generic_read_request.data, quirks, &registers_to_read)) {
             logger.printfln("Detecting values of model %u in slot %u failed.", model_id, slot);
             return;
@@ -132,6 +181,11 @@ void MeterSunSpec::read_done_callback()
         generic_read_request.register_count = registers_to_read;
     }
 
+    if (scan_cache_save_pending) {
+        scan_cache_save_pending = false;
+        save_scan_cache();
+    }
+
     if (!model_parser->parse_values(generic_read_request.data, quirks)) {
         logger.printfln("Ignoring inconsistent data set for model %u in slot %u.", model_id, slot);
         // TODO: Read again if parsing failed?
@@ -159,6 +213,7 @@ void MeterSunSpec::scan_start()
         return;
     }
 
+    scan_cache_unconfirmed = false;
     scan_base_address_index = 0;
     scan_state = ScanState::Idle;
     scan_state_next = ScanState::ReadSunSpecID;
@@ -250,11 +305,16 @@ void MeterSunSpec::scan_next()
 
                         logger.printfln("Configured SunSpec model %u/%u found at %s:%u:%u:%u",
                                         model_id, model_instance, host_name.c_str(), port, device_address, generic_read_request.start_address);
+
+                        scan_cache.model_address = static_cast<uint16_t>(generic_read_request.start_address);
+                        scan_cache.model_block_length = static_cast<uint16_t>(block_length);
+                        scan_cache_save_pending = true;
+
                         read_start(generic_read_request.start_address, 2 + block_length);
                     }
                 }
                 else if (scan_model_id == 1) { // Common model
-                    generic_read_request.register_count = 67;
+                    generic_read_request.register_count = 2 + COMMON_MODEL_BLOCK_LENGTH;
                     scan_state_next = ScanState::ReadModel;
 
                     start_generic_read();
@@ -274,6 +334,9 @@ void MeterSunSpec::scan_next()
                 size_t block_length = scan_deserializer.read_uint16();
 
                 if (scan_model_id == 1) { // Common model
+                    // Checksum the raw registers, the probe on reconnect compares them unswapped.
+                    uint32_t common_model_checksum = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(generic_read_request.data[0] + 2), COMMON_MODEL_BLOCK_LENGTH * sizeof(uint16_t));
+
                     SunSpecCommonModel001_u *common_model = reinterpret_cast<SunSpecCommonModel001_u *>(generic_read_request.data[0]);
                     modbus_bswap_registers(common_model->registers + 2, 64);
                     const SunSpecCommonModel001_s *m = &common_model->model;
@@ -298,6 +361,10 @@ void MeterSunSpec::scan_next()
                                     !scan_device_found ? "not " :"");
 
                     if (scan_device_found) {
+                        scan_cache.common_model_address = static_cast<uint16_t>(generic_read_request.start_address);
+                        scan_cache.common_model_block_length = static_cast<uint16_t>(block_length);
+                        scan_cache.common_model_checksum = common_model_checksum;
+
                         if (strncmp(m->Mn, "KOSTAL", 32) == 0) {
                             quirks |= SUN_SPEC_QUIRKS_ACC32_IS_INT32;
                             quirks |= SUN_SPEC_QUIRKS_INTEGER_METER_POWER_FACTOR_IS_UNITY;
@@ -329,3 +396,155 @@ void MeterSunSpec::scan_next()
             esp_system_abort("Invalid state.");
     }
 }
+
+// Reads the common model at the cached address and compares it with the
+// scan result. Reading the configured model itself confirms its location.
+void MeterSunSpec::probe_start()
+{
+    free(generic_read_request.data[0]);
+
+    generic_read_request.data[0] = nullptr;
+    generic_read_request.data[1] = nullptr;
+
+    uint16_t *buffer = static_cast<uint16_t *>(malloc(sizeof(uint16_t) * (2 + COMMON_MODEL_BLOCK_LENGTH)));
+    if (!buffer) {
+        logger.printfln("Cannot alloc read buffer.");
+        return;
+    }
+
+    scan_state = ScanState::ProbeCommonModel;
+    probe_failures = 0;
+
+    generic_read_request.register_type = TAddress::RegType::HREG;
+    generic_read_request.start_address = scan_cache.common_model_address;
+    generic_read_request.register_count = 2 + COMMON_MODEL_BLOCK_LENGTH;
+    generic_read_request.data[0] = buffer;
+    generic_read_request.read_twice = false;
+    generic_read_request.done_callback = [this]{ probe_done(); };
+
+    start_generic_read();
+}
+
+void MeterSunSpec::probe_done()
+{
+    if (generic_read_request.result_code != Modbus::ResultCode::EX_SUCCESS) {
+        logger.printfln("Modbus read error during probe: %s (%d)", get_modbus_result_code_name(generic_read_request.result_code), generic_read_request.result_code);
+
+        // An exception response means that the device answered but rejected
+        // the read, so the cached address is most likely wrong. Retrying the
+        // probe would never succeed in that case.
+        if (is_modbus_exception(generic_read_request.result_code) || ++probe_failures >= MAX_PROBE_FAILURES) {
+            logger.printfln("Probing cached location of model %u in slot %u failed, rescanning", model_id, slot);
+            scan_state = ScanState::Idle;
+            drop_scan_cache();
+            scan_start();
+            return;
+        }
+
+        scan_read_delay();
+        return;
+    }
+
+    scan_state = ScanState::Idle;
+
+    const uint16_t *registers = generic_read_request.data[0];
+    uint32_t common_model_checksum = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(registers + 2), COMMON_MODEL_BLOCK_LENGTH * sizeof(uint16_t));
+
+    if (registers[0] != COMMON_MODEL_ID || registers[1] != scan_cache.common_model_block_length || common_model_checksum != scan_cache.common_model_checksum) {
+        logger.printfln("Device at %s:%u:%u changed since last scan, rescanning", host_name.c_str(), port, device_address);
+        drop_scan_cache();
+        scan_start();
+        return;
+    }
+
+    logger.printfln("Using cached location %u of SunSpec model %u/%u at %s:%u:%u",
+                    scan_cache.model_address, model_id, model_instance, host_name.c_str(), port, device_address);
+
+    quirks = scan_cache.quirks;
+    scan_cache_unconfirmed = true;
+
+    read_start(scan_cache.model_address, 2 + scan_cache.model_block_length);
+}
+
+uint32_t MeterSunSpec::get_config_checksum() const
+{
+    uint16_t numbers[4] = {port, device_address, model_id, model_instance};
+    uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(numbers), sizeof(numbers));
+
+    // Include the terminating null bytes to separate the strings.
+    crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t *>(host_name.c_str()), host_name.length() + 1);
+    crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t *>(manufacturer_name.c_str()), manufacturer_name.length() + 1);
+    crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t *>(model_name.c_str()), model_name.length() + 1);
+    crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t *>(serial_number.c_str()), serial_number.length() + 1);
+
+    return crc;
+}
+
+void MeterSunSpec::load_scan_cache()
+{
+    scan_cache_valid = false;
+
+    String path = get_scan_cache_path(slot);
+
+    if (!LittleFS.exists(path)) {
+        return;
+    }
+
+    File file = LittleFS.open(path, "r");
+    size_t read = file.read(reinterpret_cast<uint8_t *>(&scan_cache), sizeof(scan_cache));
+    file.close();
+
+    if (read != sizeof(scan_cache)
+     || scan_cache.magic != SUN_SPEC_SCAN_CACHE_MAGIC
+     || scan_cache.version != SUN_SPEC_SCAN_CACHE_VERSION
+     || scan_cache.checksum != esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&scan_cache), offsetof(SunSpecScanCache, checksum))) {
+        logger.printfln("Ignoring invalid scan cache of slot %u", slot);
+        LittleFS.remove(path);
+        return;
+    }
+
+    if (scan_cache.config_checksum != get_config_checksum()) {
+        // Meter was reconfigured.
+        LittleFS.remove(path);
+        return;
+    }
+
+    scan_cache_valid = true;
+}
+
+void MeterSunSpec::save_scan_cache()
+{
+    uint64_t detected_values;
+    if (!model_parser->get_detected_value_mask(&detected_values)) {
+        return;
+    }
+
+    scan_cache.magic = SUN_SPEC_SCAN_CACHE_MAGIC;
+    scan_cache.version = SUN_SPEC_SCAN_CACHE_VERSION;
+    scan_cache.config_checksum = get_config_checksum();
+    scan_cache.registers_to_read = static_cast<uint16_t>(registers_to_read);
+    scan_cache.quirks = quirks;
+    scan_cache.detected_values = detected_values;
+    scan_cache.checksum = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&scan_cache), offsetof(SunSpecScanCache, checksum));
+
+    scan_cache_valid = true;
+
+    LittleFS.mkdir(SCAN_CACHE_FOLDER);
+
+    File file = LittleFS.open(get_scan_cache_path(slot), "w");
+    if (file.write(reinterpret_cast<const uint8_t *>(&scan_cache), sizeof(scan_cache)) != sizeof(scan_cache)) {
+        logger.printfln("Failed to write scan cache of slot %u", slot);
+    }
+}
+
+void MeterSunSpec::drop_scan_cache()
+{
+    scan_cache_valid = false;
+    scan_cache_unconfirmed = false;
+
+    String path = get_scan_cache_path(slot);
+
+    if (LittleFS.exists(path)) {
+        LittleFS.remove(path);
+    }
+}
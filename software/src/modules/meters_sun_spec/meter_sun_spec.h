@@ -34,6 +34,30 @@
     #pragma GCC diagnostic ignored "-Weffc++"
 #endif
 
+#define SUN_SPEC_SCAN_CACHE_MAGIC 0x43535353 // "SSSC"
+#define SUN_SPEC_SCAN_CACHE_VERSION 2
+
+// Result of a successful scan, stored per meter slot. The config checksum
+// covers all config values that influence the scan. The common model checksum
+// covers the raw registers of the common model (including the serial number
+// and firmware version) of the device the model was found on.
+struct [[gnu::packed]] SunSpecScanCache {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t common_model_block_length;
+    uint32_t config_checksum;
+    uint32_t common_model_checksum;
+    uint16_t common_model_address;
+    uint16_t model_address;
+    uint16_t model_block_length;
+    uint16_t registers_to_read;
+    uint32_t quirks;
+    uint64_t detected_values;
+    uint32_t checksum;
+};
+
+static_assert(sizeof(SunSpecScanCache) == 44, "Unexpected SunSpecScanCache size");
+
 class MeterSunSpec final : protected GenericModbusTCPClient, public IMeter
 {
 public:
@@ -56,6 +80,7 @@ private:
         ReadSunSpecID,
         ReadModelHeader,
         ReadModel,
+        ProbeCommonModel,
     };
 
     void connect_callback() override;
@@ -68,12 +93,21 @@ private:
     void scan_read_delay();
     void scan_next();
 
+    void probe_start();
+    void probe_done();
+
+    uint32_t get_config_checksum() const;
+    void load_scan_cache();
+    void save_scan_cache();
+    void drop_scan_cache();
+
     uint32_t slot;
     Config *state;
     Config *errors;
 
     bool read_allowed = false;
     bool values_declared = false;
+    size_t registers_to_read = 0;
 
     String manufacturer_name;
     String model_name;
@@ -87,6 +121,12 @@ private:
     bool scan_device_found;
     uint16_t scan_model_counter;
 
+    SunSpecScanCache scan_cache;
+    bool scan_cache_valid = false;
+    bool scan_cache_save_pending = false;
+    bool scan_cache_unconfirmed = false;
+    uint8_t probe_failures = 0;
+
     uint32_t quirks = 0;
     MetersSunSpecParser *model_parser;
 };
@@ -59,6 +59,12 @@ bool MetersSunSpecParser::detect_values(const uint16_t *const register_data[2],
 
     *registers_to_read = static_cast<uint32_t>(max_register) + 1;
 
+    declare_values();
+    return true;
+}
+
+void MetersSunSpecParser::declare_values()
+{
     detected_values.shrink_to_fit();
     size_t detected_value_count = detected_values.size();
 
@@ -70,7 +76,6 @@ bool MetersSunSpecParser::detect_values(const uint16_t *const register_data[2],
     free(ids);
 
     meter_values = static_cast<float *>(malloc(detected_value_count * sizeof(float)));
-    return true;
 }
 
 bool MetersSunSpecParser::parse_values(const uint16_t *const register_data[2], uint32_t quirks)
@@ -88,6 +93,38 @@ bool MetersSunSpecParser::parse_values(const uint16_t *const register_data[2], u
     return true;
 }
 
+bool MetersSunSpecParser::get_detected_value_mask(uint64_t *detected_value_mask)
+{
+    if (model->value_count > 64)
+        return false;
+
+    uint64_t mask = 0;
+
+    for (const ValueData *value_data : detected_values) {
+        mask |= 1ull << (value_data - model->value_data);
+    }
+
+    *detected_value_mask = mask;
+    return true;
+}
+
+bool MetersSunSpecParser::restore_values(uint64_t detected_value_mask)
+{
+    if (model->value_count > 64 || (model->value_count < 64 && (detected_value_mask >> model->value_count) != 0))
+        return false;
+
+    detected_values.reserve(model->value_count);
+
+    for (size_t i = 0; i < model->value_count; i++) {
+        if ((detected_value_mask & (1ull << i)) != 0) {
+            detected_values.push_back(&model->value_data[i]);
+        }
+    }
+
+    declare_values();
+    return true;
+}
+
 bool MetersSunSpecParser::must_read_twice()
 {
     return model->read_twice;
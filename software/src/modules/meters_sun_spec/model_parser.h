@@ -73,9 +73,16 @@ public:
     bool detect_values(const uint16_t *const register_data[2], uint32_t quirks, size_t *registers_to_read);
     bool parse_values(const uint16_t *const register_data[2], uint32_t quirks);
 
+    // Bit i is set if value_data[i] of the model was detected. Fails for
+    // models with more than 64 values.
+    bool get_detected_value_mask(uint64_t *detected_value_mask);
+    bool restore_values(uint64_t detected_value_mask);
+
     bool must_read_twice();
 
 private:
+    void declare_values();
+
     MetersSunSpecParser() : meter_slot(0), model(nullptr) {}
     MetersSunSpecParser(uint32_t meter_slot_, const ModelData *model_) : meter_slot(meter_slot_), model(model_) {}
 
@@ -19,15 +19,15 @@
 
 #include <Arduino.h>
 
-#include "esp_modbus_common.h"
-#include "esp_modbus_slave.h"
 #include "esp_netif.h"
+#include "lwip/sockets.h"
 
 #include "api.h"
 #include "task_scheduler.h"
 #include "module_dependencies.h"
 
 #include "modbus_tcp.h"
+#include "modbus_tcp_server.h"
 #include "build.h"
 #include "math.h"
 
@@ -38,6 +38,23 @@ extern uint32_t local_uid_num;
 // 2 - Add coils 1000, 1001
 #define MODBUS_TABLE_VERSION 2
 
+#define MODBUS_TCP_MAX_READ_ONLY_CLIENTS 8
+
+// Registers written by the client are polled with this interval.
+#define MODBUS_TCP_UPDATE_INTERVAL_MS 500
+// Input register blocks are rebuilt with this interval, but only after one of
+// the states they are derived from was updated.
+#define MODBUS_TCP_MIRROR_INTERVAL_MS 100
+
+// Register blocks and the states they are derived from. See ModbusTcp::register_events.
+#define REGS_EVSE             (1u << 0) // evse/state, evse/slots, evse/hardware_configuration
+#define REGS_CHARGE           (1u << 1) // charge_tracker/current_charge, evse/low_level_state
+#define REGS_METER            (1u << 2) // meter/state, meter/values
+#define REGS_METER_PHASES     (1u << 3) // meter/phases
+#define REGS_METER_ALL_VALUES (1u << 4) // meter/all_values
+#define REGS_NFC              (1u << 5) // nfc/seen_tags
+#define REGS_ALL              UINT32_MAX // info/features
+
 template<typename T>
 static void calloc_struct(T **out)
 {
@@ -73,7 +90,7 @@ static floatswapped_t fromFloat(float x) {return {floatswapped_t::swapReg(x)};}
 // Input Registers
 //-------------------
 struct input_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_INPUT;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::InputRegister;
     static const uint16_t OFFSET = 0;
     uint32swapped_t table_version;
     uint32swapped_t firmware_major;
@@ -85,7 +102,7 @@ struct input_regs_t {
 };
 
 struct evse_input_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_INPUT;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::InputRegister;
     static const uint16_t OFFSET = 1000;
     uint32swapped_t iec_state;
     uint32swapped_t charger_state;
@@ -97,7 +114,7 @@ struct evse_input_regs_t {
 };
 
 struct meter_input_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_INPUT;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::InputRegister;
     static const uint16_t OFFSET = 2000;
     uint32swapped_t meter_type;
     floatswapped_t power;
@@ -107,13 +124,13 @@ struct meter_input_regs_t {
 };
 
 struct meter_all_values_input_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_INPUT;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::InputRegister;
     static const uint16_t OFFSET = 2100;
     floatswapped_t meter_values[85];
 };
 
 struct nfc_input_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_INPUT;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::InputRegister;
     static const uint16_t OFFSET = 4000;
     uint32swapped_t tag_id[5];
     uint32swapped_t tag_id_age;
@@ -123,14 +140,14 @@ struct nfc_input_regs_t {
 // Holding Registers
 //-------------------
 struct holding_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint16_t OFFSET = 0;
     static const uint32_t REBOOT_PASSWORD = 0x012EB007;
     uint32swapped_t reboot;
 };
 
 struct evse_holding_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint16_t OFFSET = 1000;
     uint32swapped_t enable_charging;
     uint32swapped_t allowed_current;
@@ -139,14 +156,14 @@ struct evse_holding_regs_t {
 };
 
 struct meter_holding_regs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint16_t OFFSET = 2000;
     static const uint32_t TRIGGER_RESET_PASSWORD = 0x3E12E5E7;
     uint32swapped_t trigger_reset;
 };
 
 struct [[gnu::packed]] bender_general_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint16_t OFFSET = 100;
     char firmware_version[4];
     uint16_t padding[2];
@@ -174,7 +191,7 @@ struct [[gnu::packed]] bender_general_s {
 };
 
 struct [[gnu::packed]] bender_phases_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint16_t OFFSET = 200;
     uint32swapped_t energy[3];
     uint32swapped_t power[3];
@@ -185,7 +202,7 @@ struct [[gnu::packed]] bender_phases_s {
 };
 
 struct [[gnu::packed]] bender_dlm_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 600;
     uint16_t dlm_mode;
     uint16_t padding[9];
@@ -200,7 +217,7 @@ struct [[gnu::packed]] bender_dlm_s {
 };
 
 struct [[gnu::packed]] bender_charge_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 700;
     uint16_t padding[5];
     uint16_t wh_charged;
@@ -219,19 +236,19 @@ struct [[gnu::packed]] bender_charge_s {
 };
 
 struct [[gnu::packed]] bender_hems_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 1000;
     uint16_t hems_limit;
 };
 
 struct [[gnu::packed]] bender_write_uid_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 1110;
     uint32swapped_t user_id[5];
 };
 
 struct [[gnu::packed]] keba_read_general_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 1000;
     uint32swapped_t charging_state;
     uint32swapped_t padding;
@@ -250,7 +267,7 @@ struct [[gnu::packed]] keba_read_general_s {
 };
 
 struct [[gnu::packed]] keba_read_max_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 1100;
     uint32swapped_t max_current;
     uint16_t padding[8];
@@ -258,14 +275,14 @@ struct [[gnu::packed]] keba_read_max_s {
 };
 
 struct [[gnu::packed]] keba_read_charge_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 1500;
     uint32swapped_t rfid_tag;
     uint32swapped_t charged_energy;
 };
 
 struct [[gnu::packed]] keba_write_s {
-    static const mb_param_type_t TYPE = MB_PARAM_HOLDING;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::HoldingRegister;
     static const uint32_t OFFSET = 5004;
     uint16_t set_charging_current;
     uint16_t padding[5];
@@ -286,7 +303,7 @@ struct [[gnu::packed]] keba_write_s {
 // Discrete Inputs
 //-------------------
 struct discrete_inputs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_DISCRETE;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::DiscreteInput;
     static const uint16_t OFFSET = 0;
     bool evse : 1;
     bool meter : 1;
@@ -296,7 +313,7 @@ struct discrete_inputs_t {
 };
 
 struct meter_discrete_inputs_t {
-    static const mb_param_type_t TYPE = MB_PARAM_DISCRETE;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::DiscreteInput;
     static const uint16_t OFFSET = 2100;
     bool phase_one_connected : 1;
     bool phase_two_connected : 1;
@@ -310,13 +327,13 @@ struct meter_discrete_inputs_t {
 // Coils
 //-------------------
 struct evse_coils_t {
-    static const mb_param_type_t TYPE = MB_PARAM_COIL;
+    static const ModbusTcpDataType TYPE = ModbusTcpDataType::Coil;
     static const uint16_t OFFSET = 1000;
     bool enable_charging : 1;
     bool autostart_button : 1;
 };
 
-static input_regs_t *input_regs, *input_regs_copy;
+static input_regs_t *input_regs;
 static evse_input_regs_t *evse_input_regs, *evse_input_regs_copy;
 static meter_input_regs_t *meter_input_regs, *meter_input_regs_copy;
 static meter_all_values_input_regs_t *meter_all_values_input_regs, *meter_all_values_input_regs_copy;
@@ -344,6 +361,7 @@ static keba_read_max_s *keba_read_max, *keba_read_max_cpy;
 static keba_write_s *keba_write, *keba_write_cpy;
 
 static portMUX_TYPE mtx;
+static ModbusTcpServer server;
 
 ModbusTcp::ModbusTcp()
 {
@@ -351,17 +369,87 @@ ModbusTcp::ModbusTcp()
 
 void ModbusTcp::pre_setup()
 {
-    config = Config::Object({
+    config = ConfigRoot{Config::Object({
         {"enable", Config::Bool(false)},
         {"port", Config::Uint16(502)},
         {"table", Config::Uint16(0)},
-    });
+        {"read_only_clients", Config::Array({},
+            new Config{Config::Str("", 7, 15)},
+            0, MODBUS_TCP_MAX_READ_ONLY_CLIENTS, Config::type_id<Config::ConfString>())
+        },
+    }), [](Config &cfg, ConfigSource source) -> String {
+        for (const auto &ip_config : cfg.get("read_only_clients")) {
+            IPAddress ip;
+            if (!ip.fromString(ip_config.asEphemeralCStr()))
+                return "Failed to parse \"read_only_clients\": Expected format is dotted decimal, i.e. 10.0.0.1";
+        }
+
+        return "";
+    }};
+
+    clients = Config::Array({},
+        new Config{Config::Object({
+            {"ip", Config::Str("", 0, 15)},
+            {"port", Config::Uint16(0)},
+            {"read_only", Config::Bool(false)},
+            {"connected_since", Config::Uint32(0)},
+            {"requests", Config::Uint32(0)},
+            {"exceptions", Config::Uint32(0)},
+            {"requests_per_second", Config::Float(0)},
+            {"latency_avg_us", Config::Uint32(0)},
+            {"latency_max_us", Config::Uint32(0)},
+        })},
+        0, MODBUS_TCP_SERVER_MAX_CLIENTS, Config::type_id<Config::ConfObject>());
+}
+
+void ModbusTcp::update_client_stats()
+{
+    ModbusTcpClientStats stats[MODBUS_TCP_SERVER_MAX_CLIENTS];
+    server.get_client_stats(stats);
+
+    uint32_t now = millis();
+    uint32_t interval = now - last_client_stats_update;
+    last_client_stats_update = now;
+
+    size_t connected = 0;
+
+    for (size_t i = 0; i < MODBUS_TCP_SERVER_MAX_CLIENTS; ++i) {
+        const ModbusTcpClientStats &client_stats = stats[i];
+
+        if (!client_stats.connected)
+            continue;
+
+        while (clients.count() <= connected)
+            clients.add();
+
+        Config *client = static_cast<Config *>(clients.get(connected));
+        ++connected;
+
+        struct in_addr ip;
+        ip.s_addr = client_stats.ip;
+
+        // inet_ntoa's static buffer is shared with the server task.
+        char ip_str[16];
+        inet_ntoa_r(ip, ip_str, sizeof(ip_str));
+
+        client->get("ip")->updateString(ip_str);
+        client->get("port")->updateUint(client_stats.port);
+        client->get("read_only")->updateBool(client_stats.read_only);
+        client->get("connected_since")->updateUint(client_stats.connected_since);
+        client->get("requests")->updateUint(client_stats.requests);
+        client->get("exceptions")->updateUint(client_stats.exceptions);
+        client->get("requests_per_second")->updateFloat(interval == 0 ? 0 : client_stats.window_requests * 1000.0f / interval);
+        client->get("latency_avg_us")->updateUint(client_stats.window_requests == 0 ? 0 : client_stats.window_latency_sum_us / client_stats.window_requests);
+        client->get("latency_max_us")->updateUint(client_stats.window_latency_max_us);
+    }
+
+    while (clients.count() > connected)
+        clients.removeLast();
 }
 
 static void allocate_table()
 {
     calloc_struct(&input_regs);
-    calloc_struct(&input_regs_copy);
     calloc_struct(&evse_input_regs);
     calloc_struct(&evse_input_regs_copy);
     calloc_struct(&meter_input_regs);
@@ -421,32 +509,15 @@ void ModbusTcp::setup()
         return;
     }
 
-    void *modbus_handle = NULL;
-    esp_err_t err = mbc_slave_init_tcp(&modbus_handle);
-    if (err != ESP_OK || modbus_handle == NULL)
-        printf("Modbus init failed with code %i", err);
-
-    mb_communication_info_t comm_info;
-    comm_info.ip_addr = NULL;
-    comm_info.mode = MB_MODE_TCP;
-    comm_info.ip_addr_type = MB_IPV4;
-    comm_info.ip_port = config.get("port")->asUint();
-    // For some reason, mbc_slave_setup asserts that comm_info.ip_netif_ptr is not null,
-    // but the ip_netif_ptr is never used.
-    // Fortunately this means that we can just pass anything to circumvent the assertion
-    // and the modbus_tcp server will listen on any network interface.
-    comm_info.ip_netif_ptr = (void *)0x00000004;
-    ESP_ERROR_CHECK(mbc_slave_setup((void *)&comm_info));
-
-    mb_register_area_descriptor_t reg_area;
-
-#define REGISTER_DESCRIPTOR(x) do { \
-    reg_area.type = x->TYPE; \
-    reg_area.start_offset = x->OFFSET; \
-    reg_area.address = x; \
-    reg_area.size = sizeof(*x); \
-    ESP_ERROR_CHECK(mbc_slave_set_descriptor(reg_area)); \
-} while (0)
+    spinlock_initialize(&mtx);
+
+    for (const auto &ip_config : config.get("read_only_clients")) {
+        IPAddress ip;
+        if (ip.fromString(ip_config.asEphemeralCStr()))
+            server.add_read_only_client(static_cast<uint32_t>(ip));
+    }
+
+#define REGISTER_DESCRIPTOR(x) server.add_area(x->TYPE, x->OFFSET, x, sizeof(*x))
 
     uint32_t config_table = config.get("table")->asUint();
 
@@ -489,7 +560,9 @@ void ModbusTcp::setup()
         REGISTER_DESCRIPTOR(keba_write);
     }
 
-    ESP_ERROR_CHECK(mbc_slave_start());
+    if (!server.start(config.get("port")->asUint(), &mtx)) {
+        return;
+    }
 
     initialized = true;
 }
@@ -503,8 +576,6 @@ void ModbusTcp::update_bender_regs()
         *bender_write_uid_cpy = *bender_write_uid;
     taskEXIT_CRITICAL(&mtx);
 
-    bool charging = false;
-
     bender_general_cpy->device_id = 0xEBEE;
 
 #define NOT_SUPPORTED 0
@@ -564,14 +635,36 @@ void ModbusTcp::update_bender_regs()
         bender_general_cpy->vehicle_state_hex = api.getState("evse/state")->get("iec61851_state")->asUint() + 10;
 
         bender_general_cpy->hardware_curr_limit = api.getState("evse/slots")->get(1)->get("max_current")->asUint() / 1000;
-        bender_charge_cpy->current_signaled = api.getState("evse/state")->get("allowed_charging_current")->asUint() / 1000;
 
-        evse_common.set_modbus_current(bender_hems->hems_limit * 1000);
+        evse_common.set_modbus_current(bender_hems_cpy->hems_limit * 1000);
         evse_common.set_modbus_enabled(true);
+    }
+
+    taskENTER_CRITICAL(&mtx);
+        *bender_dlm = *bender_dlm_cpy;
+        *bender_general = *bender_general_cpy;
+        *bender_hems = *bender_hems_cpy;
+        *bender_write_uid = *bender_write_uid_cpy;
+    taskEXIT_CRITICAL(&mtx);
+}
+
+void ModbusTcp::mirror_bender_regs()
+{
+    uint32_t dirty = dirty_blocks;
+    dirty_blocks = 0;
+
+    bool has_feature_evse = api.hasFeature("evse");
+    bool charging = false;
+
+#if MODULE_CHARGE_TRACKER_AVAILABLE()
+    charging = has_feature_evse && api.getState("charge_tracker/current_charge")->get("user_id")->asInt() != -1;
+#endif
+
+    if (has_feature_evse && (dirty & (REGS_EVSE | REGS_CHARGE)) != 0)
+    {
+        bender_charge_cpy->current_signaled = api.getState("evse/state")->get("allowed_charging_current")->asUint() / 1000;
 
 #if MODULE_CHARGE_TRACKER_AVAILABLE()
-        int32_t user_id = api.getState("charge_tracker/current_charge")->get("user_id")->asInt();
-        charging = user_id != -1;
         if (charging) {
             bender_charge_cpy->charge_duration = fromUint((api.getState("evse/low_level_state")->get("uptime")->asUint() - api.getState("charge_tracker/current_charge")->get("evse_uptime_start")->asUint()) / 1000);
             bender_charge_cpy->charge_duration_new = fromUint((api.getState("evse/low_level_state")->get("uptime")->asUint() - api.getState("charge_tracker/current_charge")->get("evse_uptime_start")->asUint()) / 1000);
@@ -585,7 +678,7 @@ void ModbusTcp::update_bender_regs()
 #if MODULE_METERS_LEGACY_API_AVAILABLE()
     if (api.hasFeature("meter"))
     {
-        if (api.hasFeature("meter_all_values"))
+        if (api.hasFeature("meter_all_values") && (dirty & REGS_METER_ALL_VALUES) != 0)
         {
             auto meter_values = api.getState("meter/all_values");
 
@@ -601,34 +694,37 @@ void ModbusTcp::update_bender_regs()
         }
 
 #if MODULE_CHARGE_TRACKER_AVAILABLE()
-        auto meter_start = api.getState("charge_tracker/current_charge")->get("meter_start")->asFloat();
-        auto meter_absolute = api.getState("meter/values")->get("energy_abs")->asFloat();
-        if (!charging)
-        {
-            bender_charge_cpy->wh_charged = fromUint(0);
-            bender_charge_cpy->charged_energy = fromUint(0);
-        }
-        else if (isnan(meter_start))
-        {
-            bender_charge_cpy->wh_charged = 0;
-            bender_charge_cpy->charged_energy = fromUint(0);
-        }
-        else
+        if ((dirty & (REGS_METER | REGS_CHARGE)) != 0)
         {
-            bender_charge_cpy->wh_charged = uint16_t((meter_absolute - meter_start) * 1000);
-            bender_charge_cpy->charged_energy = fromUint((meter_absolute - meter_start) * 1000);
+            auto meter_start = api.getState("charge_tracker/current_charge")->get("meter_start")->asFloat();
+            auto meter_absolute = api.getState("meter/values")->get("energy_abs")->asFloat();
+            if (!charging)
+            {
+                bender_charge_cpy->wh_charged = fromUint(0);
+                bender_charge_cpy->charged_energy = fromUint(0);
+            }
+            else if (isnan(meter_start))
+            {
+                bender_charge_cpy->wh_charged = 0;
+                bender_charge_cpy->charged_energy = fromUint(0);
+            }
+            else
+            {
+                bender_charge_cpy->wh_charged = uint16_t((meter_absolute - meter_start) * 1000);
+                bender_charge_cpy->charged_energy = fromUint((meter_absolute - meter_start) * 1000);
+            }
         }
 #endif
     }
 #endif
 
+    // bender_charge and bender_phases are never written by the client,
+    // so they don't have to be read back first.
     taskENTER_CRITICAL(&mtx);
-        *bender_charge = *bender_charge_cpy;
-        *bender_dlm = *bender_dlm_cpy;
-        *bender_general = *bender_general_cpy;
-        *bender_hems = *bender_hems_cpy;
-        *bender_phases = *bender_phases_cpy;
-        *bender_write_uid = *bender_write_uid_cpy;
+        if ((dirty & (REGS_EVSE | REGS_CHARGE | REGS_METER)) != 0)
+            *bender_charge = *bender_charge_cpy;
+        if ((dirty & REGS_METER_ALL_VALUES) != 0)
+            *bender_phases = *bender_phases_cpy;
     taskEXIT_CRITICAL(&mtx);
 }
 
@@ -701,24 +797,49 @@ void ModbusTcp::update_regs()
             evse_holding_regs->led_blink_duration = fromUint(0);
             evse_holding_regs->led_blink_state = fromUint(-2);
         }
+
+        // The uptime is the only input register that changes without a state update.
+        input_regs->uptime = fromUint((uint32_t)(esp_timer_get_time() / 1000000));
     taskEXIT_CRITICAL(&mtx);
 
     bool write_allowed = has_feature_evse && api.getState("evse/slots")->get(CHARGING_SLOT_MODBUS_TCP)->get("active")->asBool();
-    bool charging = false;
 
     if (holding_regs_copy->reboot == holding_regs_copy->REBOOT_PASSWORD && write_allowed)
         trigger_reboot("Modbus TCP");
 
-    input_regs_copy->table_version = fromUint(MODBUS_TABLE_VERSION);
-    input_regs_copy->box_id = fromUint(local_uid_num);
-    input_regs_copy->firmware_major = fromUint(BUILD_VERSION_MAJOR);
-    input_regs_copy->firmware_minor = fromUint(BUILD_VERSION_MINOR);
-    input_regs_copy->firmware_patch = fromUint(BUILD_VERSION_PATCH);
-    input_regs_copy->firmware_build_ts = fromUint(build_timestamp());
-    input_regs_copy->uptime = fromUint((uint32_t)(esp_timer_get_time() / 1000000));
+    if (has_feature_evse)
+    {
+        if (set_evse_led)
+            evse_led.set_api(EvseLed::Blink((uint32_t)evse_holding_regs_copy->led_blink_state), evse_holding_regs_copy->led_blink_duration);
+
+        evse_common.set_modbus_current(evse_holding_regs_copy->allowed_current);
+        evse_common.set_modbus_enabled(enable_charging);
+
+        if (write_allowed && call_start_charging)
+            api.callCommand("evse/start_charging", nullptr);
+        if (write_allowed && call_stop_charging)
+            api.callCommand("evse/stop_charging", nullptr);
+    }
+
+#if MODULE_METERS_LEGACY_API_AVAILABLE()
+    if (api.hasFeature("meter"))
+    {
+        if (reset_meter && write_allowed)
+            api.callCommand("meter/reset", {});
+    }
+#endif
+}
+
+void ModbusTcp::mirror_regs()
+{
+    uint32_t dirty = dirty_blocks;
+    dirty_blocks = 0;
+
+    bool has_feature_evse = api.hasFeature("evse");
+    bool charging = false;
 
 #if MODULE_NFC_AVAILABLE()
-    if (api.hasFeature("nfc")) {
+    if (api.hasFeature("nfc") && (dirty & REGS_NFC) != 0) {
         discrete_inputs_copy->nfc = true;
         auto tag = nfc.old_tags[0];
         auto injected_tag = nfc.old_tags[TAG_LIST_LENGTH - 1];
@@ -735,50 +856,46 @@ void ModbusTcp::update_regs()
     if (has_feature_evse)
     {
         discrete_inputs_copy->evse = true;
-        evse_input_regs_copy->iec_state = fromUint(api.getState("evse/state")->get("iec61851_state")->asUint());
-        evse_input_regs_copy->charger_state = fromUint(api.getState("evse/state")->get("charger_state")->asUint());
-
-        if (set_evse_led)
-            evse_led.set_api(EvseLed::Blink((uint32_t)evse_holding_regs_copy->led_blink_state), evse_holding_regs_copy->led_blink_duration);
-
-        evse_common.set_modbus_current(evse_holding_regs_copy->allowed_current);
-        evse_common.set_modbus_enabled(enable_charging);
 
-        auto slots = api.getState("evse/slots");
+#if MODULE_CHARGE_TRACKER_AVAILABLE()
+        int32_t user_id = api.getState("charge_tracker/current_charge")->get("user_id")->asInt();
+        charging = user_id != -1;
+#endif
 
-        for (int i = 0; i < slots->count(); i++)
+        if ((dirty & (REGS_EVSE | REGS_CHARGE)) != 0)
         {
-            uint32_t current = slots->get(i)->get("max_current")->asUint();
-            uint32_t val = 0xFFFFFFFF;
+            evse_input_regs_copy->iec_state = fromUint(api.getState("evse/state")->get("iec61851_state")->asUint());
+            evse_input_regs_copy->charger_state = fromUint(api.getState("evse/state")->get("charger_state")->asUint());
 
-            if (slots->get(i)->get("active")->asBool())
+            auto slots = api.getState("evse/slots");
+
+            for (int i = 0; i < slots->count(); i++)
             {
-                val = current;
+                uint32_t current = slots->get(i)->get("max_current")->asUint();
+                uint32_t val = 0xFFFFFFFF;
+
+                if (slots->get(i)->get("active")->asBool())
+                {
+                    val = current;
+                }
+                evse_input_regs_copy->slots[i] = fromUint(val);
             }
-            evse_input_regs_copy->slots[i] = fromUint(val);
-        }
-
-        evse_input_regs_copy->max_current = fromUint(api.getState("evse/state")->get("allowed_charging_current")->asUint());
-        evse_input_regs_copy->start_time_min = fromUint(0);
-        evse_input_regs_copy->charging_time_sec = fromUint(0);
-
-        if (write_allowed && call_start_charging)
-            api.callCommand("evse/start_charging", nullptr);
-        if (write_allowed && call_stop_charging)
-            api.callCommand("evse/stop_charging", nullptr);
 
-#if MODULE_CHARGE_TRACKER_AVAILABLE()
-        int32_t user_id = api.getState("charge_tracker/current_charge")->get("user_id")->asInt();
-        charging = user_id != -1;
-        evse_input_regs_copy->current_user = fromUint(charging ? UINT32_MAX : (uint32_t)user_id);
-        if (charging) {
-            evse_input_regs_copy->start_time_min = fromUint(api.getState("charge_tracker/current_charge")->get("timestamp_minutes")->asUint());
-            evse_input_regs_copy->charging_time_sec = fromUint((api.getState("evse/low_level_state")->get("uptime")->asUint() - api.getState("charge_tracker/current_charge")->get("evse_uptime_start")->asUint()) / 1000);
-        } else {
+            evse_input_regs_copy->max_current = fromUint(api.getState("evse/state")->get("allowed_charging_current")->asUint());
             evse_input_regs_copy->start_time_min = fromUint(0);
             evse_input_regs_copy->charging_time_sec = fromUint(0);
-        }
+
+#if MODULE_CHARGE_TRACKER_AVAILABLE()
+            evse_input_regs_copy->current_user = fromUint(charging ? UINT32_MAX : (uint32_t)user_id);
+            if (charging) {
+                evse_input_regs_copy->start_time_min = fromUint(api.getState("charge_tracker/current_charge")->get("timestamp_minutes")->asUint());
+                evse_input_regs_copy->charging_time_sec = fromUint((api.getState("evse/low_level_state")->get("uptime")->asUint() - api.getState("charge_tracker/current_charge")->get("evse_uptime_start")->asUint()) / 1000);
+            } else {
+                evse_input_regs_copy->start_time_min = fromUint(0);
+                evse_input_regs_copy->charging_time_sec = fromUint(0);
+            }
 #endif
+        }
     }
 
 #if MODULE_METERS_LEGACY_API_AVAILABLE()
@@ -786,63 +903,74 @@ void ModbusTcp::update_regs()
     {
         discrete_inputs_copy->meter = true;
 
-        meter_input_regs_copy->meter_type = fromUint(api.getState("meter/state")->get("type")->asUint());
+        if ((dirty & (REGS_METER | REGS_CHARGE)) != 0)
+        {
+            meter_input_regs_copy->meter_type = fromUint(api.getState("meter/state")->get("type")->asUint());
 
-        auto meter_values = api.getState("meter/values");
-        meter_input_regs_copy->power = fromFloat(meter_values->get("power")->asFloat());
-        meter_input_regs_copy->energy_relative = fromFloat(meter_values->get("energy_rel")->asFloat());
-        meter_input_regs_copy->energy_absolute = fromFloat(meter_values->get("energy_abs")->asFloat());
+            auto meter_values = api.getState("meter/values");
+            meter_input_regs_copy->power = fromFloat(meter_values->get("power")->asFloat());
+            meter_input_regs_copy->energy_relative = fromFloat(meter_values->get("energy_rel")->asFloat());
+            meter_input_regs_copy->energy_absolute = fromFloat(meter_values->get("energy_abs")->asFloat());
 #if MODULE_CHARGE_TRACKER_AVAILABLE()
-        auto meter_start = api.getState("charge_tracker/current_charge")->get("meter_start")->asFloat();
-        if (!charging)
-            meter_input_regs_copy->energy_this_charge = fromFloat(0);
-        else if (isnan(meter_start))
-            meter_input_regs_copy->energy_this_charge = fromFloat(NAN);
-        else
-            meter_input_regs_copy->energy_this_charge = fromFloat(meter_input_regs_copy->energy_absolute - meter_start);
+            auto meter_start = api.getState("charge_tracker/current_charge")->get("meter_start")->asFloat();
+            if (!charging)
+                meter_input_regs_copy->energy_this_charge = fromFloat(0);
+            else if (isnan(meter_start))
+                meter_input_regs_copy->energy_this_charge = fromFloat(NAN);
+            else
+                meter_input_regs_copy->energy_this_charge = fromFloat(meter_input_regs_copy->energy_absolute - meter_start);
 #endif
-
-        if (reset_meter && write_allowed)
-            api.callCommand("meter/reset", {});
+        }
     }
 
     if (api.hasFeature("meter_phases"))
     {
         discrete_inputs_copy->meter_phases = true;
 
-        auto meter_phase_values = api.getState("meter/phases");
-        meter_discrete_inputs_copy->phase_one_active = meter_phase_values->get("phases_active")->get(0)->asBool();
-        meter_discrete_inputs_copy->phase_two_active = meter_phase_values->get("phases_active")->get(1)->asBool();
-        meter_discrete_inputs_copy->phase_three_active = meter_phase_values->get("phases_active")->get(2)->asBool();
-        meter_discrete_inputs_copy->phase_one_connected = meter_phase_values->get("phases_connected")->get(0)->asBool();
-        meter_discrete_inputs_copy->phase_two_connected = meter_phase_values->get("phases_connected")->get(1)->asBool();
-        meter_discrete_inputs_copy->phase_three_connected = meter_phase_values->get("phases_connected")->get(2)->asBool();
+        if ((dirty & REGS_METER_PHASES) != 0)
+        {
+            auto meter_phase_values = api.getState("meter/phases");
+            meter_discrete_inputs_copy->phase_one_active = meter_phase_values->get("phases_active")->get(0)->asBool();
+            meter_discrete_inputs_copy->phase_two_active = meter_phase_values->get("phases_active")->get(1)->asBool();
+            meter_discrete_inputs_copy->phase_three_active = meter_phase_values->get("phases_active")->get(2)->asBool();
+            meter_discrete_inputs_copy->phase_one_connected = meter_phase_values->get("phases_connected")->get(0)->asBool();
+            meter_discrete_inputs_copy->phase_two_connected = meter_phase_values->get("phases_connected")->get(1)->asBool();
+            meter_discrete_inputs_copy->phase_three_connected = meter_phase_values->get("phases_connected")->get(2)->asBool();
+        }
     }
 
     if (api.hasFeature("meter_all_values"))
     {
         discrete_inputs_copy->meter_all_values = true;
 
-        auto meter_all_values = api.getState("meter/all_values");
+        if ((dirty & REGS_METER_ALL_VALUES) != 0)
+        {
+            auto meter_all_values = api.getState("meter/all_values");
 
-        for (int i = 0; i < 85; i++)
-            meter_all_values_input_regs_copy->meter_values[i] = fromFloat(meter_all_values->get(i)->asFloat());
+            for (int i = 0; i < 85; i++)
+                meter_all_values_input_regs_copy->meter_values[i] = fromFloat(meter_all_values->get(i)->asFloat());
+        }
     }
 #endif
 
     // DO NOT write back into holding registers and coils here.
     // Write ONLY input registers and discrete inputs.
     // If we want to read and write the same register, writing into it
-    // has to be done in the first critical section, not this one.
+    // has to be done in update_regs' critical section, not this one.
     // Otherwise we would overwrite and ignore a value that was written between the critical sections.
+    // Only blocks that were rebuilt are copied.
     taskENTER_CRITICAL(&mtx);
-        *input_regs = *input_regs_copy;
-        *evse_input_regs = *evse_input_regs_copy;
-        *meter_input_regs = *meter_input_regs_copy;
-        *meter_all_values_input_regs = *meter_all_values_input_regs_copy;
+        if ((dirty & (REGS_EVSE | REGS_CHARGE)) != 0)
+            *evse_input_regs = *evse_input_regs_copy;
+        if ((dirty & (REGS_METER | REGS_CHARGE)) != 0)
+            *meter_input_regs = *meter_input_regs_copy;
+        if ((dirty & REGS_METER_ALL_VALUES) != 0)
+            *meter_all_values_input_regs = *meter_all_values_input_regs_copy;
+        if ((dirty & REGS_METER_PHASES) != 0)
+            *meter_discrete_inputs = *meter_discrete_inputs_copy;
+        if ((dirty & REGS_NFC) != 0)
+            *nfc_input_regs = *nfc_input_regs_copy;
         *discrete_inputs = *discrete_inputs_copy;
-        *meter_discrete_inputs = *meter_discrete_inputs_copy;
-        *nfc_input_regs = *nfc_input_regs_copy;
     taskEXIT_CRITICAL(&mtx);
 }
 
@@ -930,15 +1058,26 @@ void ModbusTcp::update_keba_regs()
         *keba_write_cpy = *keba_write;
     taskEXIT_CRITICAL(&mtx);
 
-    keba_read_general_cpy->features = fromUint(keba_get_features());
-    keba_read_general_cpy->firmware_version = fromUint(0x30A1B00);
-
     if (api.hasFeature("evse"))
     {
-
         evse_common.set_modbus_current(keba_write_cpy->set_charging_current);
         evse_common.set_modbus_enabled(keba_write_cpy->enable_station == 1 ? true : false);
+    }
+}
+
+void ModbusTcp::mirror_keba_regs()
+{
+    uint32_t dirty = dirty_blocks;
+    dirty_blocks = 0;
+
+    if ((dirty & REGS_EVSE) != 0)
+    {
+        keba_read_general_cpy->features = fromUint(keba_get_features());
+        keba_read_general_cpy->firmware_version = fromUint(0x30A1B00);
+    }
 
+    if (api.hasFeature("evse") && (dirty & REGS_EVSE) != 0)
+    {
         if (api.getState("evse/state")->get("iec61851_state")->asUint() == 4)
             keba_read_general_cpy->charging_state = fromUint(4);
         else
@@ -956,7 +1095,7 @@ void ModbusTcp::update_keba_regs()
     }
 
 #if MODULE_METERS_LEGACY_API_AVAILABLE()
-    if (api.hasFeature("meter"))
+    if (api.hasFeature("meter") && (dirty & (REGS_METER | REGS_CHARGE)) != 0)
     {
 #if MODULE_CHARGE_TRACKER_AVAILABLE()
         int32_t user_id = api.getState("charge_tracker/current_charge")->get("user_id")->asInt();
@@ -965,17 +1104,17 @@ void ModbusTcp::update_keba_regs()
         auto meter_start = api.getState("charge_tracker/current_charge")->get("meter_start")->asFloat();
 
         if (!charging)
-            keba_read_charge->charged_energy = fromUint(0);
+            keba_read_charge_cpy->charged_energy = fromUint(0);
         else if (isnan(meter_start))
-            keba_read_charge->charged_energy = fromUint(0);
+            keba_read_charge_cpy->charged_energy = fromUint(0);
         else
-            keba_read_charge->charged_energy = fromUint((uint32_t)((meter_absolute - meter_start) * 1000));
-    }
+            keba_read_charge_cpy->charged_energy = fromUint((uint32_t)((meter_absolute - meter_start) * 1000));
 #endif
+    }
 #endif
 
 #if MODULE_CHARGE_TRACKER_AVAILABLE()
-    if (api.getState("charge_tracker/current_charge")->get("authorization_type")->asUint() == 2)
+    if ((dirty & REGS_CHARGE) != 0 && api.getState("charge_tracker/current_charge")->get("authorization_type")->asUint() == 2)
     {
         const auto &tag_id = api.getState("charge_tracker/current_charge")->get("authorization_info")->get("tag_id")->asString();
         keba_read_charge_cpy->rfid_tag = fromUint(export_tag_id_as_uint32(tag_id));
@@ -985,7 +1124,7 @@ void ModbusTcp::update_keba_regs()
 #if MODULE_METERS_LEGACY_API_AVAILABLE()
     if (api.hasFeature("meter"))
     {
-        if (api.hasFeature("meter_all_values"))
+        if (api.hasFeature("meter_all_values") && (dirty & REGS_METER_ALL_VALUES) != 0)
         {
             auto meter_all_values = api.getState("meter/all_values");
             for (int i = 0; i < 3; i++)
@@ -995,27 +1134,38 @@ void ModbusTcp::update_keba_regs()
             }
             keba_read_general_cpy->power_factor = fromUint(meter_all_values->get(METER_ALL_VALUES_TOTAL_SYSTEM_POWER_FACTOR)->asFloat() * 1000);
         }
-        keba_read_general_cpy->power = fromUint(api.getState("meter/values")->get("power")->asFloat() * 1000);
-        keba_read_general_cpy->total_energy = fromUint(api.getState("meter/values")->get("energy_abs")->asFloat() * 1000);
+        if ((dirty & REGS_METER) != 0)
+        {
+            keba_read_general_cpy->power = fromUint(api.getState("meter/values")->get("power")->asFloat() * 1000);
+            keba_read_general_cpy->total_energy = fromUint(api.getState("meter/values")->get("energy_abs")->asFloat() * 1000);
+        }
     }
 #endif
 
     taskENTER_CRITICAL(&mtx);
-        *keba_read_charge = *keba_read_charge_cpy;
-        *keba_read_general = *keba_read_general_cpy;
-        *keba_read_max = *keba_read_max_cpy;
+        if ((dirty & (REGS_METER | REGS_CHARGE)) != 0)
+            *keba_read_charge = *keba_read_charge_cpy;
+        if ((dirty & (REGS_EVSE | REGS_METER | REGS_METER_ALL_VALUES)) != 0)
+            *keba_read_general = *keba_read_general_cpy;
+        if ((dirty & REGS_EVSE) != 0)
+            *keba_read_max = *keba_read_max_cpy;
     taskEXIT_CRITICAL(&mtx);
 }
 
 void ModbusTcp::register_urls()
 {
     api.addPersistentConfig("modbus_tcp/config", &config);
+    api.addState("modbus_tcp/clients", &clients);
 
     if (!config.get("enable")->asBool()) {
         return;
     }
 
-    spinlock_initialize(&mtx);
+    last_client_stats_update = millis();
+
+    task_scheduler.scheduleWithFixedDelay([this]() {
+        this->update_client_stats();
+    }, 1000, 1000);
 
     uint32_t config_table = config.get("table")->asUint();
 
@@ -1053,7 +1203,12 @@ void ModbusTcp::register_urls()
 
         task_scheduler.scheduleWithFixedDelay([this]() {
             this->update_regs();
-        }, 0, 500);
+        }, 0, MODBUS_TCP_UPDATE_INTERVAL_MS);
+
+        task_scheduler.scheduleWithFixedDelay([this]() {
+            if (this->dirty_blocks != 0)
+                this->mirror_regs();
+        }, 0, MODBUS_TCP_MIRROR_INTERVAL_MS);
     }
     else if (config_table == 1)
     {
@@ -1070,7 +1225,12 @@ void ModbusTcp::register_urls()
 
         task_scheduler.scheduleWithFixedDelay([this]() {
             this->update_bender_regs();
-        }, 0, 500);
+        }, 0, MODBUS_TCP_UPDATE_INTERVAL_MS);
+
+        task_scheduler.scheduleWithFixedDelay([this]() {
+            if (this->dirty_blocks != 0)
+                this->mirror_bender_regs();
+        }, 0, MODBUS_TCP_MIRROR_INTERVAL_MS);
     }
     else if (config_table == 2)
     {
@@ -1087,6 +1247,52 @@ void ModbusTcp::register_urls()
 
         task_scheduler.scheduleWithFixedDelay([this]() {
             this->update_keba_regs();
-        }, 0, 500);
+        }, 0, MODBUS_TCP_UPDATE_INTERVAL_MS);
+
+        task_scheduler.scheduleWithFixedDelay([this]() {
+            if (this->dirty_blocks != 0)
+                this->mirror_keba_regs();
+        }, 0, MODBUS_TCP_MIRROR_INTERVAL_MS);
     }
 }
+
+void ModbusTcp::mark_dirty_on_update(const char *path, uint32_t blocks)
+{
+    // Optional states, for example the legacy meter API, might not be registered.
+    if (api.getState(path, false) == nullptr)
+        return;
+
+    event.registerEvent(path, {}, [this, blocks](const Config * /*config*/) {
+        this->dirty_blocks |= blocks;
+        return EventResult::OK;
+    });
+}
+
+void ModbusTcp::register_events()
+{
+    if (!config.get("enable")->asBool()) {
+        return;
+    }
+
+    mark_dirty_on_update("info/features", REGS_ALL);
+
+    mark_dirty_on_update("evse/state", REGS_EVSE);
+    mark_dirty_on_update("evse/slots", REGS_EVSE);
+    mark_dirty_on_update("evse/hardware_configuration", REGS_EVSE);
+    mark_dirty_on_update("evse/low_level_state", REGS_CHARGE);
+
+#if MODULE_CHARGE_TRACKER_AVAILABLE()
+    mark_dirty_on_update("charge_tracker/current_charge", REGS_CHARGE);
+#endif
+
+#if MODULE_METERS_LEGACY_API_AVAILABLE()
+    mark_dirty_on_update("meter/state", REGS_METER);
+    mark_dirty_on_update("meter/values", REGS_METER);
+    mark_dirty_on_update("meter/phases", REGS_METER_PHASES);
+    mark_dirty_on_update("meter/all_values", REGS_METER_ALL_VALUES);
+#endif
+
+#if MODULE_NFC_AVAILABLE()
+    mark_dirty_on_update("nfc/seen_tags", REGS_NFC);
+#endif
+}
@@ -30,11 +30,27 @@ public:
     void pre_setup() override;
     void setup() override;
     void register_urls() override;
+    void register_events() override;
 
 private:
+    // Polls the registers written by the client.
     void update_regs();
     void update_bender_regs();
     void update_keba_regs();
 
+    // Rebuild the register blocks marked in dirty_blocks.
+    void mirror_regs();
+    void mirror_bender_regs();
+    void mirror_keba_regs();
+
+    void mark_dirty_on_update(const char *path, uint32_t blocks);
+
+    void update_client_stats();
+
     ConfigRoot config;
+    ConfigRoot clients;
+
+    uint32_t last_client_stats_update = 0;
+
+    uint32_t dirty_blocks = UINT32_MAX;
 };
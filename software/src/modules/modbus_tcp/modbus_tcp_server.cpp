@@ -0,0 +1,684 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#define EVENT_LOG_PREFIX "modbus_tcp"
+
+#include "modbus_tcp_server.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+#include "event_log.h"
+#include "module_dependencies.h"
+#include "tools.h"
+
+#define MODBUS_TCP_MBAP_LENGTH 7
+
+// Clients that don't send a request for this long are disconnected to free their slot.
+#define MODBUS_TCP_CLIENT_IDLE_TIMEOUT_MS (60 * 1000)
+
+#define MODBUS_FC_READ_COILS 0x01
+#define MODBUS_FC_READ_DISCRETE_INPUTS 0x02
+#define MODBUS_FC_READ_HOLDING_REGISTERS 0x03
+#define MODBUS_FC_READ_INPUT_REGISTERS 0x04
+#define MODBUS_FC_WRITE_SINGLE_COIL 0x05
+#define MODBUS_FC_WRITE_SINGLE_REGISTER 0x06
+#define MODBUS_FC_WRITE_MULTIPLE_COILS 0x0F
+#define MODBUS_FC_WRITE_MULTIPLE_REGISTERS 0x10
+
+#define MODBUS_EX_ILLEGAL_FUNCTION 0x01
+#define MODBUS_EX_ILLEGAL_DATA_ADDRESS 0x02
+#define MODBUS_EX_ILLEGAL_DATA_VALUE 0x03
+
+static inline uint16_t read_be16(const uint8_t *buf)
+{
+    return static_cast<uint16_t>((buf[0] << 8) | buf[1]);
+}
+
+static inline void write_be16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = static_cast<uint8_t>(value >> 8);
+    buf[1] = static_cast<uint8_t>(value);
+}
+
+static size_t exception_response(const uint8_t *request, uint8_t code, uint8_t *response)
+{
+    response[0] = request[0] | 0x80;
+    response[1] = code;
+    return 2;
+}
+
+void ModbusTcpServer::add_area(ModbusTcpDataType type, uint16_t start_address, void *data, size_t size)
+{
+    if (area_count >= MODBUS_TCP_SERVER_MAX_AREAS) {
+        logger.printfln("Too many register areas");
+        return;
+    }
+
+    uint32_t count = (type == ModbusTcpDataType::Coil || type == ModbusTcpDataType::DiscreteInput) ? size * 8 : size / 2;
+
+    areas[area_count++] = {data, start_address, start_address + count, type};
+}
+
+void ModbusTcpServer::add_read_only_client(uint32_t ip)
+{
+    read_only_ips.push_back(ip);
+}
+
+const ModbusTcpServer::Area *ModbusTcpServer::find_area(ModbusTcpDataType type, uint32_t address, uint32_t count) const
+{
+    for (size_t i = 0; i < area_count; ++i) {
+        const Area &area = areas[i];
+
+        if (area.type == type && address >= area.start_address && address + count <= area.end_address) {
+            return &area;
+        }
+    }
+
+    return nullptr;
+}
+
+bool ModbusTcpServer::start(uint16_t port, portMUX_TYPE *area_mtx_)
+{
+    area_mtx = area_mtx_;
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (listen_sock < 0) {
+        logger.printfln("Unable to create socket: errno %d", errno);
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+
+    if (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        logger.printfln("Socket unable to bind to port %u: errno %d", port, errno);
+        close(listen_sock);
+        listen_sock = -1;
+        return false;
+    }
+
+    if (listen(listen_sock, MODBUS_TCP_SERVER_MAX_CLIENTS) < 0) {
+        logger.printfln("Socket unable to listen: errno %d", errno);
+        close(listen_sock);
+        listen_sock = -1;
+        return false;
+    }
+
+    // The task runs forever.
+    TaskHandle_t task;
+    if (xTaskCreate(task_fn, "modbus_tcp", 4096, this, ESP_TASK_TCPIP_PRIO - 1, &task) != pdPASS) {
+        logger.printfln("Failed to create server task");
+        close(listen_sock);
+        listen_sock = -1;
+        return false;
+    }
+
+#if MODULE_DEBUG_AVAILABLE()
+    debug.register_task(task, 4096);
+#endif
+
+    return true;
+}
+
+void ModbusTcpServer::task_fn(void *arg)
+{
+    static_cast<ModbusTcpServer *>(arg)->run();
+}
+
+void ModbusTcpServer::run()
+{
+    for (;;) {
+        fd_set read_fds;
+        fd_set write_fds;
+        int max_fd = listen_sock;
+
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(listen_sock, &read_fds);
+
+        for (size_t i = 0; i < MODBUS_TCP_SERVER_MAX_CLIENTS; ++i) {
+            Client *client = clients[i];
+
+            if (client == nullptr) {
+                continue;
+            }
+
+            // Stop reading while the receive buffer is full. It can only
+            // be full if the client doesn't read the responses.
+            if (client->recv_used < sizeof(client->recv_buf)) {
+                FD_SET(client->sock, &read_fds);
+            }
+
+            if (client->send_used > 0) {
+                FD_SET(client->sock, &write_fds);
+            }
+
+            if (client->sock > max_fd) {
+                max_fd = client->sock;
+            }
+        }
+
+        struct timeval timeout = {1, 0};
+        int ready = select(max_fd + 1, &read_fds, &write_fds, nullptr, &timeout);
+
+        if (ready < 0) {
+            logger.printfln("select failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        for (size_t i = 0; i < MODBUS_TCP_SERVER_MAX_CLIENTS; ++i) {
+            Client *client = clients[i];
+
+            if (client == nullptr) {
+                continue;
+            }
+
+            if (FD_ISSET(client->sock, &write_fds) && !flush(i)) {
+                close_client(i);
+                continue;
+            }
+
+            if (FD_ISSET(client->sock, &read_fds)) {
+                if (!receive(i)) {
+                    close_client(i);
+                    continue;
+                }
+
+                client->last_activity = millis();
+            } else if (deadline_elapsed(client->last_activity + MODBUS_TCP_CLIENT_IDLE_TIMEOUT_MS)) {
+                close_client(i);
+                continue;
+            }
+
+            // Requests that didn't fit into the send buffer before.
+            if (client->recv_used > 0 && !handle_requests(i)) {
+                close_client(i);
+            }
+        }
+
+        if (FD_ISSET(listen_sock, &read_fds)) {
+            accept_client();
+        }
+    }
+}
+
+void ModbusTcpServer::accept_client()
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int sock = accept(listen_sock, (struct sockaddr *)&addr, &addr_len);
+
+    if (sock < 0) {
+        logger.printfln("accept failed: errno %d", errno);
+        return;
+    }
+
+    size_t idx = 0;
+    while (idx < MODBUS_TCP_SERVER_MAX_CLIENTS && clients[idx] != nullptr) {
+        ++idx;
+    }
+
+    if (idx >= MODBUS_TCP_SERVER_MAX_CLIENTS) {
+        char ip_str[16];
+        inet_ntoa_r(addr.sin_addr, ip_str, sizeof(ip_str));
+        logger.printfln("Rejecting client %s: Too many clients", ip_str);
+        close(sock);
+        return;
+    }
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        logger.printfln("Failed to set O_NONBLOCK flag: errno %d", errno);
+        close(sock);
+        return;
+    }
+
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    Client *client = static_cast<Client *>(malloc(sizeof(Client)));
+    if (client == nullptr) {
+        char ip_str[16];
+        inet_ntoa_r(addr.sin_addr, ip_str, sizeof(ip_str));
+        logger.printfln("Rejecting client %s: Out of memory", ip_str);
+        close(sock);
+        return;
+    }
+
+    client->sock = sock;
+    client->last_activity = millis();
+    client->recv_used = 0;
+    client->send_used = 0;
+    client->recv_time_us = 0;
+    client->last_recv_time_us = 0;
+
+    bool read_only = false;
+    for (uint32_t ip : read_only_ips) {
+        if (ip == addr.sin_addr.s_addr) {
+            read_only = true;
+            break;
+        }
+    }
+
+    ModbusTcpClientStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.connected = true;
+    stats.read_only = read_only;
+    stats.ip = addr.sin_addr.s_addr;
+    stats.port = ntohs(addr.sin_port);
+    stats.connected_since = millis();
+
+    portENTER_CRITICAL(&stats_mtx);
+        client_stats[idx] = stats;
+    portEXIT_CRITICAL(&stats_mtx);
+
+    clients[idx] = client;
+}
+
+void ModbusTcpServer::close_client(size_t idx)
+{
+    Client *client = clients[idx];
+
+    close(client->sock);
+    free(client);
+    clients[idx] = nullptr;
+
+    portENTER_CRITICAL(&stats_mtx);
+        client_stats[idx].connected = false;
+    portEXIT_CRITICAL(&stats_mtx);
+}
+
+bool ModbusTcpServer::receive(size_t idx)
+{
+    Client *client = clients[idx];
+    ssize_t len = recv(client->sock, client->recv_buf + client->recv_used, sizeof(client->recv_buf) - client->recv_used, 0);
+
+    if (len == 0) {
+        // Connection closed by the client.
+        return false;
+    }
+
+    if (len < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+
+    if (client->recv_used == 0) {
+        client->recv_time_us = now_us;
+    }
+
+    client->last_recv_time_us = now_us;
+    client->recv_used += static_cast<size_t>(len);
+
+    return handle_requests(idx);
+}
+
+bool ModbusTcpServer::flush(size_t idx)
+{
+    Client *client = clients[idx];
+
+    if (client->send_used == 0) {
+        return true;
+    }
+
+    ssize_t len = send(client->sock, client->send_buf, client->send_used, 0);
+
+    if (len < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    client->send_used -= static_cast<size_t>(len);
+    memmove(client->send_buf, client->send_buf + len, client->send_used);
+
+    return true;
+}
+
+bool ModbusTcpServer::handle_requests(size_t idx)
+{
+    Client *client = clients[idx];
+    int64_t recv_time_us = client->recv_time_us;
+    size_t offset = 0;
+    uint32_t handled = 0;
+    uint32_t exceptions = 0;
+
+    while (client->recv_used - offset >= MODBUS_TCP_MBAP_LENGTH + 1) {
+        const uint8_t *request = client->recv_buf + offset;
+        uint16_t protocol_id = read_be16(request + 2);
+        uint16_t length = read_be16(request + 4);
+
+        // The length covers the unit identifier and the PDU.
+        if (protocol_id != 0 || length < 2 || length > MODBUS_TCP_ADU_MAX_LENGTH - 6) {
+            struct in_addr ip;
+            ip.s_addr = client_stats[idx].ip;
+            char ip_str[16];
+            inet_ntoa_r(ip, ip_str, sizeof(ip_str));
+            logger.printfln("Closing connection to %s: Malformed request", ip_str);
+            return false;
+        }
+
+        size_t request_len = 6 + length;
+
+        if (client->recv_used - offset < request_len) {
+            break;
+        }
+
+        // Keep the request until its response fits into the send buffer.
+        if (sizeof(client->send_buf) - client->send_used < MODBUS_TCP_ADU_MAX_LENGTH) {
+            break;
+        }
+
+        uint8_t *response = client->send_buf + client->send_used;
+        size_t pdu_len = handle_pdu(idx, request + MODBUS_TCP_MBAP_LENGTH, request_len - MODBUS_TCP_MBAP_LENGTH, response + MODBUS_TCP_MBAP_LENGTH);
+
+        // Transaction identifier, protocol identifier and unit identifier are echoed.
+        memcpy(response, request, 4);
+        write_be16(response + 4, static_cast<uint16_t>(pdu_len + 1));
+        response[6] = request[6];
+
+        if ((response[MODBUS_TCP_MBAP_LENGTH] & 0x80) != 0) {
+            ++exceptions;
+        }
+
+        client->send_used += MODBUS_TCP_MBAP_LENGTH + pdu_len;
+        offset += request_len;
+        ++handled;
+    }
+
+    client->recv_used -= offset;
+    memmove(client->recv_buf, client->recv_buf + offset, client->recv_used);
+
+    // The remaining data arrived with the latest receive at the latest.
+    if (offset > 0) {
+        client->recv_time_us = client->last_recv_time_us;
+    }
+
+    if (handled == 0) {
+        return true;
+    }
+
+    if (!flush(idx)) {
+        return false;
+    }
+
+    uint32_t latency_us = static_cast<uint32_t>(esp_timer_get_time() - recv_time_us);
+
+    portENTER_CRITICAL(&stats_mtx);
+        ModbusTcpClientStats &stats = client_stats[idx];
+        stats.requests += handled;
+        stats.exceptions += exceptions;
+        stats.window_requests += handled;
+        stats.window_latency_sum_us += latency_us * handled;
+        if (latency_us > stats.window_latency_max_us) {
+            stats.window_latency_max_us = latency_us;
+        }
+    portEXIT_CRITICAL(&stats_mtx);
+
+    return true;
+}
+
+size_t ModbusTcpServer::handle_pdu(size_t idx, const uint8_t *request, size_t request_len, uint8_t *response)
+{
+    uint8_t function_code = request[0];
+    bool read_only = client_stats[idx].read_only;
+
+    switch (function_code) {
+        case MODBUS_FC_READ_COILS:
+        case MODBUS_FC_READ_DISCRETE_INPUTS: {
+            if (request_len != 5) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            uint16_t address = read_be16(request + 1);
+            uint16_t count = read_be16(request + 3);
+
+            if (count < 1 || count > 2000) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            ModbusTcpDataType type = function_code == MODBUS_FC_READ_COILS ? ModbusTcpDataType::Coil : ModbusTcpDataType::DiscreteInput;
+            const Area *area = find_area(type, address, count);
+
+            if (area == nullptr) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_ADDRESS, response);
+            }
+
+            uint8_t byte_count = static_cast<uint8_t>((count + 7) / 8);
+            const uint8_t *bits = static_cast<const uint8_t *>(area->data);
+            uint32_t first_bit = address - area->start_address;
+
+            response[0] = function_code;
+            response[1] = byte_count;
+            memset(response + 2, 0, byte_count);
+
+            portENTER_CRITICAL(area_mtx);
+                for (uint32_t i = 0; i < count; ++i) {
+                    uint32_t bit = first_bit + i;
+
+                    if ((bits[bit / 8] & (1 << (bit % 8))) != 0) {
+                        response[2 + i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+                    }
+                }
+            portEXIT_CRITICAL(area_mtx);
+
+            return 2 + byte_count;
+        }
+
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+        case MODBUS_FC_READ_INPUT_REGISTERS: {
+            if (request_len != 5) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            uint16_t address = read_be16(request + 1);
+            uint16_t count = read_be16(request + 3);
+
+            if (count < 1 || count > 125) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            ModbusTcpDataType type = function_code == MODBUS_FC_READ_HOLDING_REGISTERS ? ModbusTcpDataType::HoldingRegister : ModbusTcpDataType::InputRegister;
+            const Area *area = find_area(type, address, count);
+
+            if (area == nullptr) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_ADDRESS, response);
+            }
+
+            const uint16_t *regs = static_cast<const uint16_t *>(area->data) + (address - area->start_address);
+
+            response[0] = function_code;
+            response[1] = static_cast<uint8_t>(count * 2);
+
+            portENTER_CRITICAL(area_mtx);
+                for (uint16_t i = 0; i < count; ++i) {
+                    write_be16(response + 2 + i * 2, regs[i]);
+                }
+            portEXIT_CRITICAL(area_mtx);
+
+            return 2 + count * 2;
+        }
+
+        case MODBUS_FC_WRITE_SINGLE_COIL: {
+            if (read_only) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_FUNCTION, response);
+            }
+
+            if (request_len != 5) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            uint16_t address = read_be16(request + 1);
+            uint16_t value = read_be16(request + 3);
+
+            if (value != 0x0000 && value != 0xFF00) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            const Area *area = find_area(ModbusTcpDataType::Coil, address, 1);
+
+            if (area == nullptr) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_ADDRESS, response);
+            }
+
+            uint8_t *bits = static_cast<uint8_t *>(area->data);
+            uint32_t bit = address - area->start_address;
+
+            portENTER_CRITICAL(area_mtx);
+                if (value != 0) {
+                    bits[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+                } else {
+                    bits[bit / 8] &= static_cast<uint8_t>(~(1 << (bit % 8)));
+                }
+            portEXIT_CRITICAL(area_mtx);
+
+            memcpy(response, request, 5);
+            return 5;
+        }
+
+        case MODBUS_FC_WRITE_SINGLE_REGISTER: {
+            if (read_only) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_FUNCTION, response);
+            }
+
+            if (request_len != 5) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            uint16_t address = read_be16(request + 1);
+            const Area *area = find_area(ModbusTcpDataType::HoldingRegister, address, 1);
+
+            if (area == nullptr) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_ADDRESS, response);
+            }
+
+            uint16_t *regs = static_cast<uint16_t *>(area->data) + (address - area->start_address);
+
+            portENTER_CRITICAL(area_mtx);
+                *regs = read_be16(request + 3);
+            portEXIT_CRITICAL(area_mtx);
+
+            memcpy(response, request, 5);
+            return 5;
+        }
+
+        case MODBUS_FC_WRITE_MULTIPLE_COILS: {
+            if (read_only) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_FUNCTION, response);
+            }
+
+            if (request_len < 6) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            uint16_t address = read_be16(request + 1);
+            uint16_t count = read_be16(request + 3);
+            uint8_t byte_count = request[5];
+
+            if (count < 1 || count > 1968 || byte_count != (count + 7) / 8 || request_len != 6u + byte_count) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            const Area *area = find_area(ModbusTcpDataType::Coil, address, count);
+
+            if (area == nullptr) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_ADDRESS, response);
+            }
+
+            uint8_t *bits = static_cast<uint8_t *>(area->data);
+            uint32_t first_bit = address - area->start_address;
+
+            portENTER_CRITICAL(area_mtx);
+                for (uint32_t i = 0; i < count; ++i) {
+                    uint32_t bit = first_bit + i;
+
+                    if ((request[6 + i / 8] & (1 << (i % 8))) != 0) {
+                        bits[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+                    } else {
+                        bits[bit / 8] &= static_cast<uint8_t>(~(1 << (bit % 8)));
+                    }
+                }
+            portEXIT_CRITICAL(area_mtx);
+
+            memcpy(response, request, 5);
+            return 5;
+        }
+
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS: {
+            if (read_only) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_FUNCTION, response);
+            }
+
+            if (request_len < 6) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            uint16_t address = read_be16(request + 1);
+            uint16_t count = read_be16(request + 3);
+            uint8_t byte_count = request[5];
+
+            if (count < 1 || count > 123 || byte_count != count * 2 || request_len != 6u + byte_count) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_VALUE, response);
+            }
+
+            const Area *area = find_area(ModbusTcpDataType::HoldingRegister, address, count);
+
+            if (area == nullptr) {
+                return exception_response(request, MODBUS_EX_ILLEGAL_DATA_ADDRESS, response);
+            }
+
+            uint16_t *regs = static_cast<uint16_t *>(area->data) + (address - area->start_address);
+
+            portENTER_CRITICAL(area_mtx);
+                for (uint16_t i = 0; i < count; ++i) {
+                    regs[i] = read_be16(request + 6 + i * 2);
+                }
+            portEXIT_CRITICAL(area_mtx);
+
+            memcpy(response, request, 5);
+            return 5;
+        }
+
+        default:
+            return exception_response(request, MODBUS_EX_ILLEGAL_FUNCTION, response);
+    }
+}
+
+void ModbusTcpServer::get_client_stats(ModbusTcpClientStats stats[MODBUS_TCP_SERVER_MAX_CLIENTS])
+{
+    portENTER_CRITICAL(&stats_mtx);
+        for (size_t i = 0; i < MODBUS_TCP_SERVER_MAX_CLIENTS; ++i) {
+            stats[i] = client_stats[i];
+
+            client_stats[i].window_requests = 0;
+            client_stats[i].window_latency_sum_us = 0;
+            client_stats[i].window_latency_max_us = 0;
+        }
+    portEXIT_CRITICAL(&stats_mtx);
+}
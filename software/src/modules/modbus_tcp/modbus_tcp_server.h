@@ -0,0 +1,124 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+
+#define MODBUS_TCP_SERVER_MAX_CLIENTS 4
+#define MODBUS_TCP_SERVER_MAX_AREAS 16
+
+// MBAP header (7 bytes) and PDU (up to 253 bytes)
+#define MODBUS_TCP_ADU_MAX_LENGTH 260
+
+enum class ModbusTcpDataType : uint8_t {
+    Coil,
+    DiscreteInput,
+    HoldingRegister,
+    InputRegister,
+};
+
+struct ModbusTcpClientStats {
+    bool connected;
+    bool read_only;
+    uint32_t ip; // network byte order
+    uint16_t port;
+    uint32_t connected_since; // millis()
+    uint32_t requests;
+    uint32_t exceptions;
+
+    // Since the previous call of get_client_stats.
+    // Latency is the time from receiving a request until its response was passed to the socket.
+    uint32_t window_requests;
+    uint32_t window_latency_sum_us;
+    uint32_t window_latency_max_us;
+};
+
+// Modbus TCP server that serves register areas owned by the caller.
+// Several clients can be connected at the same time. Requests of a client
+// are answered in order; a client can send further requests without waiting
+// for the responses of the previous ones.
+class ModbusTcpServer
+{
+public:
+    ModbusTcpServer() {}
+
+    // All areas have to be added before starting the server.
+    // Register areas are arrays of uint16_t, coil and discrete input areas are bit arrays.
+    void add_area(ModbusTcpDataType type, uint16_t start_address, void *data, size_t size);
+    // Clients connecting from this IPv4 address (network byte order) get an
+    // illegal function exception for all writes.
+    void add_read_only_client(uint32_t ip);
+
+    // The areas are only accessed while holding area_mtx.
+    bool start(uint16_t port, portMUX_TYPE *area_mtx);
+
+    // Copies the statistics of all client slots and resets the window counters.
+    void get_client_stats(ModbusTcpClientStats stats[MODBUS_TCP_SERVER_MAX_CLIENTS]);
+
+private:
+    struct Area {
+        void *data;
+        uint32_t start_address;
+        uint32_t end_address; // exclusive
+        ModbusTcpDataType type;
+    };
+
+    struct Client {
+        int sock;
+        uint32_t last_activity;
+        size_t recv_used;
+        size_t send_used;
+        // Receipt of the oldest request in recv_buf. Requests that have to
+        // wait for space in send_buf keep their receipt time.
+        int64_t recv_time_us;
+        int64_t last_recv_time_us;
+        uint8_t recv_buf[MODBUS_TCP_ADU_MAX_LENGTH * 2];
+        uint8_t send_buf[MODBUS_TCP_ADU_MAX_LENGTH * 2];
+    };
+
+    static void task_fn(void *arg);
+    void run();
+
+    void accept_client();
+    void close_client(size_t idx);
+    bool receive(size_t idx);
+    bool flush(size_t idx);
+    bool handle_requests(size_t idx);
+    size_t handle_pdu(size_t idx, const uint8_t *request, size_t request_len, uint8_t *response);
+
+    const Area *find_area(ModbusTcpDataType type, uint32_t address, uint32_t count) const;
+
+    int listen_sock = -1;
+    portMUX_TYPE *area_mtx = nullptr;
+    portMUX_TYPE stats_mtx = portMUX_INITIALIZER_UNLOCKED;
+
+    Area areas[MODBUS_TCP_SERVER_MAX_AREAS];
+    size_t area_count = 0;
+
+    std::vector<uint32_t> read_only_ips;
+
+    Client *clients[MODBUS_TCP_SERVER_MAX_CLIENTS] = {};
+    ModbusTcpClientStats client_stats[MODBUS_TCP_SERVER_MAX_CLIENTS] = {};
+};
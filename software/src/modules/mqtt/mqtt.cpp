@@ -217,6 +217,17 @@ bool Mqtt::publish_with_prefix(const String &path, const String &payload, bool r
 }
 
 bool Mqtt::publish(const String &topic, const String &payload, bool retain)
+{
+    return publish(topic, payload.c_str(), payload.length(), retain);
+}
+
+bool Mqtt::publish_with_prefix(const String &path, const char *payload, size_t payload_len, bool retain)
+{
+    String topic = prefix + "/" + path;
+    return publish(topic, payload, payload_len, retain);
+}
+
+bool Mqtt::publish(const String &topic, const char *payload, size_t payload_len, bool retain)
 {
     // ESP-MQTT does this check but we only want to allow publishing after
     // onMqttConnect was called (in the main thread!)
@@ -225,9 +236,9 @@ bool Mqtt::publish(const String &topic, const String &payload, bool retain)
         return false;
 
 #if defined(BOARD_HAS_PSRAM)
-    return esp_mqtt_client_enqueue(this->client, topic.c_str(), payload.c_str(), payload.length(), 0, retain, true) >= 0;
+    return esp_mqtt_client_enqueue(this->client, topic.c_str(), payload, static_cast<int>(payload_len), 0, retain, true) >= 0;
 #else
-    return esp_mqtt_client_publish(this->client, topic.c_str(), payload.c_str(), payload.length(), 0, retain) >= 0;
+    return esp_mqtt_client_publish(this->client, topic.c_str(), payload, static_cast<int>(payload_len), 0, retain) >= 0;
 #endif
 }
 
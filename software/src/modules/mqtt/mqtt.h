@@ -62,6 +62,9 @@ public:
     // Retain messages by default because we only send on change.
     bool publish_with_prefix(const String &path, const String &payload, bool retain = true);
     bool publish(const String &topic, const String &payload, bool retain);
+    // For binary payloads that can contain null bytes.
+    bool publish_with_prefix(const String &path, const char *payload, size_t payload_len, bool retain);
+    bool publish(const String &topic, const char *payload, size_t payload_len, bool retain);
 
     void subscribe(const String &path, SubscribeCallback &&callback, Retained retained, CallbackInThread callback_in_thread = CallbackInThread::Main, AddPrefix add_prefix = AddPrefix::No);
 
@@ -37,6 +37,9 @@ extern NFC nfc;
 
 #define DETECTION_THRESHOLD_MS 2000
 
+// Per nfc/tag_db_update call. Use the import for larger changes.
+#define MAX_TAG_DB_UPDATE_TAGS 64
+
 void NFC::pre_setup()
 {
     this->DeviceModule::pre_setup();
@@ -160,6 +163,34 @@ void NFC::pre_setup()
     });
 #endif
 
+    tag_db_state = Config::Object({
+        {"tag_count", Config::Uint32(0)},
+        {"generation", Config::Uint32(0)}
+    });
+
+    tag_db_update = Config::Object({
+        {"generation", Config::Uint32(0)},
+        {"add", Config::Array(
+            {},
+            new Config{Config::Object({
+                {"user_id", Config::Uint8(0)},
+                {"tag_type", Config::Uint(0, 0, 4)},
+                {"tag_id", Config::Str("", 0, NFC_TAG_ID_STRING_LENGTH)}
+            })},
+            0, MAX_TAG_DB_UPDATE_TAGS,
+            Config::type_id<Config::ConfObject>())
+        },
+        {"remove", Config::Array(
+            {},
+            new Config{Config::Object({
+                {"tag_type", Config::Uint(0, 0, 4)},
+                {"tag_id", Config::Str("", 0, NFC_TAG_ID_STRING_LENGTH)}
+            })},
+            0, MAX_TAG_DB_UPDATE_TAGS,
+            Config::type_id<Config::ConfObject>())
+        }
+    });
+
     auth_info = Config::Object({
         {"tag_type", Config::Uint8(0)},
         {"tag_id", Config::Str("", 0, NFC_TAG_ID_STRING_LENGTH)}
@@ -220,9 +251,22 @@ uint8_t NFC::get_user_id(tag_info_t *tag, uint8_t *tag_idx)
             return auth_tag.user_id;
         }
     }
+
+    uint8_t user_id = 0;
+    if (tag_db.lookup(tag->tag_type, tag->tag_id, &user_id)) {
+        *tag_idx = UINT8_MAX;
+        return user_id;
+    }
+
     return 0;
 }
 
+void NFC::update_tag_db_state()
+{
+    tag_db_state.get("tag_count")->updateUint(tag_db.get_record_count());
+    tag_db_state.get("generation")->updateUint(tag_db.get_generation());
+}
+
 void NFC::remove_user(uint8_t user_id)
 {
     Config *tags = (Config *)config.get("authorized_tags");
@@ -232,6 +276,9 @@ void NFC::remove_user(uint8_t user_id)
             tags->get(i)->get("user_id")->updateUint(0);
     }
     API::writeConfig("nfc/config", &config);
+
+    tag_db.remove_user(user_id);
+    update_tag_db_state();
 }
 
 #if MODULE_AUTOMATION_AVAILABLE()
@@ -411,6 +458,9 @@ void NFC::setup()
     api.restorePersistentConfig("nfc/config", &config);
     setup_auth_tags();
 
+    tag_db.setup();
+    update_tag_db_state();
+
     for (int i = 0; i < TAG_LIST_LENGTH; ++i) {
         seen_tags.add();
     }
@@ -428,6 +478,15 @@ void NFC::setup()
     }, 10, 10);
 }
 
+static bool parse_tag_db_tag_id(const Config &tag, NFCTagDBRecord *record, String *result)
+{
+    if (NFCTagDB::parse_tag_id(tag.get("tag_id")->asEphemeralCStr(), record))
+        return true;
+
+    *result = String("Tag ID ") + tag.get("tag_id")->asString() + " contains unexpected character. Expected format is hex bytes separated by colons. For example \"01:23:ab:3d\".";
+    return false;
+}
+
 void NFC::register_urls()
 {
     api.addState("nfc/seen_tags", &seen_tags);
@@ -459,6 +518,60 @@ void NFC::register_urls()
             last_tag_injection -= 1;
     }, true);
 
+    api.addState("nfc/tag_db", &tag_db_state);
+    api.addCommand("nfc/tag_db_update", &tag_db_update, {}, [this](String &result) {
+        std::vector<NFCTagDBRecord> adds;
+        std::vector<NFCTagDBRecord> removes;
+
+        for (const auto &tag : tag_db_update.get("add")) {
+            NFCTagDBRecord record = {};
+            if (!parse_tag_db_tag_id(tag, &record, &result))
+                return;
+            record.tag_type = tag.get("tag_type")->asUint();
+            record.user_id = tag.get("user_id")->asUint();
+            adds.push_back(record);
+        }
+
+        for (const auto &tag : tag_db_update.get("remove")) {
+            NFCTagDBRecord record = {};
+            if (!parse_tag_db_tag_id(tag, &record, &result))
+                return;
+            record.tag_type = tag.get("tag_type")->asUint();
+            removes.push_back(record);
+        }
+
+        result = tag_db.update(tag_db_update.get("generation")->asUint(), adds, removes);
+        update_tag_db_state();
+    }, true);
+
+    server.on("/nfc/tag_db/export", HTTP_GET, [this](WebServerRequest request) {
+        return tag_db.send(request);
+    });
+
+    // The upload callback already responded if the import failed.
+    server.on("/nfc/tag_db/import", HTTP_PUT, [this](WebServerRequest request) {
+        String error;
+        bool ok = tag_db.import_end(&error);
+        update_tag_db_state();
+
+        if (!ok) {
+            return request.send(400, "text/plain; charset=utf-8", error.c_str());
+        }
+        return request.send(200);
+    }, [this](WebServerRequest request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
+        if (index == 0) {
+            tag_db.import_begin();
+        }
+
+        String error;
+        if (!tag_db.import_chunk(data, len, &error)) {
+            request.send(400, "text/plain; charset=utf-8", error.c_str());
+            return false;
+        }
+
+        return true;
+    });
+
     this->DeviceModule::register_urls();
 }
 
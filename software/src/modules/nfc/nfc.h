@@ -25,9 +25,8 @@
 #include "config.h"
 #include "device_module.h"
 #include "nfc_bricklet_firmware_bin.embedded.h"
+#include "tag_db.h"
 
-// in bytes
-#define NFC_TAG_ID_LENGTH 10
 // For hex strings: two chars per byte plus a separator between each byte
 #define NFC_TAG_ID_STRING_LENGTH (NFC_TAG_ID_LENGTH * 3 - 1)
 
@@ -87,6 +86,11 @@ private:
     std::unique_ptr<auth_tag_t[]> auth_tags = nullptr;
     void setup_auth_tags();
 
+    NFCTagDB tag_db;
+    ConfigRoot tag_db_state;
+    ConfigRoot tag_db_update;
+    void update_tag_db_state();
+
 public:
     ConfigRoot seen_tags;
     ConfigRoot state;
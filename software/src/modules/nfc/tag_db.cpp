@@ -0,0 +1,551 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "tag_db.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <LittleFS.h>
+
+#include "event_log.h"
+#include "module_dependencies.h"
+#include "tools.h"
+
+#define TAG_DB_FOLDER "/nfc"
+#define TAG_DB_PATH TAG_DB_FOLDER "/tag_db"
+#define TAG_DB_TMP_PATH TAG_DB_FOLDER "/.tag_db"
+
+// Highest tag type accepted by the nfc/config.
+#define TAG_DB_MAX_TAG_TYPE 4
+
+// An aborted upload never ends the import. Let other changes take over afterwards.
+#define TAG_DB_IMPORT_TIMEOUT_MS 30000
+
+static bool read_record(File &file, NFCTagDBRecord *record)
+{
+    return file.read(reinterpret_cast<uint8_t *>(record), sizeof(*record)) == sizeof(*record);
+}
+
+static bool write_record(File &file, const NFCTagDBRecord &record)
+{
+    return file.write(reinterpret_cast<const uint8_t *>(&record), sizeof(record)) == sizeof(record);
+}
+
+static bool write_header(File &file, uint32_t generation)
+{
+    NFCTagDBHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = NFC_TAG_DB_MAGIC;
+    header.version = NFC_TAG_DB_VERSION;
+    header.record_size = sizeof(NFCTagDBRecord);
+    header.generation = generation;
+
+    return file.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header)) == sizeof(header);
+}
+
+static bool check_header(const NFCTagDBHeader &header)
+{
+    return header.magic == NFC_TAG_DB_MAGIC
+        && header.version == NFC_TAG_DB_VERSION
+        && header.record_size == sizeof(NFCTagDBRecord);
+}
+
+void NFCTagDB::setup()
+{
+    LittleFS.mkdir(TAG_DB_FOLDER);
+
+    if (LittleFS.exists(TAG_DB_TMP_PATH)) {
+        LittleFS.remove(TAG_DB_TMP_PATH);
+    }
+
+    if (!LittleFS.exists(TAG_DB_PATH)) {
+        return;
+    }
+
+    File file = LittleFS.open(TAG_DB_PATH, "r");
+    NFCTagDBHeader header;
+    size_t size = file.size();
+
+    if (file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) != sizeof(header)
+     || !check_header(header)
+     || (size - sizeof(header)) % sizeof(NFCTagDBRecord) != 0) {
+        file.close();
+        logger.printfln("NFC tag database is corrupt. Removing it.");
+        LittleFS.remove(TAG_DB_PATH);
+        return;
+    }
+
+    file.close();
+
+    record_count = (size - sizeof(header)) / sizeof(NFCTagDBRecord);
+    generation = header.generation;
+
+    logger.printfln("Loaded NFC tag database with %u tags", record_count);
+}
+
+int NFCTagDB::compare(const NFCTagDBRecord &a, const NFCTagDBRecord &b)
+{
+    int result = memcmp(a.tag_id, b.tag_id, sizeof(a.tag_id));
+
+    if (result != 0)
+        return result;
+
+    if (a.tag_id_len != b.tag_id_len)
+        return a.tag_id_len < b.tag_id_len ? -1 : 1;
+
+    if (a.tag_type != b.tag_type)
+        return a.tag_type < b.tag_type ? -1 : 1;
+
+    return 0;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+bool NFCTagDB::parse_tag_id(const char *tag_id, NFCTagDBRecord *record)
+{
+    memset(record->tag_id, 0, sizeof(record->tag_id));
+    record->tag_id_len = 0;
+
+    if (*tag_id == '\0')
+        return true;
+
+    for (;;) {
+        int hi = hex_digit(tag_id[0]);
+        int lo = hi < 0 ? -1 : hex_digit(tag_id[1]);
+
+        if (lo < 0 || record->tag_id_len >= NFC_TAG_ID_LENGTH)
+            return false;
+
+        record->tag_id[record->tag_id_len++] = static_cast<uint8_t>((hi << 4) | lo);
+        tag_id += 2;
+
+        if (*tag_id == '\0')
+            return true;
+
+        if (*tag_id != ':')
+            return false;
+
+        ++tag_id;
+    }
+}
+
+bool NFCTagDB::lookup(uint8_t tag_type, const char *tag_id, uint8_t *user_id)
+{
+    if (record_count == 0)
+        return false;
+
+    NFCTagDBRecord key;
+    key.tag_type = tag_type;
+
+    if (!parse_tag_id(tag_id, &key))
+        return false;
+
+    File file = LittleFS.open(TAG_DB_PATH, "r");
+
+    if (!file)
+        return false;
+
+    uint32_t lo = 0;
+    uint32_t hi = record_count;
+    bool found = false;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        NFCTagDBRecord record;
+
+        if (!file.seek(sizeof(NFCTagDBHeader) + mid * sizeof(NFCTagDBRecord)) || !read_record(file, &record))
+            break;
+
+        int cmp = compare(record, key);
+
+        if (cmp == 0) {
+            *user_id = record.user_id;
+            found = true;
+            break;
+        }
+
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    file.close();
+
+    return found;
+}
+
+bool NFCTagDB::check_record(const NFCTagDBRecord &record, String *error)
+{
+    if (record.tag_type > TAG_DB_MAX_TAG_TYPE) {
+        *error = String("Unknown tag type ") + record.tag_type + ".";
+        return false;
+    }
+
+    if (record.tag_id_len > NFC_TAG_ID_LENGTH) {
+        *error = "Tag ID too long.";
+        return false;
+    }
+
+    if (!users.is_user_configured(record.user_id)) {
+        *error = String("Unknown user with ID ") + record.user_id + ".";
+        return false;
+    }
+
+    return true;
+}
+
+// LittleFS renames over an existing file atomically, so the old database survives a power loss.
+bool NFCTagDB::commit_tmp_file(uint32_t new_record_count)
+{
+    if (!LittleFS.rename(TAG_DB_TMP_PATH, TAG_DB_PATH)) {
+        logger.printfln("Failed to replace NFC tag database.");
+        LittleFS.remove(TAG_DB_TMP_PATH);
+        return false;
+    }
+
+    record_count = new_record_count;
+    ++generation;
+
+    return true;
+}
+
+// Merges the sorted database with the changes into the temporary file, then replaces the database.
+bool NFCTagDB::rewrite(std::vector<NFCTagDBRecord> &adds, std::vector<NFCTagDBRecord> &removes, int remove_user_id)
+{
+    // Both use the temporary file.
+    if (import_running) {
+        logger.printfln("Aborting NFC tag database import: Database was modified.");
+        import_abort();
+    }
+
+    auto less = [](const NFCTagDBRecord &a, const NFCTagDBRecord &b) {
+        return compare(a, b) < 0;
+    };
+
+    std::stable_sort(adds.begin(), adds.end(), less);
+    std::sort(removes.begin(), removes.end(), less);
+
+    File old_file;
+
+    if (record_count > 0) {
+        old_file = LittleFS.open(TAG_DB_PATH, "r");
+        old_file.seek(sizeof(NFCTagDBHeader));
+    }
+
+    File tmp_file = LittleFS.open(TAG_DB_TMP_PATH, "w");
+
+    if (!write_header(tmp_file, generation + 1)) {
+        tmp_file.close();
+        old_file.close();
+        return false;
+    }
+
+    NFCTagDBRecord old_record;
+    bool have_old = record_count > 0 && read_record(old_file, &old_record);
+    size_t add_idx = 0;
+    size_t remove_idx = 0;
+    uint32_t new_record_count = 0;
+    bool ok = true;
+
+    while (ok && (have_old || add_idx < adds.size())) {
+        int cmp = !have_old ? 1 : (add_idx == adds.size() ? -1 : compare(old_record, adds[add_idx]));
+        NFCTagDBRecord record;
+
+        if (cmp < 0) {
+            record = old_record;
+            have_old = read_record(old_file, &old_record);
+        } else {
+            // The last add of the same tag wins.
+            do {
+                record = adds[add_idx++];
+            } while (add_idx < adds.size() && compare(record, adds[add_idx]) == 0);
+
+            if (cmp == 0) {
+                have_old = read_record(old_file, &old_record);
+            }
+        }
+
+        while (remove_idx < removes.size() && compare(removes[remove_idx], record) < 0) {
+            ++remove_idx;
+        }
+
+        if (remove_idx < removes.size() && compare(removes[remove_idx], record) == 0) {
+            continue;
+        }
+
+        if (remove_user_id >= 0 && record.user_id == remove_user_id) {
+            record.user_id = 0;
+        }
+
+        ok = write_record(tmp_file, record);
+        ++new_record_count;
+    }
+
+    tmp_file.close();
+    old_file.close();
+
+    if (!ok) {
+        logger.printfln("Failed to write NFC tag database.");
+        LittleFS.remove(TAG_DB_TMP_PATH);
+        return false;
+    }
+
+    return commit_tmp_file(new_record_count);
+}
+
+String NFCTagDB::update(uint32_t base_generation, std::vector<NFCTagDBRecord> &adds, std::vector<NFCTagDBRecord> &removes)
+{
+    if (base_generation != generation) {
+        return String("Tag database was modified: Expected generation ") + base_generation + " but is " + generation + ". Fetch the database again.";
+    }
+
+    String error;
+
+    for (const NFCTagDBRecord &record : adds) {
+        if (!check_record(record, &error)) {
+            return error;
+        }
+    }
+
+    if (import_running) {
+        if (!deadline_elapsed(import_last_chunk + TAG_DB_IMPORT_TIMEOUT_MS)) {
+            return "Tag database import in progress.";
+        }
+
+        logger.printfln("Aborting stalled NFC tag database import.");
+        import_abort();
+    }
+
+    if (!rewrite(adds, removes, -1)) {
+        return "Failed to write tag database.";
+    }
+
+    return "";
+}
+
+bool NFCTagDB::has_user(uint8_t user_id)
+{
+    File file = LittleFS.open(TAG_DB_PATH, "r");
+
+    if (!file || !file.seek(sizeof(NFCTagDBHeader)))
+        return false;
+
+    NFCTagDBRecord record;
+
+    while (read_record(file, &record)) {
+        if (record.user_id == user_id)
+            return true;
+    }
+
+    return false;
+}
+
+void NFCTagDB::remove_user(uint8_t user_id)
+{
+    if (record_count == 0 || !has_user(user_id))
+        return;
+
+    std::vector<NFCTagDBRecord> none;
+    rewrite(none, none, user_id);
+}
+
+WebServerRequestReturnProtect NFCTagDB::send(WebServerRequest &request)
+{
+    File file;
+
+    if (record_count > 0) {
+        file = LittleFS.open(TAG_DB_PATH, "r");
+    }
+
+    if (!file) {
+        // Send an empty database.
+        NFCTagDBHeader header;
+        memset(&header, 0, sizeof(header));
+
+        header.magic = NFC_TAG_DB_MAGIC;
+        header.version = NFC_TAG_DB_VERSION;
+        header.record_size = sizeof(NFCTagDBRecord);
+        header.generation = generation;
+
+        return request.send(200, "application/octet-stream", reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+
+    request.beginChunkedResponse(200, "application/octet-stream");
+
+    char buf[1024];
+
+    for (;;) {
+        size_t read = file.read(reinterpret_cast<uint8_t *>(buf), sizeof(buf));
+
+        if (read == 0)
+            break;
+
+        if (request.sendChunk(buf, static_cast<ssize_t>(read)) != ESP_OK)
+            break;
+    }
+
+    file.close();
+
+    return request.endChunkedResponse();
+}
+
+void NFCTagDB::import_abort()
+{
+    import_file.close();
+    LittleFS.remove(TAG_DB_TMP_PATH);
+    import_running = false;
+    import_buf_used = 0;
+}
+
+void NFCTagDB::import_begin()
+{
+    // A previous import whose upload was aborted is still running.
+    if (import_running) {
+        logger.printfln("Discarding unfinished NFC tag database import.");
+        import_abort();
+    }
+
+    import_file = LittleFS.open(TAG_DB_TMP_PATH, "w");
+    import_running = true;
+    import_last_chunk = millis();
+    import_offset = 0;
+    import_record_count = 0;
+    import_buf_used = 0;
+}
+
+bool NFCTagDB::import_chunk(const uint8_t *data, size_t len, String *error)
+{
+    if (!import_running) {
+        *error = "No tag database import in progress.";
+        return false;
+    }
+
+    import_last_chunk = millis();
+
+    if (!import_file) {
+        *error = "Failed to write tag database.";
+        import_abort();
+        return false;
+    }
+
+    bool ok = true;
+
+    while (len > 0) {
+        size_t expected = import_offset == 0 ? sizeof(NFCTagDBHeader) : sizeof(NFCTagDBRecord);
+        size_t to_copy = std::min(len, expected - import_buf_used);
+
+        memcpy(import_buf + import_buf_used, data, to_copy);
+        import_buf_used += to_copy;
+        data += to_copy;
+        len -= to_copy;
+
+        if (import_buf_used < expected)
+            break;
+
+        import_buf_used = 0;
+
+        if (import_offset == 0) {
+            NFCTagDBHeader header;
+            memcpy(&header, import_buf, sizeof(header));
+
+            if (!check_header(header)) {
+                *error = "Not a tag database or unsupported version.";
+                ok = false;
+                break;
+            }
+
+            if (!write_header(import_file, generation + 1)) {
+                *error = "Failed to write tag database.";
+                ok = false;
+                break;
+            }
+
+            import_offset += sizeof(header);
+            continue;
+        }
+
+        NFCTagDBRecord record;
+        memcpy(&record, import_buf, sizeof(record));
+
+        if (!check_record(record, error)) {
+            ok = false;
+            break;
+        }
+
+        if (import_record_count > 0 && compare(import_last_record, record) >= 0) {
+            *error = String("Tags are not sorted or contain duplicates at tag ") + import_record_count + ".";
+            ok = false;
+            break;
+        }
+
+        if (!write_record(import_file, record)) {
+            *error = "Failed to write tag database.";
+            ok = false;
+            break;
+        }
+
+        import_last_record = record;
+        ++import_record_count;
+        import_offset += sizeof(record);
+    }
+
+    if (!ok) {
+        import_abort();
+    }
+
+    return ok;
+}
+
+bool NFCTagDB::import_end(String *error)
+{
+    if (!import_running) {
+        *error = "No tag database import in progress.";
+        return false;
+    }
+
+    if (import_offset == 0 || import_buf_used != 0) {
+        *error = "Tag database is truncated.";
+        import_abort();
+        return false;
+    }
+
+    import_file.close();
+    import_running = false;
+
+    if (!commit_tmp_file(import_record_count)) {
+        *error = "Failed to write tag database.";
+        return false;
+    }
+
+    logger.printfln("Imported NFC tag database with %u tags", record_count);
+
+    return true;
+}
@@ -0,0 +1,112 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "web_server.h"
+
+// in bytes
+#define NFC_TAG_ID_LENGTH 10
+
+#define NFC_TAG_DB_MAGIC 0x4244544E // "NTDB"
+#define NFC_TAG_DB_VERSION 1
+
+// File format: One header, followed by the records, sorted by tag ID, tag ID
+// length and tag type. The record count is derived from the file size.
+// Imports use the same format; the generation of an imported file is ignored.
+struct [[gnu::packed]] NFCTagDBHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t generation;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(NFCTagDBHeader) == 16, "Unexpected NFCTagDBHeader size");
+
+// Tag IDs shorter than NFC_TAG_ID_LENGTH are padded with zeros.
+struct [[gnu::packed]] NFCTagDBRecord {
+    uint8_t tag_id[NFC_TAG_ID_LENGTH];
+    uint8_t tag_id_len;
+    uint8_t tag_type;
+    uint8_t user_id;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(NFCTagDBRecord) == 16, "Unexpected NFCTagDBRecord size");
+
+// Tag whitelist for more tags than fit into the nfc/config. The records are
+// stored in LittleFS and looked up with a binary search in the file, so the
+// database does not need RAM and an update does not rewrite the config.
+class NFCTagDB
+{
+public:
+    NFCTagDB() {}
+
+    void setup();
+
+    bool lookup(uint8_t tag_type, const char *tag_id, uint8_t *user_id);
+
+    // Applies a batch of changes. Added tags replace existing tags with the
+    // same ID and type. Fails if the database was modified since the
+    // client read base_generation.
+    String update(uint32_t base_generation, std::vector<NFCTagDBRecord> &adds, std::vector<NFCTagDBRecord> &removes);
+    void remove_user(uint8_t user_id);
+
+    WebServerRequestReturnProtect send(WebServerRequest &request);
+
+    void import_begin();
+    // Returns false and sets error if the chunk is invalid. The import is aborted in this case.
+    bool import_chunk(const uint8_t *data, size_t len, String *error);
+    bool import_end(String *error);
+
+    uint32_t get_record_count() const { return record_count; }
+    uint32_t get_generation() const { return generation; }
+
+    // Parses a tag ID string in the "01:23:AB" format used by the nfc/config.
+    static bool parse_tag_id(const char *tag_id, NFCTagDBRecord *record);
+    static int compare(const NFCTagDBRecord &a, const NFCTagDBRecord &b);
+
+private:
+    bool rewrite(std::vector<NFCTagDBRecord> &adds, std::vector<NFCTagDBRecord> &removes, int remove_user_id);
+    bool commit_tmp_file(uint32_t new_record_count);
+    bool check_record(const NFCTagDBRecord &record, String *error);
+    bool has_user(uint8_t user_id);
+    void import_abort();
+
+    uint32_t record_count = 0;
+    uint32_t generation = 0;
+
+    File import_file;
+    bool import_running = false;
+    uint32_t import_last_chunk = 0;
+    size_t import_offset = 0;
+    uint32_t import_record_count = 0;
+    uint8_t import_buf[sizeof(NFCTagDBRecord)];
+    size_t import_buf_used = 0;
+    NFCTagDBRecord import_last_record;
+};
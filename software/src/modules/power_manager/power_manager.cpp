@@ -64,6 +64,9 @@ void PowerManager::pre_setup()
         {"on_state_change_delay", Config::Uint32(0)},
         {"charging_blocked", Config::Uint32(0)},
         {"switching_state", Config::Uint32(0)},
+        {"meter_step_latency", Config::Uint32(0)}, // in microseconds
+        {"meter_step_latency_max", Config::Uint32(0)}, // in microseconds
+        {"meter_samples_coalesced", Config::Uint32(0)},
     });
 
     config = ConfigRoot{Config::Object({
@@ -75,6 +78,8 @@ void PowerManager::pre_setup()
         {"target_power_from_grid", Config::Int32(0)}, // in watt
         {"guaranteed_power", Config::Uint(1380, 0, 22080)}, // in watt
         {"cloud_filter_mode", Config::Uint(CLOUD_FILTER_MEDIUM, CLOUD_FILTER_OFF, CLOUD_FILTER_STRONG)},
+        // Run a control step for every new grid meter sample instead of only every PM_TASK_DELAY_MS.
+        {"meter_triggered_control", Config::Bool(false)},
     }), [](const Config &cfg, ConfigSource source) -> String {
         if (cfg.get("phase_switching_mode")->asUint() == 3) { // external control
             if (cfg.get("excess_charging_enable")->asBool() != false) {
@@ -150,9 +155,9 @@ void PowerManager::pre_setup()
         [this](const Config *cfg) {
             int32_t current = cfg->get("current")->asInt();
             if (current == -1) {
-                this->reset_limit_max_current();
+                this->control.reset_limit_max_current();
             } else {
-                this->limit_max_current(static_cast<uint32_t>(current));
+                this->control.limit_max_current(static_cast<uint32_t>(current));
             }
         });
 
@@ -163,7 +168,7 @@ void PowerManager::pre_setup()
             {"block", Config::Bool(false)}
         }),
         [this](const Config *cfg) {
-            this->charging_blocked.pin[cfg->get("slot")->asUint()] = static_cast<uint8_t>(cfg->get("block")->asBool());
+            this->control.charging_blocked.pin[cfg->get("slot")->asUint()] = static_cast<uint8_t>(cfg->get("block")->asBool());
         });
 
     automation.register_trigger(
@@ -198,88 +203,42 @@ void PowerManager::setup()
 
     charge_manager.set_allocated_current_callback([this](uint32_t current_ma) {
         //logger.printfln("allocated current callback: %u", current_ma);
-        charge_manager_allocated_current_ma = current_ma;
+        control.charge_manager_allocated_current_ma = current_ma;
     });
 
     // Cache config for energy update
-    default_mode                = config.get("default_mode")->asUint();
-    excess_charging_enable      = config.get("excess_charging_enable")->asBool();
-    meter_slot_power            = config.get("meter_slot_grid_power")->asUint();
-    target_power_from_grid_w    = config.get("target_power_from_grid")->asInt();    // watt
-    guaranteed_power_w          = config.get("guaranteed_power")->asUint();         // watt
-    phase_switching_mode        = config.get("phase_switching_mode")->asUint();
-    switching_hysteresis_ms     = debug_config.get("hysteresis_time")->asUint() * 60 * 1000;        // milliseconds (from minutes)
-    max_current_unlimited_ma    = charge_manager.config.get("maximum_available_current")->asUint(); // milliampere
-    min_current_1p_ma           = charge_manager.config.get("minimum_current_1p")->asUint();        // milliampere
-    min_current_3p_ma           = charge_manager.config.get("minimum_current")->asUint();           // milliampere
-
-    mode = default_mode;
-    charge_mode.get("mode")->updateUint(mode);
-
-    if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
-        state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
-        api.addFeature("phase_switch");
-    }
+    default_mode     = config.get("default_mode")->asUint();
+    meter_slot_power = config.get("meter_slot_grid_power")->asUint();
+
+    PowerManagerControl::Settings settings;
+    settings.default_mode             = default_mode;
+    settings.excess_charging_enable   = config.get("excess_charging_enable")->asBool();
+    settings.target_power_from_grid_w = config.get("target_power_from_grid")->asInt();                      // watt
+    settings.guaranteed_power_w       = config.get("guaranteed_power")->asUint();                           // watt
+    settings.phase_switching_mode     = config.get("phase_switching_mode")->asUint();
+    settings.switching_hysteresis_ms  = debug_config.get("hysteresis_time")->asUint() * 60 * 1000;          // milliseconds (from minutes)
+    settings.max_current_unlimited_ma = charge_manager.config.get("maximum_available_current")->asUint();   // milliampere
+    settings.min_current_1p_ma        = charge_manager.config.get("minimum_current_1p")->asUint();          // milliampere
+    settings.min_current_3p_ma        = charge_manager.config.get("minimum_current")->asUint();             // milliampere
 
     // Set up meter power filter.
-    uint32_t power_mavg_span_s;
-    switch (config.get("cloud_filter_mode")->asUint()) {
-        default:
-        case CLOUD_FILTER_OFF:    power_mavg_span_s =   0; break;
-        case CLOUD_FILTER_LIGHT:  power_mavg_span_s = 120; break;
-        case CLOUD_FILTER_MEDIUM: power_mavg_span_s = 240; break;
-        case CLOUD_FILTER_STRONG: power_mavg_span_s = 480; break;
-    }
-    if (power_mavg_span_s <= 0) {
-        power_at_meter_mavg_values_count = 1;
-    } else {
-        power_at_meter_mavg_values_count = static_cast<int32_t>(power_mavg_span_s * 1000 / PM_TASK_DELAY_MS);
-    }
-    power_at_meter_mavg_values_w = static_cast<int32_t *>(heap_caps_malloc_prefer(static_cast<size_t>(power_at_meter_mavg_values_count) * sizeof(power_at_meter_mavg_values_w[0]), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_32BIT));
-
-    // If the user accepts the additional wear, the minimum hysteresis time is 10s. Less than that will cause the control algorithm to oscillate.
-    uint32_t hysteresis_min_ms = 10 * 1000;  // milliseconds
-    if (switching_hysteresis_ms < hysteresis_min_ms)
-        switching_hysteresis_ms = hysteresis_min_ms;
-
-    // Pre-calculate various limits
-    int32_t min_phases;
-    if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_1PHASE) {
-        min_phases = 1;
-        max_phases = 1;
-    } else if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_3PHASE) {
-        min_phases = 3;
-        max_phases = 3;
-    } else { // automatic, external or PV1P/FAST3P
-        min_phases = 1;
-        max_phases = 3;
-    }
-    if (min_phases < 3) {
-        overall_min_power_w = static_cast<int32_t>(230 * 1 * min_current_1p_ma / 1000);
-    } else {
-        overall_min_power_w = static_cast<int32_t>(230 * 3 * min_current_3p_ma / 1000);
-    }
+    int32_t power_mavg_values_count = PowerManagerControl::get_mavg_values_count(config.get("cloud_filter_mode")->asUint());
+    int32_t *power_mavg_values_w = static_cast<int32_t *>(heap_caps_malloc_prefer(static_cast<size_t>(power_mavg_values_count) * sizeof(power_mavg_values_w[0]), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_32BIT));
 
-    if (static_cast<int32_t>(guaranteed_power_w) < overall_min_power_w) { // Cast safeguards against overall_min_power_w being negative and guaranteed_power_w is unlikely to be larger than 2GW.
-        guaranteed_power_w = static_cast<uint32_t>(overall_min_power_w);  // This is now safe.
-        logger.printfln("Raising guaranteed power to %u based on minimum charge current set in charge manager.", guaranteed_power_w);
-    }
+    control.setup(settings, phase_switcher_backend, power_mavg_values_w, power_mavg_values_count);
+
+    const uint32_t phase_switching_mode = control.phase_switching_mode;
 
-    const int32_t max_1phase_w = static_cast<int32_t>(230 * 1 * max_current_unlimited_ma / 1000);
-    const int32_t min_3phase_w = static_cast<int32_t>(230 * 3 * min_current_3p_ma / 1000);
+    charge_mode.get("mode")->updateUint(control.mode);
 
-    if (min_3phase_w > max_1phase_w) { // have dead current range
-        int32_t range_width = min_3phase_w - max_1phase_w;
-        threshold_3to1_w = max_1phase_w + static_cast<int32_t>(0.25 * range_width);
-        threshold_1to3_w = max_1phase_w + static_cast<int32_t>(0.75 * range_width);
-    } else { // no dead current range, use simple limits
-        threshold_3to1_w = min_3phase_w;
-        threshold_1to3_w = max_1phase_w;
+    if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
+        state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
+        api.addFeature("phase_switch");
     }
 
-    low_level_state.get("overall_min_power")->updateInt(overall_min_power_w);
-    low_level_state.get("threshold_3to1")->updateInt(threshold_3to1_w);
-    low_level_state.get("threshold_1to3")->updateInt(threshold_1to3_w);
+    low_level_state.get("overall_min_power")->updateInt(control.overall_min_power_w);
+    low_level_state.get("threshold_3to1")->updateInt(control.threshold_3to1_w);
+    low_level_state.get("threshold_1to3")->updateInt(control.threshold_1to3_w);
 
     // Update data from meter and phase switcher back-end, requires power filter to be set up.
     update_data();
@@ -295,7 +254,7 @@ void PowerManager::setup()
         power_meter_available = true;
     }
 #endif
-    if (excess_charging_enable && !power_meter_available) {
+    if (control.excess_charging_enable && !power_meter_available) {
         set_config_error(PM_CONFIG_ERROR_FLAGS_EXCESS_NO_METER_MASK);
         logger.printfln("Excess charging enabled but configured meter can't provide power values.");
     }
@@ -303,10 +262,10 @@ void PowerManager::setup()
     task_scheduler.scheduleOnce([this]() {
         // Tell CM how many phases are available. is_3phase is updated in the previous call to update_all_data().
         // set_available_phases() uses callCommand(), which is not available during setup phase, so schedule a task for it.
-        set_available_phases(is_3phase ? 3 : 1);
+        set_available_phases(control.is_3phase ? 3 : 1);
 
         // Can't check for chargers in setup() because CM's setup() hasn't run yet to load the charger configuration.
-        if (charge_manager.get_charger_count() <= 0) {
+        if (!has_chargers()) {
             logger.printfln("No chargers configured. Won't try to distribute energy.");
             set_config_error(PM_CONFIG_ERROR_FLAGS_NO_CHARGERS_MASK);
         }
@@ -334,7 +293,7 @@ void PowerManager::setup()
         }
     }
 
-    if (max_current_unlimited_ma == 0) {
+    if (control.max_current_unlimited_ma == 0) {
         logger.printfln("No maximum current configured for chargers. Disabling energy distribution.");
         set_config_error(PM_CONFIG_ERROR_FLAGS_NO_MAX_CURRENT_MASK);
         return;
@@ -345,21 +304,30 @@ void PowerManager::setup()
     // that across a reboot. This will still fail on a power cycle or bricklet update,
     // which set the contactor back to single phase.
     if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
-        uint32_t phases_wanted = is_3phase ? 3 : 1;
+        uint32_t phases_wanted = control.is_3phase ? 3 : 1;
         external_control.get("phases_wanted")->updateUint(phases_wanted);
     }
 
-    reset_limit_max_current();
+    control.reset_limit_max_current();
+
+    // Only excess charging follows the grid meter.
+    control.meter_triggered_control = config.get("meter_triggered_control")->asBool() && control.excess_charging_enable && power_meter_available;
 
     task_scheduler.scheduleWithFixedDelay([this]() {
         this->update_data();
+
+        // Between meter samples, steps only keep the mode,
+        // phase switching and hysteresis handling running.
+        if (control.meter_triggered_control && !deadline_elapsed(last_meter_step_at + micros_t{PM_TASK_DELAY_MS * 1000}))
+            return;
+
         this->update_energy();
     }, PM_TASK_DELAY_MS, PM_TASK_DELAY_MS);
 
     task_scheduler.scheduleOnce([this]() {
-        uptime_past_hysteresis = true;
-        low_level_state.get("uptime_past_hysteresis")->updateBool(uptime_past_hysteresis);
-    }, switching_hysteresis_ms);
+        control.uptime_past_hysteresis = true;
+        low_level_state.get("uptime_past_hysteresis")->updateBool(true);
+    }, control.switching_hysteresis_ms);
 }
 
 void PowerManager::register_urls()
@@ -382,10 +350,10 @@ void PowerManager::register_urls()
 
         auto runtime_mode = this->charge_mode.get("mode");
         uint32_t old_mode = runtime_mode->asUint();
-        just_switched_mode = runtime_mode->updateUint(new_mode);
-        mode = new_mode;
+        control.just_switched_mode = runtime_mode->updateUint(new_mode);
+        control.mode = new_mode;
 
-        logger.printfln("Switched mode %u->%u", old_mode, mode);
+        logger.printfln("Switched mode %u->%u", old_mode, new_mode);
     }, false);
 
     api.addState("power_manager/external_control", &external_control);
@@ -465,42 +433,46 @@ void PowerManager::register_urls()
     }
 }
 
-void PowerManager::register_phase_switcher_backend(PhaseSwitcherBackend *backend)
+void PowerManager::register_events()
 {
-    phase_switcher_backend = backend;
-}
+    if (!control.meter_triggered_control)
+        return;
 
-void PowerManager::set_available_current(uint32_t current)
-{
-    is_on_last = current > 0;
+#if MODULE_METERS_AVAILABLE()
+    // Meters push value updates immediately, so this is called right after a sample
+    // with changed values arrived. An unchanged sample needs no new step.
+    event.registerEvent(meters.get_path(meter_slot_power, Meters::PathType::Values), {}, [this](const Config * /*values*/) {
+        // At most one step is pending. Samples arriving in the meantime are
+        // picked up by that step, which keeps the latency bounded.
+        if (meter_step_pending) {
+            ++meter_samples_coalesced;
+            return EventResult::OK;
+        }
 
-    String err = api.callCommand("charge_manager/available_current_update", Config::ConfUpdateObject{{
-        {"current", current},
-    }});
+        meter_step_pending = true;
+        meter_sample_at = now_us();
 
-    if (!err.isEmpty())
-        logger.printfln("set_available_current failed: %s", err.c_str());
+        // Run the step outside of the meter's update.
+        task_scheduler.scheduleOnce([this]() {
+            this->meter_triggered_step();
+        }, 0);
 
-    charge_manager_available_current_ma = current;
-    low_level_state.get("charge_manager_available_current")->updateUint(current);
+        return EventResult::OK;
+    });
+#endif
 }
 
-void PowerManager::set_available_phases(uint32_t phases)
+void PowerManager::register_phase_switcher_backend(PhaseSwitcherBackend *backend)
 {
-    String err = api.callCommand("charge_manager/available_phases_update", Config::ConfUpdateObject{{
-        {"phases", phases},
-    }});
-
-    if (!err.isEmpty())
-        logger.printfln("set_available_phases failed: %s", err.c_str());
+    phase_switcher_backend = backend;
+    control.phase_switcher_backend = backend;
 }
 
 void PowerManager::update_data()
 {
     // Update states from back-end
-    is_3phase = phase_switcher_backend->phase_switching_capable() ? phase_switcher_backend->get_is_3phase() : phase_switching_mode == PHASE_SWITCHING_ALWAYS_3PHASE;
-    have_phases = 1 + static_cast<uint32_t>(is_3phase) * 2;
-    low_level_state.get("is_3phase")->updateBool(is_3phase);
+    control.update_phases();
+    low_level_state.get("is_3phase")->updateBool(control.is_3phase);
 
 #if MODULE_METERS_AVAILABLE()
     if (meters.get_power_virtual(meter_slot_power, &power_at_meter_raw_w) != MeterValueAvailability::Fresh)
@@ -511,48 +483,10 @@ void PowerManager::update_data()
 
     if (!isnan(power_at_meter_raw_w)) {
         low_level_state.get("power_at_meter")->updateFloat(power_at_meter_raw_w);
-        int32_t raw_power_w = static_cast<int32_t>(power_at_meter_raw_w);
 
-        // Filtered/smoothed values must not be modified anywhere else.
-
-        // Check if smooth values need to be initialized.
-        if (power_at_meter_smooth_w == INT32_MAX) {
-            for (int32_t i = 0; i < CURRENT_POWER_SMOOTHING_SAMPLES; i++) {
-                power_at_meter_smooth_values_w[i] = raw_power_w;
-            }
-            power_at_meter_smooth_total = raw_power_w * CURRENT_POWER_SMOOTHING_SAMPLES;
-        } else {
-            power_at_meter_smooth_total = power_at_meter_smooth_total - power_at_meter_smooth_values_w[power_at_meter_smooth_position] + raw_power_w;
-            power_at_meter_smooth_values_w[power_at_meter_smooth_position] = raw_power_w;
-            power_at_meter_smooth_position++;
-            if (power_at_meter_smooth_position >= CURRENT_POWER_SMOOTHING_SAMPLES)
-                power_at_meter_smooth_position = 0;
-        }
-
-        // Signed division requires both numbers to be signed.
-        static_assert(std::is_same<int32_t, decltype(power_at_meter_smooth_total)>::value, "power_at_meter_smooth_total must be signed");
-        power_at_meter_smooth_w = power_at_meter_smooth_total / CURRENT_POWER_SMOOTHING_SAMPLES;
-
-        // Check if filter values need to be initialized.
-        if (power_at_meter_filtered_w == INT32_MAX) {
-            for (int32_t i = 0; i < power_at_meter_mavg_values_count; i++) {
-                power_at_meter_mavg_values_w[i] = raw_power_w;
-            }
-            power_at_meter_mavg_total = raw_power_w * power_at_meter_mavg_values_count;
-        } else {
-            power_at_meter_mavg_total = power_at_meter_mavg_total - power_at_meter_mavg_values_w[power_at_meter_mavg_position] + raw_power_w;
-            power_at_meter_mavg_values_w[power_at_meter_mavg_position] = raw_power_w;
-            power_at_meter_mavg_position++;
-            if (power_at_meter_mavg_position >= power_at_meter_mavg_values_count)
-                power_at_meter_mavg_position = 0;
-        }
-
-        // Signed division requires both numbers to be signed.
-        static_assert(std::is_same<int32_t, decltype(power_at_meter_mavg_total       )>::value, "power_at_meter_mavg_total must be signed");
-        static_assert(std::is_same<int32_t, decltype(power_at_meter_mavg_values_count)>::value, "power_at_meter_mavg_values_count must be signed");
-        power_at_meter_filtered_w = power_at_meter_mavg_total / power_at_meter_mavg_values_count;
-
-        low_level_state.get("power_at_meter_filtered")->updateFloat(static_cast<float>(power_at_meter_filtered_w));
+        // With meter-triggered control, only real meter samples are smoothed, see meter_triggered_step().
+        // The moving average always takes a value every PM_TASK_DELAY_MS to keep its time span.
+        update_power_filters(static_cast<int32_t>(power_at_meter_raw_w), !control.meter_triggered_control, true);
     }
 
 #if MODULE_AUTOMATION_AVAILABLE()
@@ -564,407 +498,162 @@ void PowerManager::update_data()
 #endif
 }
 
-void PowerManager::update_energy()
+void PowerManager::update_power_filters(int32_t raw_power_w, bool update_smooth, bool update_mavg)
 {
-    if (switching_state != switching_state_prev) {
-        logger.printfln("Now in state %i", static_cast<int>(switching_state));
-        switching_state_prev = switching_state;
-        low_level_state.get("switching_state")->updateUint(static_cast<uint32_t>(switching_state));
-    }
-
-    if (phase_switcher_backend->get_phase_switching_state() == PhaseSwitcherBackend::SwitchingState::Error) {
-        set_available_current(0);
-
-        if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL)
-            state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
+    control.update_power_filters(raw_power_w, update_smooth, update_mavg, static_cast<int64_t>(now_us()));
 
-        return;
+    if (update_mavg) {
+        low_level_state.get("power_at_meter_filtered")->updateFloat(static_cast<float>(control.power_at_meter_filtered_w));
     }
+}
 
-    if (switching_state == SwitchingState::Monitoring) {
-        const bool     is_on = is_on_last;
-        const uint32_t charge_manager_allocated_power_w = 230 * have_phases * charge_manager_allocated_current_ma / 1000; // watt
-
-        low_level_state.get("charge_manager_allocated_current")->updateUint(charge_manager_allocated_current_ma);
-        low_level_state.get("max_current_limited")->updateUint(max_current_limited_ma);
-        low_level_state.get("charging_blocked")->updateUint(charging_blocked.combined);
-
-        if (charging_blocked.combined) {
-            if (is_on) {
-                phase_state_change_blocked_until = on_state_change_blocked_until = millis() + switching_hysteresis_ms;
-            }
-            set_available_current(0);
-            just_switched_phases = false;
-
-            if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL)
-                state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
-
-            return;
-        }
-
-        int32_t p_error_w, p_error_filtered_w;
-        if (!excess_charging_enable) {
-            p_error_w          = 0;
-            p_error_filtered_w = 0;
-        } else {
-            if (power_at_meter_smooth_w == INT32_MAX) {
-                if (!printed_skipping_energy_update) {
-                    logger.printfln("Pausing energy updates because power value is not available yet.");
-                    printed_skipping_energy_update = true;
-                }
-                return;
-            } else {
-                if (printed_skipping_energy_update) {
-                    logger.printfln("Resuming energy updates because power value is now available.");
-                    printed_skipping_energy_update = false;
-                }
-            }
-
-            if (power_at_meter_filtered_w == INT32_MAX) {
-                logger.printfln("power_manager: Uninitialized power_at_meter_filtered_w leaked");
-                return;
-            }
+void PowerManager::meter_triggered_step()
+{
+    meter_step_pending = false;
 
-            p_error_w          = target_power_from_grid_w - power_at_meter_smooth_w;
-            p_error_filtered_w = target_power_from_grid_w - power_at_meter_filtered_w;
+#if MODULE_METERS_AVAILABLE()
+    float power_w;
+    if (meters.get_power_virtual(meter_slot_power, &power_w) == MeterValueAvailability::Fresh && !isnan(power_w)) {
+        power_at_meter_raw_w = power_w;
+        low_level_state.get("power_at_meter")->updateFloat(power_w);
 
-#if MODULE_ENERGY_MANAGER_AVAILABLE()
-            if (p_error_w > 200) {
-                energy_manager.update_grid_balance_led(EmRgbLed::GridBalance::Export);
-            } else if (p_error_w < -200) {
-                energy_manager.update_grid_balance_led(EmRgbLed::GridBalance::Import);
-            } else {
-                energy_manager.update_grid_balance_led(EmRgbLed::GridBalance::Balanced);
-            }
+        // The moving average is fed by update_data(), unless this sample arrived before its first run.
+        update_power_filters(static_cast<int32_t>(power_w), true, control.power_at_meter_filtered_w == INT32_MAX);
+    }
 #endif
-        }
-
-        switch (mode) {
-            case MODE_FAST:
-                power_available_w          = static_cast<int32_t>(230 * max_phases * max_current_limited_ma / 1000);
-                power_available_filtered_w = power_available_w;
-                break;
-            case MODE_OFF:
-            default:
-                power_available_w          = 0;
-                power_available_filtered_w = 0;
-                break;
-            case MODE_PV:
-            case MODE_MIN_PV:
-                // Excess charging enabled; use a simple P controller to adjust available power.
-                int32_t p_adjust_w;
-                int32_t p_adjust_filtered_w;
-                if (!is_on) {
-                    // When the power is not on, use p=1 so that the switch-on threshold can be reached properly.
-                    p_adjust_w          = p_error_w;
-                    p_adjust_filtered_w = p_error_filtered_w;
-                } else {
-                    // Some EVs may only be able to adjust their charge power in steps of 1500W,
-                    // so smaller factors are required for smaller errors.
-                    int32_t p_error_abs_w = abs(p_error_w);
-                    if (p_error_abs_w < 1000) {
-                        // Use p=0.5 for small differences so that the controller can converge without oscillating too much.
-                        p_adjust_w          = p_error_w          / 2;
-                        p_adjust_filtered_w = p_error_filtered_w / 2;
-                    } else if (p_error_abs_w < 1500) {
-                        // Use p=0.75 for medium differences so that the controller can converge reasonably fast while still avoiding too many oscillations.
-                        p_adjust_w          = p_error_w          * 3 / 4;
-                        p_adjust_filtered_w = p_error_filtered_w * 3 / 4;
-                    } else {
-                        // Use p=0.875 for large differences so that the controller can converge faster.
-                        p_adjust_w          = p_error_w          * 7 / 8;
-                        p_adjust_filtered_w = p_error_filtered_w * 7 / 8;
-                    }
-                }
-
-                power_available_w          = static_cast<int32_t>(charge_manager_allocated_power_w) + p_adjust_w;
-                power_available_filtered_w = static_cast<int32_t>(charge_manager_allocated_power_w) + p_adjust_filtered_w;
-
-                if (mode != MODE_MIN_PV)
-                    break;
-
-                // Check against guaranteed power only in MIN_PV mode.
-                if (power_available_w          < static_cast<int32_t>(guaranteed_power_w))
-                    power_available_w          = static_cast<int32_t>(guaranteed_power_w);
-                if (power_available_filtered_w < static_cast<int32_t>(guaranteed_power_w))
-                    power_available_filtered_w = static_cast<int32_t>(guaranteed_power_w);
 
-                break;
-        }
-
-        if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL && external_control.get("phases_wanted")->asUint() == 0) {
-            power_available_w          = 0;
-            power_available_filtered_w = 0;
-        }
-
-        // CP disconnect support unknown if some chargers haven't replied yet.
-        if (!charge_manager.seen_all_chargers()) {
-            // Don't constantly complain if we don't have any chargers configured.
-            if (charge_manager.get_charger_count() > 0) {
-                if (!printed_not_seen_all_chargers) {
-                    logger.printfln("Not seen all chargers yet.");
-                    printed_not_seen_all_chargers = true;
-                }
-            }
-
-            if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL)
-                state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
+    update_energy();
 
-            return;
-        } else if (!printed_seen_all_chargers) {
-            logger.printfln("Seen all chargers.");
-            printed_seen_all_chargers = true;
-        }
+    last_meter_step_at = now_us();
 
-        // Check how many phases are wanted.
-        if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_1PHASE) {
-            wants_3phase = false;
-        } else if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_3PHASE) {
-            wants_3phase = true;
-        } else if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
-            wants_3phase = external_control.get("phases_wanted")->asUint() == 3;
-        } else if (phase_switching_mode == PHASE_SWITCHING_PV1P_FAST3P) {
-            wants_3phase = mode == MODE_FAST;
-        } else { // automatic
-            if (is_3phase) {
-                wants_3phase = power_available_filtered_w >= threshold_3to1_w;
-            } else { // is 1phase
-                wants_3phase = power_available_filtered_w > threshold_1to3_w;
-            }
-        }
+    uint32_t latency_us = static_cast<uint32_t>(static_cast<int64_t>(last_meter_step_at - meter_sample_at));
+    if (latency_us > meter_step_latency_max_us)
+        meter_step_latency_max_us = latency_us;
 
-        // Need to get the time here instead of using deadline_elapsed(), to avoid stopping the charge when the phase switch deadline check fails but the start/stop deadline check succeeds.
-        uint32_t time_now = millis();
-
-        low_level_state.get("power_available")->updateInt(power_available_w);
-        low_level_state.get("power_available_filtered")->updateInt(power_available_filtered_w);
-        low_level_state.get("wants_3phase")->updateBool(wants_3phase);
-        low_level_state.get("wants_3phase_last")->updateBool(wants_3phase_last);
-        low_level_state.get("is_on_last")->updateBool(is_on_last);
-        low_level_state.get("wants_on_last")->updateBool(wants_on_last);
-
-        // Remember last decision change to start hysteresis time.
-        if (wants_3phase != wants_3phase_last) {
-            logger.printfln("wants_3phase decision changed to %i", wants_3phase);
-            phase_state_change_blocked_until = time_now + switching_hysteresis_ms;
-            wants_3phase_last = wants_3phase;
-        }
-
-        bool phase_state_change_is_blocked = a_after_b(phase_state_change_blocked_until, time_now);
-        bool on_state_change_is_blocked = a_after_b(on_state_change_blocked_until, time_now);
-        low_level_state.get("phase_state_change_blocked")->updateBool(phase_state_change_is_blocked);
-        low_level_state.get("phase_state_change_delay")->updateUint(phase_state_change_is_blocked ? phase_state_change_blocked_until - time_now : 0);
-        low_level_state.get("on_state_change_blocked")->updateBool(on_state_change_is_blocked);
-        low_level_state.get("on_state_change_delay")->updateUint(on_state_change_is_blocked ? on_state_change_blocked_until - time_now : 0);
-
-        // Check if phase switching is allowed right now.
-        bool switch_phases = false;
-        if (wants_3phase != is_3phase) {
-            if (!phase_switcher_backend->phase_switching_capable()) {
-                logger.printfln("Phase switch wanted but not available. Check configuration.");
-            } else if (!phase_switcher_backend->can_switch_phases_now(wants_3phase)) {
-                // Back-end can't switch to the requested phases at the moment. Try again later.
-            } else if (!charge_manager.is_control_pilot_disconnect_supported(time_now - 5000)) {
-                logger.printfln("Phase switch wanted but not supported by all chargers.");
-            } else if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
-                // Switching phases is always allowed when under external control.
-                switch_phases = true;
-            } else if (!uptime_past_hysteresis) {
-                // (Re)booted recently. Allow immediate switching.
-                logger.printfln("Immediate phase switch to %s during start-up period. available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
-                switch_phases = true;
-                // Only one immediate switch on/off allowed; mark as used.
-                uptime_past_hysteresis = true;
-                low_level_state.get("uptime_past_hysteresis")->updateBool(uptime_past_hysteresis);
-            } else if (just_switched_mode) {
-                // Just switched modes. Allow immediate switching.
-                logger.printfln("Immediate phase switch to %s after changing modes. available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
-                switch_phases = true;
-            } else if (!is_on && !on_state_change_is_blocked && a_after_b(time_now, phase_state_change_blocked_until - switching_hysteresis_ms/2)) {
-                // On/off deadline passed and at least half of the phase switching deadline passed.
-                logger.printfln("Immediate phase switch to %s while power is off. available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
-                switch_phases = true;
-            } else if (phase_state_change_is_blocked) {
-                //logger.printfln("Phase switch wanted but decision changed too recently. Have to wait another %ums.", phase_state_change_blocked_until - time_now);
-            } else {
-                logger.printfln("Wants phase change to %s: available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
-                switch_phases = true;
-            }
-        }
+    low_level_state.get("meter_step_latency")->updateUint(latency_us);
+    low_level_state.get("meter_step_latency_max")->updateUint(meter_step_latency_max_us);
+    low_level_state.get("meter_samples_coalesced")->updateUint(meter_samples_coalesced);
+}
 
-        if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
-            if (charge_manager.is_control_pilot_disconnect_supported(time_now - 5000)) {
-                state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_AVAILABLE);
-            } else {
-                state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
-            }
-        }
+void PowerManager::update_energy()
+{
+    uint32_t time_now = millis();
 
-        // Switch phases or deal with what's available.
-        if (switch_phases) {
-            switching_state = SwitchingState::StartSwitching;
-        } else {
-            // Check against overall minimum power, to avoid wanting to switch off when available power is below 3-phase minimum but switch to 1-phase is possible.
-            bool wants_on = power_available_filtered_w >= overall_min_power_w;
+    control.step(time_now);
+    update_control_state(time_now);
+}
 
-#if MODULE_AUTOMATION_AVAILABLE()
-            TristateBool automation_power_available = static_cast<TristateBool>(wants_on);
-            if (automation_power_available != automation_power_available_last) {
-                automation.trigger_action(AutomationTriggerID::PMPowerAvailable, &wants_on, [this](const Config *cfg, void *data) -> bool {return this->action_triggered(cfg, data);});
-                automation_power_available_last = automation_power_available;
-            }
-#endif
+void PowerManager::update_control_state(uint32_t time_now)
+{
+    low_level_state.get("power_available")->updateInt(control.power_available_w);
+    low_level_state.get("power_available_filtered")->updateInt(control.power_available_filtered_w);
+    low_level_state.get("charge_manager_allocated_current")->updateUint(control.charge_manager_allocated_current_ma);
+    low_level_state.get("max_current_limited")->updateUint(control.max_current_limited_ma);
+    low_level_state.get("uptime_past_hysteresis")->updateBool(control.uptime_past_hysteresis);
+    low_level_state.get("wants_3phase")->updateBool(control.wants_3phase);
+    low_level_state.get("wants_3phase_last")->updateBool(control.wants_3phase_last);
+    low_level_state.get("is_on_last")->updateBool(control.is_on_last);
+    low_level_state.get("wants_on_last")->updateBool(control.wants_on_last);
+    low_level_state.get("charging_blocked")->updateUint(control.charging_blocked.combined);
+    low_level_state.get("switching_state")->updateUint(static_cast<uint32_t>(control.switching_state));
+
+    bool phase_state_change_is_blocked = a_after_b(control.phase_state_change_blocked_until, time_now);
+    bool on_state_change_is_blocked = a_after_b(control.on_state_change_blocked_until, time_now);
+    low_level_state.get("phase_state_change_blocked")->updateBool(phase_state_change_is_blocked);
+    low_level_state.get("phase_state_change_delay")->updateUint(phase_state_change_is_blocked ? control.phase_state_change_blocked_until - time_now : 0);
+    low_level_state.get("on_state_change_blocked")->updateBool(on_state_change_is_blocked);
+    low_level_state.get("on_state_change_delay")->updateUint(on_state_change_is_blocked ? control.on_state_change_blocked_until - time_now : 0);
+}
 
-            // Remember last decision change to start hysteresis time.
-            if (wants_on != wants_on_last) {
-                logger.printfln("wants_on decision changed to %i", wants_on);
-                on_state_change_blocked_until = time_now + switching_hysteresis_ms;
-                on_state_change_is_blocked = true; // Set manually because the usual update already ran before the phase switching code.
-                wants_on_last = wants_on;
-            }
+void PowerManager::vlogfln(const char *fmt, va_list args)
+{
+    logger.vprintfln(fmt, args);
+}
 
-            // Filtered power can be above the threshold while current power is below it.
-            // In that case, don't switch yet but also don't change wants_on_last state.
-            // Instead, wait for the current power to raise above threshold while wants_on(_last) is still true.
-            // The inverse applies to the switch-off period.
-            if (is_on) {
-                // Power is on. Stay on if currently available power is above threshold, even if filtered power might be below it.
-                // Requires both filtered and current available power to be below the minimum limit to switch off.
-                if (power_available_w >= overall_min_power_w)
-                    wants_on = true;
-            } else {
-                // Power is off. Stay off if currently available power is below threshold, even if filtered power might be below it.
-                // Requires both filtered and current available power to be above the minimum limit to switch on.
-                if (power_available_w < overall_min_power_w)
-                    wants_on = false;
-            }
+void PowerManager::set_available_current(uint32_t current_ma)
+{
+    String err = api.callCommand("charge_manager/available_current_update", Config::ConfUpdateObject{{
+        {"current", current_ma},
+    }});
 
-            uint32_t min_current_now_ma = is_3phase ? min_current_3p_ma : min_current_1p_ma;
+    if (!err.isEmpty())
+        logger.printfln("set_available_current failed: %s", err.c_str());
 
-            uint32_t current_available_ma;
-            if (!wants_on) {
-                current_available_ma = 0;
-            } else if (power_available_w <= 0) {
-                current_available_ma = 0;
-            } else {
-                current_available_ma = (static_cast<uint32_t>(power_available_w) * 1000) / (230 * have_phases);
-            }
+    low_level_state.get("charge_manager_available_current")->updateUint(current_ma);
+}
 
-            // Check if switching on/off is allowed right now.
-            if (wants_on != is_on) {
-                if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
-                    // Switching on/off is always allowed when under external control.
-                } else if (!on_state_change_is_blocked) {
-                    // Start/stop allowed
-                    logger.printfln("Switch %s, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
-                } else if (!uptime_past_hysteresis) {
-                    // (Re)booted recently. Allow immediate switching.
-                    logger.printfln("Immediate switch-%s during start-up period, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
-                    // Only one immediate switch on/off allowed; mark as used.
-                    uptime_past_hysteresis = true;
-                    low_level_state.get("uptime_past_hysteresis")->updateBool(uptime_past_hysteresis);
-                } else if (just_switched_mode) {
-                    // Just switched modes. Allow immediate switching.
-                    logger.printfln("Immediate switch-%s after changing modes, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
-                } else if (just_switched_phases && a_after_b(time_now, on_state_change_blocked_until - switching_hysteresis_ms/2)) {
-                    logger.printfln("Opportunistic switch-%s, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
-                } else { // Switched too recently
-                    //logger.printfln("Start/stop wanted but decision changed too recently. Have to wait another %ums.", off_state_change_blocked_until - time_now);
-                    if (is_on) { // Is on, needs to stay on at minimum current.
-                        current_available_ma = min_current_now_ma;
-                    } else { // Is off, needs to stay off.
-                        current_available_ma = 0;
-                    }
-                }
-            } else { // Don't want to change.
-                if (is_on) {
-                    // Power is on and wants on too, need to ensure minimum current because unfiltered power available can be negative.
-                    if (current_available_ma < min_current_now_ma) {
-                        current_available_ma = min_current_now_ma;
-                    }
-                }
-            }
+void PowerManager::set_available_phases(uint32_t phases)
+{
+    String err = api.callCommand("charge_manager/available_phases_update", Config::ConfUpdateObject{{
+        {"phases", phases},
+    }});
 
-            // Apply minimum/maximum current limits.
-            if (current_available_ma < min_current_now_ma) {
-                if (current_available_ma != 0)
-                    current_available_ma = min_current_now_ma;
-            } else if (current_available_ma > max_current_limited_ma) {
-                current_available_ma = max_current_limited_ma;
-            }
+    if (!err.isEmpty())
+        logger.printfln("set_available_phases failed: %s", err.c_str());
+}
 
-            set_available_current(current_available_ma);
-            just_switched_phases = false;
-            just_switched_mode = false;
-        }
-    } else if (switching_state == SwitchingState::StartSwitching) {
-            set_available_phases(wants_3phase ? 3 : 1);
+bool PowerManager::has_chargers()
+{
+    return charge_manager.get_charger_count() > 0;
+}
 
-            if (phase_switcher_backend->requires_cp_disconnect()) {
-                set_available_current(0);
+bool PowerManager::seen_all_chargers()
+{
+    return charge_manager.seen_all_chargers();
+}
 
-                switching_state = SwitchingState::Stopping;
-                switching_start = millis();
-            } else {
-                switching_state = SwitchingState::TogglingContactor;
-            }
-    } else if (switching_state == SwitchingState::Stopping) {
-        set_available_current(0);
+bool PowerManager::is_charging_stopped(uint32_t last_update_cutoff)
+{
+    return charge_manager.is_charging_stopped(last_update_cutoff);
+}
 
-        if (charge_manager.is_charging_stopped(switching_start)) {
-            switching_state = SwitchingState::DisconnectingCP;
-            switching_start = millis();
-        }
-    } else if (switching_state == SwitchingState::DisconnectingCP) {
-        charge_manager.set_all_control_pilot_disconnect(true);
+void PowerManager::set_all_control_pilot_disconnect(bool disconnect)
+{
+    charge_manager.set_all_control_pilot_disconnect(disconnect);
+}
 
-        if (charge_manager.are_all_control_pilot_disconnected(switching_start)) {
-            switching_state = SwitchingState::TogglingContactor;
-            switching_start = 0;
-        }
-    } else if (switching_state == SwitchingState::TogglingContactor) {
-        if (!phase_switcher_backend->switch_phases_3phase(wants_3phase)) {
-            logger.printfln("Toggling phases failed (3p=%i)", wants_3phase);
-        } else {
-            switching_state = SwitchingState::WaitUntilSwitched;
-        }
-    } else if (switching_state == SwitchingState::WaitUntilSwitched) {
-        if (phase_switcher_backend->get_phase_switching_state() == PhaseSwitcherBackend::SwitchingState::Ready) {
-            if (phase_switcher_backend->get_is_3phase() != wants_3phase) {
-                logger.printfln("Incorrect number of phases after switching, wanted %u. Trying again.", wants_3phase ? 3u : 1u);
-                switching_state = SwitchingState::StartSwitching;
-            } else {
-                if (phase_switcher_backend->requires_cp_disconnect()) {
-                    charge_manager.set_all_control_pilot_disconnect(false);
-                }
-                switching_state = SwitchingState::Monitoring;
+bool PowerManager::are_all_control_pilot_disconnected(uint32_t last_update_cutoff)
+{
+    return charge_manager.are_all_control_pilot_disconnected(last_update_cutoff);
+}
 
-                just_switched_phases = true;
+bool PowerManager::is_control_pilot_disconnect_supported(uint32_t last_update_cutoff)
+{
+    return charge_manager.is_control_pilot_disconnect_supported(last_update_cutoff);
+}
 
-                // After switching from 3p to 1p, force re-initializing the cloud filter
-                // to current excess power without a vehicle charging.
-                // Otherwise, being stuck in 3p mode might have pushed the filtered value so low
-                // that the PM won't want to turn on again after switching phases.
-                if (!wants_3phase) {
-                    power_at_meter_filtered_w = INT32_MAX;
-                }
-            }
-        }
-    }
+uint32_t PowerManager::get_external_phases_wanted()
+{
+    return external_control.get("phases_wanted")->asUint();
+}
 
-    if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL && switching_state != SwitchingState::Monitoring)
-        state.get("external_control")->updateUint(EXTERNAL_CONTROL_STATE_SWITCHING);
+void PowerManager::set_external_control_state(uint32_t external_control_state)
+{
+    state.get("external_control")->updateUint(external_control_state);
 }
 
-void PowerManager::limit_max_current(uint32_t limit_ma)
+void PowerManager::update_grid_balance(int32_t p_error_w)
 {
-    if (max_current_limited_ma > limit_ma)
-        max_current_limited_ma = limit_ma;
+#if MODULE_ENERGY_MANAGER_AVAILABLE()
+    if (p_error_w > 200) {
+        energy_manager.update_grid_balance_led(EmRgbLed::GridBalance::Export);
+    } else if (p_error_w < -200) {
+        energy_manager.update_grid_balance_led(EmRgbLed::GridBalance::Import);
+    } else {
+        energy_manager.update_grid_balance_led(EmRgbLed::GridBalance::Balanced);
+    }
+#else
+    (void)p_error_w;
+#endif
 }
 
-void PowerManager::reset_limit_max_current()
+void PowerManager::power_available_changed(bool power_available)
 {
-    max_current_limited_ma = max_current_unlimited_ma;
+#if MODULE_AUTOMATION_AVAILABLE()
+    automation.trigger_action(AutomationTriggerID::PMPowerAvailable, &power_available, [this](const Config *cfg, void *data) -> bool {return this->action_triggered(cfg, data);});
+#else
+    (void)power_available;
+#endif
 }
 
 bool PowerManager::get_enabled() const
@@ -974,7 +663,7 @@ bool PowerManager::get_enabled() const
 
 bool PowerManager::get_is_3phase() const
 {
-    return is_3phase;
+    return control.is_3phase;
 }
 
 void PowerManager::set_config_error(uint32_t config_error_mask)
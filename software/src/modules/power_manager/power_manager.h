@@ -20,40 +20,13 @@
 #pragma once
 
 #include "phase_switcher_back-end.h"
+#include "power_manager_control.h"
 
 #include "config.h"
 #include "module.h"
+#include "tools.h"
 #include "modules/debug_protocol/debug_protocol_backend.h"
 
-#define PM_TASK_DELAY_MS                    250
-#define CURRENT_POWER_SMOOTHING_SAMPLES     4
-
-#define MODE_FAST                           0
-#define MODE_OFF                            1
-#define MODE_PV                             2
-#define MODE_MIN_PV                         3
-#define MODE_DO_NOTHING                     255
-
-#define CLOUD_FILTER_OFF                    0
-#define CLOUD_FILTER_LIGHT                  1
-#define CLOUD_FILTER_MEDIUM                 2
-#define CLOUD_FILTER_STRONG                 3
-
-#define PHASE_SWITCHING_MIN                 0
-#define PHASE_SWITCHING_AUTOMATIC           0
-#define PHASE_SWITCHING_ALWAYS_1PHASE       1
-#define PHASE_SWITCHING_ALWAYS_3PHASE       2
-#define PHASE_SWITCHING_EXTERNAL_CONTROL    3
-#define PHASE_SWITCHING_PV1P_FAST3P         4
-#define PHASE_SWITCHING_MAX                 4
-
-#define EXTERNAL_CONTROL_STATE_AVAILABLE    0
-#define EXTERNAL_CONTROL_STATE_DISABLED     1
-#define EXTERNAL_CONTROL_STATE_UNAVAILABLE  2
-#define EXTERNAL_CONTROL_STATE_SWITCHING    3
-
-#define HYSTERESIS_MIN_TIME_MINUTES         5
-
 #define PM_CONFIG_ERROR_FLAGS_EXCESS_NO_METER_BIT_POS   3
 #define PM_CONFIG_ERROR_FLAGS_EXCESS_NO_METER_MASK      (1 << PM_CONFIG_ERROR_FLAGS_EXCESS_NO_METER_BIT_POS)
 #define PM_CONFIG_ERROR_FLAGS_NO_CHARGERS_BIT_POS       2
@@ -63,17 +36,7 @@
 #define PM_CONFIG_ERROR_FLAGS_PHASE_SWITCHING_BIT_POS   0
 #define PM_CONFIG_ERROR_FLAGS_PHASE_SWITCHING_MASK      (1 << PM_CONFIG_ERROR_FLAGS_PHASE_SWITCHING_BIT_POS)
 
-enum class SwitchingState
-{
-    Monitoring = 0,
-    StartSwitching,
-    Stopping,
-    DisconnectingCP,
-    TogglingContactor,
-    WaitUntilSwitched,
-};
-
-class PowerManager final : public IModule, public IDebugProtocolBackend
+class PowerManager final : public IModule, public IDebugProtocolBackend, public PowerManagerControlHost
 {
     friend class EnergyManager;
 
@@ -82,6 +45,7 @@ public:
     void pre_setup() override;
     void setup() override;
     void register_urls() override;
+    void register_events() override;
 
     void register_phase_switcher_backend(PhaseSwitcherBackend *backend);
 
@@ -104,18 +68,28 @@ private:
         bool switch_phases_3phase(bool wants_3phase) override {return false;}
     };
 
-    enum class TristateBool : uint8_t {
-        False = 0,
-        True = 1,
-        Undefined = 2,
-    };
+    using TristateBool = PowerManagerControl::TristateBool;
+
+    // PowerManagerControlHost
+    void vlogfln(const char *fmt, va_list args) override;
+    void set_available_current(uint32_t current_ma) override;
+    void set_available_phases(uint32_t phases) override;
+    bool has_chargers() override;
+    bool seen_all_chargers() override;
+    bool is_charging_stopped(uint32_t last_update_cutoff) override;
+    void set_all_control_pilot_disconnect(bool disconnect) override;
+    bool are_all_control_pilot_disconnected(uint32_t last_update_cutoff) override;
+    bool is_control_pilot_disconnect_supported(uint32_t last_update_cutoff) override;
+    uint32_t get_external_phases_wanted() override;
+    void set_external_control_state(uint32_t external_control_state) override;
+    void update_grid_balance(int32_t p_error_w) override;
+    void power_available_changed(bool power_available) override;
 
-    void set_available_current(uint32_t current);
-    void set_available_phases(uint32_t phases);
     void update_data();
+    void update_power_filters(int32_t raw_power_w, bool update_smooth, bool update_mavg);
     void update_energy();
-    void limit_max_current(uint32_t limit_ma);
-    void reset_limit_max_current();
+    void update_control_state(uint32_t time_now);
+    void meter_triggered_step();
     void set_config_error(uint32_t config_error_mask);
     const char *prepare_fmtstr();
 
@@ -135,70 +109,21 @@ private:
     PhaseSwitcherBackendDummy phase_switcher_dummy = PhaseSwitcherBackendDummy();
     PhaseSwitcherBackend *phase_switcher_backend = &phase_switcher_dummy;
 
-    bool     printed_not_seen_all_chargers       = false;
-    bool     printed_seen_all_chargers           = false;
-    bool     printed_skipping_energy_update      = false;
-    bool     uptime_past_hysteresis              = false;
-
-    SwitchingState switching_state               = SwitchingState::Monitoring;
-    SwitchingState switching_state_prev          = switching_state;
-    uint32_t switching_start                     = 0;
-    uint32_t mode                                = 0;
-    uint32_t have_phases                         = 0;
-    bool     is_3phase                           = false;
-    bool     wants_3phase                        = false;
-    bool     wants_3phase_last                   = false;
-    bool     is_on_last                          = false;
-    bool     wants_on_last                       = false;
-    bool     just_switched_phases                = false;
-    bool     just_switched_mode                  = false;
-    uint32_t phase_state_change_blocked_until    = 0;
-    uint32_t on_state_change_blocked_until       = 0;
-    uint32_t charge_manager_available_current_ma = 0;
-    uint32_t charge_manager_allocated_current_ma = 0;
-    uint32_t max_current_limited_ma              = 0;
-
-    union {
-        uint32_t combined;
-        uint8_t  pin[4];
-    } charging_blocked               = {0};
-
-    int32_t  power_available_w                   = 0;
-    int32_t  power_available_filtered_w          = 0;
+    PowerManagerControl control = PowerManagerControl(this);
 
     float    power_at_meter_raw_w                = NAN;
 
-    int32_t  power_at_meter_smooth_w             = INT32_MAX;
-    int32_t  power_at_meter_smooth_values_w[CURRENT_POWER_SMOOTHING_SAMPLES];
-    int32_t  power_at_meter_smooth_total         = 0;
-    int32_t  power_at_meter_smooth_position      = 0;
-
-    int32_t  power_at_meter_filtered_w           = INT32_MAX;
-    int32_t *power_at_meter_mavg_values_w        = nullptr;
-    int32_t  power_at_meter_mavg_total           = 0;
-    int32_t  power_at_meter_mavg_values_count    = 0;
-    int32_t  power_at_meter_mavg_position        = 0;
+    // Meter-triggered control
+    bool     meter_step_pending                  = false;
+    micros_t meter_sample_at                     = 0_usec;
+    micros_t last_meter_step_at                  = 0_usec;
+    uint32_t meter_step_latency_max_us           = 0;
+    uint32_t meter_samples_coalesced             = 0;
 
     // Config cache
     uint32_t default_mode             = 0;
-    bool     excess_charging_enable   = false;
     uint32_t meter_slot_power         = UINT32_MAX;
-    int32_t  target_power_from_grid_w = 0;
-    uint32_t guaranteed_power_w       = 0;
-    uint32_t phase_switching_mode     = 0;
-    uint32_t switching_hysteresis_ms  = 0;
-    bool     hysteresis_wear_ok       = false;
-    uint32_t max_current_unlimited_ma = 0;
-    uint32_t min_current_1p_ma        = 0;
-    uint32_t min_current_3p_ma        = 0;
-
-    // Pre-calculated limits
-    int32_t  overall_min_power_w = 0;
-    int32_t  threshold_3to1_w    = 0;
-    int32_t  threshold_1to3_w    = 0;
-    uint32_t max_phases          = 0;
 
     // Automation
     TristateBool automation_drawing_power_last   = TristateBool::Undefined;
-    TristateBool automation_power_available_last = TristateBool::Undefined;
 };
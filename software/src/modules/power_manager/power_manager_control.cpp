@@ -0,0 +1,570 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Mattias Schäffersmann <mattias@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "power_manager_control.h"
+
+#include <stdlib.h>
+#include <type_traits>
+
+#include "gcc_warnings.h"
+
+// Same as a_after_b() in tools.h, which can't be used here.
+static bool time_a_after_b(uint32_t a, uint32_t b)
+{
+    return (a - b) < (UINT32_MAX / 2);
+}
+
+int32_t PowerManagerControl::get_mavg_values_count(uint32_t cloud_filter_mode)
+{
+    uint32_t power_mavg_span_s;
+    switch (cloud_filter_mode) {
+        default:
+        case CLOUD_FILTER_OFF:    power_mavg_span_s =   0; break;
+        case CLOUD_FILTER_LIGHT:  power_mavg_span_s = 120; break;
+        case CLOUD_FILTER_MEDIUM: power_mavg_span_s = 240; break;
+        case CLOUD_FILTER_STRONG: power_mavg_span_s = 480; break;
+    }
+    if (power_mavg_span_s <= 0) {
+        return 1;
+    }
+    return static_cast<int32_t>(power_mavg_span_s * 1000 / PM_TASK_DELAY_MS);
+}
+
+void PowerManagerControl::setup(const Settings &settings, PhaseSwitcherBackend *backend, int32_t *mavg_values_w, int32_t mavg_values_count)
+{
+    excess_charging_enable   = settings.excess_charging_enable;
+    target_power_from_grid_w = settings.target_power_from_grid_w;
+    guaranteed_power_w       = settings.guaranteed_power_w;
+    phase_switching_mode     = settings.phase_switching_mode;
+    switching_hysteresis_ms  = settings.switching_hysteresis_ms;
+    max_current_unlimited_ma = settings.max_current_unlimited_ma;
+    min_current_1p_ma        = settings.min_current_1p_ma;
+    min_current_3p_ma        = settings.min_current_3p_ma;
+
+    mode = settings.default_mode;
+    phase_switcher_backend = backend;
+
+    power_at_meter_mavg_values_w     = mavg_values_w;
+    power_at_meter_mavg_values_count = mavg_values_count;
+
+    // If the user accepts the additional wear, the minimum hysteresis time is 10s. Less than that will cause the control algorithm to oscillate.
+    uint32_t hysteresis_min_ms = 10 * 1000;  // milliseconds
+    if (switching_hysteresis_ms < hysteresis_min_ms)
+        switching_hysteresis_ms = hysteresis_min_ms;
+
+    // Pre-calculate various limits
+    int32_t min_phases;
+    if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_1PHASE) {
+        min_phases = 1;
+        max_phases = 1;
+    } else if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_3PHASE) {
+        min_phases = 3;
+        max_phases = 3;
+    } else { // automatic, external or PV1P/FAST3P
+        min_phases = 1;
+        max_phases = 3;
+    }
+    if (min_phases < 3) {
+        overall_min_power_w = static_cast<int32_t>(230 * 1 * min_current_1p_ma / 1000);
+    } else {
+        overall_min_power_w = static_cast<int32_t>(230 * 3 * min_current_3p_ma / 1000);
+    }
+
+    if (static_cast<int32_t>(guaranteed_power_w) < overall_min_power_w) { // Cast safeguards against overall_min_power_w being negative and guaranteed_power_w is unlikely to be larger than 2GW.
+        guaranteed_power_w = static_cast<uint32_t>(overall_min_power_w);  // This is now safe.
+        logfln("Raising guaranteed power to %u based on minimum charge current set in charge manager.", guaranteed_power_w);
+    }
+
+    const int32_t max_1phase_w = static_cast<int32_t>(230 * 1 * max_current_unlimited_ma / 1000);
+    const int32_t min_3phase_w = static_cast<int32_t>(230 * 3 * min_current_3p_ma / 1000);
+
+    if (min_3phase_w > max_1phase_w) { // have dead current range
+        int32_t range_width = min_3phase_w - max_1phase_w;
+        threshold_3to1_w = max_1phase_w + static_cast<int32_t>(0.25 * range_width);
+        threshold_1to3_w = max_1phase_w + static_cast<int32_t>(0.75 * range_width);
+    } else { // no dead current range, use simple limits
+        threshold_3to1_w = min_3phase_w;
+        threshold_1to3_w = max_1phase_w;
+    }
+
+    for (int32_t i = 0; i < CURRENT_POWER_SMOOTHING_SAMPLES; i++) {
+        power_at_meter_smooth_times_us[i] = 0;
+    }
+}
+
+void PowerManagerControl::update_phases()
+{
+    is_3phase = phase_switcher_backend->phase_switching_capable() ? phase_switcher_backend->get_is_3phase() : phase_switching_mode == PHASE_SWITCHING_ALWAYS_3PHASE;
+    have_phases = 1 + static_cast<uint32_t>(is_3phase) * 2;
+}
+
+void PowerManagerControl::update_power_filters(int32_t raw_power_w, bool update_smooth, bool update_mavg, int64_t time_now_us)
+{
+    if (update_smooth && meter_triggered_control) {
+        // Average only the samples from the time span that the periodic smoothing covers,
+        // so that samples of a slow meter aren't smoothed over several meter periods.
+        const int64_t smoothing_span_us = CURRENT_POWER_SMOOTHING_SAMPLES * PM_TASK_DELAY_MS * 1000;
+
+        power_at_meter_smooth_values_w[power_at_meter_smooth_position] = raw_power_w;
+        power_at_meter_smooth_times_us[power_at_meter_smooth_position] = time_now_us;
+        power_at_meter_smooth_position++;
+        if (power_at_meter_smooth_position >= CURRENT_POWER_SMOOTHING_SAMPLES)
+            power_at_meter_smooth_position = 0;
+
+        int32_t smooth_total = 0;
+        int32_t smooth_count = 0;
+        for (int32_t i = 0; i < CURRENT_POWER_SMOOTHING_SAMPLES; i++) {
+            if (power_at_meter_smooth_times_us[i] != 0 && time_now_us - power_at_meter_smooth_times_us[i] < smoothing_span_us) {
+                smooth_total += power_at_meter_smooth_values_w[i];
+                smooth_count++;
+            }
+        }
+
+        // The newest sample is always included.
+        power_at_meter_smooth_w = smooth_total / smooth_count;
+    } else if (update_smooth) {
+        // Check if smooth values need to be initialized.
+        if (power_at_meter_smooth_w == INT32_MAX) {
+            for (int32_t i = 0; i < CURRENT_POWER_SMOOTHING_SAMPLES; i++) {
+                power_at_meter_smooth_values_w[i] = raw_power_w;
+            }
+            power_at_meter_smooth_total = raw_power_w * CURRENT_POWER_SMOOTHING_SAMPLES;
+        } else {
+            power_at_meter_smooth_total = power_at_meter_smooth_total - power_at_meter_smooth_values_w[power_at_meter_smooth_position] + raw_power_w;
+            power_at_meter_smooth_values_w[power_at_meter_smooth_position] = raw_power_w;
+            power_at_meter_smooth_position++;
+            if (power_at_meter_smooth_position >= CURRENT_POWER_SMOOTHING_SAMPLES)
+                power_at_meter_smooth_position = 0;
+        }
+
+        // Signed division requires both numbers to be signed.
+        static_assert(std::is_same<int32_t, decltype(power_at_meter_smooth_total)>::value, "power_at_meter_smooth_total must be signed");
+        power_at_meter_smooth_w = power_at_meter_smooth_total / CURRENT_POWER_SMOOTHING_SAMPLES;
+    }
+
+    if (update_mavg) {
+        // Check if filter values need to be initialized.
+        if (power_at_meter_filtered_w == INT32_MAX) {
+            for (int32_t i = 0; i < power_at_meter_mavg_values_count; i++) {
+                power_at_meter_mavg_values_w[i] = raw_power_w;
+            }
+            power_at_meter_mavg_total = raw_power_w * power_at_meter_mavg_values_count;
+        } else {
+            power_at_meter_mavg_total = power_at_meter_mavg_total - power_at_meter_mavg_values_w[power_at_meter_mavg_position] + raw_power_w;
+            power_at_meter_mavg_values_w[power_at_meter_mavg_position] = raw_power_w;
+            power_at_meter_mavg_position++;
+            if (power_at_meter_mavg_position >= power_at_meter_mavg_values_count)
+                power_at_meter_mavg_position = 0;
+        }
+
+        // Signed division requires both numbers to be signed.
+        static_assert(std::is_same<int32_t, decltype(power_at_meter_mavg_total       )>::value, "power_at_meter_mavg_total must be signed");
+        static_assert(std::is_same<int32_t, decltype(power_at_meter_mavg_values_count)>::value, "power_at_meter_mavg_values_count must be signed");
+        power_at_meter_filtered_w = power_at_meter_mavg_total / power_at_meter_mavg_values_count;
+    }
+}
+
+void PowerManagerControl::step(uint32_t time_now)
+{
+    if (switching_state != switching_state_prev) {
+        logfln("Now in state %i", static_cast<int>(switching_state));
+        switching_state_prev = switching_state;
+    }
+
+    if (phase_switcher_backend->get_phase_switching_state() == PhaseSwitcherBackend::SwitchingState::Error) {
+        set_available_current(0);
+
+        if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL)
+            host->set_external_control_state(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
+
+        return;
+    }
+
+    if (switching_state == SwitchingState::Monitoring) {
+        const bool     is_on = is_on_last;
+        const uint32_t charge_manager_allocated_power_w = 230 * have_phases * charge_manager_allocated_current_ma / 1000; // watt
+
+        if (charging_blocked.combined) {
+            if (is_on) {
+                phase_state_change_blocked_until = on_state_change_blocked_until = time_now + switching_hysteresis_ms;
+            }
+            set_available_current(0);
+            just_switched_phases = false;
+
+            if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL)
+                host->set_external_control_state(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
+
+            return;
+        }
+
+        int32_t p_error_w, p_error_filtered_w;
+        if (!excess_charging_enable) {
+            p_error_w          = 0;
+            p_error_filtered_w = 0;
+        } else {
+            if (power_at_meter_smooth_w == INT32_MAX) {
+                if (!printed_skipping_energy_update) {
+                    logfln("Pausing energy updates because power value is not available yet.");
+                    printed_skipping_energy_update = true;
+                }
+                return;
+            } else {
+                if (printed_skipping_energy_update) {
+                    logfln("Resuming energy updates because power value is now available.");
+                    printed_skipping_energy_update = false;
+                }
+            }
+
+            if (power_at_meter_filtered_w == INT32_MAX) {
+                logfln("power_manager: Uninitialized power_at_meter_filtered_w leaked");
+                return;
+            }
+
+            p_error_w          = target_power_from_grid_w - power_at_meter_smooth_w;
+            p_error_filtered_w = target_power_from_grid_w - power_at_meter_filtered_w;
+
+            host->update_grid_balance(p_error_w);
+        }
+
+        switch (mode) {
+            case MODE_FAST:
+                power_available_w          = static_cast<int32_t>(230 * max_phases * max_current_limited_ma / 1000);
+                power_available_filtered_w = power_available_w;
+                break;
+            case MODE_OFF:
+            default:
+                power_available_w          = 0;
+                power_available_filtered_w = 0;
+                break;
+            case MODE_PV:
+            case MODE_MIN_PV:
+                // Excess charging enabled; use a simple P controller to adjust available power.
+                int32_t p_adjust_w;
+                int32_t p_adjust_filtered_w;
+                if (!is_on) {
+                    // When the power is not on, use p=1 so that the switch-on threshold can be reached properly.
+                    p_adjust_w          = p_error_w;
+                    p_adjust_filtered_w = p_error_filtered_w;
+                } else {
+                    // Some EVs may only be able to adjust their charge power in steps of 1500W,
+                    // so smaller factors are required for smaller errors.
+                    int32_t p_error_abs_w = abs(p_error_w);
+                    if (p_error_abs_w < 1000) {
+                        // Use p=0.5 for small differences so that the controller can converge without oscillating too much.
+                        p_adjust_w          = p_error_w          / 2;
+                        p_adjust_filtered_w = p_error_filtered_w / 2;
+                    } else if (p_error_abs_w < 1500) {
+                        // Use p=0.75 for medium differences so that the controller can converge reasonably fast while still avoiding too many oscillations.
+                        p_adjust_w          = p_error_w          * 3 / 4;
+                        p_adjust_filtered_w = p_error_filtered_w * 3 / 4;
+                    } else {
+                        // Use p=0.875 for large differences so that the controller can converge faster.
+                        p_adjust_w          = p_error_w          * 7 / 8;
+                        p_adjust_filtered_w = p_error_filtered_w * 7 / 8;
+                    }
+                }
+
+                power_available_w          = static_cast<int32_t>(charge_manager_allocated_power_w) + p_adjust_w;
+                power_available_filtered_w = static_cast<int32_t>(charge_manager_allocated_power_w) + p_adjust_filtered_w;
+
+                if (mode != MODE_MIN_PV)
+                    break;
+
+                // Check against guaranteed power only in MIN_PV mode.
+                if (power_available_w          < static_cast<int32_t>(guaranteed_power_w))
+                    power_available_w          = static_cast<int32_t>(guaranteed_power_w);
+                if (power_available_filtered_w < static_cast<int32_t>(guaranteed_power_w))
+                    power_available_filtered_w = static_cast<int32_t>(guaranteed_power_w);
+
+                break;
+        }
+
+        if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL && host->get_external_phases_wanted() == 0) {
+            power_available_w          = 0;
+            power_available_filtered_w = 0;
+        }
+
+        // CP disconnect support unknown if some chargers haven't replied yet.
+        if (!host->seen_all_chargers()) {
+            // Don't constantly complain if we don't have any chargers configured.
+            if (host->has_chargers()) {
+                if (!printed_not_seen_all_chargers) {
+                    logfln("Not seen all chargers yet.");
+                    printed_not_seen_all_chargers = true;
+                }
+            }
+
+            if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL)
+                host->set_external_control_state(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
+
+            return;
+        } else if (!printed_seen_all_chargers) {
+            logfln("Seen all chargers.");
+            printed_seen_all_chargers = true;
+        }
+
+        // Check how many phases are wanted.
+        if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_1PHASE) {
+            wants_3phase = false;
+        } else if (phase_switching_mode == PHASE_SWITCHING_ALWAYS_3PHASE) {
+            wants_3phase = true;
+        } else if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
+            wants_3phase = host->get_external_phases_wanted() == 3;
+        } else if (phase_switching_mode == PHASE_SWITCHING_PV1P_FAST3P) {
+            wants_3phase = mode == MODE_FAST;
+        } else { // automatic
+            if (is_3phase) {
+                wants_3phase = power_available_filtered_w >= threshold_3to1_w;
+            } else { // is 1phase
+                wants_3phase = power_available_filtered_w > threshold_1to3_w;
+            }
+        }
+
+        // Remember last decision change to start hysteresis time.
+        if (wants_3phase != wants_3phase_last) {
+            logfln("wants_3phase decision changed to %i", wants_3phase);
+            phase_state_change_blocked_until = time_now + switching_hysteresis_ms;
+            wants_3phase_last = wants_3phase;
+        }
+
+        bool phase_state_change_is_blocked = time_a_after_b(phase_state_change_blocked_until, time_now);
+        bool on_state_change_is_blocked = time_a_after_b(on_state_change_blocked_until, time_now);
+
+        // Check if phase switching is allowed right now.
+        bool switch_phases = false;
+        if (wants_3phase != is_3phase) {
+            if (!phase_switcher_backend->phase_switching_capable()) {
+                logfln("Phase switch wanted but not available. Check configuration.");
+            } else if (!phase_switcher_backend->can_switch_phases_now(wants_3phase)) {
+                // Back-end can't switch to the requested phases at the moment. Try again later.
+            } else if (!host->is_control_pilot_disconnect_supported(time_now - 5000)) {
+                logfln("Phase switch wanted but not supported by all chargers.");
+            } else if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
+                // Switching phases is always allowed when under external control.
+                switch_phases = true;
+            } else if (!uptime_past_hysteresis) {
+                // (Re)booted recently. Allow immediate switching.
+                logfln("Immediate phase switch to %s during start-up period. available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
+                switch_phases = true;
+                // Only one immediate switch on/off allowed; mark as used.
+                uptime_past_hysteresis = true;
+            } else if (just_switched_mode) {
+                // Just switched modes. Allow immediate switching.
+                logfln("Immediate phase switch to %s after changing modes. available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
+                switch_phases = true;
+            } else if (!is_on && !on_state_change_is_blocked && time_a_after_b(time_now, phase_state_change_blocked_until - switching_hysteresis_ms/2)) {
+                // On/off deadline passed and at least half of the phase switching deadline passed.
+                logfln("Immediate phase switch to %s while power is off. available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
+                switch_phases = true;
+            } else if (phase_state_change_is_blocked) {
+                //logfln("Phase switch wanted but decision changed too recently. Have to wait another %ums.", phase_state_change_blocked_until - time_now);
+            } else {
+                logfln("Wants phase change to %s: available (filtered)=%i", wants_3phase ? "3 phases" : "1 phase", power_available_filtered_w);
+                switch_phases = true;
+            }
+        }
+
+        if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
+            if (host->is_control_pilot_disconnect_supported(time_now - 5000)) {
+                host->set_external_control_state(EXTERNAL_CONTROL_STATE_AVAILABLE);
+            } else {
+                host->set_external_control_state(EXTERNAL_CONTROL_STATE_UNAVAILABLE);
+            }
+        }
+
+        // Switch phases or deal with what's available.
+        if (switch_phases) {
+            switching_state = SwitchingState::StartSwitching;
+        } else {
+            // Check against overall minimum power, to avoid wanting to switch off when available power is below 3-phase minimum but switch to 1-phase is possible.
+            bool wants_on = power_available_filtered_w >= overall_min_power_w;
+
+            TristateBool automation_power_available = static_cast<TristateBool>(wants_on);
+            if (automation_power_available != automation_power_available_last) {
+                host->power_available_changed(wants_on);
+                automation_power_available_last = automation_power_available;
+            }
+
+            // Remember last decision change to start hysteresis time.
+            if (wants_on != wants_on_last) {
+                logfln("wants_on decision changed to %i", wants_on);
+                on_state_change_blocked_until = time_now + switching_hysteresis_ms;
+                on_state_change_is_blocked = true; // Set manually because the usual update already ran before the phase switching code.
+                wants_on_last = wants_on;
+            }
+
+            // Filtered power can be above the threshold while current power is below it.
+            // In that case, don't switch yet but also don't change wants_on_last state.
+            // Instead, wait for the current power to raise above threshold while wants_on(_last) is still true.
+            // The inverse applies to the switch-off period.
+            if (is_on) {
+                // Power is on. Stay on if currently available power is above threshold, even if filtered power might be below it.
+                // Requires both filtered and current available power to be below the minimum limit to switch off.
+                if (power_available_w >= overall_min_power_w)
+                    wants_on = true;
+            } else {
+                // Power is off. Stay off if currently available power is below threshold, even if filtered power might be below it.
+                // Requires both filtered and current available power to be above the minimum limit to switch on.
+                if (power_available_w < overall_min_power_w)
+                    wants_on = false;
+            }
+
+            uint32_t min_current_now_ma = is_3phase ? min_current_3p_ma : min_current_1p_ma;
+
+            uint32_t current_available_ma;
+            if (!wants_on) {
+                current_available_ma = 0;
+            } else if (power_available_w <= 0) {
+                current_available_ma = 0;
+            } else {
+                current_available_ma = (static_cast<uint32_t>(power_available_w) * 1000) / (230 * have_phases);
+            }
+
+            // Check if switching on/off is allowed right now.
+            if (wants_on != is_on) {
+                if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL) {
+                    // Switching on/off is always allowed when under external control.
+                } else if (!on_state_change_is_blocked) {
+                    // Start/stop allowed
+                    logfln("Switch %s, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
+                } else if (!uptime_past_hysteresis) {
+                    // (Re)booted recently. Allow immediate switching.
+                    logfln("Immediate switch-%s during start-up period, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
+                    // Only one immediate switch on/off allowed; mark as used.
+                    uptime_past_hysteresis = true;
+                } else if (just_switched_mode) {
+                    // Just switched modes. Allow immediate switching.
+                    logfln("Immediate switch-%s after changing modes, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
+                } else if (just_switched_phases && time_a_after_b(time_now, on_state_change_blocked_until - switching_hysteresis_ms/2)) {
+                    logfln("Opportunistic switch-%s, power available: %i, current available: %u", wants_on ? "on" : "off", power_available_w, current_available_ma);
+                } else { // Switched too recently
+                    //logfln("Start/stop wanted but decision changed too recently. Have to wait another %ums.", off_state_change_blocked_until - time_now);
+                    if (is_on) { // Is on, needs to stay on at minimum current.
+                        current_available_ma = min_current_now_ma;
+                    } else { // Is off, needs to stay off.
+                        current_available_ma = 0;
+                    }
+                }
+            } else { // Don't want to change.
+                if (is_on) {
+                    // Power is on and wants on too, need to ensure minimum current because unfiltered power available can be negative.
+                    if (current_available_ma < min_current_now_ma) {
+                        current_available_ma = min_current_now_ma;
+                    }
+                }
+            }
+
+            // Apply minimum/maximum current limits.
+            if (current_available_ma < min_current_now_ma) {
+                if (current_available_ma != 0)
+                    current_available_ma = min_current_now_ma;
+            } else if (current_available_ma > max_current_limited_ma) {
+                current_available_ma = max_current_limited_ma;
+            }
+
+            set_available_current(current_available_ma);
+            just_switched_phases = false;
+            just_switched_mode = false;
+        }
+    } else if (switching_state == SwitchingState::StartSwitching) {
+            host->set_available_phases(wants_3phase ? 3 : 1);
+
+            if (phase_switcher_backend->requires_cp_disconnect()) {
+                set_available_current(0);
+
+                switching_state = SwitchingState::Stopping;
+                switching_start = time_now;
+            } else {
+                switching_state = SwitchingState::TogglingContactor;
+            }
+    } else if (switching_state == SwitchingState::Stopping) {
+        set_available_current(0);
+
+        if (host->is_charging_stopped(switching_start)) {
+            switching_state = SwitchingState::DisconnectingCP;
+            switching_start = time_now;
+        }
+    } else if (switching_state == SwitchingState::DisconnectingCP) {
+        host->set_all_control_pilot_disconnect(true);
+
+        if (host->are_all_control_pilot_disconnected(switching_start)) {
+            switching_state = SwitchingState::TogglingContactor;
+            switching_start = 0;
+        }
+    } else if (switching_state == SwitchingState::TogglingContactor) {
+        if (!phase_switcher_backend->switch_phases_3phase(wants_3phase)) {
+            logfln("Toggling phases failed (3p=%i)", wants_3phase);
+        } else {
+            switching_state = SwitchingState::WaitUntilSwitched;
+        }
+    } else if (switching_state == SwitchingState::WaitUntilSwitched) {
+        if (phase_switcher_backend->get_phase_switching_state() == PhaseSwitcherBackend::SwitchingState::Ready) {
+            if (phase_switcher_backend->get_is_3phase() != wants_3phase) {
+                logfln("Incorrect number of phases after switching, wanted %u. Trying again.", wants_3phase ? 3u : 1u);
+                switching_state = SwitchingState::StartSwitching;
+            } else {
+                if (phase_switcher_backend->requires_cp_disconnect()) {
+                    host->set_all_control_pilot_disconnect(false);
+                }
+                switching_state = SwitchingState::Monitoring;
+
+                just_switched_phases = true;
+
+                // After switching from 3p to 1p, force re-initializing the cloud filter
+                // to current excess power without a vehicle charging.
+                // Otherwise, being stuck in 3p mode might have pushed the filtered value so low
+                // that the PM won't want to turn on again after switching phases.
+                if (!wants_3phase) {
+                    power_at_meter_filtered_w = INT32_MAX;
+                }
+            }
+        }
+    }
+
+    if (phase_switching_mode == PHASE_SWITCHING_EXTERNAL_CONTROL && switching_state != SwitchingState::Monitoring)
+        host->set_external_control_state(EXTERNAL_CONTROL_STATE_SWITCHING);
+}
+
+void PowerManagerControl::set_available_current(uint32_t current_ma)
+{
+    is_on_last = current_ma > 0;
+
+    host->set_available_current(current_ma);
+
+    charge_manager_available_current_ma = current_ma;
+}
+
+void PowerManagerControl::limit_max_current(uint32_t limit_ma)
+{
+    if (max_current_limited_ma > limit_ma)
+        max_current_limited_ma = limit_ma;
+}
+
+void PowerManagerControl::reset_limit_max_current()
+{
+    max_current_limited_ma = max_current_unlimited_ma;
+}
+
+void PowerManagerControl::logfln(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    host->vlogfln(fmt, args);
+    va_end(args);
+}
@@ -0,0 +1,205 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Mattias Schäffersmann <mattias@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+// The control core must not depend on Arduino or ESP-IDF headers,
+// so that it can be built on the host by software/power_manager_sim.
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "phase_switcher_back-end.h"
+
+#define PM_TASK_DELAY_MS                    250
+#define CURRENT_POWER_SMOOTHING_SAMPLES     4
+
+#define MODE_FAST                           0
+#define MODE_OFF                            1
+#define MODE_PV                             2
+#define MODE_MIN_PV                         3
+#define MODE_DO_NOTHING                     255
+
+#define CLOUD_FILTER_OFF                    0
+#define CLOUD_FILTER_LIGHT                  1
+#define CLOUD_FILTER_MEDIUM                 2
+#define CLOUD_FILTER_STRONG                 3
+
+#define PHASE_SWITCHING_MIN                 0
+#define PHASE_SWITCHING_AUTOMATIC           0
+#define PHASE_SWITCHING_ALWAYS_1PHASE       1
+#define PHASE_SWITCHING_ALWAYS_3PHASE       2
+#define PHASE_SWITCHING_EXTERNAL_CONTROL    3
+#define PHASE_SWITCHING_PV1P_FAST3P         4
+#define PHASE_SWITCHING_MAX                 4
+
+#define EXTERNAL_CONTROL_STATE_AVAILABLE    0
+#define EXTERNAL_CONTROL_STATE_DISABLED     1
+#define EXTERNAL_CONTROL_STATE_UNAVAILABLE  2
+#define EXTERNAL_CONTROL_STATE_SWITCHING    3
+
+#define HYSTERESIS_MIN_TIME_MINUTES         5
+
+enum class SwitchingState
+{
+    Monitoring = 0,
+    StartSwitching,
+    Stopping,
+    DisconnectingCP,
+    TogglingContactor,
+    WaitUntilSwitched,
+};
+
+// Everything the control core needs from the outside world.
+// Implemented by the PowerManager module on the ESP and by the simulator on the host.
+class PowerManagerControlHost
+{
+public:
+    virtual ~PowerManagerControlHost() = default;
+
+    virtual void vlogfln(const char *fmt, va_list args) = 0;
+
+    virtual void set_available_current(uint32_t current_ma) = 0;
+    virtual void set_available_phases(uint32_t phases) = 0;
+
+    virtual bool has_chargers() = 0;
+    virtual bool seen_all_chargers() = 0;
+    virtual bool is_charging_stopped(uint32_t last_update_cutoff) = 0;
+    virtual void set_all_control_pilot_disconnect(bool disconnect) = 0;
+    virtual bool are_all_control_pilot_disconnected(uint32_t last_update_cutoff) = 0;
+    virtual bool is_control_pilot_disconnect_supported(uint32_t last_update_cutoff) = 0;
+
+    virtual uint32_t get_external_phases_wanted() = 0;
+    virtual void set_external_control_state(uint32_t external_control_state) = 0;
+
+    // Called for every step with a valid grid power error while excess charging is enabled.
+    virtual void update_grid_balance(int32_t p_error_w) = 0;
+    // Called when the decision whether enough power for charging is available changed.
+    virtual void power_available_changed(bool power_available) = 0;
+};
+
+// Meter filters, P controller, on/off and phase switching decisions of the power manager.
+// All times are passed in by the caller: milliseconds for step(), microseconds for the filters.
+class PowerManagerControl
+{
+public:
+    struct Settings {
+        uint32_t default_mode;
+        bool     excess_charging_enable;
+        int32_t  target_power_from_grid_w;
+        uint32_t guaranteed_power_w;
+        uint32_t phase_switching_mode;
+        uint32_t switching_hysteresis_ms;
+        uint32_t max_current_unlimited_ma;
+        uint32_t min_current_1p_ma;
+        uint32_t min_current_3p_ma;
+    };
+
+    enum class TristateBool : uint8_t {
+        False = 0,
+        True = 1,
+        Undefined = 2,
+    };
+
+    PowerManagerControl(PowerManagerControlHost *host) : host(host) {}
+
+    // Number of values the caller has to allocate for the moving average of the given cloud filter mode.
+    [[gnu::const]] static int32_t get_mavg_values_count(uint32_t cloud_filter_mode);
+
+    void setup(const Settings &settings, PhaseSwitcherBackend *backend, int32_t *mavg_values_w, int32_t mavg_values_count);
+
+    void update_phases();
+    // Filtered/smoothed values must not be modified anywhere else.
+    void update_power_filters(int32_t raw_power_w, bool update_smooth, bool update_mavg, int64_t time_now_us);
+    void step(uint32_t time_now);
+
+    void set_available_current(uint32_t current_ma);
+    void limit_max_current(uint32_t limit_ma);
+    void reset_limit_max_current();
+
+    [[gnu::format(__printf__, 2, 3)]] void logfln(const char *fmt, ...);
+
+    PowerManagerControlHost *host;
+    PhaseSwitcherBackend *phase_switcher_backend = nullptr;
+
+    bool     printed_not_seen_all_chargers       = false;
+    bool     printed_seen_all_chargers           = false;
+    bool     printed_skipping_energy_update      = false;
+    bool     uptime_past_hysteresis              = false;
+
+    SwitchingState switching_state               = SwitchingState::Monitoring;
+    SwitchingState switching_state_prev          = switching_state;
+    uint32_t switching_start                     = 0;
+    uint32_t mode                                = 0;
+    uint32_t have_phases                         = 0;
+    bool     is_3phase                           = false;
+    bool     wants_3phase                        = false;
+    bool     wants_3phase_last                   = false;
+    bool     is_on_last                          = false;
+    bool     wants_on_last                       = false;
+    bool     just_switched_phases                = false;
+    bool     just_switched_mode                  = false;
+    uint32_t phase_state_change_blocked_until    = 0;
+    uint32_t on_state_change_blocked_until       = 0;
+    uint32_t charge_manager_available_current_ma = 0;
+    uint32_t charge_manager_allocated_current_ma = 0;
+    uint32_t max_current_limited_ma              = 0;
+
+    union {
+        uint32_t combined;
+        uint8_t  pin[4];
+    } charging_blocked               = {0};
+
+    int32_t  power_available_w                   = 0;
+    int32_t  power_available_filtered_w          = 0;
+
+    int32_t  power_at_meter_smooth_w             = INT32_MAX;
+    int32_t  power_at_meter_smooth_values_w[CURRENT_POWER_SMOOTHING_SAMPLES];
+    int64_t  power_at_meter_smooth_times_us[CURRENT_POWER_SMOOTHING_SAMPLES] = {}; // only used with meter-triggered control
+    int32_t  power_at_meter_smooth_total         = 0;
+    int32_t  power_at_meter_smooth_position      = 0;
+
+    int32_t  power_at_meter_filtered_w           = INT32_MAX;
+    int32_t *power_at_meter_mavg_values_w        = nullptr;
+    int32_t  power_at_meter_mavg_total           = 0;
+    int32_t  power_at_meter_mavg_values_count    = 0;
+    int32_t  power_at_meter_mavg_position        = 0;
+
+    // Smooth only real meter samples, see update_power_filters().
+    bool     meter_triggered_control             = false;
+
+    // Config cache
+    bool     excess_charging_enable   = false;
+    int32_t  target_power_from_grid_w = 0;
+    uint32_t guaranteed_power_w       = 0;
+    uint32_t phase_switching_mode     = 0;
+    uint32_t switching_hysteresis_ms  = 0;
+    uint32_t max_current_unlimited_ma = 0;
+    uint32_t min_current_1p_ma        = 0;
+    uint32_t min_current_3p_ma        = 0;
+
+    // Pre-calculated limits
+    int32_t  overall_min_power_w = 0;
+    int32_t  threshold_3to1_w    = 0;
+    int32_t  threshold_1to3_w    = 0;
+    uint32_t max_phases          = 0;
+
+    // Automation
+    TristateBool automation_power_available_last = TristateBool::Undefined;
+};
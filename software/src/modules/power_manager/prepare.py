@@ -21,29 +21,29 @@ from software import util
 import re
 
 debug_log_variables = [
-    "power_at_meter_smooth_w",
-    "power_at_meter_filtered_w",
-    "power_available_w",
-    "power_available_filtered_w",
-    "charge_manager_available_current_ma",
-    "charge_manager_allocated_current_ma",
-    "max_current_limited_ma",
+    "control.power_at_meter_smooth_w",
+    "control.power_at_meter_filtered_w",
+    "control.power_available_w",
+    "control.power_available_filtered_w",
+    "control.charge_manager_available_current_ma",
+    "control.charge_manager_allocated_current_ma",
+    "control.max_current_limited_ma",
     "",
-    "mode",
-    "is_3phase",
-    "wants_3phase",
-    "wants_3phase_last",
-    "is_on_last",
-    "wants_on_last",
+    "control.mode",
+    "control.is_3phase",
+    "control.wants_3phase",
+    "control.wants_3phase_last",
+    "control.is_on_last",
+    "control.wants_on_last",
     "",
-    "charging_blocked.combined",
-    "excess_charging_enable",
-    "just_switched_phases",
-    "uptime_past_hysteresis",
-    "switching_state",
+    "control.charging_blocked.combined",
+    "control.excess_charging_enable",
+    "control.just_switched_phases",
+    "control.uptime_past_hysteresis",
+    "control.switching_state",
     "",
-    "phase_state_change_blocked_until",
-    "on_state_change_blocked_until",
+    "control.phase_state_change_blocked_until",
+    "control.on_state_change_blocked_until",
 ]
 
 formats = 'fmt(' + '),\n        fmt('.join(debug_log_variables) + '),'
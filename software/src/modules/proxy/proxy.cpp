@@ -44,6 +44,15 @@ void Proxy::pre_setup()
         0, 12, Config::type_id<Config::ConfObject>()
     );
 
+    latency_histograms = Config::Array(
+        {},
+        new Config{Config::Object({
+            {"uid", Config::Str("", 0, 7)},
+            {"buckets", Config::Array({}, new Config{Config::Uint32(0)}, 0, TF_TFP_LATENCY_BUCKET_COUNT, Config::type_id<Config::ConfUint>())}
+        })},
+        0, 12, Config::type_id<Config::ConfObject>()
+    );
+
     error_counters = Config::Object({
         {"A", Config::Object({
                 {"SpiTfpChecksum", Config::Uint32(0)},
@@ -131,6 +140,14 @@ void Proxy::setup()
         devices.get(devices.count() - 1)->get("port")->updateString(String(port_name));
         devices.get(devices.count() - 1)->get("name")->updateString(String(tf_get_device_display_name(device_id)));
         devices.get(devices.count() - 1)->get("device_id")->updateUint(device_id);
+
+        auto histogram = latency_histograms.add();
+        histogram->get("uid")->updateString(String(uid));
+
+        for (uint16_t k = 0; k < TF_TFP_LATENCY_BUCKET_COUNT; ++k) {
+            histogram->get("buckets")->add();
+        }
+
         ++i;
     }
 
@@ -141,6 +158,7 @@ void Proxy::register_urls()
 {
     api.addState("proxy/error_counters", &error_counters);
     api.addState("proxy/devices", &devices);
+    api.addState("proxy/latency_histograms", &latency_histograms);
     api.addPersistentConfig("proxy/config", &config, {"authentication_secret"});
 
     task_scheduler.scheduleWithFixedDelay([this](){
@@ -154,5 +172,17 @@ void Proxy::register_urls()
             error_counters.get(String(c))->get("TfpFrame")->updateUint(tfp_frame);
             error_counters.get(String(c))->get("TfpUnexpected")->updateUint(tfp_unexpected);
         }
+
+        uint32_t buckets[TF_TFP_LATENCY_BUCKET_COUNT];
+
+        for (uint16_t i = 0; i < latency_histograms.count(); ++i) {
+            if (tf_hal_get_latency_histogram(&hal, i, buckets) != TF_E_OK) {
+                break;
+            }
+
+            for (uint16_t k = 0; k < TF_TFP_LATENCY_BUCKET_COUNT; ++k) {
+                latency_histograms.get(i)->get("buckets")->get(k)->updateUint(buckets[k]);
+            }
+        }
     }, 5000, 5000);
 }
@@ -36,6 +36,7 @@ public:
 private:
     TF_Net net;
     ConfigRoot devices;
+    ConfigRoot latency_histograms;
     ConfigRoot error_counters;
     ConfigRoot config;
     String auth_secret;
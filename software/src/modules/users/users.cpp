@@ -205,11 +205,8 @@ void Users::pre_setup()
         if (remove.get("id")->asUint() == 0)
             return "The anonymous user can't be removed.";
 
-        for (int i = 0; i < config.get("users")->count(); ++i) {
-            if (config.get("users")->get(i)->get("id")->asUint() == remove.get("id")->asUint()) {
-                return "";
-            }
-        }
+        if (is_user_configured(remove.get("id")->asUint()))
+            return "";
 
         return "Can't remove user. User with this ID not found.";
     }};
@@ -227,6 +224,8 @@ void Users::pre_setup()
 
         return "Can't enable HTTP authentication if not at least one user with a password is configured!";
     }};
+
+    update_user_index();
 }
 
 void create_username_file()
@@ -242,6 +241,7 @@ void create_username_file()
 void Users::setup()
 {
     api.restorePersistentConfig("users/config", &config);
+    update_user_index();
 
     if (!LittleFS.exists(USERNAME_FILE)) {
         logger.printfln("Username list does not exist! Recreating now.");
@@ -335,17 +335,16 @@ void Users::setup()
         }
 
         server.onAuthenticate_HTTPThread([this](WebServerRequest req) -> bool {
-            String auth = req.header("Authorization");
-            if (auth.isEmpty()) {
+            const char *auth = req.headerCStr("Authorization");
+            if (auth == nullptr) {
                 return false;
             }
 
-            if (!auth.startsWith("Digest ")) {
+            if (strncmp(auth, "Digest ", 7) != 0) {
                 return false;
             }
 
-            auth = auth.substring(7);
-            AuthFields fields = parseDigestAuth(auth.c_str());
+            AuthFields fields = parseDigestAuth(auth + 7);
 
             bool result = false;
 
@@ -390,28 +389,74 @@ void Users::search_next_free_user()
     config.get("next_user_id")->updateUint(user_id);
 }
 
+void Users::update_user_index()
+{
+    memset(user_config_index, UINT8_MAX, sizeof(user_config_index));
+
+    Config *users = (Config *)config.get("users");
+    for (uint16_t i = 0; i < users->count(); ++i)
+        user_config_index[users->get(i)->get("id")->asUint()] = i;
+}
+
+Config *Users::get_user_config(uint8_t user_id)
+{
+    uint8_t idx = user_config_index[user_id];
+    if (idx == UINT8_MAX)
+        return nullptr;
+
+    return (Config *)config.get("users")->get(idx);
+}
+
 int Users::get_display_name(uint8_t user_id, char *ret_buf)
 {
-    for (auto &cfg : config.get("users")) {
-        if (cfg.get("id")->asUint() == user_id) {
-            String s = cfg.get("display_name")->asString();
-            strncpy(ret_buf, s.c_str(), 32);
-            return min(s.length(), 32u);
+    {
+        std::lock_guard<std::mutex> lock{display_name_cache_mutex};
+
+        for (DisplayNameCacheEntry &entry : display_name_cache) {
+            if (entry.last_used != 0 && entry.user_id == user_id) {
+                entry.last_used = ++display_name_cache_counter;
+                memcpy(ret_buf, entry.display_name, DISPLAY_NAME_LENGTH);
+                return entry.length;
+            }
         }
     }
-    File f = LittleFS.open(USERNAME_FILE, "r");
-    f.seek(user_id * USERNAME_ENTRY_LENGTH + USERNAME_LENGTH, SeekMode::SeekSet);
-    f.read((uint8_t *)ret_buf, DISPLAY_NAME_LENGTH);
-    return strnlen(ret_buf, 32);
+
+    // The config and the username file are only accessed by the main thread.
+    if (!running_in_main_task()) {
+        int result = 0;
+        memset(ret_buf, 0, DISPLAY_NAME_LENGTH);
+        task_scheduler.await([this, &result, user_id, ret_buf](){result = this->get_display_name(user_id, ret_buf);});
+        return result;
+    }
+
+    const Config *user = get_user_config(user_id);
+    if (user != nullptr) {
+        strncpy(ret_buf, user->get("display_name")->asEphemeralCStr(), DISPLAY_NAME_LENGTH);
+    } else {
+        File f = LittleFS.open(USERNAME_FILE, "r");
+        f.seek(user_id * USERNAME_ENTRY_LENGTH + USERNAME_LENGTH, SeekMode::SeekSet);
+        f.read((uint8_t *)ret_buf, DISPLAY_NAME_LENGTH);
+    }
+
+    std::lock_guard<std::mutex> lock{display_name_cache_mutex};
+    DisplayNameCacheEntry *victim = &display_name_cache[0];
+
+    for (DisplayNameCacheEntry &entry : display_name_cache) {
+        if (entry.last_used < victim->last_used)
+            victim = &entry;
+    }
+
+    victim->last_used = ++display_name_cache_counter;
+    victim->user_id = user_id;
+    victim->length = strnlen(ret_buf, DISPLAY_NAME_LENGTH);
+    memcpy(victim->display_name, ret_buf, DISPLAY_NAME_LENGTH);
+
+    return victim->length;
 }
 
 bool Users::is_user_configured(uint8_t user_id)
 {
-    for (auto &cfg : config.get("users"))
-        if (cfg.get("id")->asUint() == user_id)
-            return true;
-
-    return false;
+    return user_config_index[user_id] != UINT8_MAX;
 }
 
 static void check_waiting_for_start()
@@ -521,13 +566,7 @@ void Users::register_urls()
                 return "Digest_hash needs to be empty.";
         }
 
-        Config *user = nullptr;
-        for(int i = 0; i < config.get("users")->count(); ++i) {
-            if (config.get("users")->get(i)->get("id")->asUint() == id) {
-                user = (Config *)config.get("users")->get(i);
-                break;
-            }
-        }
+        Config *user = get_user_config(id);
 
         if (user == nullptr) {
             return "Can't modify user. User with this ID not found.";
@@ -603,6 +642,7 @@ void Users::register_urls()
         user->get("username")->updateString(add.get("username")->asString());
         user->get("digest_hash")->updateString(add.get("digest_hash")->asString());
 
+        update_user_index();
         search_next_free_user();
 
         API::writeConfig("users/config", &config);
@@ -610,20 +650,15 @@ void Users::register_urls()
     }, true);
 
     api.addCommand("users/remove", &remove, {}, [this](){
-        int idx = -1;
-        for(int i = 0; i < config.get("users")->count(); ++i) {
-            if (config.get("users")->get(i)->get("id")->asUint() == remove.get("id")->asUint()) {
-                idx = i;
-                break;
-            }
-        }
+        uint8_t idx = user_config_index[remove.get("id")->asUint()];
 
-        if (idx < 0) {
+        if (idx == UINT8_MAX) {
             logger.printfln("Can't remove user. User with this ID not found.");
             return;
         }
 
         config.get("users")->remove(idx);
+        update_user_index();
         API::writeConfig("users/config", &config);
 
 #if MODULE_NFC_AVAILABLE()
@@ -688,16 +723,18 @@ void Users::rename_user(uint8_t user_id, const String &username, const String &d
     File f = LittleFS.open(USERNAME_FILE, "r+");
     f.seek(user_id * USERNAME_ENTRY_LENGTH, SeekMode::SeekSet);
     f.write((const uint8_t *)buf, USERNAME_ENTRY_LENGTH);
+
+    std::lock_guard<std::mutex> lock{display_name_cache_mutex};
+    for (DisplayNameCacheEntry &entry : display_name_cache) {
+        if (entry.user_id == user_id)
+            entry.last_used = 0;
+    }
 }
 
 void Users::remove_from_username_file(uint8_t user_id)
 {
-    Config *users = (Config *)config.get("users");
-    for (int i = 0; i < users->count(); ++i) {
-        if (users->get(i)->get("id")->asUint() == user_id) {
-            return;
-        }
-    }
+    if (is_user_configured(user_id))
+        return;
 
     this->rename_user(user_id, "", "");
     if (config.get("next_user_id")->asUint() == 0)
@@ -758,6 +795,10 @@ void Users::remove_username_file()
 {
     if (LittleFS.exists(USERNAME_FILE))
         LittleFS.remove(USERNAME_FILE);
+
+    std::lock_guard<std::mutex> lock{display_name_cache_mutex};
+    for (DisplayNameCacheEntry &entry : display_name_cache)
+        entry.last_used = 0;
 }
 
 bool Users::start_charging(uint8_t user_id, uint16_t current_limit, uint8_t auth_type, Config::ConfVariant auth_info)
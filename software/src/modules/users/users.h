@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <mutex>
+
 #include "config.h"
 
 #include "module.h"
@@ -43,6 +45,11 @@
 #define MAX_ACTIVE_USERS 17
 #endif
 
+// Display names of users that are not configured anymore (but still have
+// tracked charges) are read from the username file and other threads have to
+// wait for the main thread to resolve a name. Cache the most recently used.
+#define DISPLAY_NAME_CACHE_SIZE 16
+
 class Users final : public IModule
 {
 public:
@@ -55,6 +62,7 @@ public:
     void rename_user(uint8_t user_id, const String &username, const String &display_name);
     void remove_from_username_file(uint8_t user_id);
     void search_next_free_user();
+    // Can be called from any thread. ret_buf must hold DISPLAY_NAME_LENGTH bytes and is not null-terminated if the name is that long.
     int get_display_name(uint8_t user_id, char *ret_buf);
     bool is_user_configured(uint8_t user_id);
 
@@ -73,6 +81,25 @@ public:
 
     bool start_charging(uint8_t user_id, uint16_t current_limit, uint8_t auth_type, Config::ConfVariant auth_info);
     bool stop_charging(uint8_t user_id, bool force, float meter_abs = 0);
+
+private:
+    struct DisplayNameCacheEntry {
+        uint32_t last_used;
+        uint8_t user_id;
+        uint8_t length;
+        char display_name[DISPLAY_NAME_LENGTH];
+    };
+
+    void update_user_index();
+    Config *get_user_config(uint8_t user_id);
+
+    // Index of each user ID in the users array of the config or UINT8_MAX if the user is not configured.
+    uint8_t user_config_index[MAX_PASSIVE_USERS];
+
+    // Entries are only added and invalidated by the main thread. Other threads read them.
+    DisplayNameCacheEntry display_name_cache[DISPLAY_NAME_CACHE_SIZE] = {};
+    uint32_t display_name_cache_counter = 0;
+    std::mutex display_name_cache_mutex;
 };
 
 void set_led(int16_t mode);
@@ -65,38 +65,12 @@ void WS::register_urls()
             return;
         }
 
-        int i = 0;
+        size_t i = 0;
         bool done = false;
 
         while (!done) {
             auto result = task_scheduler.await([&i, &done, &sb]() {
-                for (; i < api.states.size(); ++i) {
-                    auto &reg = api.states[i];
-                    auto path = reg.path;
-                    auto path_len = reg.path_len;
-                    auto config_len = reg.config->string_length();
-                    int req = prefix_len + path_len + infix_len + config_len + suffix_len + 1; // +1 for the second \n
-
-                    if (sb.getRemainingLength() < req) {
-                        done = false;
-
-                        if (req > sb.getCapacity()) {
-                            logger.printfln("API %s exceeds max WS buffer capacity! Required %u, buffer capacity %u", path, req, sb.getCapacity());
-                        }
-
-                        return;
-                    }
-
-                    sb.puts(prefix, prefix_len);
-                    sb.puts(path, path_len);
-                    sb.puts(infix, infix_len);
-
-                    reg.config->to_string_except(reg.keys_to_censor, reg.keys_to_censor_len, &sb);
-
-                    sb.puts(suffix, suffix_len);
-                }
-
-                done = true;
+                done = api.appendStateDump(&sb, &i);
             });
 
             if (result == TaskScheduler::AwaitResult::Done) {
@@ -23,4 +23,5 @@
 #include "module.h"
 
 extern void       modules_get_imodules(std::vector<IModule*> *imodules);
+extern const char *modules_get_imodule_name(size_t index);
 extern ConfigRoot modules_get_init_config();
@@ -166,6 +166,31 @@ public:
         return true;
     }
 
+    // Returns the used items as (at most) two contiguous spans in the order
+    // they would be popped. The spans point into the ring's buffer and are
+    // only valid until the next push or pop.
+    // On little endian targets, the items packed into the AlignedT slots
+    // have the same memory layout as a plain T array.
+    size_t get_spans(const T **first, size_t *first_len, const T **second, size_t *second_len)
+    {
+        static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "TF_Ringbuffer: get_spans requires a little endian target");
+
+        const T *items = reinterpret_cast<const T *>(buffer);
+
+        *first = items + start;
+        *second = items;
+
+        if (end < start) {
+            *first_len = SIZE - start;
+            *second_len = end;
+        } else {
+            *first_len = end - start;
+            *second_len = 0;
+        }
+
+        return *first_len + *second_len;
+    }
+
     // index of first valid elemnt
     size_t start;
     // index of first invalid element
@@ -19,6 +19,7 @@
 
 #include "task_scheduler.h"
 
+#include "heap_profiler.h"
 #include "web_server.h"
 
 // Global definition here to match the declaration in task_scheduler.h.
@@ -33,7 +34,8 @@ Task::Task(std::function<void(void)> &&fn, uint64_t task_id, uint32_t first_run_
           delay_ms(delay_ms),
           awaited_by(nullptr),
           once(once),
-          cancelled(false) {
+          cancelled(false),
+          heap_owner(heap_profiler_get_owner()) {
 
 }
 
@@ -146,7 +148,9 @@ void TaskScheduler::loop()
     if (!this->currentTask->fn) {
         logger.printfln("Invalid task");
     } else {
+        uint8_t previous_owner = heap_profiler_set_owner(this->currentTask->heap_owner);
         this->currentTask->fn();
+        heap_profiler_set_owner(previous_owner);
     }
 
     {
@@ -39,6 +39,8 @@ struct Task {
     TaskHandle_t awaited_by;
     bool once;
     bool cancelled;
+    // Heap profiler owner of the code that scheduled the task.
+    uint8_t heap_owner;
 
     Task(std::function<void(void)> &&fn, uint64_t task_id, uint32_t first_run_delay_ms, uint32_t delay_ms, bool once);
 };
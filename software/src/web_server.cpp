@@ -25,18 +25,52 @@
 
 #include "task_scheduler.h"
 #include "digest_auth.h"
+#include "tools.h"
 
 #include "cool_string.h"
 
 #include <memory>
 
-#define MAX_URI_HANDLERS 128
+// Only the route dispatchers and the web socket endpoint are registered
+// with the httpd. All other URIs are resolved by WebServer::routes.
+#define MAX_URI_HANDLERS 8
+
+// Header values of the request currently being handled, see WebServerRequest::headerCStr.
+// The httpd handles one request at a time, so the arena is shared by all requests.
+#define REQUEST_SCRATCH_SIZE 1024
 
 // Global definition here to match the declaration in web_server.h.
 WebServer server;
 
 #define HTTPD_STACK_SIZE 6144
 
+static char request_scratch[REQUEST_SCRATCH_SIZE];
+
+static const size_t SCRATCH_BUFSIZE = 2048;
+
+static uint8_t upload_scratch_buf[SCRATCH_BUFSIZE];
+
+static bool uri_match(const char *ref_uri, const char *in_uri, size_t len)
+{
+    if (ref_uri == nullptr || in_uri == nullptr)
+        return false;
+
+    // Handlers registered directly with the httpd (i.e. the web socket endpoint) only match their exact URI.
+    if (strcmp(ref_uri, "*") != 0)
+        return strncmp_with_same_len(ref_uri, in_uri, len) == 0;
+
+    if (boot_stage <= BootStage::REGISTER_URLS)
+        return false;
+
+    // Match the dispatchers if any route matches the URI, even if it has no route for the request method.
+    // The dispatcher will then respond with 405.
+    bool uri_matched;
+    server.routes.match(in_uri, len, -1, &uri_matched);
+    return uri_matched;
+}
+
+static esp_err_t dispatch_handler(httpd_req_t *req);
+
 void WebServer::start()
 {
     if (this->httpd != nullptr) {
@@ -56,9 +90,7 @@ void WebServer::start()
     config.server_port = network.config.get("web_server_port")->asUint();
 #endif
 
-#if MODULE_HTTP_AVAILABLE()
-    config.uri_match_fn = custom_uri_match;
-#endif
+    config.uri_match_fn = uri_match;
 
     /*config.task_priority = tskIDLE_PRIORITY+7;
     config.core_id = 1;*/
@@ -71,6 +103,19 @@ void WebServer::start()
         return;
     }
 
+    // The httpd checks its handlers in registration order. Register GET first, as it is the most common method.
+    static const httpd_method_t dispatcher_methods[] = {HTTP_GET, HTTP_PUT, HTTP_POST, HTTP_DELETE};
+
+    for (httpd_method_t method : dispatcher_methods) {
+        httpd_uri_t dispatcher = {};
+        dispatcher.uri      = "*";
+        dispatcher.method   = method;
+        dispatcher.handler  = dispatch_handler;
+        dispatcher.user_ctx = this;
+
+        httpd_register_uri_handler(httpd, &dispatcher);
+    }
+
 #if MODULE_DEBUG_AVAILABLE()
     debug.register_task("httpd", HTTPD_STACK_SIZE);
 #endif
@@ -81,55 +126,23 @@ void WebServer::runInHTTPThread(void (*fn)(void *arg), void *arg)
     httpd_queue_work(server.httpd, fn, arg);
 }
 
-struct UserCtx {
-    WebServer *server;
-    WebServerHandler *handler;
-};
-
-static esp_err_t low_level_handler(httpd_req_t *req)
+static esp_err_t low_level_handler(WebServerHandler *handler, WebServerRequest request)
 {
-    auto ctx = (UserCtx *)req->user_ctx;
-    auto request = WebServerRequest{req};
-
-    if (ctx->server->auth_fn && !ctx->server->auth_fn(request)) {
-        if (ctx->server->on_not_authorized) {
-            ctx->server->on_not_authorized(request);
-            return ESP_OK;
-        }
-        request.requestAuthentication();
-        return ESP_OK;
-    }
-
-    if (ctx->handler->callbackInMainThread)
-        task_scheduler.await([ctx, request](){ctx->handler->callback(request);});
+    if (handler->callbackInMainThread)
+        task_scheduler.await([handler, request](){handler->callback(request);});
     else
-        ctx->handler->callback(request);
+        handler->callback(request);
 
     return ESP_OK;
 }
 
-static const size_t SCRATCH_BUFSIZE = 2048;
-
-static esp_err_t low_level_upload_handler(httpd_req_t *req)
+static esp_err_t low_level_upload_handler(httpd_req_t *req, WebServerHandler *handler, WebServerRequest request)
 {
-    auto ctx = (UserCtx *)req->user_ctx;
-    auto request = WebServerRequest{req};
-    if (ctx->server->auth_fn && !ctx->server->auth_fn(request)) {
-        if (ctx->server->on_not_authorized) {
-            ctx->server->on_not_authorized(request);
-            return ESP_OK;
-        }
-        request.requestAuthentication();
-        return ESP_OK;
-    }
-
     size_t remaining = req->content_len;
     size_t index = 0;
 
-    auto scratch_buf = heap_alloc_array<uint8_t>(SCRATCH_BUFSIZE);
-
     while (remaining > 0) {
-        int received = httpd_req_recv(req, (char *)scratch_buf.get(), MIN(remaining, SCRATCH_BUFSIZE));
+        int received = httpd_req_recv(req, (char *)upload_scratch_buf, MIN(remaining, SCRATCH_BUFSIZE));
         // Retry if timeout occurred
         if (received == HTTPD_SOCK_ERR_TIMEOUT) {
             continue;
@@ -145,11 +158,10 @@ static esp_err_t low_level_upload_handler(httpd_req_t *req)
 
         remaining -= received;
         bool result = false;
-        if (ctx->handler->callbackInMainThread) {
-            auto scratch_ptr = scratch_buf.get();
-            task_scheduler.await([ctx, request, index, scratch_ptr, received, remaining, &result]{result = ctx->handler->uploadCallback(request, "not implemented", index, scratch_ptr, received, remaining == 0);});
+        if (handler->callbackInMainThread) {
+            task_scheduler.await([handler, request, index, received, remaining, &result]{result = handler->uploadCallback(request, "not implemented", index, upload_scratch_buf, received, remaining == 0);});
         } else {
-            result = ctx->handler->uploadCallback(request, "not implemented", index, scratch_buf.get(), received, remaining == 0);
+            result = handler->uploadCallback(request, "not implemented", index, upload_scratch_buf, received, remaining == 0);
         }
 
         if (!result) {
@@ -159,14 +171,63 @@ static esp_err_t low_level_upload_handler(httpd_req_t *req)
         index += received;
     }
 
-    if (ctx->handler->callbackInMainThread)
-        task_scheduler.await([ctx, request](){ctx->handler->callback(request);});
+    if (handler->callbackInMainThread)
+        task_scheduler.await([handler, request](){handler->callback(request);});
     else
-        ctx->handler->callback(request);
+        handler->callback(request);
 
     return ESP_OK;
 }
 
+static esp_err_t dispatch_handler(httpd_req_t *req)
+{
+    WebServer *web_server = (WebServer *)req->user_ctx;
+
+    web_server->resetRequestScratch();
+
+    // The httpd passes the URI including the query string.
+    size_t uri_len = strcspn(req->uri, "?");
+    bool uri_matched;
+    WebServerRouteMatch match = web_server->routes.match(req->uri, uri_len, req->method, &uri_matched);
+
+    auto request = WebServerRequest{req, false, match.arg};
+
+    if (web_server->auth_fn && !web_server->auth_fn(request)) {
+        if (web_server->on_not_authorized) {
+            web_server->on_not_authorized(request);
+            return ESP_OK;
+        }
+        request.requestAuthentication();
+        return ESP_OK;
+    }
+
+    if (match.handler == nullptr) {
+        if (uri_matched) {
+            request.send(405, "text/plain", "Request method for this URI is not handled by server");
+        } else {
+            request.send(404);
+        }
+        return ESP_OK;
+    }
+
+    if (match.handler->uploadCallback)
+        return low_level_upload_handler(req, match.handler, request);
+
+    return low_level_handler(match.handler, request);
+}
+
+char *WebServer::allocRequestScratch(size_t len)
+{
+    if (len > REQUEST_SCRATCH_SIZE - request_scratch_used) {
+        return nullptr;
+    }
+
+    char *result = request_scratch + request_scratch_used;
+    request_scratch_used += len;
+
+    return result;
+}
+
 WebServerHandler *WebServer::on(const char *uri, httpd_method_t method, wshCallback &&callback, wshUploadCallback &&uploadCallback)
 {
     return addHandler(uri, method, true, std::forward<wshCallback>(callback), std::forward<wshUploadCallback>(uploadCallback));
@@ -182,30 +243,38 @@ void WebServer::onNotAuthorized_HTTPThread(wshCallback &&callback)
     this->on_not_authorized = std::forward<wshCallback>(callback);
 }
 
-WebServerHandler *WebServer::addHandler(const char *uri, httpd_method_t method, bool callbackInMainThread, wshCallback &&callback, wshUploadCallback &&uploadCallback)
+WebServerHandler *WebServer::createHandler_HTTPThread(wshCallback &&callback)
 {
-    if (handler_count >= MAX_URI_HANDLERS) {
-        logger.printfln("Can't add WebServer handler for %s: %d handlers already registered. Please increase MAX_URI_HANDLERS.", uri, handler_count);
-        return nullptr;
+    handlers.emplace_front(false, std::forward<wshCallback>(callback), wshUploadCallback());
+    return &handlers.front();
+}
+
+bool WebServer::addRoute(const char *uri, size_t uri_len, httpd_method_t method, WebServerHandler *handler, uint32_t arg)
+{
+    if (!routes.insert(uri, uri_len, method, handler, arg)) {
+        logger.printfln("Can't add WebServer route for %.*s: URI already has a handler for this method.", (int)uri_len, uri);
+        return false;
     }
 
-    httpd_uri_t ll_handler = {};
-    ll_handler.uri       = uri;
-    ll_handler.method    = method;
-    // This check has to happen before uploadCallback is forwarded!
-    ll_handler.handler   = uploadCallback == nullptr ? low_level_handler : low_level_upload_handler;
+    return true;
+}
 
+bool WebServer::hasRoute(const char *uri, size_t uri_len, httpd_method_t method)
+{
+    bool uri_matched;
+    return routes.match(uri, uri_len, method, &uri_matched).handler != nullptr;
+}
+
+WebServerHandler *WebServer::addHandler(const char *uri, httpd_method_t method, bool callbackInMainThread, wshCallback &&callback, wshUploadCallback &&uploadCallback)
+{
     handlers.emplace_front(callbackInMainThread, std::forward<wshCallback>(callback), std::forward<wshUploadCallback>(uploadCallback));
-    ++handler_count;
     WebServerHandler *result = &handlers.front();
 
-    UserCtx *user_ctx = (UserCtx *)malloc(sizeof(UserCtx));
-    user_ctx->server = this;
-    user_ctx->handler = result;
-
-    ll_handler.user_ctx  = (void*)user_ctx;
+    if (!addRoute(uri, strlen(uri), method, result)) {
+        handlers.pop_front();
+        return nullptr;
+    }
 
-    httpd_register_uri_handler(httpd, &ll_handler);
     return result;
 }
 
@@ -418,6 +487,114 @@ String WebServerRequest::header(const char *header_name)
     return result;
 }
 
+const char *WebServerRequest::headerCStr(const char *header_name)
+{
+    size_t value_len = httpd_req_get_hdr_value_len(req, header_name);
+    if (value_len == 0)
+        return nullptr;
+
+    char *buf = server.allocRequestScratch(value_len + 1);
+    if (buf == nullptr)
+        return nullptr;
+
+    if (httpd_req_get_hdr_value_str(req, header_name, buf, value_len + 1) != ESP_OK)
+        return nullptr;
+
+    return buf;
+}
+
+static int hex_digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Moves the raw value of key to the start of query.
+static bool extract_query_value(char *query, const char *key)
+{
+    size_t key_len = strlen(key);
+    char *pos = query;
+
+    while (*pos != '\0') {
+        size_t segment_len = strcspn(pos, "&");
+
+        if (segment_len >= key_len && memcmp(pos, key, key_len) == 0 && (segment_len == key_len || pos[key_len] == '=')) {
+            const char *value = segment_len == key_len ? pos + key_len : pos + key_len + 1;
+            size_t value_len = segment_len - static_cast<size_t>(value - pos);
+
+            memmove(query, value, value_len);
+            query[value_len] = '\0';
+            return true;
+        }
+
+        pos += segment_len;
+
+        if (*pos == '&')
+            ++pos;
+    }
+
+    return false;
+}
+
+const char *WebServerRequest::queryParamCStr(const char *key)
+{
+    size_t query_len = queryLength();
+    if (query_len == 0)
+        return nullptr;
+
+    char *value = server.allocRequestScratch(query_len + 1);
+    if (value == nullptr)
+        return nullptr;
+
+    if (queryParam(key, value, query_len + 1) != ESP_OK)
+        return nullptr;
+
+    return value;
+}
+
+size_t WebServerRequest::queryLength()
+{
+    return httpd_req_get_url_query_len(req);
+}
+
+esp_err_t WebServerRequest::queryParam(const char *key, char *buf, size_t buf_len)
+{
+    size_t query_len = queryLength();
+    if (query_len == 0)
+        return ESP_ERR_NOT_FOUND;
+
+    if (buf_len < query_len + 1)
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+
+    esp_err_t err = httpd_req_get_url_query_str(req, buf, buf_len);
+    if (err != ESP_OK)
+        return err;
+
+    if (!extract_query_value(buf, key))
+        return ESP_ERR_NOT_FOUND;
+
+    // Decode in place. The decoded value is never longer than the encoded one.
+    char *out = buf;
+    for (const char *in = buf; *in != '\0'; ++in) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%' && hex_digit_value(in[1]) >= 0 && hex_digit_value(in[2]) >= 0) {
+            *out++ = static_cast<char>(hex_digit_value(in[1]) * 16 + hex_digit_value(in[2]));
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+
+    return ESP_OK;
+}
+
 size_t WebServerRequest::contentLength()
 {
     return req->content_len;
@@ -441,7 +618,13 @@ int WebServerRequest::receive(char *buf, size_t buf_len)
     return contentLength();
 }
 
-WebServerRequest::WebServerRequest(httpd_req_t *req, bool keep_alive) : req(req)
+int WebServerRequest::receiveChunk(char *buf, size_t buf_len)
+{
+    // httpd_req_recv limits buf_len to the remaining payload length.
+    return httpd_req_recv(req, buf, buf_len);
+}
+
+WebServerRequest::WebServerRequest(httpd_req_t *req, bool keep_alive, uint32_t route_arg) : req(req), route_arg(route_arg)
 {
     if (!keep_alive)
         this->addResponseHeader("Connection", "close");
@@ -26,6 +26,8 @@
 
 #include <Arduino.h>
 
+#include "web_server_routes.h"
+
 // This struct is used to make sure a registered handler always calls
 // one of the WebServerRequest methods that send a reponse.
 struct WebServerRequestReturnProtect {
@@ -35,7 +37,7 @@ struct WebServerRequestReturnProtect {
 class WebServerRequest
 {
 public:
-    WebServerRequest(httpd_req_t *req, bool keep_alive = false);
+    WebServerRequest(httpd_req_t *req, bool keep_alive = false, uint32_t route_arg = 0);
 
     WebServerRequestReturnProtect send(uint16_t code, const char *content_type = "text/plain; charset=utf-8", const char *content = "", ssize_t content_len = HTTPD_RESP_USE_STRLEN);
 
@@ -51,10 +53,31 @@ public:
 
     String header(const char *header_name);
 
+    // Copies the header value into the per-request scratch arena instead of
+    // allocating a String. Returns nullptr if the header is missing or empty
+    // or if the arena is exhausted. Valid until the request is handled.
+    const char *headerCStr(const char *header_name);
+
+    // Same as headerCStr, but for the URL-decoded value of a query parameter.
+    // Needs queryLength() + 1 bytes of the arena.
+    const char *queryParamCStr(const char *key);
+
+    size_t queryLength();
+
+    // Copies the URL-decoded value of a query parameter into buf. buf_len must
+    // be larger than queryLength(), the raw query is decoded in place.
+    // Returns ESP_ERR_NOT_FOUND if the parameter is missing and
+    // ESP_ERR_HTTPD_RESULT_TRUNC if buf is too small.
+    esp_err_t queryParam(const char *key, char *buf, size_t buf_len);
+
     size_t contentLength();
 
     int receive(char *buf, size_t buf_len);
 
+    // Receives the next part of the payload, at most buf_len bytes.
+    // Returns 0 if the payload was received completely.
+    int receiveChunk(char *buf, size_t buf_len);
+
     int method()
     {
         return req->method;
@@ -83,6 +106,12 @@ public:
         return req->uri;
     }
 
+    // The argument passed to WebServer::addRoute for the matched route.
+    uint32_t routeArg()
+    {
+        return route_arg;
+    }
+
     WebServerRequestReturnProtect unsafe_ResponseAlreadySent()
     {
         return WebServerRequestReturnProtect{};
@@ -90,6 +119,7 @@ public:
 
 private:
     httpd_req_t *req;
+    uint32_t route_arg;
 };
 
 using wshCallback = std::function<WebServerRequestReturnProtect(WebServerRequest)>;
@@ -115,6 +145,13 @@ public:
 
     WebServerHandler *on(const char *uri, httpd_method_t method, wshCallback &&callback, wshUploadCallback &&uploadCallback = wshUploadCallback());
     WebServerHandler *on_HTTPThread(const char *uri, httpd_method_t method, wshCallback &&callback, wshUploadCallback &&uploadCallback = wshUploadCallback());
+
+    // Creates a handler that is not bound to any URI yet. Use addRoute to
+    // route one or more URIs to it, for example all paths of an API type.
+    WebServerHandler *createHandler_HTTPThread(wshCallback &&callback);
+    bool addRoute(const char *uri, size_t uri_len, httpd_method_t method, WebServerHandler *handler, uint32_t arg = 0);
+    bool hasRoute(const char *uri, size_t uri_len, httpd_method_t method);
+
     void onNotAuthorized_HTTPThread(wshCallback &&callback);
 
     void onAuthenticate_HTTPThread(std::function<bool(WebServerRequest)> auth_fn)
@@ -126,11 +163,20 @@ public:
 
     httpd_handle_t httpd;
     std::forward_list<WebServerHandler> handlers;
-    int handler_count = 0;
+    WebServerRouteTree routes;
     wshCallback on_not_authorized;
 
     std::function<bool(WebServerRequest)> auth_fn;
+
+    char *allocRequestScratch(size_t len);
+    void resetRequestScratch()
+    {
+        request_scratch_used = 0;
+    }
+
 private:
+    size_t request_scratch_used = 0;
+
     WebServerHandler *addHandler(const char *uri, httpd_method_t method, bool callbackInMainThread, wshCallback &&callback, wshUploadCallback &&uploadCallback);
 };
 
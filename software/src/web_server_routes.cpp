@@ -0,0 +1,181 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "web_server_routes.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_system.h"
+
+WebServerRouteTree::Node *WebServerRouteTree::new_node(const char *label, size_t label_len)
+{
+    Node *node = static_cast<Node *>(malloc(sizeof(Node)));
+    char *label_copy = static_cast<char *>(malloc(label_len));
+
+    if (node == nullptr || label_copy == nullptr) {
+        esp_system_abort("Failed to allocate web server route");
+    }
+
+    memcpy(label_copy, label, label_len);
+
+    node->label = label_copy;
+    node->label_len = static_cast<uint16_t>(label_len);
+    node->first_child = nullptr;
+    node->next_sibling = nullptr;
+    node->routes = nullptr;
+
+    ++node_count;
+
+    return node;
+}
+
+// Splits node's label at the given offset. The node keeps the first part of
+// the label; a new child takes the rest of the label and all children and routes.
+void WebServerRouteTree::split(Node *node, size_t at)
+{
+    Node *tail = new_node(node->label + at, node->label_len - at);
+
+    tail->first_child = node->first_child;
+    tail->routes = node->routes;
+
+    // The label buffer is only shortened, not reallocated.
+    node->label_len = static_cast<uint16_t>(at);
+    node->first_child = tail;
+    node->routes = nullptr;
+}
+
+bool WebServerRouteTree::insert(const char *uri, size_t uri_len, httpd_method_t method, WebServerHandler *handler, uint32_t arg)
+{
+    bool wildcard = uri_len > 0 && uri[uri_len - 1] == '*';
+    size_t key_len = wildcard ? uri_len - 1 : uri_len;
+    const char *rest = uri;
+    size_t rest_len = key_len;
+    Node *node = &root;
+
+    while (rest_len > 0) {
+        Node *child = node->first_child;
+
+        while (child != nullptr && child->label[0] != rest[0]) {
+            child = child->next_sibling;
+        }
+
+        if (child == nullptr) {
+            child = new_node(rest, rest_len);
+            child->next_sibling = node->first_child;
+            node->first_child = child;
+            node = child;
+            break;
+        }
+
+        size_t common = 1;
+        size_t max_common = child->label_len < rest_len ? child->label_len : rest_len;
+
+        while (common < max_common && child->label[common] == rest[common]) {
+            ++common;
+        }
+
+        if (common < child->label_len) {
+            split(child, common);
+        }
+
+        node = child;
+        rest += common;
+        rest_len -= common;
+    }
+
+    for (const Route *route = node->routes; route != nullptr; route = route->next) {
+        if (route->method == method && route->wildcard == wildcard) {
+            return false;
+        }
+    }
+
+    Route *route = static_cast<Route *>(malloc(sizeof(Route)));
+
+    if (route == nullptr) {
+        esp_system_abort("Failed to allocate web server route");
+    }
+
+    route->handler = handler;
+    route->arg = arg;
+    route->method = method;
+    route->wildcard = wildcard;
+    route->next = node->routes;
+    node->routes = route;
+
+    ++route_count;
+
+    return true;
+}
+
+WebServerRouteMatch WebServerRouteTree::match(const char *uri, size_t uri_len, int method, bool *uri_matched) const
+{
+    WebServerRouteMatch wildcard_match = {nullptr, 0};
+    const Node *node = &root;
+    size_t pos = 0;
+
+    *uri_matched = false;
+
+    for (;;) {
+        for (const Route *route = node->routes; route != nullptr; route = route->next) {
+            if (!route->wildcard) {
+                continue;
+            }
+
+            *uri_matched = true;
+
+            if (route->method == method) {
+                wildcard_match = {route->handler, route->arg};
+            }
+        }
+
+        if (pos == uri_len) {
+            for (const Route *route = node->routes; route != nullptr; route = route->next) {
+                if (route->wildcard) {
+                    continue;
+                }
+
+                *uri_matched = true;
+
+                if (route->method == method) {
+                    return {route->handler, route->arg};
+                }
+            }
+
+            break;
+        }
+
+        const Node *child = node->first_child;
+
+        while (child != nullptr && child->label[0] != uri[pos]) {
+            child = child->next_sibling;
+        }
+
+        if (child == nullptr
+         || uri_len - pos < child->label_len
+         || memcmp(child->label, uri + pos, child->label_len) != 0) {
+            break;
+        }
+
+        pos += child->label_len;
+        node = child;
+    }
+
+    return wildcard_match;
+}
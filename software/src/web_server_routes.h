@@ -0,0 +1,77 @@
+/* esp32-firmware
+ * Copyright (C) 2024 Tinkerforge GmbH <info@tinkerforge.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_http_server.h>
+
+struct WebServerHandler;
+
+struct WebServerRouteMatch {
+    WebServerHandler *handler;
+    uint32_t arg;
+};
+
+// Radix tree of all URIs served by the web server. A URI ending in '*' is a
+// wildcard route that matches every URI starting with the part before the '*'.
+// Exact routes take precedence over wildcard routes; of multiple matching
+// wildcard routes, the longest one wins.
+class WebServerRouteTree
+{
+public:
+    WebServerRouteTree() {}
+
+    // Returns false if the URI already has a route for this method.
+    bool insert(const char *uri, size_t uri_len, httpd_method_t method, WebServerHandler *handler, uint32_t arg);
+
+    // uri_matched is set if any route matches the URI, even if no route
+    // for the requested method exists. The handler of the returned match
+    // is nullptr in that case.
+    WebServerRouteMatch match(const char *uri, size_t uri_len, int method, bool *uri_matched) const;
+
+    size_t get_route_count() const { return route_count; }
+    size_t get_node_count() const { return node_count; }
+
+private:
+    struct Route {
+        Route *next;
+        WebServerHandler *handler;
+        uint32_t arg;
+        httpd_method_t method;
+        bool wildcard;
+    };
+
+    struct Node {
+        char *label;
+        Node *first_child;
+        Node *next_sibling;
+        Route *routes;
+        uint16_t label_len;
+    };
+
+    Node *new_node(const char *label, size_t label_len);
+    void split(Node *node, size_t at);
+
+    Node root = {nullptr, nullptr, nullptr, nullptr, 0};
+    size_t route_count = 0;
+    size_t node_count = 1;
+};
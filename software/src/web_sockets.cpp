@@ -137,6 +137,8 @@ static void work(void *arg)
 static esp_err_t ws_handler(httpd_req_t *req)
 {
     if (req->method == HTTP_GET) {
+        server.resetRequestScratch();
+
         auto request = WebServerRequest{req};
         if (server.auth_fn && !server.auth_fn(request)) {
             if (server.on_not_authorized) {
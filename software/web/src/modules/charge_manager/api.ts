@@ -17,6 +17,18 @@ interface ServCharger {
 
 export type scan_result = ServCharger[] | string;
 
+interface ChargerRxStats {
+    rx: number,
+    dropped: number,
+    rate: number
+}
+
+export interface rx_stats {
+    unknown_sender: number,
+    queue_drops: number,
+    chargers: ChargerRxStats[]
+}
+
 export interface state {
     state: number,
     uptime: number,
@@ -40,6 +52,8 @@ export interface config {
     minimum_current_vehicle_type: number,
     requested_current_threshold: number,
     requested_current_margin: number,
+    enable_uplink: boolean,
+    uplink_port: number,
     chargers: ChargerConfig[]
 }
 
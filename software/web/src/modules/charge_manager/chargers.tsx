@@ -244,7 +244,7 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
         if (!util.render_allowed())
             return <SubPage name="charge_manager_chargers" />;
 
-        const MAX_CONTROLLED_CHARGERS = API.hasModule("esp32_ethernet_brick") ? 32 : 10;
+        const MAX_CONTROLLED_CHARGERS = API.hasModule("esp32_ethernet_brick") ? 128 : 10;
 
         let energyManagerMode = API.hasModule("energy_manager") && !(API.hasModule("evse_v2") || API.hasModule("evse"));
 
@@ -292,7 +292,7 @@ export class ChargeManagerChargers extends ConfigComponent<'charge_manager/confi
                             { return {
                                 columnValues: [
                                     charger.name,
-                                    <a target="_blank" rel="noopener noreferrer" href={(charger.host == '127.0.0.1' || charger.host == 'localhost') ? '/' : "http://" + charger.host}>{charger.host}</a>
+                                    <a target="_blank" rel="noopener noreferrer" href={(charger.host == '127.0.0.1' || charger.host == 'localhost') ? '/' : "http://" + charger.host.replace(/:\d+$/, "")}>{charger.host}</a>
                                 ],
                                 editTitle: __("charge_manager.content.edit_charger_title"),
                                 onEditShow: async () => this.setState({editCharger: {name: charger.name.trim(), host: charger.host.trim()}}),
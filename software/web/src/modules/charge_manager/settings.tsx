@@ -139,6 +139,27 @@ export class ChargeManagerSettings extends ConfigComponent<'charge_manager/confi
                     />
             </FormRow>;
 
+        let uplink = <>
+            <FormRow label={__("charge_manager.content.enable_uplink")} label_muted={__("charge_manager.content.enable_uplink_muted")}>
+                <Switch desc={__("charge_manager.content.enable_uplink_desc")}
+                        checked={state.enable_uplink}
+                        onClick={this.toggle("enable_uplink")}/>
+            </FormRow>
+
+            <Collapse in={state.enable_uplink}>
+                <div>
+                    <FormRow label={__("charge_manager.content.uplink_port")} label_muted={__("charge_manager.content.uplink_port_muted")}>
+                        <InputNumber
+                            value={state.uplink_port}
+                            onValue={this.set("uplink_port")}
+                            min={1}
+                            max={65535}
+                            />
+                    </FormRow>
+                </div>
+            </Collapse>
+        </>;
+
         let minimum_current = <>
             <FormRow label={__("charge_manager.content.minimum_current_auto")}>
                 <Switch desc={__("charge_manager.content.minimum_current_auto_desc")}
@@ -226,6 +247,7 @@ export class ChargeManagerSettings extends ConfigComponent<'charge_manager/confi
                                     {default_available_current}
                                     {requested_current_threshold}
                                     {requested_current_margin}
+                                    {uplink}
                                 </div>
                             </Collapse>
                         </>
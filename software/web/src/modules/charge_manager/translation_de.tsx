@@ -45,6 +45,11 @@ let x = {
             "requested_current_margin_muted": "",
             "requested_current_threshold": "Länge der Startphase",
             "requested_current_threshold_muted": "Wallboxen mit einem Stromzähler, der Phasenströme misst, werden nach Ablauf der Startphase auf den größten Phasenstrom plus den konfigurierten Spielraum limitiert. Damit kann der verfügbare Strom effizienter auf mehrere Wallboxen verteilt werden.",
+            "enable_uplink": "Unter-Lastmanager",
+            "enable_uplink_muted": "für Installationen mit mehreren Unterverteilungen",
+            "enable_uplink_desc": "Meldet den Bedarf aller gesteuerten Wallboxen an einen übergeordneten Lastmanager und verteilt den von diesem zugeteilten Strom. Dieser Lastmanager muss beim übergeordneten als Wallbox mit Host:Port eingetragen werden.",
+            "uplink_port": "Port des Unter-Lastmanagers",
+            "uplink_port_muted": "UDP-Port, auf dem der Strom vom übergeordneten Lastmanager empfangen wird",
 
             "configuration_mode": "Experteneinstellungen",
             "configuration_mode_muted": "",
@@ -45,6 +45,11 @@ let x = {
             "requested_current_margin_muted": "",
             "requested_current_threshold": "Start-up phase length",
             "requested_current_threshold_muted": "Chargers with an energy meter that measures phase currents will be limited to the maximum phase current plus the configured margin after the start-up phase is elapsed. This enables more efficient current distribution to multiple chargers.",
+            "enable_uplink": "Sub-manager",
+            "enable_uplink_muted": "for installations with several sub-distributions",
+            "enable_uplink_desc": "Reports the demand of all managed chargers to a parent charge manager and distributes the current received from it. Add this charge manager to the parent's chargers as host:port.",
+            "uplink_port": "Sub-manager port",
+            "uplink_port_muted": "UDP port on which the current is received from the parent charge manager",
 
             "configuration_mode": "Expert settings",
             "configuration_mode_muted": "",
@@ -41,7 +41,9 @@ export function ChargeTrackerNavbar() {
     return <NavbarItem name="charge_tracker" module="charge_tracker" title={__("charge_tracker.navbar.charge_tracker")} symbol={<List />} />;
 }
 
-const MAX_TRACKED_CHARGES = 7680;
+// 42 files with 185 records each. Records written before the
+// change to the second file format can temporarily exceed this.
+const MAX_TRACKED_CHARGES = 7770;
 
 type Charge = API.getType["charge_tracker/last_charges"][0];
 type ChargeTrackerConfig = API.getType["charge_tracker/config"];
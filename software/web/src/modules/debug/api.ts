@@ -42,3 +42,26 @@ interface task_hwm {
 }
 
 export type state_hwm = task_hwm[];
+
+// Only available in builds with the heap profiler.
+interface heap_owner {
+    name: string;
+    live_bytes: number;
+    peak_bytes: number;
+    live_blocks: number;
+    allocs: number;
+}
+
+export type heap_owners = heap_owner[];
+
+interface heap_site {
+    pc: number;
+    caller_pc: number;
+    count: number;
+    bytes: number;
+}
+
+export interface heap_sites {
+    untracked_allocs: number;
+    sites: heap_site[];
+}
@@ -30,6 +30,31 @@ import { SubPage } from "../../ts/components/sub_page";
 import { NavbarItem } from "../../ts/components/navbar_item";
 import { Upload } from "react-feather";
 
+// Offset of the app image in the firmware file.
+const FIRMWARE_OFFSET = 0x10000 - 0x1000;
+const UPLOAD_ATTEMPTS = 5;
+
+let crc32_table: Uint32Array = null;
+
+function crc32(data: Uint8Array) {
+    if (crc32_table == null) {
+        crc32_table = new Uint32Array(256);
+
+        for (let i = 0; i < 256; ++i) {
+            let c = i;
+            for (let k = 0; k < 8; ++k)
+                c = (c & 1) ? (0xEDB88320 ^ (c >>> 1)) : (c >>> 1);
+            crc32_table[i] = c;
+        }
+    }
+
+    let crc = 0xFFFFFFFF;
+    for (let i = 0; i < data.length; ++i)
+        crc = crc32_table[(crc ^ data[i]) & 0xFF] ^ (crc >>> 8);
+
+    return (crc ^ 0xFFFFFFFF) >>> 0;
+}
+
 export function FirmwareUpdateNavbar() {
     return <NavbarItem name="firmware_update" module="firmware_update" title={__("firmware_update.navbar.firmware_update")} symbol={<Upload />} />;
 }
@@ -93,6 +118,45 @@ export class FirmwareUpdate extends Component<{}, FirmwareUpdateConfig> {
         return true;
     }
 
+    // Continues the upload where the firmware stopped receiving it if the
+    // connection is lost. The CRC32 of the app image identifies the upload.
+    async uploadFirmware(f: File, progress: (i: number) => void) {
+        let image = new Uint8Array(await f.slice(FIRMWARE_OFFSET).arrayBuffer());
+        let headers = {
+            "X-Update-Length": f.size.toString(),
+            "X-Update-CRC32": crc32(image).toString(16),
+        };
+        let offset = 0;
+        let last_error: string | XMLHttpRequest = null;
+
+        for (let attempt = 0; attempt < UPLOAD_ATTEMPTS; ++attempt) {
+            if (attempt > 0) {
+                await util.wait(2000);
+
+                try {
+                    let response = await fetch("/flash_firmware_offset", {headers: headers});
+                    offset = (await response.json())["offset"];
+                } catch {
+                    continue;
+                }
+            }
+
+            try {
+                await util.upload(f.slice(offset), "/flash_firmware", i => progress((offset + i * (f.size - offset)) / f.size),
+                                  undefined, 120 * 1000, {...headers, "X-Update-Offset": offset.toString()});
+                return;
+            } catch (error) {
+                // Errors reported by the firmware are final. Only lost connections are retried.
+                if (typeof error !== "string")
+                    throw error;
+
+                last_error = error;
+            }
+        }
+
+        throw last_error ?? __("util.upload_error");
+    }
+
     render(props: {}, state: Readonly<FirmwareUpdateConfig>) {
         if (!util.render_allowed())
             return <SubPage name="firmware_update" />;
@@ -131,6 +195,7 @@ export class FirmwareUpdate extends Component<{}, FirmwareUpdateConfig> {
 
                         timeout_ms={120 * 1000}
                         onUploadStart={async (f) => this.checkFirmware(f)}
+                        uploadFunction={(f, progress) => this.uploadFirmware(f, progress)}
                         onUploadSuccess={() => util.postReboot(__("firmware_update.script.update_success"), __("util.reboot_text"))}
                         onUploadError={error => {
                             if (typeof error === "string") {
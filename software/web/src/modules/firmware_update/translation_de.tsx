@@ -45,6 +45,7 @@ let x = {
             "info_page_corrupted": "Firmware-Datei ist beschädigt (Checksummenfehler)",
             "wrong_firmware_type": null,
             "downgrade": "Firmware-Datei beinhaltet ein Downgrade auf Version %fw%. Installiert ist Version %installed%.",
+            "resume_failed": "Unterbrochener Upload konnte nicht fortgesetzt werden. Bitte erneut versuchen.",
             "build_time_prefix": " (erstellt ",
             "build_time_suffix": ")"
         }
@@ -46,6 +46,7 @@ let x = {
             "info_page_corrupted": "Firmware file corrupted (checksum error)",
             "wrong_firmware_type": null,
             "downgrade": "Firmware file contains a downgrade to version %fw%. Installed is version %installed%.",
+            "resume_failed": "Failed to continue the interrupted upload. Please try again.",
             "build_time_prefix": " (created ",
             "build_time_suffix": ")"
         }
@@ -0,0 +1,3 @@
+export interface config {
+    publish_binary_values: boolean;
+}
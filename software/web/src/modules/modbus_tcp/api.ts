@@ -2,4 +2,19 @@ export interface config {
     enable: boolean;
     port: number;
     table: number;
+    read_only_clients: string[];
 }
+
+interface Client {
+    ip: string;
+    port: number;
+    read_only: boolean;
+    connected_since: number;
+    requests: number;
+    exceptions: number;
+    requests_per_second: number;
+    latency_avg_us: number;
+    latency_max_us: number;
+}
+
+export type clients = Client[];
@@ -15,3 +15,25 @@ interface SeenTag {
 }
 
 export type seen_tags = SeenTag[];
+
+export interface tag_db {
+    tag_count: number;
+    generation: number;
+}
+
+interface TagDBUpdateTag {
+    user_id: number;
+    tag_type: number;
+    tag_id: string;
+}
+
+interface TagDBRemoveTag {
+    tag_type: number;
+    tag_id: string;
+}
+
+export interface tag_db_update {
+    generation: number;
+    add: TagDBUpdateTag[];
+    remove: TagDBRemoveTag[];
+}
@@ -26,6 +26,9 @@ export interface low_level_state {
     on_state_change_delay: number;
     charging_blocked: number;
     switching_state: number;
+    meter_step_latency: number;
+    meter_step_latency_max: number;
+    meter_samples_coalesced: number;
 }
 
 export interface config {
@@ -37,6 +40,7 @@ export interface config {
     target_power_from_grid: number;
     guaranteed_power: number;
     cloud_filter_mode: number;
+    meter_triggered_control: boolean;
 }
 
 export interface debug_config {
@@ -513,6 +513,13 @@ export class PVExcessSettings extends ConfigComponent<'power_manager/config', {s
                                     onValue={(v) => this.setState({cloud_filter_mode: parseInt(v)})}
                                 />
                             </FormRow>
+
+                            <FormRow label={__("power_manager.content.meter_triggered_control")} label_muted={__("power_manager.content.meter_triggered_control_muted")}>
+                                <Switch desc={__("power_manager.content.meter_triggered_control_desc")}
+                                    checked={s.meter_triggered_control}
+                                    onClick={this.toggle('meter_triggered_control')}
+                                />
+                            </FormRow>
                         </div>
                     </Collapse>
 
@@ -74,6 +74,9 @@ let x = {
             "cloud_filter_weak": "Schwach",
             "cloud_filter_medium": "Mittel",
             "cloud_filter_strong": "Stark",
+            "meter_triggered_control": "Zählerwerten folgen",
+            "meter_triggered_control_muted": "für Zähler mit schneller Aktualisierungsrate",
+            "meter_triggered_control_desc": "Passt die verfügbare Leistung an, sobald der Zähler einen neuen Wert meldet, statt nur viermal pro Sekunde",
 
             "header_expert_settings": "Experteneinstellungen",
             "hysteresis_time": "Hysterese-Zeit",
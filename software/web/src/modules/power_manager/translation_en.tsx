@@ -74,6 +74,9 @@ let x = {
             "cloud_filter_weak": "Weak",
             "cloud_filter_medium": "Medium",
             "cloud_filter_strong": "Strong",
+            "meter_triggered_control": "Follow meter updates",
+            "meter_triggered_control_muted": "for meters with fast update rates",
+            "meter_triggered_control_desc": "Updates the available power as soon as the meter reports a new value instead of only four times per second",
 
             "header_expert_settings": "Expert settings",
             "hysteresis_time": "Hysteresis time",
@@ -12,7 +12,14 @@ interface ErrorCounter {
     TfpUnexpected: number;
 }
 
+interface LatencyHistogram {
+    uid: string;
+    buckets: number[];
+}
+
 export type devices = Device[];
+// Bucket i counts Bricklet round trips shorter than 250 µs * 2^i, the last bucket counts all slower ones.
+export type latency_histograms = LatencyHistogram[];
 export type error_counters = {[index:string]: ErrorCounter};
 
 export interface config {
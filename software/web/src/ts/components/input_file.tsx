@@ -30,6 +30,8 @@ interface InputFileProps extends Omit<JSXInternal.HTMLAttributes<HTMLInputElemen
     onUploadStart?: (f: File) => Promise<boolean>,
     onUploadSuccess: () => void,
     onUploadError: (error: string | XMLHttpRequest) => void,
+    // Replaces the upload of the whole file to url, for example to resume interrupted uploads.
+    uploadFunction?: (f: File, progress: (i: number) => void) => Promise<void>,
     browse: string
     select_file: string
     upload: string,
@@ -52,7 +54,10 @@ export function InputFile(props: InputFileProps) {
         setProgress(0);
         setUploading(true);
 
-        util.upload(file, props.url, setProgress, props.contentType, props.timeout_ms)
+        let promise = props.uploadFunction ? props.uploadFunction(file, setProgress)
+                                           : util.upload(file, props.url, setProgress, props.contentType, props.timeout_ms);
+
+        promise
             .then(() => {
                 setUploading(false);
                 setProgress(0);
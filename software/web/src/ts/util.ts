@@ -441,7 +441,7 @@ export function timestamp_sec_to_date(timestamp_seconds: number, unsynced_string
     return timestamp_to_date(timestamp_seconds * 1000, {hour: '2-digit', minute: '2-digit', second: '2-digit'});
 }
 
-export function upload(data: Blob, url: string, progress: (i: number) => void = i => {}, contentType?: string, timeout_ms: number = 5000) {
+export function upload(data: Blob, url: string, progress: (i: number) => void = i => {}, contentType?: string, timeout_ms: number = 5000, headers: {[name: string]: string} = {}) {
     const xhr = new XMLHttpRequest();
     progress(0);
 
@@ -478,6 +478,8 @@ export function upload(data: Blob, url: string, progress: (i: number) => void =
         xhr.timeout = timeout_ms;
         if (contentType)
             xhr.setRequestHeader("Content-Type", contentType);
+        for (let name in headers)
+            xhr.setRequestHeader(name, headers[name]);
         xhr.send(data);
     });
 }